@@ -0,0 +1,123 @@
+#include "fault_file_backend.hpp"
+
+#include <util/platform.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace stems {
+namespace bench {
+
+static void sleep_until_ns(uint64_t deadline_ns)
+{
+	const uint64_t now = os_gettime_ns();
+	if (deadline_ns > now)
+		std::this_thread::sleep_for(std::chrono::nanoseconds(deadline_ns - now));
+}
+
+void FaultFileBackend::start(uint64_t origin_ns, double run_s)
+{
+	windows_.clear();
+	const uint64_t run_ns = (uint64_t)std::llround(std::max(0.0, run_s) * 1e9);
+
+	if (spec_.stall_every_s > 0.0 && spec_.stall_ms > 0.0) {
+		const uint64_t every_ns = (uint64_t)std::llround(spec_.stall_every_s * 1e9);
+		const uint64_t len_ns = (uint64_t)std::llround(spec_.stall_ms * 1e6);
+		uint32_t rng = (uint32_t)(spec_.seed * 2654435761u) | 1u;
+		for (uint64_t t = 0;;) {
+			rng ^= rng << 13;
+			rng ^= rng >> 17;
+			rng ^= rng << 5;
+			t += every_ns / 2 + (uint64_t)((double)(rng >> 8) / 16777216.0 * (double)every_ns);
+			if (t >= run_ns)
+				break;
+			windows_.push_back(FaultWindow{origin_ns + t, origin_ns + t + len_ns, false});
+			t += len_ns;
+		}
+	}
+	if (spec_.enospc_at_s >= 0.0) {
+		const uint64_t begin = origin_ns + (uint64_t)std::llround(spec_.enospc_at_s * 1e9);
+		const uint64_t end = spec_.enospc_for_s > 0.0 ? begin + (uint64_t)std::llround(spec_.enospc_for_s * 1e9)
+							      : UINT64_MAX;
+		windows_.push_back(FaultWindow{begin, end, true});
+	}
+	std::sort(windows_.begin(), windows_.end(),
+		  [](const FaultWindow &a, const FaultWindow &b) { return a.begin_ns < b.begin_ns; });
+	disk_free_ns_ = 0;
+	started_.store(true, std::memory_order_release);
+}
+
+const FaultWindow *FaultFileBackend::window_at(uint64_t now_ns, bool enospc) const
+{
+	for (const FaultWindow &w : windows_) {
+		if (w.begin_ns > now_ns)
+			break;
+		if (w.enospc == enospc && now_ns < w.end_ns)
+			return &w;
+	}
+	return nullptr;
+}
+
+size_t FaultFileBackend::write(std::FILE *f, const void *data, size_t size, size_t count)
+{
+	if (!started_.load(std::memory_order_acquire))
+		return FileBackend::write(f, data, size, count);
+
+	const uint64_t begin_ns = os_gettime_ns();
+	writes_++;
+	if (window_at(begin_ns, true)) {
+		enospc_errors_++;
+		errno = ENOSPC;
+		return 0;
+	}
+
+	if (const FaultWindow *stall = window_at(begin_ns, false)) {
+		stalled_writes_++;
+		stalled_ns_ += stall->end_ns - begin_ns;
+		sleep_until_ns(stall->end_ns);
+	}
+
+	const uint64_t bytes = (uint64_t)size * count;
+	if (spec_.bandwidth_mib_s > 0.0) {
+		// Writes queue up behind each other for the shared bandwidth.
+		const uint64_t cost_ns = (uint64_t)((double)bytes / (spec_.bandwidth_mib_s * 1048576.0) * 1e9);
+		uint64_t done_ns;
+		{
+			std::lock_guard<std::mutex> lock(disk_mtx_);
+			done_ns = std::max(disk_free_ns_, os_gettime_ns()) + cost_ns;
+			disk_free_ns_ = done_ns;
+		}
+		const uint64_t now = os_gettime_ns();
+		if (done_ns > now)
+			throttled_ns_ += done_ns - now;
+		sleep_until_ns(done_ns);
+	}
+
+	const size_t written = FileBackend::write(f, data, size, count);
+	bytes_ += (uint64_t)written * size;
+
+	const uint64_t took = os_gettime_ns() - begin_ns;
+	uint64_t prev = max_write_ns_.load(std::memory_order_relaxed);
+	while (took > prev && !max_write_ns_.compare_exchange_weak(prev, took, std::memory_order_relaxed)) {
+	}
+	return written;
+}
+
+FaultStats FaultFileBackend::stats() const
+{
+	FaultStats s;
+	s.writes = writes_.load();
+	s.bytes = bytes_.load();
+	s.stalled_writes = stalled_writes_.load();
+	s.stalled_ns = stalled_ns_.load();
+	s.throttled_ns = throttled_ns_.load();
+	s.enospc_errors = enospc_errors_.load();
+	s.max_write_ns = max_write_ns_.load();
+	return s;
+}
+
+}
+}
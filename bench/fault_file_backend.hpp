@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "stems/wav_writer.hpp"
+
+namespace stems {
+namespace bench {
+
+struct FaultSpec {
+	// Shared by every open file, like one disk; 0 is unlimited.
+	double bandwidth_mib_s = 0.0;
+	// Every write stalls while a stall is on. Stalls of stall_ms start
+	// stall_every_s apart on average (0.5x to 1.5x); 0 means none.
+	double stall_every_s = 0.0;
+	double stall_ms = 0.0;
+	// Writes fail with ENOSPC from enospc_at_s for enospc_for_s seconds
+	// (0: until the end); a negative start means never.
+	double enospc_at_s = -1.0;
+	double enospc_for_s = 0.0;
+	uint64_t seed = 1;
+};
+
+struct FaultWindow {
+	uint64_t begin_ns = 0;
+	uint64_t end_ns = 0;
+	bool enospc = false;
+};
+
+struct FaultStats {
+	uint64_t writes = 0;
+	uint64_t bytes = 0;
+	uint64_t stalled_writes = 0;
+	uint64_t stalled_ns = 0;
+	uint64_t throttled_ns = 0;
+	uint64_t enospc_errors = 0;
+	uint64_t max_write_ns = 0;
+};
+
+// A FileBackend for stress runs: stdio underneath, with faults injected
+// on the write path. Faults are timed from start(); before it, and for
+// opens, seeks and closes, it behaves like stdio.
+class FaultFileBackend : public FileBackend {
+public:
+	explicit FaultFileBackend(const FaultSpec &spec) : spec_(spec) {}
+
+	// Lays out the fault windows over run_s seconds from origin_ns. Call
+	// before any writer can write concurrently.
+	void start(uint64_t origin_ns, double run_s);
+
+	size_t write(std::FILE *f, const void *data, size_t size, size_t count) override;
+
+	const std::vector<FaultWindow> &windows() const { return windows_; }
+	FaultStats stats() const;
+
+private:
+	const FaultWindow *window_at(uint64_t now_ns, bool enospc) const;
+
+	FaultSpec spec_;
+	std::atomic<bool> started_{false};
+	std::vector<FaultWindow> windows_;
+
+	std::mutex disk_mtx_;
+	uint64_t disk_free_ns_ = 0;
+
+	std::atomic<uint64_t> writes_{0};
+	std::atomic<uint64_t> bytes_{0};
+	std::atomic<uint64_t> stalled_writes_{0};
+	std::atomic<uint64_t> stalled_ns_{0};
+	std::atomic<uint64_t> throttled_ns_{0};
+	std::atomic<uint64_t> enospc_errors_{0};
+	std::atomic<uint64_t> max_write_ns_{0};
+};
+
+}
+}
@@ -0,0 +1,289 @@
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+static int min_level = LOG_WARNING;
+
+void bench_set_log_level(int level)
+{
+	min_level = level;
+}
+
+void blog(int log_level, const char *format, ...)
+{
+	if (log_level > min_level)
+		return;
+	va_list args;
+	va_start(args, format);
+	std::vfprintf(stderr, format, args);
+	va_end(args);
+	std::fputc('\n', stderr);
+}
+
+uint64_t os_gettime_ns(void)
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		       std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+namespace {
+
+struct Value {
+	enum Kind { String, Int, Double, Bool, Object, Array } kind = Int;
+	std::string s;
+	long long i = 0;
+	double d = 0.0;
+	bool b = false;
+	obs_data_t *obj = nullptr;
+	obs_data_array_t *arr = nullptr;
+};
+
+}
+
+struct obs_data {
+	std::atomic<long> refs{1};
+	std::vector<std::pair<std::string, Value>> items;
+};
+
+struct obs_data_array {
+	std::atomic<long> refs{1};
+	std::vector<obs_data_t *> items;
+};
+
+static void release_value(Value &v)
+{
+	if (v.obj)
+		obs_data_release(v.obj);
+	if (v.arr)
+		obs_data_array_release(v.arr);
+	v.obj = nullptr;
+	v.arr = nullptr;
+}
+
+static void set_value(obs_data_t *data, const char *name, Value v)
+{
+	if (!data || !name)
+		return;
+	for (auto &item : data->items) {
+		if (item.first == name) {
+			release_value(item.second);
+			item.second = std::move(v);
+			return;
+		}
+	}
+	data->items.emplace_back(name, std::move(v));
+}
+
+obs_data_t *obs_data_create(void)
+{
+	return new obs_data;
+}
+
+void obs_data_release(obs_data_t *data)
+{
+	if (!data || --data->refs > 0)
+		return;
+	for (auto &item : data->items)
+		release_value(item.second);
+	delete data;
+}
+
+void obs_data_set_string(obs_data_t *data, const char *name, const char *val)
+{
+	Value v;
+	v.kind = Value::String;
+	v.s = val ? val : "";
+	set_value(data, name, std::move(v));
+}
+
+void obs_data_set_int(obs_data_t *data, const char *name, long long val)
+{
+	Value v;
+	v.kind = Value::Int;
+	v.i = val;
+	set_value(data, name, std::move(v));
+}
+
+void obs_data_set_double(obs_data_t *data, const char *name, double val)
+{
+	Value v;
+	v.kind = Value::Double;
+	v.d = val;
+	set_value(data, name, std::move(v));
+}
+
+void obs_data_set_bool(obs_data_t *data, const char *name, bool val)
+{
+	Value v;
+	v.kind = Value::Bool;
+	v.b = val;
+	set_value(data, name, std::move(v));
+}
+
+void obs_data_set_obj(obs_data_t *data, const char *name, obs_data_t *obj)
+{
+	if (!obj)
+		return;
+	obj->refs++;
+	Value v;
+	v.kind = Value::Object;
+	v.obj = obj;
+	set_value(data, name, std::move(v));
+}
+
+void obs_data_set_array(obs_data_t *data, const char *name, obs_data_array_t *array)
+{
+	if (!array)
+		return;
+	array->refs++;
+	Value v;
+	v.kind = Value::Array;
+	v.arr = array;
+	set_value(data, name, std::move(v));
+}
+
+obs_data_array_t *obs_data_array_create(void)
+{
+	return new obs_data_array;
+}
+
+size_t obs_data_array_push_back(obs_data_array_t *array, obs_data_t *obj)
+{
+	if (!array || !obj)
+		return 0;
+	obj->refs++;
+	array->items.push_back(obj);
+	return array->items.size() - 1;
+}
+
+void obs_data_array_release(obs_data_array_t *array)
+{
+	if (!array || --array->refs > 0)
+		return;
+	for (obs_data_t *obj : array->items)
+		obs_data_release(obj);
+	delete array;
+}
+
+static void append_string(std::string &out, const std::string &s)
+{
+	out += '"';
+	for (unsigned char c : s) {
+		switch (c) {
+		case '"':
+			out += "\\\"";
+			break;
+		case '\\':
+			out += "\\\\";
+			break;
+		case '\n':
+			out += "\\n";
+			break;
+		case '\r':
+			out += "\\r";
+			break;
+		case '\t':
+			out += "\\t";
+			break;
+		default:
+			if (c < 0x20) {
+				char buf[8];
+				std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+				out += buf;
+			} else {
+				out += (char)c;
+			}
+		}
+	}
+	out += '"';
+}
+
+static void append_object(std::string &out, const obs_data_t *data, int depth);
+
+static void append_value(std::string &out, const Value &v, int depth)
+{
+	char buf[64];
+	switch (v.kind) {
+	case Value::String:
+		append_string(out, v.s);
+		break;
+	case Value::Int:
+		std::snprintf(buf, sizeof(buf), "%lld", v.i);
+		out += buf;
+		break;
+	case Value::Double:
+		std::snprintf(buf, sizeof(buf), "%.17g", v.d);
+		out += buf;
+		break;
+	case Value::Bool:
+		out += v.b ? "true" : "false";
+		break;
+	case Value::Object:
+		append_object(out, v.obj, depth);
+		break;
+	case Value::Array: {
+		const std::string pad((size_t)(depth + 1) * 4, ' ');
+		out += "[";
+		for (size_t i = 0; i < v.arr->items.size(); i++) {
+			out += i ? ",\n" : "\n";
+			out += pad;
+			append_object(out, v.arr->items[i], depth + 1);
+		}
+		if (!v.arr->items.empty())
+			out += "\n" + std::string((size_t)depth * 4, ' ');
+		out += "]";
+		break;
+	}
+	}
+}
+
+// Indented by four spaces like libobs writes it.
+static void append_object(std::string &out, const obs_data_t *data, int depth)
+{
+	const std::string pad((size_t)(depth + 1) * 4, ' ');
+	out += "{";
+	for (size_t i = 0; i < data->items.size(); i++) {
+		out += i ? ",\n" : "\n";
+		out += pad;
+		append_string(out, data->items[i].first);
+		out += ": ";
+		append_value(out, data->items[i].second, depth + 1);
+	}
+	if (!data->items.empty())
+		out += "\n" + std::string((size_t)depth * 4, ' ');
+	out += "}";
+}
+
+bool obs_data_save_json_safe(obs_data_t *data, const char *file, const char *temp_ext, const char *backup_ext)
+{
+	if (!data || !file)
+		return false;
+	std::string json;
+	append_object(json, data, 0);
+	json += "\n";
+
+	namespace fs = std::filesystem;
+	const std::string tmp = std::string(file) + "." + (temp_ext ? temp_ext : "tmp");
+	std::FILE *f = std::fopen(tmp.c_str(), "wb");
+	if (!f)
+		return false;
+	const bool ok = std::fwrite(json.data(), 1, json.size(), f) == json.size();
+	if (std::fclose(f) != 0 || !ok)
+		return false;
+
+	std::error_code ec;
+	if (backup_ext && fs::exists(file, ec))
+		fs::rename(file, std::string(file) + "." + backup_ext, ec);
+	fs::rename(tmp, file, ec);
+	return !ec;
+}
@@ -0,0 +1,18 @@
+#include "stems/settings.hpp"
+
+// The plugin's settings JSON goes through Qt. Bench runs only write the
+// session journal, so they store an empty object and never read it back.
+
+namespace stems {
+
+std::string settings_to_json(const Settings &)
+{
+	return "{}";
+}
+
+bool settings_from_json(const std::string &, Settings &)
+{
+	return false;
+}
+
+}
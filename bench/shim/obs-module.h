@@ -0,0 +1,44 @@
+#pragma once
+
+// The slice of libobs the capture, post-processing and finalize core uses,
+// for building it without OBS. Matches the libobs declarations.
+
+#include <stddef.h>
+
+#define LOG_ERROR 100
+#define LOG_WARNING 200
+#define LOG_INFO 300
+#define LOG_DEBUG 400
+
+#if defined(__GNUC__)
+void blog(int log_level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+#else
+void blog(int log_level, const char *format, ...);
+#endif
+
+// Not in libobs: messages above level are dropped (LOG_WARNING by default).
+void bench_set_log_level(int level);
+
+// Only named by the session headers; nothing here creates them.
+typedef struct obs_source obs_source_t;
+typedef struct obs_weak_source obs_weak_source_t;
+typedef struct calldata calldata_t;
+struct audio_data;
+
+// Enough of obs_data to write session.json.
+typedef struct obs_data obs_data_t;
+typedef struct obs_data_array obs_data_array_t;
+
+obs_data_t *obs_data_create(void);
+void obs_data_release(obs_data_t *data);
+void obs_data_set_string(obs_data_t *data, const char *name, const char *val);
+void obs_data_set_int(obs_data_t *data, const char *name, long long val);
+void obs_data_set_double(obs_data_t *data, const char *name, double val);
+void obs_data_set_bool(obs_data_t *data, const char *name, bool val);
+void obs_data_set_obj(obs_data_t *data, const char *name, obs_data_t *obj);
+void obs_data_set_array(obs_data_t *data, const char *name, obs_data_array_t *array);
+bool obs_data_save_json_safe(obs_data_t *data, const char *file, const char *temp_ext, const char *backup_ext);
+
+obs_data_array_t *obs_data_array_create(void);
+size_t obs_data_array_push_back(obs_data_array_t *array, obs_data_t *obj);
+void obs_data_array_release(obs_data_array_t *array);
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <cstdint>
+
+uint64_t os_gettime_ns(void);
@@ -0,0 +1,516 @@
+// Headless benchmark of the stem capture and post-processing path: N
+// synthetic sources feed StemRecorders the way OBS audio callbacks would,
+// then the written stems optionally go through post-processing. Prints a
+// summary, and JSON for regression tracking with --json.
+
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "stems/histogram.hpp"
+#include "stems/live_stats.hpp"
+#include "stems/parallel.hpp"
+#include "stems/stem_recorder.hpp"
+#include "stems/trace.hpp"
+#include "stems/transcode.hpp"
+#include "stems/wav_postprocess.hpp"
+#include "synthetic_source.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+using namespace stems;
+using namespace stems::bench;
+
+namespace {
+
+struct Options {
+	size_t stems = 8;
+	ClockSpec clock;
+	uint16_t channels = 2;
+	DitherMode dither = DitherMode::Off;
+	std::vector<SignalSpec> signals;
+	float level_dbfs = -12.0f;
+	double silence_every_s = 0.0;
+	double silence_s = 0.0;
+	bool postprocess = false;
+	std::string export_format;
+	std::string ffmpeg;
+	std::string out_dir;
+	bool keep = false;
+	std::string json_path;
+	std::string trace_path;
+	long long max_drops = -1;
+	bool verbose = false;
+};
+
+enum PostStep {
+	StepTrim,
+	StepNormalize,
+	StepExport,
+	StepCount,
+};
+
+const char *const k_step_names[StepCount] = {"trim", "normalize", "export"};
+
+struct Result {
+	double wall_s = 0.0;
+	double stop_ms = 0.0;
+	uint64_t frames_written = 0;
+	uint64_t bytes_written = 0;
+	uint64_t dropped_chunks = 0;
+	size_t stems_with_drops = 0;
+	size_t failed_stems = 0;
+	HotPathHistograms hot;
+	Histogram clock_late_ns;
+	bool postprocessed = false;
+	double post_wall_ms = 0.0;
+	Histogram step_ns[StepCount];
+	size_t step_failures[StepCount] = {};
+};
+
+void usage(const char *argv0)
+{
+	std::fprintf(stderr,
+		     "usage: %s [options]\n"
+		     "  --stems N            sources recorded at once (8)\n"
+		     "  --seconds S          audio length per stem (10)\n"
+		     "  --rate HZ            sample rate (48000)\n"
+		     "  --channels N         channels per stem (2)\n"
+		     "  --frames N           frames per audio callback (1024)\n"
+		     "  --speed X            callbacks paced at X times real time, 0 = unpaced (1)\n"
+		     "  --jitter-ms MS       callbacks fire up to MS late (0)\n"
+		     "  --signal LIST        tone|noise|silence|clicks, comma list assigned round-robin (tone)\n"
+		     "  --level-dbfs DB      signal level (-12)\n"
+		     "  --silence-every S    drop to silence once every S seconds (off)\n"
+		     "  --silence-for S      length of each silence span (0)\n"
+		     "  --dither MODE        off|tpdf|shaped (off)\n"
+		     "  --postprocess        trim silence and normalize every stem afterwards\n"
+		     "  --export FMT         also transcode to mp3|wav with ffmpeg\n"
+		     "  --ffmpeg PATH        ffmpeg binary (ffmpeg on PATH)\n"
+		     "  --out DIR            where stems are written (a temporary directory)\n"
+		     "  --keep               keep the written stems\n"
+		     "  --json PATH          write results as JSON, - for stdout\n"
+		     "  --trace PATH         write a Chrome trace of the run\n"
+		     "  --max-drops N        exit with status 2 when more chunks were dropped\n"
+		     "  --verbose            log at info level\n",
+		     argv0);
+}
+
+bool parse_signals(const std::string &list, Options &o)
+{
+	size_t pos = 0;
+	while (pos <= list.size()) {
+		const size_t comma = list.find(',', pos);
+		const std::string name = list.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+		SignalSpec spec;
+		if (!signal_kind_from_string(name, spec.kind))
+			return false;
+		o.signals.push_back(spec);
+		if (comma == std::string::npos)
+			break;
+		pos = comma + 1;
+	}
+	return !o.signals.empty();
+}
+
+bool parse_args(int argc, char **argv, Options &o)
+{
+	std::string signals = "tone";
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+		auto take = [&]() -> const char * {
+			if (!value) {
+				std::fprintf(stderr, "%s needs a value\n", arg.c_str());
+				return nullptr;
+			}
+			i++;
+			return value;
+		};
+
+		if (arg == "--postprocess") {
+			o.postprocess = true;
+			continue;
+		}
+		if (arg == "--keep") {
+			o.keep = true;
+			continue;
+		}
+		if (arg == "--verbose") {
+			o.verbose = true;
+			continue;
+		}
+		if (arg == "--help" || arg == "-h")
+			return false;
+
+		const char *v = take();
+		if (!v)
+			return false;
+		if (arg == "--stems")
+			o.stems = (size_t)std::strtoull(v, nullptr, 10);
+		else if (arg == "--seconds")
+			o.clock.seconds = std::atof(v);
+		else if (arg == "--rate")
+			o.clock.sample_rate = (uint32_t)std::strtoul(v, nullptr, 10);
+		else if (arg == "--channels")
+			o.channels = (uint16_t)std::strtoul(v, nullptr, 10);
+		else if (arg == "--frames")
+			o.clock.frames_per_callback = (uint32_t)std::strtoul(v, nullptr, 10);
+		else if (arg == "--speed")
+			o.clock.speed = std::atof(v);
+		else if (arg == "--jitter-ms")
+			o.clock.jitter_ms = std::atof(v);
+		else if (arg == "--signal")
+			signals = v;
+		else if (arg == "--level-dbfs")
+			o.level_dbfs = (float)std::atof(v);
+		else if (arg == "--silence-every")
+			o.silence_every_s = std::atof(v);
+		else if (arg == "--silence-for")
+			o.silence_s = std::atof(v);
+		else if (arg == "--dither")
+			o.dither = dither_mode_from_string(v);
+		else if (arg == "--export")
+			o.export_format = v;
+		else if (arg == "--ffmpeg")
+			o.ffmpeg = v;
+		else if (arg == "--out")
+			o.out_dir = v;
+		else if (arg == "--json")
+			o.json_path = v;
+		else if (arg == "--trace")
+			o.trace_path = v;
+		else if (arg == "--max-drops")
+			o.max_drops = std::atoll(v);
+		else {
+			std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+			return false;
+		}
+	}
+
+	if (!parse_signals(signals, o)) {
+		std::fprintf(stderr, "bad --signal %s\n", signals.c_str());
+		return false;
+	}
+	for (SignalSpec &s : o.signals) {
+		s.level_dbfs = o.level_dbfs;
+		s.silence_period_s = o.silence_every_s;
+		s.silence_s = o.silence_s;
+	}
+	if (!o.export_format.empty() && o.export_format != "mp3" && o.export_format != "wav") {
+		std::fprintf(stderr, "bad --export %s\n", o.export_format.c_str());
+		return false;
+	}
+	if (o.stems == 0 || o.clock.seconds <= 0.0 || o.clock.sample_rate == 0 || o.channels == 0 ||
+	    o.channels > 8 || o.clock.frames_per_callback == 0 || o.clock.speed < 0.0) {
+		std::fprintf(stderr, "stems, seconds, rate, frames and 1-8 channels must be positive\n");
+		return false;
+	}
+	return true;
+}
+
+bool record(const Options &o, const std::vector<std::string> &wav_paths, Result &r)
+{
+	std::vector<std::unique_ptr<StemRecorder>> recorders;
+	SyntheticClock clock;
+	std::vector<SyntheticSource *> sources;
+	auto gate = std::make_shared<StartGate>(o.stems, 2000000000ull);
+
+	for (size_t i = 0; i < o.stems; i++) {
+		const std::string uuid = "synthetic-" + std::to_string(i);
+		auto source = std::make_unique<SyntheticSource>(uuid, "Stem " + std::to_string(i + 1),
+								o.signals[i % o.signals.size()],
+								o.clock.sample_rate, o.clock.seed + i);
+		SyntheticSource *raw = source.get();
+		auto rec = std::make_unique<StemRecorder>();
+		if (!rec->prepare(std::move(source), wav_paths[i], o.clock.sample_rate, o.channels)) {
+			std::fprintf(stderr, "could not open %s\n", wav_paths[i].c_str());
+			gate->leave();
+			r.failed_stems++;
+			continue;
+		}
+		sources.push_back(raw);
+		recorders.push_back(std::move(rec));
+	}
+	for (size_t i = 0; i < recorders.size(); i++) {
+		if (!recorders[i]->attach(o.dither, gate)) {
+			gate->leave();
+			r.failed_stems++;
+			continue;
+		}
+		clock.add(sources[i]);
+	}
+	if (recorders.empty())
+		return false;
+
+	const uint64_t begin_ns = os_gettime_ns();
+	clock.run(o.clock);
+	r.clock_late_ns.merge_from(clock.late_ns());
+
+	// Sources go away with their recorders, so read them first.
+	for (SyntheticSource *s : sources)
+		r.hot.audio_callback_ns.merge_from(s->callback_ns());
+	for (auto &rec : recorders) {
+		StemLiveStats live;
+		rec->collect_stats(live, &r.hot);
+	}
+
+	const uint64_t stop_ns = os_gettime_ns();
+	for (auto &rec : recorders)
+		rec->stop();
+	const uint64_t end_ns = os_gettime_ns();
+	r.stop_ms = (double)(end_ns - stop_ns) / 1e6;
+	r.wall_s = (double)(end_ns - begin_ns) / 1e9;
+
+	for (auto &rec : recorders) {
+		const StemCaptureStats s = rec->capture_stats();
+		r.frames_written += s.frames_written;
+		r.bytes_written += s.bytes_written;
+		r.dropped_chunks += s.dropped_chunks;
+		if (s.dropped_chunks > 0)
+			r.stems_with_drops++;
+	}
+	return true;
+}
+
+void postprocess(const Options &o, const std::vector<std::string> &wav_paths, Result &r)
+{
+	const LimiterParams limiter;
+	const bool mp3 = o.export_format == "mp3";
+	std::vector<uint8_t> failed[StepCount];
+	for (auto &f : failed)
+		f.assign(wav_paths.size(), 0);
+
+	auto timed = [&](PostStep step, size_t i, bool ok, uint64_t begin_ns) {
+		r.step_ns[step].record(os_gettime_ns() - begin_ns);
+		if (!ok)
+			failed[step][i] = 1;
+	};
+
+	const uint64_t begin_ns = os_gettime_ns();
+	const size_t total = wav_paths.size();
+	parallel_for(total, parallel_workers(total), [&](size_t, size_t i) {
+		const std::string &path = wav_paths[i];
+		uint64_t t = os_gettime_ns();
+		timed(StepTrim, i, trim_silence_wav(path, o.channels, o.clock.sample_rate, -50.0f, 100, 250), t);
+		t = os_gettime_ns();
+		timed(StepNormalize, i, normalize_wav_rms(path, o.channels, o.clock.sample_rate, -20.0f, &limiter),
+		      t);
+		if (!o.export_format.empty()) {
+			const std::string out = path.substr(0, path.size() - 4) + (mp3 ? ".mp3" : ".export.wav");
+			t = os_gettime_ns();
+			timed(StepExport, i,
+			      export_audio(o.ffmpeg, path, out, mp3 ? OutputFormat::Mp3 : OutputFormat::Wav, 192,
+					   o.clock.sample_rate, o.channels, 16),
+			      t);
+		}
+	});
+	r.post_wall_ms = (double)(os_gettime_ns() - begin_ns) / 1e6;
+	r.postprocessed = true;
+	for (int s = 0; s < StepCount; s++)
+		for (uint8_t f : failed[s])
+			r.step_failures[s] += f;
+}
+
+double realtime_factor(const Options &o, const Result &r)
+{
+	return r.wall_s > 0.0 ? o.clock.seconds / r.wall_s : 0.0;
+}
+
+void print_summary(const Options &o, const Result &r)
+{
+	auto ms = [](uint64_t ns) { return (double)ns / 1e6; };
+	auto line = [&](const char *name, const Histogram &h, double scale, const char *unit) {
+		const HistogramSummary s = summarize(h);
+		std::printf("  %-16s p50 %9.3f  p99 %9.3f  max %9.3f %s  (n=%" PRIu64 ")\n", name, s.p50 * scale,
+			    s.p99 * scale, s.max * scale, unit, s.count);
+	};
+
+	std::printf("%zu stems x %.1f s, %u Hz, %u ch, %u-frame callbacks, speed %.2f, jitter %.1f ms\n", o.stems,
+		    o.clock.seconds, o.clock.sample_rate, (unsigned)o.channels, o.clock.frames_per_callback,
+		    o.clock.speed, o.clock.jitter_ms);
+	std::printf("wall %.3f s (%.1fx real time), stop %.1f ms\n", r.wall_s, realtime_factor(o, r), r.stop_ms);
+	std::printf("written %" PRIu64 " frames, %.1f MiB: %.0f frames/s, %.1f MiB/s\n", r.frames_written,
+		    r.bytes_written / 1048576.0, r.wall_s > 0.0 ? r.frames_written / r.wall_s : 0.0,
+		    r.wall_s > 0.0 ? r.bytes_written / 1048576.0 / r.wall_s : 0.0);
+	std::printf("dropped %" PRIu64 " chunks on %zu stems, %zu stems failed to start\n", r.dropped_chunks,
+		    r.stems_with_drops, r.failed_stems);
+	line("audio_callback", r.hot.audio_callback_ns, 1e-3, "us");
+	line("write", r.hot.write_ns, 1e-3, "us");
+	line("wake_to_write", r.hot.wake_to_write_ns, 1e-3, "us");
+	line("queue_depth", r.hot.queue_depth, 1.0, "chunks");
+	if (o.clock.speed > 0.0)
+		line("clock_late", r.clock_late_ns, 1e-3, "us");
+	if (r.postprocessed) {
+		std::printf("post-processing %.1f ms\n", r.post_wall_ms);
+		for (int s = 0; s < StepCount; s++) {
+			if (r.step_ns[s].count() == 0)
+				continue;
+			const HistogramSummary h = summarize(r.step_ns[s]);
+			std::printf("  %-16s p50 %9.1f  max %9.1f ms  (n=%" PRIu64 ", %zu failed)\n", k_step_names[s],
+				    ms(h.p50), ms(h.max), h.count, r.step_failures[s]);
+		}
+	}
+}
+
+void json_summary(FILE *f, const char *name, const Histogram &h, bool last)
+{
+	const HistogramSummary s = summarize(h);
+	std::fprintf(f,
+		     "    \"%s\": {\"count\": %" PRIu64 ", \"p50\": %" PRIu64 ", \"p90\": %" PRIu64 ", \"p99\": %" PRIu64
+		     ", \"max\": %" PRIu64 ", \"mean\": %.1f}%s\n",
+		     name, s.count, s.p50, s.p90, s.p99, s.max, s.mean, last ? "" : ",");
+}
+
+bool write_json(const Options &o, const Result &r, const std::string &path)
+{
+	const bool to_stdout = path == "-";
+	FILE *f = to_stdout ? stdout : std::fopen(path.c_str(), "wb");
+	if (!f) {
+		std::fprintf(stderr, "could not write %s\n", path.c_str());
+		return false;
+	}
+
+	std::string signals;
+	for (const SignalSpec &s : o.signals) {
+		if (!signals.empty())
+			signals += ",";
+		signals += s.kind == SignalKind::Tone	  ? "tone"
+			   : s.kind == SignalKind::Noise  ? "noise"
+			   : s.kind == SignalKind::Clicks ? "clicks"
+							  : "silence";
+	}
+	const char *dither = o.dither == DitherMode::Off ? "off" : o.dither == DitherMode::Shaped ? "shaped" : "tpdf";
+
+	std::fprintf(f, "{\n  \"config\": {\n");
+	std::fprintf(f, "    \"stems\": %zu,\n    \"seconds\": %.3f,\n    \"sample_rate\": %u,\n    \"channels\": %u,\n",
+		     o.stems, o.clock.seconds, o.clock.sample_rate, (unsigned)o.channels);
+	std::fprintf(f, "    \"frames_per_callback\": %u,\n    \"speed\": %.3f,\n    \"jitter_ms\": %.3f,\n",
+		     o.clock.frames_per_callback, o.clock.speed, o.clock.jitter_ms);
+	std::fprintf(f, "    \"signal\": \"%s\",\n    \"dither\": \"%s\",\n    \"postprocess\": %s,\n", signals.c_str(),
+		     dither, o.postprocess ? "true" : "false");
+	std::fprintf(f, "    \"export\": \"%s\"\n  },\n", o.export_format.c_str());
+
+	std::fprintf(f, "  \"wall_s\": %.6f,\n  \"realtime_factor\": %.3f,\n  \"stop_ms\": %.3f,\n", r.wall_s,
+		     realtime_factor(o, r), r.stop_ms);
+	std::fprintf(f, "  \"frames_written\": %" PRIu64 ",\n  \"bytes_written\": %" PRIu64 ",\n", r.frames_written,
+		     r.bytes_written);
+	std::fprintf(f, "  \"frames_per_s\": %.1f,\n  \"mib_per_s\": %.3f,\n",
+		     r.wall_s > 0.0 ? r.frames_written / r.wall_s : 0.0,
+		     r.wall_s > 0.0 ? r.bytes_written / 1048576.0 / r.wall_s : 0.0);
+	std::fprintf(f, "  \"dropped_chunks\": %" PRIu64 ",\n  \"stems_with_drops\": %zu,\n  \"failed_stems\": %zu,\n",
+		     r.dropped_chunks, r.stems_with_drops, r.failed_stems);
+
+	std::fprintf(f, "  \"latency_ns\": {\n");
+	json_summary(f, "audio_callback", r.hot.audio_callback_ns, false);
+	json_summary(f, "write", r.hot.write_ns, false);
+	json_summary(f, "wake_to_write", r.hot.wake_to_write_ns, false);
+	json_summary(f, "clock_late", r.clock_late_ns, true);
+	std::fprintf(f, "  },\n  \"queue_depth\": {\n");
+	json_summary(f, "chunks", r.hot.queue_depth, true);
+	std::fprintf(f, "  }");
+
+	if (r.postprocessed) {
+		std::fprintf(f, ",\n  \"postprocess\": {\n    \"wall_ms\": %.3f,\n    \"steps_ns\": {\n", r.post_wall_ms);
+		bool first = true;
+		for (int s = 0; s < StepCount; s++) {
+			if (r.step_ns[s].count() == 0)
+				continue;
+			const HistogramSummary h = summarize(r.step_ns[s]);
+			std::fprintf(f,
+				     "%s      \"%s\": {\"count\": %" PRIu64 ", \"p50\": %" PRIu64 ", \"p99\": %" PRIu64
+				     ", \"max\": %" PRIu64 ", \"failed\": %zu}",
+				     first ? "" : ",\n", k_step_names[s], h.count, h.p50, h.p99, h.max, r.step_failures[s]);
+			first = false;
+		}
+		std::fprintf(f, "\n    }\n  }");
+	}
+	std::fprintf(f, "\n}\n");
+
+	if (to_stdout)
+		return std::fflush(f) == 0;
+	return std::fclose(f) == 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	Options o;
+	if (!parse_args(argc, argv, o)) {
+		usage(argv[0]);
+		return 1;
+	}
+	bench_set_log_level(o.verbose ? LOG_INFO : LOG_WARNING);
+
+	namespace fs = std::filesystem;
+	std::error_code ec;
+	const bool temp_dir = o.out_dir.empty();
+	const fs::path dir = temp_dir ? fs::temp_directory_path(ec) / ("stems-bench-" + std::to_string(getpid()))
+				      : fs::path(o.out_dir);
+	fs::create_directories(dir, ec);
+	if (ec) {
+		std::fprintf(stderr, "could not create %s: %s\n", dir.string().c_str(), ec.message().c_str());
+		return 1;
+	}
+	std::vector<std::string> wav_paths;
+	for (size_t i = 0; i < o.stems; i++)
+		wav_paths.push_back((dir / ("stem_" + std::to_string(i + 1) + ".wav")).string());
+
+	const uint64_t trace_since_ns = os_gettime_ns();
+	if (!o.trace_path.empty()) {
+		trace::acquire();
+		trace::name_thread("main");
+	}
+
+	Result r;
+	const bool ok = record(o, wav_paths, r);
+	if (ok && o.postprocess)
+		postprocess(o, wav_paths, r);
+
+	if (!o.trace_path.empty()) {
+		std::vector<trace::Event> events;
+		std::vector<trace::ThreadInfo> threads;
+		trace::collect(trace_since_ns, events, threads);
+		trace::release();
+		if (!trace::write_chrome_trace(o.trace_path, events, threads, trace_since_ns))
+			std::fprintf(stderr, "could not write %s\n", o.trace_path.c_str());
+	}
+
+	if (!o.keep) {
+		if (temp_dir) {
+			fs::remove_all(dir, ec);
+		} else {
+			for (const std::string &p : wav_paths) {
+				fs::remove(p, ec);
+				fs::remove(p.substr(0, p.size() - 4) + ".mp3", ec);
+				fs::remove(p.substr(0, p.size() - 4) + ".export.wav", ec);
+			}
+		}
+	}
+	if (!ok) {
+		std::fprintf(stderr, "no stem could be started\n");
+		return 1;
+	}
+
+	if (o.json_path != "-")
+		print_summary(o, r);
+	if (!o.json_path.empty() && !write_json(o, r, o.json_path))
+		return 1;
+	if (o.max_drops >= 0 && r.dropped_chunks > (uint64_t)o.max_drops)
+		return 2;
+	return 0;
+}
@@ -0,0 +1,629 @@
+// End-to-end cost of finalizing a session: builds synthetic sessions over a
+// matrix of stem counts, lengths and post-processing settings and runs
+// finalize_session() on each, as Session::stop() hands it off. Reports wall
+// time, peak RSS and bytes of I/O per case; JSON with --json.
+//
+// Each case runs in its own process so peak RSS is that case's alone. The
+// stems are written before the fork and are not part of the timing; with
+// --cold they are also dropped from the page cache, as they would be after
+// a long recording. Disk use is about rate * channels * 2 bytes per second
+// per stem, plus one temporary copy per worker: the full sweep
+//
+//   --stems 1,8,32,64 --durations 60,600,3600,28800
+//
+// needs about 5.5 GB per 8 h stereo stem, 350 GB for the largest case.
+// Cases that do not fit on the scratch disk are skipped.
+
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "stems/finalize.hpp"
+#include "stems/parallel.hpp"
+#include "stems/wav_writer.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace stems;
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Preset {
+	const char *name;
+	const char *help;
+	void (*apply)(Settings &s, SourceAudioProperties &props);
+};
+
+// Source properties default to the mix format, so nothing is exported.
+const Preset k_presets[] = {
+	{"none", "no trim, no normalize",
+	 [](Settings &s, SourceAudioProperties &) {
+		 s.trim_silence = false;
+		 s.normalize_audio = false;
+	 }},
+	{"trim", "per-stem trim",
+	 [](Settings &s, SourceAudioProperties &) { s.normalize_audio = false; }},
+	{"session-trim", "one trim range across all stems",
+	 [](Settings &s, SourceAudioProperties &) {
+		 s.trim_mode = "session";
+		 s.normalize_audio = false;
+	 }},
+	{"default", "trim, RMS normalize, limiter", [](Settings &, SourceAudioProperties &) {}},
+	{"lufs", "trim, LUFS normalize, limiter",
+	 [](Settings &s, SourceAudioProperties &) { s.normalize_mode = "lufs"; }},
+	{"no-limiter", "trim, RMS normalize",
+	 [](Settings &s, SourceAudioProperties &) { s.normalize_limiter = false; }},
+	{"resample", "default, then resample to 44.1 kHz",
+	 [](Settings &, SourceAudioProperties &p) { p.sample_rate = 44100; }},
+	{"remix", "default, then downmix to mono", [](Settings &, SourceAudioProperties &p) { p.channels = 1; }},
+	{"remix-resample", "default, then downmix to mono at 44.1 kHz in one pass",
+	 [](Settings &, SourceAudioProperties &p) {
+		 p.channels = 1;
+		 p.sample_rate = 44100;
+	 }},
+	{"mp3", "default, then mp3 with ffmpeg from PATH",
+	 [](Settings &s, SourceAudioProperties &) { s.output_format = "mp3"; }},
+	{"wav24", "default, then 24-bit WAV with ffmpeg from PATH",
+	 [](Settings &s, SourceAudioProperties &) { s.wav_bit_depth = 24; }},
+};
+
+struct Options {
+	std::vector<uint32_t> stems = {1, 8, 32};
+	std::vector<double> durations_s = {60.0, 300.0};
+	std::vector<const Preset *> presets;
+	uint32_t sample_rate = 48000;
+	uint16_t channels = 2;
+	bool sidecar = true;
+	bool cold = false;
+	bool keep = false;
+	double max_ms = 0.0;
+	std::string out_dir;
+	std::string json_path;
+};
+
+// Written by the case's process into a pipe.
+struct Measurement {
+	bool ok = false;
+	bool ran = false;
+	double wall_ms = 0.0;
+	uint64_t peak_rss_kb = 0;
+	// /proc/self/io, all threads of the process.
+	bool have_proc_io = false;
+	uint64_t rchar = 0;
+	uint64_t wchar = 0;
+	uint64_t read_bytes = 0;
+	uint64_t write_bytes = 0;
+	// Block I/O of the process and of any encoder it waited for.
+	uint64_t in_blocks = 0;
+	uint64_t out_blocks = 0;
+	uint64_t output_bytes = 0;
+	// Summed over stems; steps of different stems overlap in time.
+	double step_ms[k_post_step_count] = {};
+};
+
+struct CaseResult {
+	const Preset *preset = nullptr;
+	uint32_t stems = 0;
+	double seconds = 0.0;
+	uint64_t input_bytes = 0;
+	bool skipped = false;
+	Measurement m;
+};
+
+void usage(const char *argv0)
+{
+	std::fprintf(stderr,
+		     "usage: %s [options]\n"
+		     "  --stems LIST         stem counts (1,8,32)\n"
+		     "  --durations LIST     session lengths in seconds (60,300)\n"
+		     "  --presets LIST       post-processing settings (none,trim,default,lufs)\n"
+		     "  --rate HZ            sample rate (48000)\n"
+		     "  --channels N         channels per stem (2)\n"
+		     "  --no-sidecar         do not write session.json\n"
+		     "  --cold               drop the stems from the page cache before each run\n"
+		     "  --max-ms MS          exit 2 if any case takes longer\n"
+		     "  --out DIR            scratch directory (a temporary one)\n"
+		     "  --keep               leave the finalized sessions in place\n"
+		     "  --json PATH          write results as JSON, - for stdout\n"
+		     "presets:\n",
+		     argv0);
+	for (const Preset &p : k_presets)
+		std::fprintf(stderr, "  %-20s %s\n", p.name, p.help);
+}
+
+template<typename T> bool parse_list(const char *text, std::vector<T> &out)
+{
+	out.clear();
+	const std::string s = text;
+	size_t pos = 0;
+	while (pos < s.size()) {
+		size_t comma = s.find(',', pos);
+		if (comma == std::string::npos)
+			comma = s.size();
+		const double v = std::atof(s.substr(pos, comma - pos).c_str());
+		if (v <= 0.0)
+			return false;
+		out.push_back((T)v);
+		pos = comma + 1;
+	}
+	return !out.empty();
+}
+
+bool parse_presets(const char *text, std::vector<const Preset *> &out)
+{
+	out.clear();
+	const std::string s = text;
+	size_t pos = 0;
+	while (pos < s.size()) {
+		size_t comma = s.find(',', pos);
+		if (comma == std::string::npos)
+			comma = s.size();
+		const std::string name = s.substr(pos, comma - pos);
+		const Preset *found = nullptr;
+		for (const Preset &p : k_presets)
+			if (name == p.name)
+				found = &p;
+		if (!found)
+			return false;
+		out.push_back(found);
+		pos = comma + 1;
+	}
+	return !out.empty();
+}
+
+bool parse_args(int argc, char **argv, Options &o)
+{
+	parse_presets("none,trim,default,lufs", o.presets);
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg == "--no-sidecar") {
+			o.sidecar = false;
+			continue;
+		}
+		if (arg == "--cold") {
+			o.cold = true;
+			continue;
+		}
+		if (arg == "--keep") {
+			o.keep = true;
+			continue;
+		}
+		if (arg == "--help" || arg == "-h" || i + 1 >= argc)
+			return false;
+		const char *v = argv[++i];
+		bool ok = true;
+		if (arg == "--stems")
+			ok = parse_list(v, o.stems);
+		else if (arg == "--durations")
+			ok = parse_list(v, o.durations_s);
+		else if (arg == "--presets")
+			ok = parse_presets(v, o.presets);
+		else if (arg == "--rate")
+			ok = (o.sample_rate = (uint32_t)std::strtoul(v, nullptr, 10)) > 0;
+		else if (arg == "--channels")
+			ok = (o.channels = (uint16_t)std::atoi(v)) > 0 && o.channels <= 8;
+		else if (arg == "--max-ms")
+			ok = (o.max_ms = std::atof(v)) > 0.0;
+		else if (arg == "--out")
+			o.out_dir = v;
+		else if (arg == "--json")
+			o.json_path = v;
+		else
+			ok = false;
+		if (!ok) {
+			std::fprintf(stderr, "bad option %s %s\n", arg.c_str(), v);
+			return false;
+		}
+	}
+	return true;
+}
+
+// A second of quiet tone and noise, interleaved, at a level that varies by
+// stem so normalizing has work to do.
+std::vector<int16_t> make_block(uint32_t rate, uint16_t channels, uint32_t stem)
+{
+	std::vector<int16_t> block((size_t)rate * channels);
+	const double amp = 0.05 + 0.2 * (double)(stem % 5) / 4.0;
+	uint32_t rng = 0x9e3779b9u + stem;
+	for (size_t i = 0; i < rate; i++) {
+		for (uint16_t ch = 0; ch < channels; ch++) {
+			rng ^= rng << 13;
+			rng ^= rng >> 17;
+			rng ^= rng << 5;
+			const double noise = (double)(rng >> 8) * (1.0 / 8388608.0) - 1.0;
+			const double w = 2.0 * 3.14159265358979323846 * (220.0 + 110.0 * ch + 7.0 * stem) / rate;
+			const double v = amp * std::sin(w * (double)i) + 0.01 * noise;
+			block[i * channels + ch] = (int16_t)std::lrint(v * 32767.0);
+		}
+	}
+	return block;
+}
+
+// Silent for the first 1-2.5 s and the last second, like a source that
+// was idle when recording started and stopped.
+bool write_stem(const std::string &path, uint32_t rate, uint16_t channels, uint32_t stem, double seconds)
+{
+	WavWriter w;
+	if (!w.open(path, rate, channels))
+		return false;
+	const uint64_t total = (uint64_t)std::llround(seconds * rate);
+	const uint64_t head = std::min<uint64_t>(total / 4, rate + (uint64_t)(stem % 4) * rate / 2);
+	const uint64_t tail = std::min<uint64_t>(total / 4, rate);
+	const std::vector<int16_t> block = make_block(rate, channels, stem);
+	bool ok = w.write_silence(head);
+	for (uint64_t done = head; ok && done < total - tail;) {
+		const size_t n = (size_t)std::min<uint64_t>(rate, total - tail - done);
+		ok = w.write_samples(block.data(), n);
+		done += n;
+	}
+	ok = ok && w.write_silence(tail);
+	w.close();
+	return ok;
+}
+
+// Flushes the file and asks the kernel to drop its cached pages.
+void evict(const std::string &path)
+{
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+	::fdatasync(fd);
+#if defined(POSIX_FADV_DONTNEED)
+	::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+	::close(fd);
+}
+
+bool read_proc_io(Measurement &m, bool after)
+{
+	std::FILE *f = std::fopen("/proc/self/io", "r");
+	if (!f)
+		return false;
+	char key[64];
+	unsigned long long v = 0;
+	uint64_t rchar = 0, wchar = 0, rb = 0, wb = 0;
+	while (std::fscanf(f, "%63[^:]: %llu\n", key, &v) == 2) {
+		if (!std::strcmp(key, "rchar"))
+			rchar = v;
+		else if (!std::strcmp(key, "wchar"))
+			wchar = v;
+		else if (!std::strcmp(key, "read_bytes"))
+			rb = v;
+		else if (!std::strcmp(key, "write_bytes"))
+			wb = v;
+	}
+	std::fclose(f);
+	if (after) {
+		m.rchar = rchar - m.rchar;
+		m.wchar = wchar - m.wchar;
+		m.read_bytes = rb - m.read_bytes;
+		m.write_bytes = wb - m.write_bytes;
+	} else {
+		m.rchar = rchar;
+		m.wchar = wchar;
+		m.read_bytes = rb;
+		m.write_bytes = wb;
+	}
+	return true;
+}
+
+// Peak RSS since reset_peak_rss(), or since the fork on kernels that cannot
+// reset it; the fork copies little, the scratch data is written before it.
+bool reset_peak_rss()
+{
+	std::FILE *f = std::fopen("/proc/self/clear_refs", "w");
+	if (!f)
+		return false;
+	const bool ok = std::fputs("5", f) >= 0;
+	return std::fclose(f) == 0 && ok;
+}
+
+uint64_t peak_rss_kb()
+{
+	uint64_t kb = 0;
+	if (std::FILE *f = std::fopen("/proc/self/status", "r")) {
+		char line[256];
+		while (std::fgets(line, sizeof(line), f))
+			if (std::sscanf(line, "VmHWM: %" SCNu64, &kb) == 1)
+				break;
+		std::fclose(f);
+	}
+	if (kb)
+		return kb;
+	struct rusage ru = {};
+	getrusage(RUSAGE_SELF, &ru);
+	return (uint64_t)ru.ru_maxrss;
+}
+
+uint64_t dir_bytes(const fs::path &dir)
+{
+	uint64_t total = 0;
+	std::error_code ec;
+	for (const auto &e : fs::recursive_directory_iterator(dir, ec)) {
+		if (!e.is_regular_file(ec))
+			continue;
+		const uintmax_t size = e.file_size(ec);
+		if (!ec)
+			total += (uint64_t)size;
+	}
+	return total;
+}
+
+// Runs in the forked process.
+Measurement run_finalize(FinalizeJob &job, const std::string &expect_ext)
+{
+	Measurement m;
+	m.ran = true;
+	reset_peak_rss();
+	m.have_proc_io = read_proc_io(m, false);
+	struct rusage self_before = {};
+	getrusage(RUSAGE_SELF, &self_before);
+
+	const uint64_t begin = os_gettime_ns();
+	finalize_session(job, nullptr, nullptr);
+	m.wall_ms = (double)(os_gettime_ns() - begin) / 1e6;
+
+	if (m.have_proc_io)
+		m.have_proc_io = read_proc_io(m, true);
+	m.peak_rss_kb = peak_rss_kb();
+	struct rusage self_after = {};
+	struct rusage children = {};
+	getrusage(RUSAGE_SELF, &self_after);
+	getrusage(RUSAGE_CHILDREN, &children);
+	m.in_blocks = (uint64_t)(self_after.ru_inblock - self_before.ru_inblock + children.ru_inblock);
+	m.out_blocks = (uint64_t)(self_after.ru_oublock - self_before.ru_oublock + children.ru_oublock);
+
+	m.ok = true;
+	std::error_code ec;
+	for (const StemOutput &o : job.stems) {
+		for (size_t i = 0; i < k_post_step_count; i++)
+			m.step_ms[i] += o.step_stats[i].ms;
+		if (o.final_path.empty() || !fs::exists(o.final_path, ec) ||
+		    fs::path(o.final_path).extension() != expect_ext)
+			m.ok = false;
+	}
+	m.output_bytes = dir_bytes(job.session_dir);
+	return m;
+}
+
+bool measure_in_child(FinalizeJob &job, const std::string &expect_ext, Measurement &out)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+		return false;
+	std::fflush(nullptr);
+	const pid_t pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		const Measurement m = run_finalize(job, expect_ext);
+		const bool ok = write(fds[1], &m, sizeof(m)) == (ssize_t)sizeof(m);
+		_exit(ok ? 0 : 1);
+	}
+	close(fds[1]);
+	Measurement m;
+	size_t got = 0;
+	while (got < sizeof(m)) {
+		const ssize_t n = read(fds[0], (char *)&m + got, sizeof(m) - got);
+		if (n <= 0)
+			break;
+		got += (size_t)n;
+	}
+	close(fds[0]);
+	int status = 0;
+	waitpid(pid, &status, 0);
+	if (got != sizeof(m) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return false;
+	out = m;
+	return true;
+}
+
+std::string fmt(double v)
+{
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%g", v);
+	return buf;
+}
+
+double mib(uint64_t bytes)
+{
+	return (double)bytes / 1048576.0;
+}
+
+CaseResult run_case(const Options &o, const fs::path &root, const Preset &preset, uint32_t stems, double seconds)
+{
+	CaseResult r;
+	r.preset = &preset;
+	r.stems = stems;
+	r.seconds = seconds;
+	const uint64_t stem_bytes = (uint64_t)std::llround(seconds * o.sample_rate) * o.channels * sizeof(int16_t);
+	r.input_bytes = stem_bytes * stems;
+
+	// Room for the stems and one temporary copy per worker.
+	std::error_code ec;
+	const fs::space_info space = fs::space(root, ec);
+	const uint64_t needed = r.input_bytes + stem_bytes * parallel_workers(stems);
+	if (!ec && space.available < needed) {
+		r.skipped = true;
+		return r;
+	}
+
+	const std::string tag = std::string(preset.name) + "_" + std::to_string(stems) + "x" + fmt(seconds) + "s";
+	const fs::path dir = root / tag;
+	fs::remove_all(dir, ec);
+	fs::create_directories(dir, ec);
+
+	FinalizeJob job;
+	job.kind = SessionKind::Recording;
+	job.settings.output_dir = root.string();
+	job.settings.write_sidecar_json = o.sidecar;
+	job.session_dir = dir.string();
+	job.sample_rate = o.sample_rate;
+	job.channels = o.channels;
+	job.start_ns = os_gettime_ns();
+	for (int i = 0; i < 4; i++)
+		job.markers.push_back({(uint64_t)(seconds * 1e9 * i / 4), "scene", "Scene " + std::to_string(i + 1)});
+
+	SourceAudioProperties props;
+	props.sample_rate = o.sample_rate;
+	props.channels = o.channels;
+	props.bitrate_kbps = 192;
+	preset.apply(job.settings, props);
+
+	bool ok = true;
+	for (uint32_t i = 0; ok && i < stems; i++) {
+		StemOutput s;
+		s.source_name = "Source " + std::to_string(i + 1);
+		s.source_uuid = "00000000-0000-4000-8000-" + std::to_string(100000000000ull + i);
+		s.wav_path = (dir / (s.source_name + ".wav")).string();
+		s.audio_properties = props;
+		ok = write_stem(s.wav_path, o.sample_rate, o.channels, i, seconds);
+		s.has_capture_stats = true;
+		s.capture_stats.frames_written = (uint64_t)std::llround(seconds * o.sample_rate);
+		s.capture_stats.bytes_written = stem_bytes;
+		if (o.cold)
+			evict(s.wav_path);
+		job.stems.push_back(std::move(s));
+	}
+
+	const std::string ext = job.settings.output_format == "mp3" ? ".mp3" : ".wav";
+	if (ok)
+		measure_in_child(job, ext, r.m);
+	if (!o.keep)
+		fs::remove_all(dir, ec);
+	return r;
+}
+
+void print_row(FILE *f, const CaseResult &r)
+{
+	std::fprintf(f, "%-13s %5u %8s  ", r.preset->name, r.stems, fmt(r.seconds).c_str());
+	if (r.skipped) {
+		std::fprintf(f, "skipped: needs more free disk\n");
+		return;
+	}
+	if (!r.m.ran) {
+		std::fprintf(f, "FAILED\n");
+		return;
+	}
+	const Measurement &m = r.m;
+	std::fprintf(f, "%10.1f %8.1f %10.1f %10.1f %10.1f %10.1f%s\n", m.wall_ms, m.peak_rss_kb / 1024.0,
+		     mib(m.have_proc_io ? m.rchar : m.in_blocks * 512), mib(m.have_proc_io ? m.wchar : m.out_blocks * 512),
+		     mib(m.read_bytes), mib(m.write_bytes), m.ok ? "" : "  (incomplete)");
+}
+
+bool write_json(const Options &o, const std::vector<CaseResult> &results, const std::string &path)
+{
+	const bool to_stdout = path == "-";
+	FILE *f = to_stdout ? stdout : std::fopen(path.c_str(), "wb");
+	if (!f) {
+		std::fprintf(stderr, "could not write %s\n", path.c_str());
+		return false;
+	}
+
+	std::fprintf(f,
+		     "{\n  \"sample_rate\": %u,\n  \"channels\": %u,\n  \"sidecar\": %s,\n  \"cold\": %s,\n"
+		     "  \"workers\": %zu,\n  \"cases\": [",
+		     o.sample_rate, (unsigned)o.channels, o.sidecar ? "true" : "false", o.cold ? "true" : "false",
+		     parallel_workers(SIZE_MAX));
+	for (size_t i = 0; i < results.size(); i++) {
+		const CaseResult &r = results[i];
+		const Measurement &m = r.m;
+		std::fprintf(f,
+			     "%s\n    {\"preset\": \"%s\", \"stems\": %u, \"seconds\": %s, \"input_bytes\": %" PRIu64
+			     ", \"skipped\": %s, \"ok\": %s",
+			     i ? "," : "", r.preset->name, r.stems, fmt(r.seconds).c_str(), r.input_bytes,
+			     r.skipped ? "true" : "false", m.ran && m.ok ? "true" : "false");
+		if (m.ran) {
+			std::fprintf(f,
+				     ", \"wall_ms\": %.3f, \"peak_rss_kb\": %" PRIu64 ", \"output_bytes\": %" PRIu64
+				     ", \"in_blocks\": %" PRIu64 ", \"out_blocks\": %" PRIu64,
+				     m.wall_ms, m.peak_rss_kb, m.output_bytes, m.in_blocks, m.out_blocks);
+			if (m.have_proc_io)
+				std::fprintf(f,
+					     ", \"rchar\": %" PRIu64 ", \"wchar\": %" PRIu64 ", \"read_bytes\": %" PRIu64
+					     ", \"write_bytes\": %" PRIu64,
+					     m.rchar, m.wchar, m.read_bytes, m.write_bytes);
+			std::fprintf(f, ", \"step_ms\": {");
+			for (size_t s = 0; s < k_post_step_count; s++)
+				std::fprintf(f, "%s\"%s\": %.3f", s ? ", " : "", post_step_name((PostStep)(1u << s)),
+					     m.step_ms[s]);
+			std::fprintf(f, "}");
+		}
+		std::fprintf(f, "}");
+	}
+	std::fprintf(f, "\n  ]\n}\n");
+
+	if (to_stdout)
+		return std::fflush(f) == 0;
+	return std::fclose(f) == 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	Options o;
+	if (!parse_args(argc, argv, o)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::error_code ec;
+	const bool temp_dir = o.out_dir.empty();
+	const fs::path dir = temp_dir ? fs::temp_directory_path(ec) / ("stems-finalize-bench-" + std::to_string(getpid()))
+				      : fs::path(o.out_dir);
+	fs::create_directories(dir, ec);
+	if (ec) {
+		std::fprintf(stderr, "could not create %s: %s\n", dir.string().c_str(), ec.message().c_str());
+		return 1;
+	}
+
+	FILE *table = o.json_path == "-" ? stderr : stdout;
+	std::fprintf(table, "%u Hz, %u ch, %zu workers%s%s\n", o.sample_rate, (unsigned)o.channels,
+		     parallel_workers(SIZE_MAX), o.sidecar ? ", sidecar" : "", o.cold ? ", cold cache" : "");
+	std::fprintf(table, "%-13s %5s %8s  %10s %8s %10s %10s %10s %10s\n", "preset", "stems", "seconds", "wall ms",
+		     "rss MiB", "read MiB", "write MiB", "disk rd", "disk wr");
+
+	std::vector<CaseResult> results;
+	for (const Preset *preset : o.presets) {
+		for (double seconds : o.durations_s) {
+			for (uint32_t stems : o.stems) {
+				results.push_back(run_case(o, dir, *preset, stems, seconds));
+				print_row(table, results.back());
+				std::fflush(table);
+			}
+		}
+	}
+
+	if (temp_dir && !o.keep)
+		fs::remove_all(dir, ec);
+
+	if (!o.json_path.empty() && !write_json(o, results, o.json_path))
+		return 1;
+	bool slow = false;
+	for (const CaseResult &r : results) {
+		if (!r.skipped && (!r.m.ran || !r.m.ok))
+			return 1;
+		if (o.max_ms > 0.0 && r.m.wall_ms > o.max_ms)
+			slow = true;
+	}
+	return slow ? 2 : 0;
+}
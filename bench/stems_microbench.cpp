@@ -0,0 +1,522 @@
+// Microbenchmarks of the conversion, writing and post-processing kernels at
+// several buffer sizes, channel counts and stem lengths. Prints a table, and
+// JSON with --json so runs can be compared against a baseline.
+//
+// The dsp kernels dispatch on the CPU; AUDIO_STEMS_SIMD=scalar|sse2 caps
+// the instruction set for a comparison run.
+
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "stems/dither.hpp"
+#include "stems/dsp.hpp"
+#include "stems/limiter.hpp"
+#include "stems/wav_postprocess.hpp"
+#include "stems/wav_writer.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+using namespace stems;
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Options {
+	std::vector<uint32_t> buffer_frames = {256, 1024, 4096};
+	std::vector<uint16_t> channels = {1, 2, 8};
+	std::vector<double> durations_s = {10.0, 60.0};
+	uint32_t sample_rate = 48000;
+	double min_time_s = 0.5;
+	int min_iterations = 3;
+	std::string filter;
+	std::string out_dir;
+	std::string json_path;
+};
+
+using Params = std::vector<std::pair<std::string, std::string>>;
+
+struct Case {
+	std::string name;
+	Params params;
+	// Work done by one run(), for the rate columns.
+	uint64_t frames = 0;
+	uint64_t bytes = 0;
+	// Untimed, before every run().
+	std::function<bool()> setup;
+	std::function<bool()> run;
+};
+
+struct CaseResult {
+	const Case *c = nullptr;
+	bool ok = true;
+	size_t iterations = 0;
+	uint64_t min_ns = 0;
+	uint64_t median_ns = 0;
+	double mean_ns = 0.0;
+};
+
+void usage(const char *argv0)
+{
+	std::fprintf(stderr,
+		     "usage: %s [options]\n"
+		     "  --buffers LIST       frames per buffer (256,1024,4096)\n"
+		     "  --channels LIST      channel counts (1,2,8)\n"
+		     "  --durations LIST     stem lengths in seconds for file kernels (10,60)\n"
+		     "  --rate HZ            sample rate (48000)\n"
+		     "  --min-time S         time spent on each case (0.5)\n"
+		     "  --min-iterations N   runs of each case at least (3)\n"
+		     "  --filter TEXT        only cases whose name contains TEXT\n"
+		     "  --out DIR            scratch directory, left in place (a temporary one)\n"
+		     "  --json PATH          write results as JSON, - for stdout\n",
+		     argv0);
+}
+
+template<typename T> bool parse_list(const char *text, std::vector<T> &out)
+{
+	out.clear();
+	const std::string s = text;
+	size_t pos = 0;
+	while (pos < s.size()) {
+		size_t comma = s.find(',', pos);
+		if (comma == std::string::npos)
+			comma = s.size();
+		const double v = std::atof(s.substr(pos, comma - pos).c_str());
+		if (v <= 0.0)
+			return false;
+		out.push_back((T)v);
+		pos = comma + 1;
+	}
+	return !out.empty();
+}
+
+bool parse_args(int argc, char **argv, Options &o)
+{
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h" || i + 1 >= argc)
+			return false;
+		const char *v = argv[++i];
+		bool ok = true;
+		if (arg == "--buffers")
+			ok = parse_list(v, o.buffer_frames);
+		else if (arg == "--channels")
+			ok = parse_list(v, o.channels) &&
+			     std::all_of(o.channels.begin(), o.channels.end(), [](uint16_t c) { return c <= 8; });
+		else if (arg == "--durations")
+			ok = parse_list(v, o.durations_s);
+		else if (arg == "--rate")
+			ok = (o.sample_rate = (uint32_t)std::strtoul(v, nullptr, 10)) > 0;
+		else if (arg == "--min-time")
+			ok = (o.min_time_s = std::atof(v)) >= 0.0;
+		else if (arg == "--min-iterations")
+			ok = (o.min_iterations = std::atoi(v)) > 0;
+		else if (arg == "--filter")
+			o.filter = v;
+		else if (arg == "--out")
+			o.out_dir = v;
+		else if (arg == "--json")
+			o.json_path = v;
+		else
+			ok = false;
+		if (!ok) {
+			std::fprintf(stderr, "bad option %s %s\n", arg.c_str(), v);
+			return false;
+		}
+	}
+	return true;
+}
+
+// A test tone with a little noise, in float planes.
+void fill_planes(std::vector<std::vector<float>> &planes, uint16_t channels, size_t frames, uint32_t rate)
+{
+	planes.assign(channels, std::vector<float>(frames));
+	uint32_t rng = 0x9e3779b9u;
+	for (uint16_t ch = 0; ch < channels; ch++) {
+		const double w = 2.0 * 3.14159265358979323846 * (440.0 + 55.0 * ch) / rate;
+		for (size_t i = 0; i < frames; i++) {
+			rng ^= rng << 13;
+			rng ^= rng >> 17;
+			rng ^= rng << 5;
+			const float noise = (float)(rng >> 8) * (1.0f / 8388608.0f) - 1.0f;
+			planes[ch][i] = 0.25f * (float)std::sin(w * (double)i) + 0.01f * noise;
+		}
+	}
+}
+
+// A stem as the recorder leaves it: a second of silence at both ends
+// around a tone, so trimming has something to cut.
+bool write_reference_stem(const std::string &path, uint16_t channels, uint32_t rate, double seconds)
+{
+	WavWriter w;
+	if (!w.open(path, rate, channels))
+		return false;
+	const size_t block = 4096;
+	std::vector<std::vector<float>> planes;
+	fill_planes(planes, channels, block, rate);
+	std::vector<const float *> ptrs(channels);
+	for (uint16_t ch = 0; ch < channels; ch++)
+		ptrs[ch] = planes[ch].data();
+	Ditherer dither;
+	dither.reset(channels, DitherMode::Tpdf, 1);
+	std::vector<int16_t> buf(block * channels);
+
+	const uint64_t total = (uint64_t)std::llround(seconds * rate);
+	const uint64_t edge = std::min<uint64_t>(rate, total / 4);
+	bool ok = w.write_silence(edge);
+	for (uint64_t done = edge; ok && done < total - edge;) {
+		const size_t n = (size_t)std::min<uint64_t>(block, total - edge - done);
+		dither.quantize_s16(ptrs.data(), n, buf.data());
+		ok = w.write_samples(buf.data(), n);
+		done += n;
+	}
+	ok = ok && w.write_silence(edge);
+	w.close();
+	return ok;
+}
+
+bool copy_file(const std::string &from, const std::string &to)
+{
+	std::error_code ec;
+	fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+	return !ec;
+}
+
+std::string fmt(double v)
+{
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%g", v);
+	return buf;
+}
+
+class Suite {
+public:
+	Suite(const Options &o, const fs::path &dir) : o_(o), dir_(dir) {}
+
+	void build();
+	std::vector<CaseResult> run_all(FILE *table);
+
+private:
+	void add(Case c)
+	{
+		if (o_.filter.empty() || c.name.find(o_.filter) != std::string::npos)
+			cases_.push_back(std::move(c));
+	}
+	void add_quantize();
+	void add_wav_write();
+	void add_file_kernels();
+	CaseResult run_case(const Case &c);
+
+	const Options &o_;
+	fs::path dir_;
+	std::vector<Case> cases_;
+	// Inputs the cases' closures refer to; a deque keeps them in place.
+	std::deque<std::vector<std::vector<float>>> planes_;
+	std::deque<std::vector<int16_t>> pcm_;
+};
+
+void Suite::build()
+{
+	add_quantize();
+	add_wav_write();
+	add_file_kernels();
+}
+
+void Suite::add_quantize()
+{
+	const DitherMode modes[] = {DitherMode::Off, DitherMode::Tpdf, DitherMode::Shaped};
+	const char *const mode_names[] = {"off", "tpdf", "shaped"};
+	for (uint16_t ch : o_.channels) {
+		for (uint32_t frames : o_.buffer_frames) {
+			planes_.emplace_back();
+			fill_planes(planes_.back(), ch, frames, o_.sample_rate);
+			const auto &planes = planes_.back();
+			pcm_.emplace_back((size_t)frames * ch);
+			int16_t *out = pcm_.back().data();
+			// Enough calls per run that timer overhead does not matter.
+			const size_t reps = std::max<size_t>(1, 65536 / frames);
+
+			for (size_t m = 0; m < 3; m++) {
+				auto dither = std::make_shared<Ditherer>();
+				dither->reset(ch, modes[m], 1);
+				Case c;
+				c.name = "quantize_s16";
+				c.params = {{"dither", mode_names[m]},
+					    {"channels", std::to_string(ch)},
+					    {"buffer_frames", std::to_string(frames)}};
+				c.frames = (uint64_t)frames * reps;
+				c.bytes = c.frames * ch * sizeof(int16_t);
+				c.run = [dither, &planes, out, ch, frames, reps]() {
+					const float *ptrs[8] = {};
+					for (uint16_t i = 0; i < ch; i++)
+						ptrs[i] = planes[i].data();
+					for (size_t r = 0; r < reps; r++)
+						dither->quantize_s16(ptrs, frames, out);
+					return true;
+				};
+				add(std::move(c));
+			}
+
+			// What the capture callback does ahead of conversion.
+			Case peak;
+			peak.name = "peak_f32";
+			peak.params = {{"channels", std::to_string(ch)}, {"buffer_frames", std::to_string(frames)}};
+			peak.frames = (uint64_t)frames * reps;
+			peak.bytes = peak.frames * ch * sizeof(float);
+			peak.run = [&planes, ch, frames, reps]() {
+				float p = 0.0f;
+				for (size_t r = 0; r < reps; r++)
+					for (uint16_t i = 0; i < ch; i++)
+						p = std::max(p, dsp::abs_max_f32(planes[i].data(), frames));
+				return p > 0.0f;
+			};
+			add(std::move(peak));
+		}
+	}
+}
+
+void Suite::add_wav_write()
+{
+	const double seconds = o_.durations_s.front();
+	for (uint16_t ch : o_.channels) {
+		for (uint32_t frames : o_.buffer_frames) {
+			pcm_.emplace_back((size_t)frames * ch);
+			std::vector<int16_t> &buf = pcm_.back();
+			for (size_t i = 0; i < buf.size(); i++)
+				buf[i] = (int16_t)((i * 2654435761u) >> 20);
+			const uint64_t total = (uint64_t)std::llround(seconds * o_.sample_rate);
+			const std::string path = (dir_ / ("write_" + std::to_string(ch) + "ch.wav")).string();
+			const uint32_t rate = o_.sample_rate;
+
+			Case c;
+			c.name = "wav_write";
+			c.params = {{"channels", std::to_string(ch)},
+				    {"buffer_frames", std::to_string(frames)},
+				    {"seconds", fmt(seconds)}};
+			c.frames = total;
+			c.bytes = total * ch * sizeof(int16_t);
+			// open() and close() included: the header and flush are part
+			// of every stem.
+			c.run = [path, rate, ch, frames, total, &buf]() {
+				WavWriter w;
+				if (!w.open(path, rate, ch))
+					return false;
+				bool ok = true;
+				for (uint64_t done = 0; ok && done < total; done += frames)
+					ok = w.write_samples(buf.data(), (size_t)std::min<uint64_t>(frames, total - done));
+				w.close();
+				return ok;
+			};
+			add(std::move(c));
+		}
+	}
+}
+
+void Suite::add_file_kernels()
+{
+	const uint16_t ch = std::find(o_.channels.begin(), o_.channels.end(), 2) != o_.channels.end()
+				    ? 2
+				    : o_.channels.front();
+	const uint32_t rate = o_.sample_rate;
+
+	for (double seconds : o_.durations_s) {
+		const std::string tag = fmt(seconds) + "s_" + std::to_string(ch) + "ch";
+		const std::string ref = (dir_ / ("ref_" + tag + ".wav")).string();
+		const std::string work = (dir_ / ("work_" + tag + ".wav")).string();
+		const uint64_t total = (uint64_t)std::llround(seconds * rate);
+		const Params params = {{"channels", std::to_string(ch)}, {"seconds", fmt(seconds)}};
+		auto make_ref = [ref, ch, rate, seconds]() {
+			return fs::exists(ref) || write_reference_stem(ref, ch, rate, seconds);
+		};
+		auto fresh = [make_ref, ref, work]() { return make_ref() && copy_file(ref, work); };
+
+		Case trim;
+		trim.name = "trim_silence_wav";
+		trim.params = params;
+		trim.frames = total;
+		trim.bytes = total * ch * sizeof(int16_t);
+		trim.setup = fresh;
+		trim.run = [work, ch, rate]() { return trim_silence_wav(work, ch, rate, -50.0f, 100, 250); };
+		add(std::move(trim));
+
+		for (bool limit : {false, true}) {
+			Case norm;
+			norm.name = "normalize_wav_rms";
+			norm.params = params;
+			norm.params.push_back({"limiter", limit ? "on" : "off"});
+			norm.frames = total;
+			norm.bytes = total * ch * sizeof(int16_t);
+			norm.setup = fresh;
+			norm.run = [work, ch, rate, limit]() {
+				const LimiterParams limiter;
+				return normalize_wav_rms(work, ch, rate, -20.0f, limit ? &limiter : nullptr);
+			};
+			add(std::move(norm));
+		}
+
+		// A stem whose header still has the zero sizes written at open().
+		Case repair;
+		repair.name = "repair_header";
+		repair.params = params;
+		repair.frames = total;
+		repair.setup = [fresh, work]() {
+			if (!fresh())
+				return false;
+			std::FILE *f = std::fopen(work.c_str(), "rb+");
+			if (!f)
+				return false;
+			const unsigned char zero[4] = {};
+			const bool ok = std::fseek(f, 4, SEEK_SET) == 0 && std::fwrite(zero, 1, 4, f) == 4 &&
+					std::fseek(f, 40, SEEK_SET) == 0 && std::fwrite(zero, 1, 4, f) == 4;
+			return std::fclose(f) == 0 && ok;
+		};
+		repair.run = [work]() { return WavWriter::repair_header(work); };
+		add(std::move(repair));
+	}
+}
+
+CaseResult Suite::run_case(const Case &c)
+{
+	CaseResult r;
+	r.c = &c;
+	std::vector<uint64_t> samples;
+	uint64_t spent_ns = 0;
+	const uint64_t budget_ns = (uint64_t)(o_.min_time_s * 1e9);
+
+	// The first run warms caches and creates any reference files.
+	for (bool warmup = true;; warmup = false) {
+		if (c.setup && !c.setup()) {
+			r.ok = false;
+			break;
+		}
+		const uint64_t begin = os_gettime_ns();
+		const bool ok = c.run();
+		const uint64_t ns = os_gettime_ns() - begin;
+		if (!ok) {
+			r.ok = false;
+			break;
+		}
+		if (warmup)
+			continue;
+		samples.push_back(ns);
+		spent_ns += ns;
+		if (samples.size() >= (size_t)o_.min_iterations && spent_ns >= budget_ns)
+			break;
+	}
+
+	r.iterations = samples.size();
+	if (samples.empty())
+		return r;
+	std::sort(samples.begin(), samples.end());
+	r.min_ns = samples.front();
+	r.median_ns = samples[samples.size() / 2];
+	r.mean_ns = (double)spent_ns / samples.size();
+	return r;
+}
+
+std::vector<CaseResult> Suite::run_all(FILE *table)
+{
+	std::vector<CaseResult> out;
+	for (const Case &c : cases_) {
+		out.push_back(run_case(c));
+		const CaseResult &r = out.back();
+		std::string label = c.name;
+		for (const auto &p : c.params)
+			label += " " + p.first + "=" + p.second;
+		if (!r.ok) {
+			std::fprintf(table, "%-60s FAILED\n", label.c_str());
+			continue;
+		}
+		const double secs = r.median_ns / 1e9;
+		std::fprintf(table, "%-60s %12.1f us  %8.1f Mframes/s  %8.1f MiB/s\n", label.c_str(),
+			     r.median_ns / 1e3, secs > 0.0 ? c.frames / secs / 1e6 : 0.0,
+			     secs > 0.0 ? c.bytes / secs / 1048576.0 : 0.0);
+	}
+	return out;
+}
+
+bool write_json(const Options &o, const std::vector<CaseResult> &results, const std::string &path)
+{
+	const bool to_stdout = path == "-";
+	FILE *f = to_stdout ? stdout : std::fopen(path.c_str(), "wb");
+	if (!f) {
+		std::fprintf(stderr, "could not write %s\n", path.c_str());
+		return false;
+	}
+
+	std::fprintf(f, "{\n  \"simd\": \"%s\",\n  \"sample_rate\": %u,\n  \"min_time_s\": %.3f,\n  \"cases\": [",
+		     dsp::simd_level_name(dsp::simd_level()), o.sample_rate, o.min_time_s);
+	for (size_t i = 0; i < results.size(); i++) {
+		const CaseResult &r = results[i];
+		const Case &c = *r.c;
+		const double secs = r.median_ns / 1e9;
+		std::fprintf(f, "%s\n    {\"name\": \"%s\", \"params\": {", i ? "," : "", c.name.c_str());
+		for (size_t p = 0; p < c.params.size(); p++)
+			std::fprintf(f, "%s\"%s\": \"%s\"", p ? ", " : "", c.params[p].first.c_str(),
+				     c.params[p].second.c_str());
+		std::fprintf(f,
+			     "}, \"ok\": %s, \"iterations\": %zu, \"frames\": %" PRIu64 ", \"bytes\": %" PRIu64
+			     ", \"min_ns\": %" PRIu64 ", \"median_ns\": %" PRIu64
+			     ", \"mean_ns\": %.1f, \"frames_per_s\": %.1f, \"mib_per_s\": %.3f}",
+			     r.ok ? "true" : "false", r.iterations, c.frames, c.bytes, r.min_ns, r.median_ns, r.mean_ns,
+			     secs > 0.0 ? c.frames / secs : 0.0, secs > 0.0 ? c.bytes / secs / 1048576.0 : 0.0);
+	}
+	std::fprintf(f, "\n  ]\n}\n");
+
+	if (to_stdout)
+		return std::fflush(f) == 0;
+	return std::fclose(f) == 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	Options o;
+	if (!parse_args(argc, argv, o)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::error_code ec;
+	const bool temp_dir = o.out_dir.empty();
+	const fs::path dir = temp_dir ? fs::temp_directory_path(ec) / ("stems-microbench-" + std::to_string(getpid()))
+				      : fs::path(o.out_dir);
+	fs::create_directories(dir, ec);
+	if (ec) {
+		std::fprintf(stderr, "could not create %s: %s\n", dir.string().c_str(), ec.message().c_str());
+		return 1;
+	}
+
+	FILE *table = o.json_path == "-" ? stderr : stdout;
+	std::fprintf(table, "simd %s, %u Hz\n", dsp::simd_level_name(dsp::simd_level()), o.sample_rate);
+	Suite suite(o, dir);
+	suite.build();
+	const std::vector<CaseResult> results = suite.run_all(table);
+
+	if (temp_dir)
+		fs::remove_all(dir, ec);
+
+	if (!o.json_path.empty() && !write_json(o, results, o.json_path))
+		return 1;
+	for (const CaseResult &r : results)
+		if (!r.ok)
+			return 1;
+	return 0;
+}
@@ -0,0 +1,650 @@
+// Fault-injection stress run: synthetic real-time sources record through
+// StemRecorder onto a file backend that stalls, throttles or runs out of
+// space. Reports drops, queue headroom, how quickly the writers caught up
+// after each fault and how far the written audio drifted from the timeline.
+//
+// Every source plays indexed clicks, so reading the stems back shows
+// exactly which audio was lost and how much later audio moved.
+
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "fault_file_backend.hpp"
+#include "stems/stem_recorder.hpp"
+#include "stems/wav_writer.hpp"
+#include "synthetic_source.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+using namespace stems;
+using namespace stems::bench;
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Options {
+	size_t stems = 8;
+	ClockSpec clock;
+	uint16_t channels = 2;
+	DitherMode dither = DitherMode::Tpdf;
+	double click_every_s = 0.1;
+	FaultSpec faults;
+	std::string out_dir;
+	bool keep = false;
+	std::string json_path;
+	long long max_drops = -1;
+	double max_sync_ms = -1.0;
+	bool verbose = false;
+};
+
+// One monitor sample, summed or maxed over the stems.
+struct Sample {
+	uint64_t t_ns = 0;
+	uint64_t dropped_chunks = 0;
+	uint64_t max_backlog_frames = 0;
+};
+
+struct StemResult {
+	std::string path;
+	StemCaptureStats capture;
+	uint64_t clicks_expected = 0;
+	uint64_t clicks_found = 0;
+	// Stream time of the first click that was lost or moved, or -1.
+	double first_fault_s = -1.0;
+	double max_sync_error_ms = 0.0;
+	double final_sync_error_ms = 0.0;
+	// Click index to frame position, for the cross-stem skew.
+	std::vector<std::pair<uint64_t, uint64_t>> clicks;
+};
+
+struct WindowResult {
+	FaultWindow window;
+	uint64_t drops = 0;
+	// From the end of the fault until every writer had caught up; -1 when
+	// none did before the run ended.
+	double recovered_after_ms = -1.0;
+};
+
+struct Result {
+	// Fault and timeline times count from here.
+	uint64_t origin_ns = 0;
+	double run_s = 0.0;
+	double stop_ms = 0.0;
+	uint64_t delivered_frames = 0;
+	std::vector<StemResult> stems;
+	std::vector<Sample> samples;
+	std::vector<WindowResult> windows;
+	FaultStats io;
+	uint64_t dropped_chunks = 0;
+	size_t stems_with_drops = 0;
+	size_t stems_failed = 0;
+	size_t queue_peak = 0;
+	size_t queue_capacity = 0;
+	double max_sync_error_ms = 0.0;
+	double max_skew_ms = 0.0;
+};
+
+void usage(const char *argv0)
+{
+	std::fprintf(stderr,
+		     "usage: %s [options]\n"
+		     "  --stems N            sources recorded at once (8)\n"
+		     "  --seconds S          audio length per stem (30)\n"
+		     "  --rate HZ            sample rate (48000)\n"
+		     "  --channels N         channels per stem (2)\n"
+		     "  --frames N           frames per audio callback (1024)\n"
+		     "  --speed X            callbacks paced at X times real time (1)\n"
+		     "  --jitter-ms MS       callbacks fire up to MS late (0)\n"
+		     "  --dither MODE        off|tpdf|shaped (tpdf)\n"
+		     "  --click-ms MS        click spacing, the sync resolution (100)\n"
+		     "  --bandwidth-mib X    shared write bandwidth in MiB/s (unlimited)\n"
+		     "  --stall-every S      a write stall about every S seconds of run time (off)\n"
+		     "  --stall-ms MS        length of each stall (0)\n"
+		     "  --enospc-at S        writes fail with ENOSPC from S seconds into the run (off)\n"
+		     "  --enospc-for S       for S seconds (until the end)\n"
+		     "  --seed N             fault and jitter seed (1)\n"
+		     "  --out DIR            where stems are written (a temporary directory)\n"
+		     "  --keep               keep the written stems\n"
+		     "  --json PATH          write results as JSON, - for stdout\n"
+		     "  --max-drops N        exit with status 2 when more chunks were dropped\n"
+		     "  --max-sync-ms MS     exit with status 2 when a stem drifted further\n"
+		     "  --verbose            log at info level\n",
+		     argv0);
+}
+
+bool parse_args(int argc, char **argv, Options &o)
+{
+	o.clock.seconds = 30.0;
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg == "--keep") {
+			o.keep = true;
+			continue;
+		}
+		if (arg == "--verbose") {
+			o.verbose = true;
+			continue;
+		}
+		if (arg == "--help" || arg == "-h" || i + 1 >= argc)
+			return false;
+		const char *v = argv[++i];
+		if (arg == "--stems")
+			o.stems = (size_t)std::strtoull(v, nullptr, 10);
+		else if (arg == "--seconds")
+			o.clock.seconds = std::atof(v);
+		else if (arg == "--rate")
+			o.clock.sample_rate = (uint32_t)std::strtoul(v, nullptr, 10);
+		else if (arg == "--channels")
+			o.channels = (uint16_t)std::strtoul(v, nullptr, 10);
+		else if (arg == "--frames")
+			o.clock.frames_per_callback = (uint32_t)std::strtoul(v, nullptr, 10);
+		else if (arg == "--speed")
+			o.clock.speed = std::atof(v);
+		else if (arg == "--jitter-ms")
+			o.clock.jitter_ms = std::atof(v);
+		else if (arg == "--dither")
+			o.dither = dither_mode_from_string(v);
+		else if (arg == "--click-ms")
+			o.click_every_s = std::atof(v) / 1000.0;
+		else if (arg == "--bandwidth-mib")
+			o.faults.bandwidth_mib_s = std::atof(v);
+		else if (arg == "--stall-every")
+			o.faults.stall_every_s = std::atof(v);
+		else if (arg == "--stall-ms")
+			o.faults.stall_ms = std::atof(v);
+		else if (arg == "--enospc-at")
+			o.faults.enospc_at_s = std::atof(v);
+		else if (arg == "--enospc-for")
+			o.faults.enospc_for_s = std::atof(v);
+		else if (arg == "--seed")
+			o.faults.seed = o.clock.seed = std::strtoull(v, nullptr, 10);
+		else if (arg == "--out")
+			o.out_dir = v;
+		else if (arg == "--json")
+			o.json_path = v;
+		else if (arg == "--max-drops")
+			o.max_drops = std::atoll(v);
+		else if (arg == "--max-sync-ms")
+			o.max_sync_ms = std::atof(v);
+		else {
+			std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+			return false;
+		}
+	}
+
+	// Unpaced runs would make every fault look like an overload.
+	if (o.stems == 0 || o.clock.seconds <= 0.0 || o.clock.sample_rate == 0 || o.channels == 0 ||
+	    o.channels > 8 || o.clock.frames_per_callback == 0 || o.clock.speed <= 0.0) {
+		std::fprintf(stderr, "stems, seconds, rate, frames, speed and 1-8 channels must be positive\n");
+		return false;
+	}
+	const uint64_t every = (uint64_t)std::llround(o.click_every_s * o.clock.sample_rate);
+	if (every < 4) {
+		std::fprintf(stderr, "--click-ms is too short for the sample rate\n");
+		return false;
+	}
+	return true;
+}
+
+// Samples drops and writer backlog until told to stop.
+class Monitor {
+public:
+	Monitor(const std::vector<std::unique_ptr<StemRecorder>> &recorders, const SyntheticClock &clock,
+		uint32_t frames_per_callback)
+		: recorders_(recorders),
+		  clock_(clock),
+		  period_(frames_per_callback)
+	{
+	}
+
+	void start() { thread_ = std::thread([this]() { run(); }); }
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			quit_ = true;
+		}
+		cv_.notify_all();
+		if (thread_.joinable())
+			thread_.join();
+	}
+	const std::vector<Sample> &samples() const { return samples_; }
+
+private:
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mtx_);
+		while (!quit_) {
+			lock.unlock();
+			take();
+			lock.lock();
+			cv_.wait_for(lock, std::chrono::milliseconds(10), [this]() { return quit_; });
+		}
+	}
+
+	void take()
+	{
+		Sample s;
+		s.t_ns = os_gettime_ns();
+		const uint64_t delivered = clock_.frames();
+		for (const auto &rec : recorders_) {
+			const StemCaptureStats st = rec->capture_stats();
+			s.dropped_chunks += st.dropped_chunks;
+			// Still queued: delivered but neither dropped nor written. A
+			// failed writer's backlog only grows.
+			const uint64_t gone = st.dropped_chunks * period_ + st.frames_written;
+			s.max_backlog_frames = std::max(s.max_backlog_frames, delivered > gone ? delivered - gone : 0);
+		}
+		samples_.push_back(s);
+	}
+
+	const std::vector<std::unique_ptr<StemRecorder>> &recorders_;
+	const SyntheticClock &clock_;
+	const uint64_t period_;
+	std::vector<Sample> samples_;
+	std::thread thread_;
+	std::mutex mtx_;
+	std::condition_variable cv_;
+	bool quit_ = false;
+};
+
+// Finds the clicks on the first channel and compares each one's position
+// with where the timeline puts it.
+bool analyze_stem(const Options &o, StemResult &r)
+{
+	std::FILE *f = std::fopen(r.path.c_str(), "rb");
+	if (!f)
+		return false;
+	const uint32_t rate = o.clock.sample_rate;
+	const uint64_t every = (uint64_t)std::llround(o.click_every_s * rate);
+	const size_t ch = o.channels;
+	std::vector<int16_t> buf(4096 * ch);
+	std::fseek(f, 44, SEEK_SET);
+
+	uint64_t frame = 0;
+	int16_t prev = 0;
+	bool prev_pending = false;
+	int64_t last_k = -1;
+	int64_t base = 0;
+	bool have_base = false;
+	const uint64_t wrap = 128 * 128;
+	for (;;) {
+		const size_t got = std::fread(buf.data(), sizeof(int16_t), buf.size(), f) / ch;
+		if (got == 0)
+			break;
+		for (size_t i = 0; i < got; i++, frame++) {
+			const int16_t v = buf[i * ch];
+			if (!prev_pending) {
+				prev_pending = v >= k_click_threshold;
+				prev = v;
+				continue;
+			}
+			prev_pending = false;
+			const int64_t code = decode_click(prev, v);
+			if (code < 0)
+				continue;
+			// Unwrap against the previous click; indices only go up.
+			int64_t k = code;
+			if (last_k >= 0)
+				k = last_k + 1 + (int64_t)((uint64_t)(code - last_k - 1) % wrap);
+			if (last_k >= 0 && k > last_k + 1 && r.first_fault_s < 0.0)
+				r.first_fault_s = (double)((last_k + 1) * (int64_t)every) / rate;
+			last_k = k;
+			const uint64_t pos = frame - 1;
+			if (!have_base) {
+				// The first click fixes where the stem sits on the timeline.
+				base = (int64_t)pos - k * (int64_t)every;
+				have_base = true;
+			}
+			const int64_t err = (int64_t)pos - (base + k * (int64_t)every);
+			const double err_ms = (double)err * 1000.0 / rate;
+			if (err != 0 && r.first_fault_s < 0.0)
+				r.first_fault_s = (double)(k * (int64_t)every) / rate;
+			r.max_sync_error_ms = std::max(r.max_sync_error_ms, std::fabs(err_ms));
+			r.final_sync_error_ms = err_ms;
+			r.clicks.emplace_back((uint64_t)k, pos);
+			r.clicks_found++;
+		}
+	}
+	std::fclose(f);
+
+	if (r.clicks_found < r.clicks_expected && r.first_fault_s < 0.0) {
+		// Clicks missing without any shift: the tail is gone. Report the
+		// first one that never arrived.
+		const uint64_t first_missing = r.clicks.empty() ? 0 : r.clicks.back().first + 1;
+		r.first_fault_s = (double)(first_missing * every) / rate;
+	}
+	return true;
+}
+
+double max_skew_ms(const std::vector<StemResult> &stems, uint32_t rate)
+{
+	// Position of each click relative to stem 0's copy of it.
+	if (stems.size() < 2 || stems[0].clicks.empty())
+		return 0.0;
+	std::vector<int64_t> ref;
+	for (const auto &c : stems[0].clicks) {
+		if (c.first >= ref.size())
+			ref.resize(c.first + 1, -1);
+		ref[c.first] = (int64_t)c.second;
+	}
+	int64_t worst = 0;
+	for (size_t s = 1; s < stems.size(); s++) {
+		for (const auto &c : stems[s].clicks) {
+			if (c.first < ref.size() && ref[c.first] >= 0)
+				worst = std::max<int64_t>(worst, std::llabs((int64_t)c.second - ref[c.first]));
+		}
+	}
+	return (double)worst * 1000.0 / rate;
+}
+
+void analyze_windows(const Options &o, const FaultFileBackend &io, Result &r)
+{
+	// Caught up: at most a few callbacks of audio waiting for the writer.
+	const uint64_t settled = 3ull * o.clock.frames_per_callback;
+	for (const FaultWindow &w : io.windows()) {
+		WindowResult wr;
+		wr.window = w;
+		uint64_t drops_before = 0;
+		bool have_before = false;
+		for (const Sample &s : r.samples) {
+			if (!have_before && s.t_ns >= w.begin_ns) {
+				have_before = true;
+				drops_before = s.dropped_chunks;
+			}
+			if (s.t_ns < w.end_ns || w.end_ns == UINT64_MAX)
+				continue;
+			if (s.max_backlog_frames <= settled) {
+				wr.recovered_after_ms = (double)(s.t_ns - w.end_ns) / 1e6;
+				wr.drops = s.dropped_chunks - drops_before;
+				break;
+			}
+		}
+		if (wr.recovered_after_ms < 0.0 && have_before && !r.samples.empty())
+			wr.drops = r.samples.back().dropped_chunks - drops_before;
+		r.windows.push_back(wr);
+	}
+}
+
+bool run(const Options &o, const fs::path &dir, Result &r)
+{
+	FaultFileBackend io(o.faults);
+	set_file_backend(&io);
+
+	std::vector<std::unique_ptr<StemRecorder>> recorders;
+	std::vector<SyntheticSource *> sources;
+	SyntheticClock clock;
+	auto gate = std::make_shared<StartGate>(o.stems, 2000000000ull);
+	SignalSpec clicks;
+	clicks.kind = SignalKind::Clicks;
+	clicks.click_every_s = o.click_every_s;
+
+	for (size_t i = 0; i < o.stems; i++) {
+		auto source = std::make_unique<SyntheticSource>("synthetic-" + std::to_string(i),
+								"Stem " + std::to_string(i + 1), clicks,
+								o.clock.sample_rate, o.clock.seed + i);
+		SyntheticSource *raw = source.get();
+		auto rec = std::make_unique<StemRecorder>();
+		StemResult sr;
+		sr.path = (dir / ("stem_" + std::to_string(i + 1) + ".wav")).string();
+		if (!rec->prepare(std::move(source), sr.path, o.clock.sample_rate, o.channels) ||
+		    !rec->attach(o.dither, gate)) {
+			std::fprintf(stderr, "could not start %s\n", sr.path.c_str());
+			gate->leave();
+			continue;
+		}
+		sources.push_back(raw);
+		clock.add(raw);
+		recorders.push_back(std::move(rec));
+		r.stems.push_back(std::move(sr));
+	}
+	if (recorders.empty()) {
+		set_file_backend(nullptr);
+		return false;
+	}
+
+	Monitor monitor(recorders, clock, o.clock.frames_per_callback);
+	const uint64_t begin_ns = os_gettime_ns();
+	r.origin_ns = begin_ns;
+	io.start(begin_ns, o.clock.seconds / o.clock.speed);
+	monitor.start();
+	clock.run(o.clock);
+	r.run_s = (double)(os_gettime_ns() - begin_ns) / 1e9;
+	r.delivered_frames = clock.frames();
+
+	const uint64_t stop_ns = os_gettime_ns();
+	for (auto &rec : recorders)
+		rec->stop();
+	r.stop_ms = (double)(os_gettime_ns() - stop_ns) / 1e6;
+	monitor.stop();
+	set_file_backend(nullptr);
+
+	r.samples = monitor.samples();
+	r.io = io.stats();
+	const uint64_t every = (uint64_t)std::llround(o.click_every_s * o.clock.sample_rate);
+	for (size_t i = 0; i < recorders.size(); i++) {
+		StemResult &sr = r.stems[i];
+		sr.capture = recorders[i]->capture_stats();
+		sr.clicks_expected = r.delivered_frames > 1 ? (r.delivered_frames - 2) / every + 1 : 0;
+		if (!analyze_stem(o, sr))
+			std::fprintf(stderr, "could not read %s\n", sr.path.c_str());
+
+		r.dropped_chunks += sr.capture.dropped_chunks;
+		r.stems_with_drops += sr.capture.dropped_chunks > 0 ? 1 : 0;
+		r.stems_failed += sr.capture.write_failed ? 1 : 0;
+		r.queue_peak = std::max(r.queue_peak, sr.capture.max_queue_depth);
+		r.queue_capacity = sr.capture.queue_capacity;
+		r.max_sync_error_ms = std::max(r.max_sync_error_ms, sr.max_sync_error_ms);
+	}
+	r.max_skew_ms = max_skew_ms(r.stems, o.clock.sample_rate);
+	analyze_windows(o, io, r);
+	return true;
+}
+
+// Audio missing from the stem, to click resolution.
+double lost_ms(const Options &o, const StemResult &s)
+{
+	const uint64_t missing = s.clicks_expected > s.clicks_found ? s.clicks_expected - s.clicks_found : 0;
+	return (double)missing * o.click_every_s * 1000.0;
+}
+
+double rel_s(uint64_t ns, uint64_t origin_ns)
+{
+	return ns >= origin_ns ? (double)(ns - origin_ns) / 1e9 : 0.0;
+}
+
+void print_summary(const Options &o, const Result &r, uint64_t origin_ns)
+{
+	std::printf("%zu stems x %.1f s at %.2fx real time, %u-frame callbacks\n", r.stems.size(), o.clock.seconds,
+		    o.clock.speed, o.clock.frames_per_callback);
+	std::printf("io: %" PRIu64 " writes, %.1f MiB, %" PRIu64 " stalled (%.0f ms), %.0f ms throttled, %" PRIu64
+		    " ENOSPC, slowest write %.1f ms\n",
+		    r.io.writes, r.io.bytes / 1048576.0, r.io.stalled_writes, r.io.stalled_ns / 1e6,
+		    r.io.throttled_ns / 1e6, r.io.enospc_errors, r.io.max_write_ns / 1e6);
+	std::printf("dropped %" PRIu64 " chunks on %zu stems, %zu stems stopped writing, queue peak %zu/%zu\n",
+		    r.dropped_chunks, r.stems_with_drops, r.stems_failed, r.queue_peak, r.queue_capacity);
+	std::printf("sync error max %.1f ms, skew between stems %.1f ms, stop %.1f ms\n", r.max_sync_error_ms,
+		    r.max_skew_ms, r.stop_ms);
+	for (const WindowResult &w : r.windows) {
+		const double end = w.window.end_ns == UINT64_MAX ? -1.0 : rel_s(w.window.end_ns, origin_ns);
+		std::printf("  %-6s %7.2f-%7.2f s: %4" PRIu64 " drops, ", w.window.enospc ? "enospc" : "stall",
+			    rel_s(w.window.begin_ns, origin_ns), end, w.drops);
+		if (w.recovered_after_ms >= 0.0)
+			std::printf("caught up %.0f ms after\n", w.recovered_after_ms);
+		else
+			std::printf("never caught up\n");
+	}
+	for (const StemResult &s : r.stems) {
+		if (s.capture.dropped_chunks == 0 && !s.capture.write_failed && s.max_sync_error_ms == 0.0 &&
+		    s.clicks_found == s.clicks_expected)
+			continue;
+		std::printf("  %s: %" PRIu64 " drops, clicks %" PRIu64 "/%" PRIu64
+			    " (%.0f ms lost), first fault at %.2f s, sync error max %.1f ms, final %.1f ms%s\n",
+			    fs::path(s.path).filename().string().c_str(), s.capture.dropped_chunks, s.clicks_found,
+			    s.clicks_expected, lost_ms(o, s), s.first_fault_s, s.max_sync_error_ms, s.final_sync_error_ms,
+			    s.capture.write_failed ? ", stopped writing" : "");
+	}
+}
+
+bool write_json(const Options &o, const Result &r, uint64_t origin_ns, const std::string &path)
+{
+	const bool to_stdout = path == "-";
+	FILE *f = to_stdout ? stdout : std::fopen(path.c_str(), "wb");
+	if (!f) {
+		std::fprintf(stderr, "could not write %s\n", path.c_str());
+		return false;
+	}
+
+	std::fprintf(f, "{\n  \"config\": {\n");
+	std::fprintf(f, "    \"stems\": %zu,\n    \"seconds\": %.3f,\n    \"sample_rate\": %u,\n    \"channels\": %u,\n",
+		     o.stems, o.clock.seconds, o.clock.sample_rate, (unsigned)o.channels);
+	std::fprintf(f, "    \"frames_per_callback\": %u,\n    \"speed\": %.3f,\n    \"jitter_ms\": %.3f,\n",
+		     o.clock.frames_per_callback, o.clock.speed, o.clock.jitter_ms);
+	std::fprintf(f, "    \"click_ms\": %.3f,\n    \"bandwidth_mib_s\": %.3f,\n", o.click_every_s * 1000.0,
+		     o.faults.bandwidth_mib_s);
+	std::fprintf(f, "    \"stall_every_s\": %.3f,\n    \"stall_ms\": %.3f,\n", o.faults.stall_every_s,
+		     o.faults.stall_ms);
+	std::fprintf(f, "    \"enospc_at_s\": %.3f,\n    \"enospc_for_s\": %.3f,\n    \"seed\": %" PRIu64 "\n  },\n",
+		     o.faults.enospc_at_s, o.faults.enospc_for_s, o.faults.seed);
+
+	std::fprintf(f, "  \"run_s\": %.6f,\n  \"stop_ms\": %.3f,\n  \"delivered_frames\": %" PRIu64 ",\n", r.run_s,
+		     r.stop_ms, r.delivered_frames);
+	std::fprintf(f,
+		     "  \"io\": {\"writes\": %" PRIu64 ", \"bytes\": %" PRIu64 ", \"stalled_writes\": %" PRIu64
+		     ", \"stalled_ms\": %.3f, \"throttled_ms\": %.3f, \"enospc_errors\": %" PRIu64
+		     ", \"max_write_ms\": %.3f},\n",
+		     r.io.writes, r.io.bytes, r.io.stalled_writes, r.io.stalled_ns / 1e6, r.io.throttled_ns / 1e6,
+		     r.io.enospc_errors, r.io.max_write_ns / 1e6);
+	std::fprintf(f,
+		     "  \"dropped_chunks\": %" PRIu64
+		     ",\n  \"stems_with_drops\": %zu,\n  \"stems_stopped_writing\": %zu,\n",
+		     r.dropped_chunks, r.stems_with_drops, r.stems_failed);
+	std::fprintf(f, "  \"queue_peak\": %zu,\n  \"queue_capacity\": %zu,\n", r.queue_peak, r.queue_capacity);
+	std::fprintf(f, "  \"max_sync_error_ms\": %.3f,\n  \"max_skew_ms\": %.3f,\n", r.max_sync_error_ms,
+		     r.max_skew_ms);
+
+	std::fprintf(f, "  \"faults\": [");
+	for (size_t i = 0; i < r.windows.size(); i++) {
+		const WindowResult &w = r.windows[i];
+		std::fprintf(f, "%s\n    {\"kind\": \"%s\", \"begin_s\": %.3f, ", i ? "," : "",
+			     w.window.enospc ? "enospc" : "stall", rel_s(w.window.begin_ns, origin_ns));
+		if (w.window.end_ns == UINT64_MAX)
+			std::fprintf(f, "\"end_s\": null, ");
+		else
+			std::fprintf(f, "\"end_s\": %.3f, ", rel_s(w.window.end_ns, origin_ns));
+		std::fprintf(f, "\"drops\": %" PRIu64 ", ", w.drops);
+		if (w.recovered_after_ms >= 0.0)
+			std::fprintf(f, "\"recovered_after_ms\": %.1f}", w.recovered_after_ms);
+		else
+			std::fprintf(f, "\"recovered_after_ms\": null}");
+	}
+	std::fprintf(f, "%s],\n", r.windows.empty() ? "" : "\n  ");
+
+	std::fprintf(f, "  \"stems\": [");
+	for (size_t i = 0; i < r.stems.size(); i++) {
+		const StemResult &s = r.stems[i];
+		std::fprintf(f,
+			     "%s\n    {\"file\": \"%s\", \"frames_written\": %" PRIu64 ", \"dropped_chunks\": %" PRIu64
+			     ", \"max_queue_depth\": %zu, \"write_failed\": %s, \"write_max_ms\": %.3f, "
+			     "\"clicks_expected\": %" PRIu64 ", \"clicks_found\": %" PRIu64 ", ",
+			     i ? "," : "", fs::path(s.path).filename().string().c_str(), s.capture.frames_written,
+			     s.capture.dropped_chunks, s.capture.max_queue_depth,
+			     s.capture.write_failed ? "true" : "false", s.capture.write_max_ns / 1e6, s.clicks_expected,
+			     s.clicks_found);
+		if (s.first_fault_s >= 0.0)
+			std::fprintf(f, "\"first_fault_s\": %.3f, ", s.first_fault_s);
+		else
+			std::fprintf(f, "\"first_fault_s\": null, ");
+		std::fprintf(f, "\"lost_ms\": %.1f, \"max_sync_error_ms\": %.3f, \"final_sync_error_ms\": %.3f}",
+			     lost_ms(o, s), s.max_sync_error_ms, s.final_sync_error_ms);
+	}
+	std::fprintf(f, "\n  ],\n");
+
+	// Only where something changed, to keep long runs small.
+	std::fprintf(f, "  \"timeline\": [");
+	bool first = true;
+	uint64_t last_drops = 0;
+	uint64_t last_backlog = 0;
+	for (const Sample &s : r.samples) {
+		if (!first && s.dropped_chunks == last_drops && s.max_backlog_frames == last_backlog)
+			continue;
+		std::fprintf(f, "%s\n    {\"t_s\": %.3f, \"dropped_chunks\": %" PRIu64 ", \"backlog_ms\": %.1f}",
+			     first ? "" : ",", rel_s(s.t_ns, origin_ns), s.dropped_chunks,
+			     s.max_backlog_frames * 1000.0 / o.clock.sample_rate);
+		first = false;
+		last_drops = s.dropped_chunks;
+		last_backlog = s.max_backlog_frames;
+	}
+	std::fprintf(f, "%s]\n}\n", first ? "" : "\n  ");
+
+	if (to_stdout)
+		return std::fflush(f) == 0;
+	return std::fclose(f) == 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	Options o;
+	if (!parse_args(argc, argv, o)) {
+		usage(argv[0]);
+		return 1;
+	}
+	bench_set_log_level(o.verbose ? LOG_INFO : LOG_WARNING);
+
+	std::error_code ec;
+	const bool temp_dir = o.out_dir.empty();
+	const fs::path dir = temp_dir ? fs::temp_directory_path(ec) / ("stems-stress-" + std::to_string(getpid()))
+				      : fs::path(o.out_dir);
+	fs::create_directories(dir, ec);
+	if (ec) {
+		std::fprintf(stderr, "could not create %s: %s\n", dir.string().c_str(), ec.message().c_str());
+		return 1;
+	}
+
+	Result r;
+	const bool ok = run(o, dir, r);
+
+	if (!o.keep) {
+		if (temp_dir) {
+			fs::remove_all(dir, ec);
+		} else {
+			for (const StemResult &s : r.stems)
+				fs::remove(s.path, ec);
+		}
+	}
+	if (!ok) {
+		std::fprintf(stderr, "no stem could be started\n");
+		return 1;
+	}
+
+	if (o.json_path != "-")
+		print_summary(o, r, r.origin_ns);
+	if (!o.json_path.empty() && !write_json(o, r, r.origin_ns, o.json_path))
+		return 1;
+	if (o.max_drops >= 0 && r.dropped_chunks > (uint64_t)o.max_drops)
+		return 2;
+	if (o.max_sync_ms >= 0.0 && r.max_sync_error_ms > o.max_sync_ms)
+		return 2;
+	return 0;
+}
@@ -0,0 +1,234 @@
+#include "synthetic_source.hpp"
+
+#include <util/platform.h>
+
+#include "stems/dsp.hpp"
+#include "stems/trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <thread>
+
+namespace stems {
+namespace bench {
+
+static const double k_pi = 3.14159265358979323846;
+
+bool signal_kind_from_string(const std::string &name, SignalKind &out)
+{
+	if (name == "tone")
+		out = SignalKind::Tone;
+	else if (name == "noise")
+		out = SignalKind::Noise;
+	else if (name == "silence")
+		out = SignalKind::Silence;
+	else if (name == "clicks")
+		out = SignalKind::Clicks;
+	else
+		return false;
+	return true;
+}
+
+// Each pulse sample carries 7 bits of the click index as 0.25 + bits/512,
+// 64 LSB apart after conversion, which dither does not blur.
+static const uint64_t k_click_wrap = 128 * 128;
+
+static float click_level(uint64_t bits)
+{
+	return 0.25f + (float)(bits & 127) / 512.0f;
+}
+
+static int64_t click_bits(int16_t v)
+{
+	const long bits = std::lround(((double)v - 8192.0) / 64.0);
+	return bits >= 0 && bits < 128 ? bits : -1;
+}
+
+int64_t decode_click(int16_t lo, int16_t hi)
+{
+	if (lo < k_click_threshold || hi < k_click_threshold)
+		return -1;
+	const int64_t l = click_bits(lo);
+	const int64_t h = click_bits(hi);
+	return l < 0 || h < 0 ? -1 : l + 128 * h;
+}
+
+static uint32_t xorshift32(uint32_t &state)
+{
+	uint32_t x = state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	state = x;
+	return x;
+}
+
+SyntheticSource::SyntheticSource(std::string uuid, std::string name, const SignalSpec &signal, uint32_t sample_rate,
+				 uint64_t seed)
+	: uuid_(std::move(uuid)),
+	  name_(std::move(name)),
+	  signal_(signal),
+	  sample_rate_(sample_rate ? sample_rate : 48000),
+	  seed_(seed),
+	  amplitude_(std::pow(10.0f, signal.level_dbfs / 20.0f)),
+	  noise_state_((uint32_t)(seed * 2654435761u) | 1u)
+{
+}
+
+bool SyntheticSource::attach(CaptureSink *sink, uint16_t channels, DitherMode dither, std::atomic<uint64_t> *preroll_frames)
+{
+	if (preroll_frames)
+		preroll_frames->store(0);
+	if (!sink)
+		return false;
+	channels = channels ? channels : 2;
+
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (!sinks_.empty() && channels != channels_)
+		return false;
+	if (sinks_.empty()) {
+		channels_ = channels;
+		dither_.reset(channels, dither, seed_);
+		planes_.assign(channels, {});
+	}
+	if (std::find(sinks_.begin(), sinks_.end(), sink) == sinks_.end())
+		sinks_.push_back(sink);
+	return true;
+}
+
+void SyntheticSource::detach(CaptureSink *sink)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	sinks_.erase(std::remove(sinks_.begin(), sinks_.end(), sink), sinks_.end());
+}
+
+bool SyntheticSource::silent_at(uint64_t frame) const
+{
+	if (signal_.kind == SignalKind::Silence)
+		return true;
+	if (signal_.silence_period_s <= 0.0 || signal_.silence_s <= 0.0)
+		return false;
+	const uint64_t period = (uint64_t)std::llround(signal_.silence_period_s * sample_rate_);
+	const uint64_t gap = (uint64_t)std::llround(signal_.silence_s * sample_rate_);
+	if (period == 0)
+		return false;
+	// The gap closes each period so a session starts with signal.
+	return frame % period >= (period > gap ? period - gap : 0);
+}
+
+void SyntheticSource::fill(float *plane, uint16_t ch, uint64_t first_frame, uint32_t frames)
+{
+	if (signal_.kind == SignalKind::Noise) {
+		for (uint32_t i = 0; i < frames; i++) {
+			const float r = (float)(xorshift32(noise_state_) >> 8) * (1.0f / 8388608.0f) - 1.0f;
+			plane[i] = silent_at(first_frame + i) ? 0.0f : r * amplitude_;
+		}
+		return;
+	}
+	if (signal_.kind == SignalKind::Clicks) {
+		const uint64_t every = std::max<uint64_t>(1, (uint64_t)std::llround(signal_.click_every_s * sample_rate_));
+		std::fill(plane, plane + frames, 0.0f);
+		// A pulse can straddle two buffers, so start from the one before.
+		for (uint64_t n = first_frame / every * every; n < first_frame + frames; n += every) {
+			const uint64_t k = (n / every) % k_click_wrap;
+			if (n >= first_frame)
+				plane[n - first_frame] = click_level(k);
+			if (n + 1 >= first_frame && n + 1 < first_frame + frames)
+				plane[n + 1 - first_frame] = click_level(k / 128);
+		}
+		return;
+	}
+	// Each channel a little higher so the channels are not identical.
+	const double w = 2.0 * k_pi * signal_.frequency_hz * (1.0 + 0.01 * ch) / sample_rate_;
+	for (uint32_t i = 0; i < frames; i++) {
+		const uint64_t n = first_frame + i;
+		plane[i] = silent_at(n) ? 0.0f : amplitude_ * (float)std::sin(w * (double)n);
+	}
+}
+
+void SyntheticSource::render(uint32_t frames, uint64_t timestamp)
+{
+	if (frames == 0)
+		return;
+
+	const uint64_t begin_ns = os_gettime_ns();
+	trace::Scope span("audio_callback", "capture");
+	std::lock_guard<std::mutex> lock(mtx_);
+	const uint64_t first = position_;
+	position_ += frames;
+	if (sinks_.empty())
+		return;
+
+	const float *planes[8] = {};
+	float peak = 0.0f;
+	if (signal_.kind != SignalKind::Silence) {
+		for (uint16_t ch = 0; ch < channels_ && ch < 8; ch++) {
+			planes_[ch].resize(frames);
+			fill(planes_[ch].data(), ch, first, frames);
+			planes[ch] = planes_[ch].data();
+			peak = std::max(peak, dsp::abs_max_f32(planes[ch], frames));
+		}
+	}
+
+	ChunkPtr shared;
+	if (peak == 0.0f) {
+		ChunkPtr &cached = silence_[frames];
+		if (!cached) {
+			auto zero = std::make_shared<PcmChunk>();
+			zero->frames = frames;
+			zero->samples.assign((size_t)frames * channels_, 0);
+			cached = std::move(zero);
+		}
+		shared = cached;
+	} else {
+		auto chunk = std::make_shared<PcmChunk>();
+		chunk->frames = frames;
+		chunk->peak = peak;
+		chunk->samples.resize((size_t)frames * channels_);
+		dither_.quantize_s16(planes, frames, chunk->samples.data());
+		shared = std::move(chunk);
+	}
+
+	for (CaptureSink *sink : sinks_)
+		sink->on_chunk(shared, timestamp);
+	callback_ns_.record(os_gettime_ns() - begin_ns);
+}
+
+void SyntheticClock::run(const ClockSpec &spec)
+{
+	const uint32_t rate = spec.sample_rate ? spec.sample_rate : 48000;
+	const uint32_t period = spec.frames_per_callback ? spec.frames_per_callback : 1024;
+	const uint64_t total = (uint64_t)std::llround(spec.seconds * rate);
+	const bool paced = spec.speed > 0.0;
+	const uint64_t jitter_ns = (uint64_t)std::llround(std::max(0.0, spec.jitter_ms) * 1e6);
+	uint32_t rng = (uint32_t)(spec.seed * 2246822519u) | 1u;
+
+	trace::name_thread("audio");
+	start_ns_ = os_gettime_ns();
+	frames_ = 0;
+	late_ns_.reset();
+	for (uint64_t done = 0; done < total;) {
+		const uint32_t frames = (uint32_t)std::min<uint64_t>(period, total - done);
+		const uint64_t nominal_ns = start_ns_ + done * 1000000000ull / rate;
+		if (paced) {
+			const uint64_t sched_ns = start_ns_ + (uint64_t)((double)(nominal_ns - start_ns_) / spec.speed);
+			uint64_t due_ns = sched_ns;
+			if (jitter_ns)
+				due_ns += (uint64_t)xorshift32(rng) % (jitter_ns + 1);
+			const uint64_t now = os_gettime_ns();
+			if (due_ns > now)
+				std::this_thread::sleep_for(std::chrono::nanoseconds(due_ns - now));
+			const uint64_t woke = os_gettime_ns();
+			late_ns_.record(woke > sched_ns ? woke - sched_ns : 0);
+		}
+		for (SyntheticSource *s : sources_)
+			s->render(frames, nominal_ns);
+		done += frames;
+		frames_.store(done, std::memory_order_relaxed);
+	}
+}
+
+}
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "stems/audio_source.hpp"
+#include "stems/histogram.hpp"
+
+namespace stems {
+namespace bench {
+
+enum class SignalKind {
+	Tone,
+	Noise,
+	Silence,
+	// A two-sample pulse every click_every_s on every channel, digital
+	// silence in between. The pulse encodes its index (see decode_click),
+	// so a written stem can be checked for lost or shifted audio.
+	Clicks,
+};
+
+// Pulse samples are at least this loud.
+constexpr int16_t k_click_threshold = 4096;
+
+// Index of the click whose pulse is (lo, hi), or -1 when the two samples
+// are not one.
+int64_t decode_click(int16_t lo, int16_t hi);
+
+bool signal_kind_from_string(const std::string &name, SignalKind &out);
+
+struct SignalSpec {
+	SignalKind kind = SignalKind::Tone;
+	double frequency_hz = 440.0;
+	float level_dbfs = -12.0f;
+	// Every silence_period_s the signal drops to digital silence for
+	// silence_s; 0 means no gaps.
+	double silence_period_s = 0.0;
+	double silence_s = 0.0;
+	double click_every_s = 1.0;
+};
+
+// An AudioSource that renders a test signal. Chunks are converted the way
+// CaptureHub converts OBS audio: through a Ditherer, with digital silence
+// shared as one zero chunk per buffer size.
+class SyntheticSource : public AudioSource {
+public:
+	SyntheticSource(std::string uuid, std::string name, const SignalSpec &signal, uint32_t sample_rate,
+			uint64_t seed);
+
+	const std::string &uuid() const override { return uuid_; }
+	const std::string &name() const override { return name_; }
+	bool attach(CaptureSink *sink, uint16_t channels, DitherMode dither,
+		    std::atomic<uint64_t> *preroll_frames) override;
+	void detach(CaptureSink *sink) override;
+
+	// One audio callback of `frames` frames; called by the clock thread.
+	void render(uint32_t frames, uint64_t timestamp);
+
+	const Histogram &callback_ns() const { return callback_ns_; }
+
+private:
+	void fill(float *plane, uint16_t ch, uint64_t first_frame, uint32_t frames);
+	bool silent_at(uint64_t frame) const;
+
+	std::string uuid_;
+	std::string name_;
+	SignalSpec signal_;
+	uint32_t sample_rate_;
+	uint64_t seed_;
+	float amplitude_;
+
+	std::mutex mtx_;
+	std::vector<CaptureSink *> sinks_;
+	uint16_t channels_ = 2;
+	Ditherer dither_;
+	uint32_t noise_state_;
+	uint64_t position_ = 0;
+	std::vector<std::vector<float>> planes_;
+	std::unordered_map<uint32_t, ChunkPtr> silence_;
+	Histogram callback_ns_;
+};
+
+struct ClockSpec {
+	uint32_t sample_rate = 48000;
+	uint32_t frames_per_callback = 1024;
+	double seconds = 10.0;
+	// Multiple of real time the callbacks are paced at; 0 runs unpaced.
+	double speed = 1.0;
+	// Each callback fires up to this much after its nominal time. Deadlines
+	// stay on the nominal grid, so a late callback is followed by a burst.
+	double jitter_ms = 0.0;
+	uint64_t seed = 1;
+};
+
+// Plays the part of the OBS audio thread: one thread calls every source in
+// turn once per period, with timestamps on the nominal sample clock.
+class SyntheticClock {
+public:
+	void add(SyntheticSource *source) { sources_.push_back(source); }
+	// Blocks until spec.seconds of audio has been delivered.
+	void run(const ClockSpec &spec);
+
+	uint64_t start_ns() const { return start_ns_; }
+	// Frames delivered to each source so far; may be read while running.
+	uint64_t frames() const { return frames_.load(std::memory_order_relaxed); }
+	// How far behind its nominal time each period started, jitter included.
+	const Histogram &late_ns() const { return late_ns_; }
+
+private:
+	std::vector<SyntheticSource *> sources_;
+	uint64_t start_ns_ = 0;
+	std::atomic<uint64_t> frames_{0};
+	Histogram late_ns_;
+};
+
+}
+}
@@ -0,0 +1,38 @@
+#include "audio_source.hpp"
+
+#include <algorithm>
+
+namespace stems {
+
+void HistorySnapshot::for_each_block(const std::function<bool(const int16_t *samples, size_t frames)> &fn) const
+{
+	const size_t ch = channels ? channels : 2;
+	uint64_t remaining = frames;
+	if (pad_frames > 0) {
+		const std::vector<int16_t> zeros((size_t)std::min<uint64_t>(pad_frames, 4096) * ch, 0);
+		for (uint64_t left = std::min(pad_frames, remaining); left > 0;) {
+			const size_t n = (size_t)std::min<uint64_t>(left, zeros.size() / ch);
+			if (!fn(zeros.data(), n))
+				return;
+			left -= n;
+			remaining -= n;
+		}
+	}
+
+	uint64_t skip = skip_frames;
+	for (const auto &c : chunks) {
+		if (remaining == 0)
+			break;
+		if (skip >= c->frames) {
+			skip -= c->frames;
+			continue;
+		}
+		const size_t n = (size_t)std::min<uint64_t>(c->frames - skip, remaining);
+		if (!fn(c->samples.data() + skip * ch, n))
+			return;
+		skip = 0;
+		remaining -= n;
+	}
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dither.hpp"
+
+namespace stems {
+
+struct PcmChunk {
+	std::vector<int16_t> samples;
+	uint32_t frames = 0;
+	float peak = 0.0f;
+};
+
+using ChunkPtr = std::shared_ptr<const PcmChunk>;
+
+// A fixed-length window of one source's history. Holds references to the
+// captured chunks, so taking it is cheap and the data can be written out on
+// another thread.
+struct HistorySnapshot {
+	std::string uuid;
+	uint16_t channels = 2;
+	uint64_t frames = 0;
+	uint64_t pad_frames = 0;
+	uint64_t skip_frames = 0;
+	std::vector<ChunkPtr> chunks;
+
+	// Visits exactly `frames` frames in order, starting with zero padding
+	// when the source was captured for less than the window.
+	void for_each_block(const std::function<bool(const int16_t *samples, size_t frames)> &fn) const;
+};
+
+class CaptureSink {
+public:
+	virtual ~CaptureSink() = default;
+	// Called on the OBS audio thread (or the attaching thread for pre-roll);
+	// calls for one sink never overlap and must not block. timestamp is the
+	// OBS audio time of the chunk's first frame.
+	virtual void on_chunk(const ChunkPtr &chunk, uint64_t timestamp) = 0;
+};
+
+// Where a stem's audio comes from. OBS sources are captured through
+// CaptureHub (see HubSource); tools and benchmarks feed synthetic audio
+// into the same recorder path without libobs.
+class AudioSource {
+public:
+	virtual ~AudioSource() = default;
+
+	virtual const std::string &uuid() const = 0;
+	virtual const std::string &name() const = 0;
+	// Starts delivering chunks to sink. preroll_frames as for
+	// CaptureHub::attach; null means no history is replayed. It is stored
+	// before the first chunk reaches the sink, so the sink may adjust it.
+	virtual bool attach(CaptureSink *sink, uint16_t channels, DitherMode dither,
+			    std::atomic<uint64_t> *preroll_frames) = 0;
+	// Returns once no call into sink is in flight.
+	virtual void detach(CaptureSink *sink) = 0;
+};
+
+}
@@ -0,0 +1,454 @@
+#include "capture_hub.hpp"
+
+#include "dsp.hpp"
+#include "trace.hpp"
+
+#include <util/platform.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+
+namespace stems {
+
+// OBS delivers at most AUDIO_OUTPUT_FRAMES (1024) per callback but can go
+// lower; size pre-roll rings for small buffers so they fill by duration.
+static const uint64_t k_min_callback_frames = 256;
+static const size_t k_max_callback_frames = 1024;
+// Chunks in flight to sinks on top of those in the history ring.
+static const size_t k_pool_headroom = 512;
+
+static std::string source_uuid(obs_source_t *source)
+{
+	const char *uuid = source ? obs_source_get_uuid(source) : nullptr;
+	return uuid ? uuid : "";
+}
+
+std::unique_ptr<HubSource> HubSource::create(CaptureHub &hub, obs_source_t *source)
+{
+	obs_source_t *ref = source ? obs_source_get_ref(source) : nullptr;
+	if (!ref)
+		return nullptr;
+	std::unique_ptr<HubSource> out(new HubSource(hub, ref));
+	if (out->uuid_.empty())
+		return nullptr;
+	return out;
+}
+
+HubSource::HubSource(CaptureHub &hub, obs_source_t *source) : hub_(hub), source_(source)
+{
+	const char *name = obs_source_get_name(source);
+	uuid_ = source_uuid(source);
+	name_ = name ? name : "";
+}
+
+HubSource::~HubSource()
+{
+	obs_source_release(source_);
+}
+
+bool HubSource::attach(CaptureSink *sink, uint16_t channels, DitherMode dither, std::atomic<uint64_t> *preroll_frames)
+{
+	return hub_.attach(source_, channels, dither, sink, preroll_frames);
+}
+
+void HubSource::detach(CaptureSink *sink)
+{
+	hub_.detach(uuid_, sink);
+}
+
+CaptureHub::~CaptureHub()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	for (auto &it : taps_)
+		destroy_tap(std::move(it.second));
+	taps_.clear();
+}
+
+CaptureHub::Tap *CaptureHub::create_tap(obs_source_t *source, const std::string &uuid, uint16_t channels,
+					DitherMode dither)
+{
+	auto tap = std::make_unique<Tap>();
+	tap->weak = obs_source_get_weak_source(source);
+	tap->uuid = uuid;
+	tap->channels = channels;
+	tap->dither.reset(channels, dither, std::hash<std::string>()(uuid));
+	reserve_pool(*tap);
+	Tap *raw = tap.get();
+	taps_[uuid] = std::move(tap);
+	obs_source_add_audio_capture_callback(source, &CaptureHub::audio_cb, raw);
+	return raw;
+}
+
+void CaptureHub::destroy_tap(std::unique_ptr<Tap> tap)
+{
+	if (!tap)
+		return;
+	// A destroyed source takes its callbacks with it. Otherwise removal waits
+	// for an in-flight call, so the tap can be freed afterwards.
+	obs_source_t *source = obs_weak_source_get_source(tap->weak);
+	if (source) {
+		obs_source_remove_audio_capture_callback(source, &CaptureHub::audio_cb, tap.get());
+		obs_source_release(source);
+	}
+	obs_weak_source_release(tap->weak);
+}
+
+bool CaptureHub::attach(obs_source_t *source, uint16_t channels, DitherMode dither, CaptureSink *sink,
+			std::atomic<uint64_t> *preroll_frames)
+{
+	if (preroll_frames)
+		preroll_frames->store(0);
+	if (!source || !sink)
+		return false;
+	const std::string uuid = source_uuid(source);
+	if (uuid.empty())
+		return false;
+	channels = channels ? channels : 2;
+
+	std::lock_guard<std::mutex> lock(mtx_);
+	auto it = taps_.find(uuid);
+	Tap *tap = it != taps_.end() ? it->second.get() : nullptr;
+	if (tap && tap->channels != channels) {
+		blog(LOG_ERROR, "Audio Stems: capture for %s already runs with %u channels, not %u", uuid.c_str(),
+		     (unsigned)tap->channels, (unsigned)channels);
+		return false;
+	}
+	if (!tap)
+		tap = create_tap(source, uuid, channels, dither);
+
+	std::unique_lock<std::mutex> tap_lock(tap->mtx);
+	if (std::find(tap->sinks.begin(), tap->sinks.end(), sink) != tap->sinks.end())
+		return true;
+	const uint64_t preroll = std::min(tap->history_cap, (uint64_t)std::llround(preroll_seconds_ * tap->rate));
+	if (!preroll_frames || !tap->history || preroll == 0) {
+		tap->sinks.push_back(sink);
+		return true;
+	}
+
+	// Only chunk references are taken under the tap lock; the audio thread
+	// is not held up while the pre-roll is copied.
+	HistorySnapshot snap;
+	take_snapshot(*tap, UINT64_MAX, preroll, snap);
+	const uint64_t end_ns = tap->history_end_ns;
+	const uint64_t last_seq = tap->seq;
+	const uint16_t tap_channels = tap->channels;
+	const uint32_t rate = tap->rate;
+	tap_lock.unlock();
+
+	// Replayed as one chunk so it takes a single slot in the sink's queue.
+	auto out = std::make_shared<PcmChunk>();
+	out->frames = (uint32_t)preroll;
+	out->samples.reserve((size_t)preroll * tap_channels);
+	snap.for_each_block([&](const int16_t *samples, size_t frames) {
+		out->samples.insert(out->samples.end(), samples, samples + frames * tap_channels);
+		return true;
+	});
+	for (const auto &c : snap.chunks)
+		out->peak = std::max(out->peak, c->peak);
+	const uint64_t replay_ns = preroll * 1000000000ull / rate;
+	preroll_frames->store(preroll);
+	sink->on_chunk(out, end_ns > replay_ns ? end_ns - replay_ns : 0);
+
+	// Chunks captured while the replay was built are still in the history
+	// ring; hand them over before the sink goes live so none is lost or
+	// delivered twice.
+	tap_lock.lock();
+	bool gap = false;
+	uint64_t next_seq = last_seq + 1;
+	if (tap->history) {
+		tap->history->for_each([&](const HistoryEntry &e) {
+			if (e.seq <= last_seq)
+				return;
+			gap = gap || e.seq != next_seq;
+			next_seq = e.seq + 1;
+			sink->on_chunk(e.chunk, e.timestamp);
+		});
+	}
+	if (gap || next_seq != tap->seq + 1)
+		blog(LOG_WARNING, "Audio Stems: capture for %s lost audio while replaying pre-roll", uuid.c_str());
+	tap->sinks.push_back(sink);
+	return true;
+}
+
+void CaptureHub::detach(const std::string &uuid, CaptureSink *sink)
+{
+	std::unique_ptr<Tap> removed;
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		auto it = taps_.find(uuid);
+		if (it == taps_.end())
+			return;
+		Tap &tap = *it->second;
+		{
+			std::lock_guard<std::mutex> tap_lock(tap.mtx);
+			tap.sinks.erase(std::remove(tap.sinks.begin(), tap.sinks.end(), sink), tap.sinks.end());
+			if (!tap.sinks.empty() || tap.pinned)
+				return;
+		}
+		removed = std::move(it->second);
+		taps_.erase(it);
+	}
+	destroy_tap(std::move(removed));
+}
+
+void CaptureHub::set_history(double seconds, uint32_t sample_rate, uint16_t channels, DitherMode dither,
+			     const std::vector<obs_source_t *> &sources)
+{
+	std::vector<std::unique_ptr<Tap>> removed;
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		sample_rate = sample_rate ? sample_rate : 48000;
+		channels = channels ? channels : 2;
+		const uint64_t cap = (uint64_t)std::llround(std::max(0.0, seconds) * sample_rate);
+
+		std::vector<std::string> wanted;
+		if (cap > 0) {
+			for (obs_source_t *src : sources) {
+				const std::string uuid = source_uuid(src);
+				if (uuid.empty())
+					continue;
+				wanted.push_back(uuid);
+				auto it = taps_.find(uuid);
+				Tap *tap = it != taps_.end() ? it->second.get() : nullptr;
+				if (tap && tap->channels != channels)
+					continue;
+				if (!tap)
+					tap = create_tap(src, uuid, channels, dither);
+				std::lock_guard<std::mutex> tap_lock(tap->mtx);
+				tap->pinned = true;
+				if (tap->history_cap != cap || tap->rate != sample_rate) {
+					const size_t slots = (size_t)(cap / k_min_callback_frames) + 2;
+					tap->history = std::make_unique<SpscQueue<HistoryEntry>>(slots);
+					tap->rate = sample_rate;
+					tap->history_cap = cap;
+					tap->history_frames = 0;
+					tap->history_bytes = 0;
+					tap->history_end_ns = 0;
+					reserve_pool(*tap);
+				}
+			}
+		}
+
+		for (auto it = taps_.begin(); it != taps_.end();) {
+			Tap &tap = *it->second;
+			if (std::find(wanted.begin(), wanted.end(), it->first) != wanted.end()) {
+				++it;
+				continue;
+			}
+			std::lock_guard<std::mutex> tap_lock(tap.mtx);
+			tap.pinned = false;
+			tap.history.reset();
+			tap.history_cap = 0;
+			tap.history_frames = 0;
+			tap.history_bytes = 0;
+			if (tap.sinks.empty()) {
+				removed.push_back(std::move(it->second));
+				it = taps_.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+	for (auto &tap : removed)
+		destroy_tap(std::move(tap));
+}
+
+void CaptureHub::set_preroll_seconds(double seconds)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	preroll_seconds_ = std::max(0.0, seconds);
+}
+
+bool CaptureHub::snapshot(const std::vector<std::string> &uuids, double seconds, std::vector<HistorySnapshot> &out)
+{
+	out.clear();
+	std::lock_guard<std::mutex> lock(mtx_);
+	std::vector<Tap *> taps;
+	uint64_t end_ns = UINT64_MAX;
+	for (const auto &uuid : uuids) {
+		auto it = taps_.find(uuid);
+		if (it == taps_.end())
+			continue;
+		Tap *tap = it->second.get();
+		std::lock_guard<std::mutex> tap_lock(tap->mtx);
+		if (!tap->history || tap->history_end_ns == 0)
+			continue;
+		taps.push_back(tap);
+		end_ns = std::min(end_ns, tap->history_end_ns);
+	}
+	if (taps.empty())
+		return false;
+
+	for (Tap *tap : taps) {
+		std::lock_guard<std::mutex> tap_lock(tap->mtx);
+		const uint64_t frames = std::min(tap->history_cap, (uint64_t)std::llround(seconds * tap->rate));
+		HistorySnapshot snap;
+		take_snapshot(*tap, end_ns, frames, snap);
+		out.push_back(std::move(snap));
+	}
+	return true;
+}
+
+size_t CaptureHub::tap_count()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	return taps_.size();
+}
+
+size_t CaptureHub::history_bytes()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	size_t total = 0;
+	for (auto &it : taps_) {
+		std::lock_guard<std::mutex> tap_lock(it.second->mtx);
+		total += it.second->history_bytes;
+		if (it.second->history)
+			total += it.second->history->capacity() * sizeof(HistoryEntry);
+	}
+	return total;
+}
+
+void CaptureHub::collect_callback_stats(std::unordered_map<std::string, HistogramCounts> &out, Histogram *total)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	for (auto &it : taps_) {
+		it.second->callback_ns.copy_to(out[it.first]);
+		if (total)
+			total->merge_from(it.second->callback_ns);
+	}
+}
+
+void CaptureHub::reserve_pool(Tap &tap)
+{
+	tap.pool.reserve((tap.history ? tap.history->capacity() : 0) + k_pool_headroom);
+}
+
+std::shared_ptr<PcmChunk> CaptureHub::take_chunk(Tap &tap)
+{
+	// History drops chunks oldest first, so the slot after the last one
+	// taken is usually free.
+	const size_t n = tap.pool.size();
+	for (size_t i = 0; i < n; i++) {
+		const size_t slot = (tap.pool_next + i) % n;
+		if (tap.pool[slot].use_count() != 1)
+			continue;
+		// Pairs with the release in the last holder dropping its reference.
+		std::atomic_thread_fence(std::memory_order_acquire);
+		tap.pool_next = (slot + 1) % n;
+		return tap.pool[slot];
+	}
+	auto chunk = std::make_shared<PcmChunk>();
+	chunk->samples.reserve(k_max_callback_frames * tap.channels);
+	if (tap.pool.size() < tap.pool.capacity())
+		tap.pool.push_back(chunk);
+	return chunk;
+}
+
+void CaptureHub::push_history(Tap &tap, const ChunkPtr &chunk, uint64_t timestamp)
+{
+	auto &ring = *tap.history;
+	const bool shared_silence = chunk->peak == 0.0f;
+	auto drop_oldest = [&]() {
+		HistoryEntry old;
+		if (!ring.try_pop(old))
+			return false;
+		tap.history_frames -= old.chunk->frames;
+		if (old.chunk->peak != 0.0f)
+			tap.history_bytes -= old.chunk->samples.size() * sizeof(int16_t);
+		return true;
+	};
+
+	if (ring.full())
+		drop_oldest();
+	HistoryEntry entry{chunk, timestamp, ++tap.seq};
+	if (!ring.try_push(std::move(entry)))
+		return;
+	tap.history_frames += chunk->frames;
+	if (!shared_silence)
+		tap.history_bytes += chunk->samples.size() * sizeof(int16_t);
+	tap.history_end_ns = timestamp + (uint64_t)chunk->frames * 1000000000ull / tap.rate;
+
+	// Keep just enough chunks to cover the configured length.
+	while (const HistoryEntry *oldest = ring.peek()) {
+		if (tap.history_frames - oldest->chunk->frames < tap.history_cap || !drop_oldest())
+			break;
+	}
+}
+
+void CaptureHub::take_snapshot(Tap &tap, uint64_t end_ns, uint64_t frames, HistorySnapshot &out)
+{
+	out.uuid = tap.uuid;
+	out.channels = tap.channels;
+	out.frames = frames;
+	out.chunks.clear();
+
+	uint64_t available = 0;
+	tap.history->for_each([&](const HistoryEntry &e) {
+		if (e.timestamp >= end_ns)
+			return;
+		const uint64_t until_end = (end_ns - e.timestamp) * tap.rate / 1000000000ull;
+		available += std::min<uint64_t>(e.chunk->frames, until_end);
+		out.chunks.push_back(e.chunk);
+	});
+	// The newest chunk may run past end_ns; for_each_block stops at `frames`.
+	if (available >= frames) {
+		out.pad_frames = 0;
+		out.skip_frames = available - frames;
+	} else {
+		out.pad_frames = frames - available;
+		out.skip_frames = 0;
+	}
+}
+
+void CaptureHub::audio_cb(void *param, obs_source_t *, const struct audio_data *audio, bool muted)
+{
+	auto *tap = static_cast<Tap *>(param);
+	if (!tap || !audio || audio->frames == 0)
+		return;
+
+	const uint64_t begin_ns = os_gettime_ns();
+	trace::Scope span("audio_callback", "capture");
+	std::lock_guard<std::mutex> lock(tap->mtx);
+	if (tap->sinks.empty() && !tap->history)
+		return;
+
+	const uint32_t frames = audio->frames;
+	const float *planes[MAX_AV_PLANES] = {};
+	float peak = 0.0f;
+	for (uint16_t ch = 0; ch < tap->channels && ch < MAX_AV_PLANES; ch++) {
+		planes[ch] = muted ? nullptr : reinterpret_cast<const float *>(audio->data[ch]);
+		if (planes[ch])
+			peak = std::max(peak, dsp::abs_max_f32(planes[ch], frames));
+	}
+
+	// Digital silence converts to all zeros; share one chunk per buffer size
+	// so silent stretches cost no memory in the history ring.
+	ChunkPtr shared;
+	if (peak == 0.0f) {
+		ChunkPtr &cached = tap->silence[frames];
+		if (!cached) {
+			auto zero = std::make_shared<PcmChunk>();
+			zero->frames = frames;
+			zero->samples.assign((size_t)frames * tap->channels, 0);
+			cached = std::move(zero);
+		}
+		shared = cached;
+	} else {
+		std::shared_ptr<PcmChunk> chunk = take_chunk(*tap);
+		chunk->frames = frames;
+		chunk->peak = peak;
+		chunk->samples.resize((size_t)frames * tap->channels);
+		tap->dither.quantize_s16(planes, frames, chunk->samples.data());
+		shared = std::move(chunk);
+	}
+
+	for (CaptureSink *sink : tap->sinks)
+		sink->on_chunk(shared, audio->timestamp);
+	if (tap->history)
+		push_history(*tap, shared, audio->timestamp);
+	tap->callback_ns.record(os_gettime_ns() - begin_ns);
+}
+
+}
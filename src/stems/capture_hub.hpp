@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <obs-module.h>
+
+#include "audio_source.hpp"
+#include "dither.hpp"
+#include "histogram.hpp"
+#include "spsc_queue.hpp"
+
+namespace stems {
+
+// One audio capture callback per source, keyed by source UUID. The callback
+// converts each buffer once and hands the same chunk to every attached sink,
+// so a source recorded by several sessions costs one conversion.
+//
+// Sources passed to set_history() stay captured with no sinks attached and
+// keep their last seconds of audio. New sinks get the pre-roll part of it
+// replayed first; snapshot() hands out aligned windows for replay saves.
+class CaptureHub {
+public:
+	CaptureHub() = default;
+	~CaptureHub();
+	CaptureHub(const CaptureHub &) = delete;
+	CaptureHub &operator=(const CaptureHub &) = delete;
+
+	// preroll_frames is set, before the sink sees any chunk, to how much
+	// audio is replayed ahead of live chunks; it is always the full pre-roll length, zero-padded if the
+	// source has not been captured for that long. Pass null to attach
+	// without replaying any history.
+	bool attach(obs_source_t *source, uint16_t channels, DitherMode dither, CaptureSink *sink,
+		    std::atomic<uint64_t> *preroll_frames = nullptr);
+	void detach(const std::string &uuid, CaptureSink *sink);
+
+	// Replaces the set of always-captured sources; seconds <= 0 turns it off.
+	void set_history(double seconds, uint32_t sample_rate, uint16_t channels, DitherMode dither,
+			 const std::vector<obs_source_t *> &sources);
+	void set_preroll_seconds(double seconds);
+
+	// Windows ending at the same instant on every listed source that has
+	// history; returns false when none has.
+	bool snapshot(const std::vector<std::string> &uuids, double seconds, std::vector<HistorySnapshot> &out);
+
+	size_t tap_count();
+	size_t history_bytes();
+	// Time spent in each source's audio callback, keyed by source UUID.
+	void collect_callback_stats(std::unordered_map<std::string, HistogramCounts> &out, Histogram *total);
+
+private:
+	struct HistoryEntry {
+		ChunkPtr chunk;
+		uint64_t timestamp = 0;
+		uint64_t seq = 0;
+	};
+
+	struct Tap {
+		obs_weak_source_t *weak = nullptr;
+		std::string uuid;
+		uint16_t channels = 2;
+		Ditherer dither;
+		std::mutex mtx;
+		std::vector<CaptureSink *> sinks;
+
+		bool pinned = false;
+		uint32_t rate = 48000;
+		uint64_t history_cap = 0;
+		uint64_t history_frames = 0;
+		size_t history_bytes = 0;
+		uint64_t history_end_ns = 0;
+		// Numbers chunks pushed to history, for handing live chunks over
+		// after a pre-roll replay.
+		uint64_t seq = 0;
+		std::unique_ptr<SpscQueue<HistoryEntry>> history;
+		std::unordered_map<uint32_t, ChunkPtr> silence;
+		// Chunks handed out by the callback, reused once the pool holds the
+		// only reference, so a warm tap neither allocates nor frees. Never
+		// grows past its reserved capacity.
+		std::vector<std::shared_ptr<PcmChunk>> pool;
+		size_t pool_next = 0;
+		Histogram callback_ns;
+	};
+
+	static void audio_cb(void *param, obs_source_t *source, const struct audio_data *audio, bool muted);
+	static void reserve_pool(Tap &tap);
+	static std::shared_ptr<PcmChunk> take_chunk(Tap &tap);
+	static void push_history(Tap &tap, const ChunkPtr &chunk, uint64_t timestamp);
+	static void take_snapshot(Tap &tap, uint64_t end_ns, uint64_t frames, HistorySnapshot &out);
+
+	Tap *create_tap(obs_source_t *source, const std::string &uuid, uint16_t channels, DitherMode dither);
+	static void destroy_tap(std::unique_ptr<Tap> tap);
+
+	std::mutex mtx_;
+	std::unordered_map<std::string, std::unique_ptr<Tap>> taps_;
+	double preroll_seconds_ = 0.0;
+};
+
+// An OBS source as an AudioSource. Holds a strong reference to it for as
+// long as it exists.
+class HubSource : public AudioSource {
+public:
+	// Null when the source is gone or has no UUID.
+	static std::unique_ptr<HubSource> create(CaptureHub &hub, obs_source_t *source);
+	~HubSource() override;
+	HubSource(const HubSource &) = delete;
+	HubSource &operator=(const HubSource &) = delete;
+
+	const std::string &uuid() const override { return uuid_; }
+	const std::string &name() const override { return name_; }
+	bool attach(CaptureSink *sink, uint16_t channels, DitherMode dither,
+		    std::atomic<uint64_t> *preroll_frames) override;
+	void detach(CaptureSink *sink) override;
+
+private:
+	HubSource(CaptureHub &hub, obs_source_t *source);
+
+	CaptureHub &hub_;
+	obs_source_t *source_ = nullptr;
+	std::string uuid_;
+	std::string name_;
+};
+
+}
@@ -0,0 +1,87 @@
+#include "dither.hpp"
+
+#include "dsp.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace stems {
+
+DitherMode dither_mode_from_string(const std::string &name)
+{
+	if (name == "tpdf")
+		return DitherMode::Tpdf;
+	if (name == "shaped")
+		return DitherMode::Shaped;
+	return DitherMode::Off;
+}
+
+static inline uint64_t splitmix64(uint64_t &x)
+{
+	uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+static inline int16_t round_s16(float v)
+{
+	const long x = lrintf(v);
+	return (int16_t)std::clamp<long>(x, -32768, 32767);
+}
+
+void Ditherer::reset(uint16_t channels, DitherMode mode, uint64_t seed)
+{
+	channels_ = channels ? channels : 2;
+	mode_ = mode;
+	for (uint32_t &s : state_) {
+		s = (uint32_t)splitmix64(seed);
+		if (s == 0)
+			s = 0x6d2b79f5u;
+	}
+	error_.assign(channels_, 0.0f);
+}
+
+void Ditherer::quantize_s16(const float *const *planes, size_t frames, int16_t *interleaved)
+{
+	const float scale = 32767.0f;
+	if (mode_ != DitherMode::Off && noise_.size() < frames)
+		noise_.resize(frames);
+
+	for (uint16_t c = 0; c < channels_; c++) {
+		const float *p = planes[c];
+		int16_t *out = interleaved + c;
+		if (!p || dsp::abs_max_f32(p, frames) == 0.0f) {
+			for (size_t i = 0; i < frames; i++)
+				out[i * channels_] = 0;
+			error_[c] = 0.0f;
+			continue;
+		}
+
+		switch (mode_) {
+		case DitherMode::Off:
+			for (size_t i = 0; i < frames; i++)
+				out[i * channels_] = round_s16(std::clamp(p[i], -1.0f, 1.0f) * scale);
+			break;
+		case DitherMode::Tpdf:
+			dsp::tpdf_noise_f32(state_, noise_.data(), frames);
+			for (size_t i = 0; i < frames; i++)
+				out[i * channels_] = round_s16(std::clamp(p[i], -1.0f, 1.0f) * scale + noise_[i]);
+			break;
+		case DitherMode::Shaped: {
+			dsp::tpdf_noise_f32(state_, noise_.data(), frames);
+			float err = error_[c];
+			for (size_t i = 0; i < frames; i++) {
+				const float want = std::clamp(p[i], -1.0f, 1.0f) * scale - err;
+				const int16_t q = round_s16(want + noise_[i]);
+				out[i * channels_] = q;
+				err = std::clamp((float)q - want, -2.0f, 2.0f);
+			}
+			error_[c] = err;
+			break;
+		}
+		}
+	}
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace stems {
+
+enum class DitherMode {
+	Off,
+	Tpdf,
+	Shaped,
+};
+
+DitherMode dither_mode_from_string(const std::string &name);
+
+// Float to 16-bit conversion for the capture path. Tpdf adds +/-1 LSB
+// triangular noise before rounding; Shaped also feeds the rounding error
+// back through a first-order filter, pushing the noise towards high
+// frequencies. Digital silence stays exactly zero.
+class Ditherer {
+public:
+	void reset(uint16_t channels, DitherMode mode, uint64_t seed);
+
+	// Null planes are written as silence.
+	void quantize_s16(const float *const *planes, size_t frames, int16_t *interleaved);
+
+private:
+	uint16_t channels_ = 2;
+	DitherMode mode_ = DitherMode::Off;
+	uint32_t state_[8] = {};
+	std::vector<float> noise_;
+	std::vector<float> error_;
+};
+
+}
@@ -0,0 +1,1041 @@
+#include "dsp.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define STEMS_DSP_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define STEMS_AVX2_TARGET
+#else
+#define STEMS_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#else
+#define STEMS_DSP_X86 0
+#endif
+
+namespace stems {
+namespace dsp {
+
+static const size_t k_s24_chunk = 1024;
+
+static SimdLevel detect_simd_level()
+{
+#if STEMS_DSP_X86
+	SimdLevel level = SimdLevel::Sse2;
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4] = {};
+	__cpuid(info, 0);
+	if (info[0] >= 7) {
+		__cpuid(info, 1);
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		if (osxsave && avx && (_xgetbv(0) & 6) == 6) {
+			__cpuidex(info, 7, 0);
+			if (info[1] & (1 << 5))
+				level = SimdLevel::Avx2;
+		}
+	}
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		level = SimdLevel::Avx2;
+#endif
+#else
+	SimdLevel level = SimdLevel::Scalar;
+#endif
+
+	const char *cap = std::getenv("AUDIO_STEMS_SIMD");
+	if (cap && std::strcmp(cap, "scalar") == 0)
+		level = SimdLevel::Scalar;
+	else if (cap && std::strcmp(cap, "sse2") == 0 && level == SimdLevel::Avx2)
+		level = SimdLevel::Sse2;
+	return level;
+}
+
+SimdLevel simd_level()
+{
+	static const SimdLevel level = detect_simd_level();
+	return level;
+}
+
+const char *simd_level_name(SimdLevel level)
+{
+	switch (level) {
+	case SimdLevel::Avx2:
+		return "avx2";
+	case SimdLevel::Sse2:
+		return "sse2";
+	default:
+		return "scalar";
+	}
+}
+
+static inline int32_t load_s24(const uint8_t *p)
+{
+	return (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) >> 8;
+}
+
+static inline void decode_s24(const uint8_t *v, size_t n, int32_t *out)
+{
+	for (size_t i = 0; i < n; i++)
+		out[i] = load_s24(v + i * 3);
+}
+
+/* ------------------------------------------------------------------------- */
+/* scalar                                                                    */
+
+static int32_t abs_max_s16_scalar(const int16_t *v, size_t n)
+{
+	int32_t m = 0;
+	for (size_t i = 0; i < n; i++) {
+		const int32_t x = v[i];
+		m = std::max(m, x < 0 ? -x : x);
+	}
+	return m;
+}
+
+static int32_t abs_max_s32_scalar(const int32_t *v, size_t n)
+{
+	int32_t m = 0;
+	for (size_t i = 0; i < n; i++) {
+		const int32_t x = v[i];
+		m = std::max(m, x < 0 ? -x : x);
+	}
+	return m;
+}
+
+static float abs_max_f32_scalar(const float *v, size_t n)
+{
+	float m = 0.0f;
+	for (size_t i = 0; i < n; i++)
+		m = std::max(m, std::fabs(v[i]));
+	return m;
+}
+
+static uint64_t sum_squares_s16_scalar(const int16_t *v, size_t n)
+{
+	uint64_t acc = 0;
+	for (size_t i = 0; i < n; i++) {
+		const int32_t x = v[i];
+		acc += (uint32_t)(x * x);
+	}
+	return acc;
+}
+
+// Decoded s24 samples; exact while n * 2^46 fits, i.e. for a k_s24_chunk.
+static uint64_t sum_squares_s32_scalar(const int32_t *v, size_t n)
+{
+	uint64_t acc = 0;
+	for (size_t i = 0; i < n; i++) {
+		const int64_t x = v[i];
+		acc += (uint64_t)(x * x);
+	}
+	return acc;
+}
+
+static void sum_squares_f32_lanes(const float *v, size_t begin, size_t n, double lanes[8])
+{
+	for (size_t i = begin; i < n; i++) {
+		const double x = v[i];
+		lanes[(i - begin) & 7] += x * x;
+	}
+}
+
+static double reduce_lanes(const double lanes[8])
+{
+	return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+static void dot_f32_lanes(const float *a, const float *b, size_t begin, size_t n, float lanes[8])
+{
+	for (size_t i = begin; i < n; i++)
+		lanes[(i - begin) & 7] += a[i] * b[i];
+}
+
+static float reduce_lanes_f32(const float lanes[8])
+{
+	return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+static void mix_add_f32_scalar(float *dst, const float *src, float gain, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		dst[i] += src[i] * gain;
+}
+
+static inline uint32_t xorshift32(uint32_t x)
+{
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+static inline float tpdf_from_bits(uint32_t x)
+{
+	return (float)((int32_t)(x >> 16) - (int32_t)(x & 0xffff)) * (1.0f / 65536.0f);
+}
+
+static void tpdf_noise_f32_scalar(uint32_t state[8], float *out, size_t n)
+{
+	for (size_t i = 0; i < n; i += 8) {
+		const size_t count = std::min<size_t>(8, n - i);
+		for (size_t k = 0; k < 8; k++) {
+			state[k] = xorshift32(state[k]);
+			if (k < count)
+				out[i + k] = tpdf_from_bits(state[k]);
+		}
+	}
+}
+
+static size_t find_first_above_s16_scalar(const int16_t *v, size_t n, int32_t thr)
+{
+	for (size_t i = 0; i < n; i++) {
+		const int32_t x = v[i];
+		if ((x < 0 ? -x : x) >= thr)
+			return i;
+	}
+	return n;
+}
+
+static size_t find_last_above_s16_scalar(const int16_t *v, size_t n, int32_t thr)
+{
+	for (size_t i = n; i-- > 0;) {
+		const int32_t x = v[i];
+		if ((x < 0 ? -x : x) >= thr)
+			return i;
+	}
+	return n;
+}
+
+static size_t find_first_above_s32_scalar(const int32_t *v, size_t n, int32_t thr)
+{
+	for (size_t i = 0; i < n; i++) {
+		const int32_t x = v[i];
+		if ((x < 0 ? -x : x) >= thr)
+			return i;
+	}
+	return n;
+}
+
+static size_t find_last_above_s32_scalar(const int32_t *v, size_t n, int32_t thr)
+{
+	for (size_t i = n; i-- > 0;) {
+		const int32_t x = v[i];
+		if ((x < 0 ? -x : x) >= thr)
+			return i;
+	}
+	return n;
+}
+
+static size_t find_first_above_f32_scalar(const float *v, size_t n, float thr)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (std::fabs(v[i]) >= thr)
+			return i;
+	}
+	return n;
+}
+
+static size_t find_last_above_f32_scalar(const float *v, size_t n, float thr)
+{
+	for (size_t i = n; i-- > 0;) {
+		if (std::fabs(v[i]) >= thr)
+			return i;
+	}
+	return n;
+}
+
+#if STEMS_DSP_X86
+
+static inline unsigned lowest_bit(uint32_t mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long idx = 0;
+	_BitScanForward(&idx, mask);
+	return (unsigned)idx;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+static inline unsigned highest_bit(uint32_t mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long idx = 0;
+	_BitScanReverse(&idx, mask);
+	return (unsigned)idx;
+#else
+	return 31u - (unsigned)__builtin_clz(mask);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+/* sse2                                                                      */
+
+static int32_t abs_max_s16_sse2(const int16_t *v, size_t n)
+{
+	__m128i vmax = _mm_setzero_si128();
+	__m128i vmin = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i));
+		vmax = _mm_max_epi16(vmax, x);
+		vmin = _mm_min_epi16(vmin, x);
+	}
+	alignas(16) int16_t hi[8];
+	alignas(16) int16_t lo[8];
+	_mm_store_si128(reinterpret_cast<__m128i *>(hi), vmax);
+	_mm_store_si128(reinterpret_cast<__m128i *>(lo), vmin);
+	int32_t m = 0;
+	for (int k = 0; k < 8; k++)
+		m = std::max(m, std::max((int32_t)hi[k], -(int32_t)lo[k]));
+	return std::max(m, abs_max_s16_scalar(v + i, n - i));
+}
+
+static inline __m128i abs_epi32_sse2(__m128i x)
+{
+	const __m128i sign = _mm_srai_epi32(x, 31);
+	return _mm_sub_epi32(_mm_xor_si128(x, sign), sign);
+}
+
+static int32_t abs_max_s32_sse2(const int32_t *v, size_t n)
+{
+	__m128i m = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128i a = abs_epi32_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i)));
+		const __m128i gt = _mm_cmpgt_epi32(a, m);
+		m = _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, m));
+	}
+	alignas(16) int32_t lanes[4];
+	_mm_store_si128(reinterpret_cast<__m128i *>(lanes), m);
+	int32_t r = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+	return std::max(r, abs_max_s32_scalar(v + i, n - i));
+}
+
+static uint64_t sum_squares_s32_sse2(const int32_t *v, size_t n)
+{
+	__m128i acc = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		// SSE2 only multiplies unsigned; squares of |x| are the same.
+		const __m128i a = abs_epi32_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i)));
+		acc = _mm_add_epi64(acc, _mm_mul_epu32(a, a));
+		const __m128i odd = _mm_srli_epi64(a, 32);
+		acc = _mm_add_epi64(acc, _mm_mul_epu32(odd, odd));
+	}
+	alignas(16) uint64_t lanes[2];
+	_mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+	return lanes[0] + lanes[1] + sum_squares_s32_scalar(v + i, n - i);
+}
+
+static float abs_max_f32_sse2(const float *v, size_t n)
+{
+	const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 m = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		m = _mm_max_ps(m, _mm_and_ps(_mm_loadu_ps(v + i), mask));
+	alignas(16) float lanes[4];
+	_mm_store_ps(lanes, m);
+	float r = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+	return std::max(r, abs_max_f32_scalar(v + i, n - i));
+}
+
+static uint64_t sum_squares_s16_sse2(const int16_t *v, size_t n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i));
+		// Pair sums are at most 2^31 and therefore exact as unsigned 32-bit.
+		const __m128i sq = _mm_madd_epi16(x, x);
+		acc = _mm_add_epi64(acc, _mm_add_epi64(_mm_unpacklo_epi32(sq, zero), _mm_unpackhi_epi32(sq, zero)));
+	}
+	alignas(16) uint64_t lanes[2];
+	_mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+	return lanes[0] + lanes[1] + sum_squares_s16_scalar(v + i, n - i);
+}
+
+static double sum_squares_f32_sse2(const float *v, size_t n)
+{
+	__m128d a0 = _mm_setzero_pd();
+	__m128d a1 = _mm_setzero_pd();
+	__m128d a2 = _mm_setzero_pd();
+	__m128d a3 = _mm_setzero_pd();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128 x0 = _mm_loadu_ps(v + i);
+		const __m128 x1 = _mm_loadu_ps(v + i + 4);
+		const __m128d d0 = _mm_cvtps_pd(x0);
+		const __m128d d1 = _mm_cvtps_pd(_mm_movehl_ps(x0, x0));
+		const __m128d d2 = _mm_cvtps_pd(x1);
+		const __m128d d3 = _mm_cvtps_pd(_mm_movehl_ps(x1, x1));
+		a0 = _mm_add_pd(a0, _mm_mul_pd(d0, d0));
+		a1 = _mm_add_pd(a1, _mm_mul_pd(d1, d1));
+		a2 = _mm_add_pd(a2, _mm_mul_pd(d2, d2));
+		a3 = _mm_add_pd(a3, _mm_mul_pd(d3, d3));
+	}
+	alignas(16) double lanes[8];
+	_mm_store_pd(lanes + 0, a0);
+	_mm_store_pd(lanes + 2, a1);
+	_mm_store_pd(lanes + 4, a2);
+	_mm_store_pd(lanes + 6, a3);
+	sum_squares_f32_lanes(v, i, n, lanes);
+	return reduce_lanes(lanes);
+}
+
+static float dot_f32_sse2(const float *a, const float *b, size_t n)
+{
+	__m128 a0 = _mm_setzero_ps();
+	__m128 a1 = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	alignas(16) float lanes[8];
+	_mm_store_ps(lanes + 0, a0);
+	_mm_store_ps(lanes + 4, a1);
+	dot_f32_lanes(a, b, i, n, lanes);
+	return reduce_lanes_f32(lanes);
+}
+
+static void mix_add_f32_sse2(float *dst, const float *src, float gain, size_t n)
+{
+	const __m128 g = _mm_set1_ps(gain);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+	mix_add_f32_scalar(dst + i, src + i, gain, n - i);
+}
+
+static inline __m128i xorshift32_sse2(__m128i x)
+{
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+	return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+static inline __m128 tpdf_from_bits_sse2(__m128i x)
+{
+	const __m128i hi = _mm_srli_epi32(x, 16);
+	const __m128i lo = _mm_and_si128(x, _mm_set1_epi32(0xffff));
+	return _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(hi, lo)), _mm_set1_ps(1.0f / 65536.0f));
+}
+
+static void tpdf_noise_f32_sse2(uint32_t state[8], float *out, size_t n)
+{
+	__m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state));
+	__m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state + 4));
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		s0 = xorshift32_sse2(s0);
+		s1 = xorshift32_sse2(s1);
+		_mm_storeu_ps(out + i, tpdf_from_bits_sse2(s0));
+		_mm_storeu_ps(out + i + 4, tpdf_from_bits_sse2(s1));
+	}
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(state), s0);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(state + 4), s1);
+	tpdf_noise_f32_scalar(state, out + i, n - i);
+}
+
+static size_t find_first_above_s16_sse2(const int16_t *v, size_t n, int32_t thr)
+{
+	const __m128i hi = _mm_set1_epi16((int16_t)(thr - 1));
+	const __m128i lo = _mm_set1_epi16((int16_t)(1 - thr));
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i));
+		const __m128i hit = _mm_or_si128(_mm_cmpgt_epi16(x, hi), _mm_cmplt_epi16(x, lo));
+		const uint32_t mask = (uint32_t)_mm_movemask_epi8(hit);
+		if (mask)
+			return i + lowest_bit(mask) / 2;
+	}
+	const size_t r = find_first_above_s16_scalar(v + i, n - i, thr);
+	return r == n - i ? n : i + r;
+}
+
+static size_t find_last_above_s16_sse2(const int16_t *v, size_t n, int32_t thr)
+{
+	const __m128i hi = _mm_set1_epi16((int16_t)(thr - 1));
+	const __m128i lo = _mm_set1_epi16((int16_t)(1 - thr));
+	size_t end = n;
+	const size_t tail = n % 8;
+	if (tail) {
+		const size_t r = find_last_above_s16_scalar(v + n - tail, tail, thr);
+		if (r != tail)
+			return n - tail + r;
+		end -= tail;
+	}
+	while (end >= 8) {
+		end -= 8;
+		const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(v + end));
+		const __m128i hit = _mm_or_si128(_mm_cmpgt_epi16(x, hi), _mm_cmplt_epi16(x, lo));
+		const uint32_t mask = (uint32_t)_mm_movemask_epi8(hit);
+		if (mask)
+			return end + highest_bit(mask) / 2;
+	}
+	return n;
+}
+
+static size_t find_first_above_s32_sse2(const int32_t *v, size_t n, int32_t thr)
+{
+	const __m128i t = _mm_set1_epi32(thr - 1);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128i a = abs_epi32_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i)));
+		const uint32_t mask = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a, t)));
+		if (mask)
+			return i + lowest_bit(mask);
+	}
+	const size_t r = find_first_above_s32_scalar(v + i, n - i, thr);
+	return r == n - i ? n : i + r;
+}
+
+static size_t find_last_above_s32_sse2(const int32_t *v, size_t n, int32_t thr)
+{
+	const __m128i t = _mm_set1_epi32(thr - 1);
+	size_t end = n;
+	const size_t tail = n % 4;
+	if (tail) {
+		const size_t r = find_last_above_s32_scalar(v + n - tail, tail, thr);
+		if (r != tail)
+			return n - tail + r;
+		end -= tail;
+	}
+	while (end >= 4) {
+		end -= 4;
+		const __m128i a = abs_epi32_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(v + end)));
+		const uint32_t mask = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a, t)));
+		if (mask)
+			return end + highest_bit(mask);
+	}
+	return n;
+}
+
+static size_t find_first_above_f32_sse2(const float *v, size_t n, float thr)
+{
+	const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 t = _mm_set1_ps(thr);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128 a = _mm_and_ps(_mm_loadu_ps(v + i), mask);
+		const uint32_t hit = (uint32_t)_mm_movemask_ps(_mm_cmpge_ps(a, t));
+		if (hit)
+			return i + lowest_bit(hit);
+	}
+	const size_t r = find_first_above_f32_scalar(v + i, n - i, thr);
+	return r == n - i ? n : i + r;
+}
+
+static size_t find_last_above_f32_sse2(const float *v, size_t n, float thr)
+{
+	const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 t = _mm_set1_ps(thr);
+	size_t end = n;
+	const size_t tail = n % 4;
+	if (tail) {
+		const size_t r = find_last_above_f32_scalar(v + n - tail, tail, thr);
+		if (r != tail)
+			return n - tail + r;
+		end -= tail;
+	}
+	while (end >= 4) {
+		end -= 4;
+		const __m128 a = _mm_and_ps(_mm_loadu_ps(v + end), mask);
+		const uint32_t hit = (uint32_t)_mm_movemask_ps(_mm_cmpge_ps(a, t));
+		if (hit)
+			return end + highest_bit(hit);
+	}
+	return n;
+}
+
+/* ------------------------------------------------------------------------- */
+/* avx2                                                                      */
+
+STEMS_AVX2_TARGET static int32_t abs_max_s16_avx2(const int16_t *v, size_t n)
+{
+	__m256i m = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i));
+		// abs(-32768) wraps to 0x8000, which is 32768 when compared unsigned.
+		m = _mm256_max_epu16(m, _mm256_abs_epi16(x));
+	}
+	alignas(32) uint16_t lanes[16];
+	_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), m);
+	int32_t r = 0;
+	for (int k = 0; k < 16; k++)
+		r = std::max(r, (int32_t)lanes[k]);
+	return std::max(r, abs_max_s16_scalar(v + i, n - i));
+}
+
+STEMS_AVX2_TARGET static int32_t abs_max_s32_avx2(const int32_t *v, size_t n)
+{
+	__m256i m = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		m = _mm256_max_epi32(m, _mm256_abs_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i))));
+	alignas(32) int32_t lanes[8];
+	_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), m);
+	int32_t r = 0;
+	for (int k = 0; k < 8; k++)
+		r = std::max(r, lanes[k]);
+	return std::max(r, abs_max_s32_scalar(v + i, n - i));
+}
+
+STEMS_AVX2_TARGET static uint64_t sum_squares_s32_avx2(const int32_t *v, size_t n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i));
+		acc = _mm256_add_epi64(acc, _mm256_mul_epi32(x, x));
+		const __m256i odd = _mm256_srli_epi64(x, 32);
+		acc = _mm256_add_epi64(acc, _mm256_mul_epi32(odd, odd));
+	}
+	alignas(32) uint64_t lanes[4];
+	_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_squares_s32_scalar(v + i, n - i);
+}
+
+// Unpacks four s24 samples from the low 12 bytes into the top of each
+// dword; an arithmetic shift then sign-extends them.
+STEMS_AVX2_TARGET static inline __m256i load_s24x8_avx2(const uint8_t *p)
+{
+	const __m256i shuffle = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2,
+						 -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+	const __m256i raw = _mm256_inserti128_si256(
+		_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))),
+		_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 12)), 1);
+	return _mm256_srai_epi32(_mm256_shuffle_epi8(raw, shuffle), 8);
+}
+
+STEMS_AVX2_TARGET static double sum_squares_s24_avx2(const uint8_t *v, size_t n)
+{
+	double total = 0.0;
+	for (size_t base = 0; base < n; base += k_s24_chunk) {
+		const size_t count = std::min(k_s24_chunk, n - base);
+		const uint8_t *p = v + base * 3;
+		__m256i acc = _mm256_setzero_si256();
+		size_t i = 0;
+		// The second 16-byte load reads 4 bytes past its samples.
+		for (; i + 8 <= count && (base + i + 10) <= n; i += 8) {
+			const __m256i x = load_s24x8_avx2(p + i * 3);
+			acc = _mm256_add_epi64(acc, _mm256_mul_epi32(x, x));
+			const __m256i odd = _mm256_srli_epi64(x, 32);
+			acc = _mm256_add_epi64(acc, _mm256_mul_epi32(odd, odd));
+		}
+		alignas(32) uint64_t lanes[4];
+		_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc);
+		uint64_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		for (; i < count; i++) {
+			const int64_t x = load_s24(p + i * 3);
+			sum += (uint64_t)(x * x);
+		}
+		total += (double)sum;
+	}
+	return total;
+}
+
+STEMS_AVX2_TARGET static float abs_max_f32_avx2(const float *v, size_t n)
+{
+	const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 m = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		m = _mm256_max_ps(m, _mm256_and_ps(_mm256_loadu_ps(v + i), mask));
+	alignas(32) float lanes[8];
+	_mm256_store_ps(lanes, m);
+	float r = 0.0f;
+	for (int k = 0; k < 8; k++)
+		r = std::max(r, lanes[k]);
+	return std::max(r, abs_max_f32_scalar(v + i, n - i));
+}
+
+STEMS_AVX2_TARGET static uint64_t sum_squares_s16_avx2(const int16_t *v, size_t n)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i));
+		const __m256i sq = _mm256_madd_epi16(x, x);
+		acc = _mm256_add_epi64(acc, _mm256_add_epi64(_mm256_unpacklo_epi32(sq, zero),
+							     _mm256_unpackhi_epi32(sq, zero)));
+	}
+	alignas(32) uint64_t lanes[4];
+	_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_squares_s16_scalar(v + i, n - i);
+}
+
+STEMS_AVX2_TARGET static double sum_squares_f32_avx2(const float *v, size_t n)
+{
+	__m256d a0 = _mm256_setzero_pd();
+	__m256d a1 = _mm256_setzero_pd();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256d d0 = _mm256_cvtps_pd(_mm_loadu_ps(v + i));
+		const __m256d d1 = _mm256_cvtps_pd(_mm_loadu_ps(v + i + 4));
+		a0 = _mm256_add_pd(a0, _mm256_mul_pd(d0, d0));
+		a1 = _mm256_add_pd(a1, _mm256_mul_pd(d1, d1));
+	}
+	alignas(32) double lanes[8];
+	_mm256_store_pd(lanes + 0, a0);
+	_mm256_store_pd(lanes + 4, a1);
+	sum_squares_f32_lanes(v, i, n, lanes);
+	return reduce_lanes(lanes);
+}
+
+STEMS_AVX2_TARGET static float dot_f32_avx2(const float *a, const float *b, size_t n)
+{
+	__m256 acc = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+	alignas(32) float lanes[8];
+	_mm256_store_ps(lanes, acc);
+	dot_f32_lanes(a, b, i, n, lanes);
+	return reduce_lanes_f32(lanes);
+}
+
+STEMS_AVX2_TARGET static void mix_add_f32_avx2(float *dst, const float *src, float gain, size_t n)
+{
+	const __m256 g = _mm256_set1_ps(gain);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), g)));
+	mix_add_f32_scalar(dst + i, src + i, gain, n - i);
+}
+
+STEMS_AVX2_TARGET static void tpdf_noise_f32_avx2(uint32_t state[8], float *out, size_t n)
+{
+	__m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state));
+	const __m256i mask = _mm256_set1_epi32(0xffff);
+	const __m256 scale = _mm256_set1_ps(1.0f / 65536.0f);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 13));
+		s = _mm256_xor_si256(s, _mm256_srli_epi32(s, 17));
+		s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 5));
+		const __m256i d = _mm256_sub_epi32(_mm256_srli_epi32(s, 16), _mm256_and_si256(s, mask));
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(d), scale));
+	}
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(state), s);
+	tpdf_noise_f32_scalar(state, out + i, n - i);
+}
+
+STEMS_AVX2_TARGET static size_t find_first_above_s16_avx2(const int16_t *v, size_t n, int32_t thr)
+{
+	const __m256i hi = _mm256_set1_epi16((int16_t)(thr - 1));
+	const __m256i lo = _mm256_set1_epi16((int16_t)(1 - thr));
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i));
+		const __m256i hit = _mm256_or_si256(_mm256_cmpgt_epi16(x, hi), _mm256_cmpgt_epi16(lo, x));
+		const uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+		if (mask)
+			return i + lowest_bit(mask) / 2;
+	}
+	const size_t r = find_first_above_s16_scalar(v + i, n - i, thr);
+	return r == n - i ? n : i + r;
+}
+
+STEMS_AVX2_TARGET static size_t find_last_above_s16_avx2(const int16_t *v, size_t n, int32_t thr)
+{
+	const __m256i hi = _mm256_set1_epi16((int16_t)(thr - 1));
+	const __m256i lo = _mm256_set1_epi16((int16_t)(1 - thr));
+	size_t end = n;
+	const size_t tail = n % 16;
+	if (tail) {
+		const size_t r = find_last_above_s16_scalar(v + n - tail, tail, thr);
+		if (r != tail)
+			return n - tail + r;
+		end -= tail;
+	}
+	while (end >= 16) {
+		end -= 16;
+		const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + end));
+		const __m256i hit = _mm256_or_si256(_mm256_cmpgt_epi16(x, hi), _mm256_cmpgt_epi16(lo, x));
+		const uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+		if (mask)
+			return end + highest_bit(mask) / 2;
+	}
+	return n;
+}
+
+STEMS_AVX2_TARGET static size_t find_first_above_s32_avx2(const int32_t *v, size_t n, int32_t thr)
+{
+	const __m256i t = _mm256_set1_epi32(thr - 1);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i a = _mm256_abs_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i)));
+		const uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(a, t)));
+		if (mask)
+			return i + lowest_bit(mask);
+	}
+	const size_t r = find_first_above_s32_scalar(v + i, n - i, thr);
+	return r == n - i ? n : i + r;
+}
+
+STEMS_AVX2_TARGET static size_t find_last_above_s32_avx2(const int32_t *v, size_t n, int32_t thr)
+{
+	const __m256i t = _mm256_set1_epi32(thr - 1);
+	size_t end = n;
+	const size_t tail = n % 8;
+	if (tail) {
+		const size_t r = find_last_above_s32_scalar(v + n - tail, tail, thr);
+		if (r != tail)
+			return n - tail + r;
+		end -= tail;
+	}
+	while (end >= 8) {
+		end -= 8;
+		const __m256i a = _mm256_abs_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + end)));
+		const uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(a, t)));
+		if (mask)
+			return end + highest_bit(mask);
+	}
+	return n;
+}
+
+STEMS_AVX2_TARGET static size_t find_first_above_f32_avx2(const float *v, size_t n, float thr)
+{
+	const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const __m256 t = _mm256_set1_ps(thr);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256 a = _mm256_and_ps(_mm256_loadu_ps(v + i), mask);
+		const uint32_t hit = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(a, t, _CMP_GE_OQ));
+		if (hit)
+			return i + lowest_bit(hit);
+	}
+	const size_t r = find_first_above_f32_scalar(v + i, n - i, thr);
+	return r == n - i ? n : i + r;
+}
+
+STEMS_AVX2_TARGET static size_t find_last_above_f32_avx2(const float *v, size_t n, float thr)
+{
+	const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const __m256 t = _mm256_set1_ps(thr);
+	size_t end = n;
+	const size_t tail = n % 8;
+	if (tail) {
+		const size_t r = find_last_above_f32_scalar(v + n - tail, tail, thr);
+		if (r != tail)
+			return n - tail + r;
+		end -= tail;
+	}
+	while (end >= 8) {
+		end -= 8;
+		const __m256 a = _mm256_and_ps(_mm256_loadu_ps(v + end), mask);
+		const uint32_t hit = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(a, t, _CMP_GE_OQ));
+		if (hit)
+			return end + highest_bit(hit);
+	}
+	return n;
+}
+
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* dispatch                                                                  */
+
+#if STEMS_DSP_X86
+#define STEMS_DISPATCH(fn, ...)                          \
+	do {                                             \
+		switch (simd_level()) {                  \
+		case SimdLevel::Avx2:                    \
+			return fn##_avx2(__VA_ARGS__);   \
+		case SimdLevel::Sse2:                    \
+			return fn##_sse2(__VA_ARGS__);   \
+		default:                                 \
+			return fn##_scalar(__VA_ARGS__); \
+		}                                        \
+	} while (0)
+#else
+#define STEMS_DISPATCH(fn, ...) return fn##_scalar(__VA_ARGS__)
+#endif
+
+static int32_t abs_max_s32(const int32_t *v, size_t n)
+{
+	STEMS_DISPATCH(abs_max_s32, v, n);
+}
+
+static uint64_t sum_squares_s32(const int32_t *v, size_t n)
+{
+	STEMS_DISPATCH(sum_squares_s32, v, n);
+}
+
+static size_t find_first_above_s32(const int32_t *v, size_t n, int32_t thr)
+{
+	STEMS_DISPATCH(find_first_above_s32, v, n, thr);
+}
+
+static size_t find_last_above_s32(const int32_t *v, size_t n, int32_t thr)
+{
+	STEMS_DISPATCH(find_last_above_s32, v, n, thr);
+}
+
+int32_t abs_max_s16(const int16_t *v, size_t n)
+{
+	STEMS_DISPATCH(abs_max_s16, v, n);
+}
+
+int32_t abs_max_s24(const uint8_t *v, size_t n)
+{
+	int32_t buf[k_s24_chunk];
+	int32_t m = 0;
+	for (size_t i = 0; i < n; i += k_s24_chunk) {
+		const size_t count = std::min(k_s24_chunk, n - i);
+		decode_s24(v + i * 3, count, buf);
+		m = std::max(m, abs_max_s32(buf, count));
+	}
+	return m;
+}
+
+float abs_max_f32(const float *v, size_t n)
+{
+	STEMS_DISPATCH(abs_max_f32, v, n);
+}
+
+uint64_t sum_squares_s16(const int16_t *v, size_t n)
+{
+	STEMS_DISPATCH(sum_squares_s16, v, n);
+}
+
+// Without SSSE3 shuffles, unpacking s24 stays scalar; the squares use the
+// s32 kernel.
+static double sum_squares_s24_decoded(const uint8_t *v, size_t n)
+{
+	int32_t buf[k_s24_chunk];
+	double acc = 0.0;
+	for (size_t i = 0; i < n; i += k_s24_chunk) {
+		const size_t count = std::min(k_s24_chunk, n - i);
+		decode_s24(v + i * 3, count, buf);
+		acc += (double)sum_squares_s32(buf, count);
+	}
+	return acc;
+}
+
+#if STEMS_DSP_X86
+static double sum_squares_s24_sse2(const uint8_t *v, size_t n)
+{
+	return sum_squares_s24_decoded(v, n);
+}
+#endif
+
+static double sum_squares_s24_scalar(const uint8_t *v, size_t n)
+{
+	return sum_squares_s24_decoded(v, n);
+}
+
+double sum_squares_s24(const uint8_t *v, size_t n)
+{
+	STEMS_DISPATCH(sum_squares_s24, v, n);
+}
+
+static double sum_squares_f32_scalar(const float *v, size_t n)
+{
+	double lanes[8] = {};
+	sum_squares_f32_lanes(v, 0, n, lanes);
+	return reduce_lanes(lanes);
+}
+
+double sum_squares_f32(const float *v, size_t n)
+{
+	STEMS_DISPATCH(sum_squares_f32, v, n);
+}
+
+static float dot_f32_scalar(const float *a, const float *b, size_t n)
+{
+	float lanes[8] = {};
+	dot_f32_lanes(a, b, 0, n, lanes);
+	return reduce_lanes_f32(lanes);
+}
+
+float dot_f32(const float *a, const float *b, size_t n)
+{
+	STEMS_DISPATCH(dot_f32, a, b, n);
+}
+
+void mix_add_f32(float *dst, const float *src, float gain, size_t n)
+{
+	STEMS_DISPATCH(mix_add_f32, dst, src, gain, n);
+}
+
+void tpdf_noise_f32(uint32_t state[8], float *out, size_t n)
+{
+	STEMS_DISPATCH(tpdf_noise_f32, state, out, n);
+}
+
+size_t find_first_above_s16(const int16_t *v, size_t n, int32_t threshold)
+{
+	if (threshold > 32768)
+		return n;
+	threshold = std::max(threshold, 1);
+	STEMS_DISPATCH(find_first_above_s16, v, n, threshold);
+}
+
+size_t find_last_above_s16(const int16_t *v, size_t n, int32_t threshold)
+{
+	if (threshold > 32768)
+		return n;
+	threshold = std::max(threshold, 1);
+	STEMS_DISPATCH(find_last_above_s16, v, n, threshold);
+}
+
+size_t find_first_above_s24(const uint8_t *v, size_t n, int32_t threshold)
+{
+	if (threshold > 8388608)
+		return n;
+	threshold = std::max(threshold, 1);
+	int32_t buf[k_s24_chunk];
+	for (size_t i = 0; i < n; i += k_s24_chunk) {
+		const size_t count = std::min(k_s24_chunk, n - i);
+		decode_s24(v + i * 3, count, buf);
+		const size_t r = find_first_above_s32(buf, count, threshold);
+		if (r != count)
+			return i + r;
+	}
+	return n;
+}
+
+size_t find_last_above_s24(const uint8_t *v, size_t n, int32_t threshold)
+{
+	if (threshold > 8388608)
+		return n;
+	threshold = std::max(threshold, 1);
+	int32_t buf[k_s24_chunk];
+	size_t end = n;
+	while (end > 0) {
+		const size_t count = std::min(k_s24_chunk, end);
+		end -= count;
+		decode_s24(v + end * 3, count, buf);
+		const size_t r = find_last_above_s32(buf, count, threshold);
+		if (r != count)
+			return end + r;
+	}
+	return n;
+}
+
+size_t find_first_above_f32(const float *v, size_t n, float threshold)
+{
+	STEMS_DISPATCH(find_first_above_f32, v, n, threshold);
+}
+
+size_t find_last_above_f32(const float *v, size_t n, float threshold)
+{
+	STEMS_DISPATCH(find_last_above_f32, v, n, threshold);
+}
+
+}
+}
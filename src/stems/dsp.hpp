@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace stems {
+namespace dsp {
+
+enum class SimdLevel {
+	Scalar,
+	Sse2,
+	Avx2,
+};
+
+SimdLevel simd_level();
+const char *simd_level_name(SimdLevel level);
+
+// s24 buffers are packed little-endian 3-byte samples; n counts samples.
+int32_t abs_max_s16(const int16_t *v, size_t n);
+int32_t abs_max_s24(const uint8_t *v, size_t n);
+float abs_max_f32(const float *v, size_t n);
+
+// Sums are exact for integer formats; f32 uses a fixed lane layout so the
+// result does not depend on the dispatched instruction set.
+uint64_t sum_squares_s16(const int16_t *v, size_t n);
+double sum_squares_s24(const uint8_t *v, size_t n);
+double sum_squares_f32(const float *v, size_t n);
+
+// Same fixed 8-lane accumulation order on every instruction set.
+float dot_f32(const float *a, const float *b, size_t n);
+
+// dst[i] += src[i] * gain
+void mix_add_f32(float *dst, const float *src, float gain, size_t n);
+
+// Triangular noise in (-1, 1) from eight xorshift32 lanes; state must be
+// non-zero. The sequence is identical on every instruction set.
+void tpdf_noise_f32(uint32_t state[8], float *out, size_t n);
+
+// Index of the first/last sample with |v| >= threshold, or n when none is.
+size_t find_first_above_s16(const int16_t *v, size_t n, int32_t threshold);
+size_t find_last_above_s16(const int16_t *v, size_t n, int32_t threshold);
+size_t find_first_above_s24(const uint8_t *v, size_t n, int32_t threshold);
+size_t find_last_above_s24(const uint8_t *v, size_t n, int32_t threshold);
+size_t find_first_above_f32(const float *v, size_t n, float threshold);
+size_t find_last_above_f32(const float *v, size_t n, float threshold);
+
+} 
+} 
@@ -0,0 +1,610 @@
+#include "finalize.hpp"
+
+#include "parallel.hpp"
+#include "session_index.hpp"
+#include "session_journal.hpp"
+#include "trace.hpp"
+#include "transcode.hpp"
+#include "wav_postprocess.hpp"
+#include "wav_writer.hpp"
+
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace stems {
+
+namespace fs = std::filesystem;
+
+size_t post_step_index(PostStep step)
+{
+	size_t index = 0;
+	for (unsigned bits = (unsigned)step; bits > 1; bits >>= 1)
+		index++;
+	return index;
+}
+
+const char *post_step_name(PostStep step)
+{
+	static const char *const names[k_post_step_count] = {"trim", "normalize", "remix", "resample", "export"};
+	const size_t index = post_step_index(step);
+	return index < k_post_step_count ? names[index] : "";
+}
+
+static bool write_snapshot_wav(const FinalizeJob &job, StemOutput &o)
+{
+	trace::Scope span("write_replay_stem", "finalize", o.source_name);
+	WavWriter wav;
+	if (!wav.open(o.wav_path, job.sample_rate, o.snapshot->channels)) {
+		blog(LOG_ERROR, "Audio Stems: failed creating replay stem %s", o.wav_path.c_str());
+		o.snapshot.reset();
+		return false;
+	}
+	bool ok = true;
+	o.snapshot->for_each_block([&](const int16_t *samples, size_t frames) {
+		ok = wav.write_samples(samples, frames);
+		return ok;
+	});
+	o.capture_stats.frames_written = wav.frames_written();
+	o.capture_stats.bytes_written = wav.frames_written() * o.snapshot->channels * sizeof(int16_t);
+	for (const auto &c : o.snapshot->chunks)
+		o.capture_stats.peak = std::max(o.capture_stats.peak, c->peak);
+	o.has_capture_stats = true;
+	wav.close();
+	o.snapshot.reset();
+	if (!ok)
+		blog(LOG_ERROR, "Audio Stems: failed writing replay stem %s", o.wav_path.c_str());
+	return ok;
+}
+
+struct TrimCut {
+	uint64_t start_frame = 0;
+	uint64_t end_frame = 0;
+};
+
+// The range trim_silence_wav() keeps; false when the stem is silent or
+// unreadable, which leaves it as it is.
+static bool stem_trim_cut(const FinalizeJob &job, const StemOutput &o, TrimCut &cut)
+{
+	const Settings &settings = job.settings;
+	AudibleRange range;
+	if (!find_audible_range_wav(o.wav_path, job.channels, settings.trim_threshold_dbfs, range) || !range.audible)
+		return false;
+	const uint32_t rate = job.sample_rate ? job.sample_rate : 48000;
+	const uint64_t lead_frames = (uint64_t)std::max(0, settings.trim_lead_ms) * rate / 1000u;
+	const uint64_t trail_frames = (uint64_t)std::max(0, settings.trim_trail_ms) * rate / 1000u;
+	cut.start_frame = range.first_frame > lead_frames ? range.first_frame - lead_frames : 0;
+	cut.end_frame = std::min(range.total_frames, range.last_frame + 1 + trail_frames);
+	return true;
+}
+
+// A crash can land between deleting a stem and renaming its processed copy
+// into place. Finish that rename; any other temp file is partial and goes.
+static void resolve_interrupted_files(StemOutput &o, uint16_t channels)
+{
+	static const struct {
+		const char *suffix;
+		PostStep step;
+	} temps[] = {
+		{".trim.tmp", PostStep::Trim},
+		{".norm.tmp", PostStep::Normalize},
+		{".remix.tmp", PostStep::Remix},
+		{".resample.tmp", PostStep::Resample},
+	};
+	if (o.wav_path.empty() || o.step_done(PostStep::Export))
+		return;
+	std::error_code ec;
+	const fs::path wav(o.wav_path);
+	for (const auto &t : temps) {
+		fs::path tmp = wav;
+		tmp += t.suffix;
+		if (!fs::exists(tmp, ec))
+			continue;
+		if (!fs::exists(wav, ec)) {
+			fs::rename(tmp, wav, ec);
+			if (ec)
+				continue;
+			o.set_step_done(t.step);
+			// Resampling may have remixed in the same pass.
+			WavFormat now;
+			if (t.step == PostStep::Resample && read_wav_format(o.wav_path, now) && now.channels != channels)
+				o.set_step_done(PostStep::Remix);
+		} else {
+			fs::remove(tmp, ec);
+		}
+	}
+
+	const fs::path render = wav.parent_path() / (wav.stem().string() + ".render.wav");
+	const fs::path mp3 = fs::path(wav).replace_extension(".mp3");
+	if (fs::exists(render, ec)) {
+		if (!fs::exists(wav, ec)) {
+			fs::rename(render, wav, ec);
+			if (!ec)
+				o.set_step_done(PostStep::Export);
+		} else {
+			fs::remove(render, ec);
+		}
+	} else if (fs::exists(mp3, ec)) {
+		if (!fs::exists(wav, ec)) {
+			o.final_path = mp3.string();
+			o.set_step_done(PostStep::Export);
+		} else {
+			fs::remove(mp3, ec);
+		}
+	}
+	if (!o.step_done(PostStep::Export) && !fs::exists(wav, ec)) {
+		blog(LOG_WARNING, "Audio Stems: stem missing after restart: %s", o.wav_path.c_str());
+		o.wav_path.clear();
+	}
+}
+
+static bool postprocess_stem(const FinalizeJob &job, size_t index, StemOutput &o, const TrimCut *session_cut,
+			     SessionJournal &journal, const FinalizeCancelledFn &cancelled)
+{
+	const Settings &settings = job.settings;
+	uint64_t step_begin_ns = 0;
+	auto done = [&](PostStep step, bool ran) {
+		o.set_step_done(step);
+		journal.step(index, o, step);
+		if (!ran)
+			return;
+		PostStepStats &st = o.step_stats[post_step_index(step)];
+		st.ran = true;
+		st.ms = (double)(os_gettime_ns() - step_begin_ns) / 1e6;
+		std::error_code ec;
+		const uintmax_t size = fs::file_size(o.final_path.empty() ? o.wav_path : o.final_path, ec);
+		st.bytes = ec ? 0 : (uint64_t)size;
+	};
+	if (o.wav_path.empty() || o.step_done(PostStep::Export))
+		return true;
+	if (cancelled())
+		return false;
+	if (!o.step_done(PostStep::Trim)) {
+		trace::Scope span("trim", "postprocess", o.source_name);
+		step_begin_ns = os_gettime_ns();
+		TrimCut cut;
+		WavFormat in;
+		bool have_cut = false;
+		if (session_cut) {
+			cut = *session_cut;
+			have_cut = read_wav_format(o.wav_path, in);
+		} else if (settings.trim_silence) {
+			have_cut = stem_trim_cut(job, o, cut) && read_wav_format(o.wav_path, in);
+		}
+		if (have_cut) {
+			WavFormat out = in;
+			const uint64_t end = std::min(cut.end_frame, in.frames);
+			out.frames = end > cut.start_frame ? end - cut.start_frame : 0;
+			journal.step_begin(index, PostStep::Trim, in, out, cut.start_frame);
+			if (cut_wav(o.wav_path, job.channels, job.sample_rate, cut.start_frame, cut.end_frame))
+				o.trim_start_frames = cut.start_frame;
+		}
+		done(PostStep::Trim, session_cut != nullptr || settings.trim_silence);
+	}
+	if (cancelled())
+		return false;
+	if (settings.normalize_audio && !o.step_done(PostStep::Normalize)) {
+		trace::Scope span("normalize", "postprocess", o.source_name);
+		step_begin_ns = os_gettime_ns();
+		LimiterParams limiter;
+		limiter.ceiling_dbfs = settings.limiter_ceiling_dbfs;
+		limiter.attack_ms = settings.limiter_attack_ms;
+		limiter.release_ms = settings.limiter_release_ms;
+		const LimiterParams *limiter_ptr = settings.normalize_limiter ? &limiter : nullptr;
+		// Same format in and out; the fingerprint shows whether the swap
+		// happened.
+		WavFormat in;
+		uint64_t fingerprint = 0;
+		if (read_wav_format(o.wav_path, in) && wav_fingerprint(o.wav_path, fingerprint))
+			journal.step_begin(index, PostStep::Normalize, in, in, 0, fingerprint);
+		if (settings.normalize_mode == "lufs") {
+			o.loudness_measured = measure_wav_loudness(o.wav_path, job.channels, job.sample_rate, o.loudness);
+			if (o.loudness_measured && cancelled())
+				return false;
+			if (o.loudness_measured)
+				normalize_wav_lufs(o.wav_path, job.channels, job.sample_rate, settings.normalize_target_dbfs,
+						   limiter_ptr, o.loudness);
+		} else {
+			normalize_wav_rms(o.wav_path, job.channels, job.sample_rate, settings.normalize_target_dbfs,
+					  limiter_ptr);
+		}
+		done(PostStep::Normalize, true);
+	}
+	if (cancelled())
+		return false;
+
+	const uint16_t target_channels = o.audio_properties.channels;
+	uint16_t wav_channels = o.step_done(PostStep::Remix) ? target_channels : job.channels;
+	const uint32_t target_rate = o.audio_properties.sample_rate;
+	uint32_t wav_rate = o.step_done(PostStep::Resample) ? target_rate : job.sample_rate;
+	const bool remix = target_channels && target_channels != job.channels && !o.step_done(PostStep::Remix);
+	const bool resample = target_rate && target_rate != job.sample_rate && !o.step_done(PostStep::Resample) &&
+			      Resampler::supported(job.sample_rate, target_rate);
+	ChannelMatrix matrix;
+	if (remix) {
+		matrix = ChannelMatrix::standard(job.channels, target_channels);
+		if (!settings.remix_matrix.empty() &&
+		    !ChannelMatrix::parse(settings.remix_matrix, job.channels, target_channels, matrix))
+			blog(LOG_WARNING, "Audio Stems: custom channel matrix does not fit %u -> %u channels, using default",
+			     (unsigned)job.channels, (unsigned)target_channels);
+	}
+	if (remix && resample) {
+		// One pass for both; mixing down first also leaves fewer channels
+		// to resample. Its time is counted under resample.
+		trace::Scope span("remix+resample", "postprocess", o.source_name);
+		step_begin_ns = os_gettime_ns();
+		WavFormat in;
+		if (read_wav_format(o.wav_path, in)) {
+			WavFormat out = in;
+			out.channels = target_channels;
+			out.sample_rate = target_rate;
+			out.frames = Resampler::output_frames(in.frames, job.sample_rate, target_rate);
+			journal.step_begin(index, PostStep::Remix, in, out);
+			journal.step_begin(index, PostStep::Resample, in, out);
+		}
+		if (resample_wav(o.wav_path, job.channels, job.sample_rate, target_rate,
+				 resample_quality_from_string(settings.resample_quality), &matrix)) {
+			wav_channels = target_channels;
+			wav_rate = target_rate;
+			done(PostStep::Remix, false);
+			done(PostStep::Resample, true);
+		} else {
+			blog(LOG_WARNING, "Audio Stems: in-process remix and resample failed, falling back to ffmpeg: %s",
+			     o.wav_path.c_str());
+		}
+	} else if (remix) {
+		trace::Scope span("remix", "postprocess", o.source_name);
+		step_begin_ns = os_gettime_ns();
+		WavFormat in;
+		if (read_wav_format(o.wav_path, in)) {
+			WavFormat out = in;
+			out.channels = target_channels;
+			journal.step_begin(index, PostStep::Remix, in, out);
+		}
+		if (remix_wav(o.wav_path, job.sample_rate, matrix)) {
+			wav_channels = target_channels;
+			done(PostStep::Remix, true);
+		} else {
+			blog(LOG_WARNING, "Audio Stems: in-process remix failed, falling back to ffmpeg: %s",
+			     o.wav_path.c_str());
+		}
+	} else if (resample) {
+		trace::Scope span("resample", "postprocess", o.source_name);
+		step_begin_ns = os_gettime_ns();
+		WavFormat in;
+		if (read_wav_format(o.wav_path, in)) {
+			WavFormat out = in;
+			out.sample_rate = target_rate;
+			out.frames = Resampler::output_frames(in.frames, job.sample_rate, target_rate);
+			journal.step_begin(index, PostStep::Resample, in, out);
+		}
+		if (resample_wav(o.wav_path, wav_channels, job.sample_rate, target_rate,
+				 resample_quality_from_string(settings.resample_quality))) {
+			wav_rate = target_rate;
+			done(PostStep::Resample, true);
+		} else {
+			blog(LOG_WARNING, "Audio Stems: in-process resample failed, falling back to ffmpeg: %s",
+			     o.wav_path.c_str());
+		}
+	}
+	if (cancelled())
+		return false;
+
+	OutputFormat output_format = settings.output_format == "mp3" ? OutputFormat::Mp3 : OutputFormat::Wav;
+	const bool needs_export = output_format == OutputFormat::Mp3 ||
+		(o.audio_properties.sample_rate != wav_rate) ||
+		(o.audio_properties.channels != wav_channels) ||
+		(settings.wav_bit_depth != 16);
+	if (!needs_export) {
+		o.final_path = o.wav_path;
+		done(PostStep::Export, false);
+		return true;
+	}
+
+	trace::Scope span("export", "postprocess", o.source_name);
+	step_begin_ns = os_gettime_ns();
+	fs::path desired_path = fs::path(o.wav_path).replace_extension(output_format == OutputFormat::Mp3 ? ".mp3" : ".wav");
+	fs::path export_path = desired_path;
+	if (output_format == OutputFormat::Wav)
+		export_path = desired_path.parent_path() / (desired_path.stem().string() + ".render.wav");
+
+	if (export_audio("", o.wav_path, export_path.string(), output_format, o.audio_properties.bitrate_kbps,
+			 o.audio_properties.sample_rate, o.audio_properties.channels, settings.wav_bit_depth)) {
+		if (output_format == OutputFormat::Wav) {
+			std::error_code ec;
+			fs::remove(o.wav_path, ec);
+			ec.clear();
+			fs::rename(export_path, desired_path, ec);
+			if (ec) {
+				blog(LOG_ERROR, "Audio Stems: failed finalizing WAV export: %s", ec.message().c_str());
+				o.final_path = o.wav_path;
+				fs::remove(export_path, ec);
+			} else {
+				o.final_path = desired_path.string();
+			}
+		} else {
+			o.final_path = desired_path.string();
+			std::error_code ec;
+			fs::remove(o.wav_path, ec);
+		}
+	} else {
+		o.final_path = o.wav_path;
+	}
+	done(PostStep::Export, true);
+	return true;
+}
+
+static double to_dbfs(double linear)
+{
+	return linear > 0.0 ? 20.0 * std::log10(linear) : -200.0;
+}
+
+static obs_data_t *stem_telemetry(const FinalizeJob &job, const StemOutput &o)
+{
+	obs_data_t *t = obs_data_create();
+	if (o.has_capture_stats) {
+		const StemCaptureStats &c = o.capture_stats;
+		const uint32_t rate = job.sample_rate ? job.sample_rate : 48000;
+		obs_data_set_int(t, "frames_written", (int64_t)c.frames_written);
+		obs_data_set_double(t, "duration_s", (double)c.frames_written / rate);
+		obs_data_set_int(t, "bytes_written", (int64_t)c.bytes_written);
+		obs_data_set_int(t, "dropped_chunks", (int64_t)c.dropped_chunks);
+		obs_data_set_int(t, "max_queue_depth", (int64_t)c.max_queue_depth);
+		obs_data_set_int(t, "queue_capacity", (int64_t)c.queue_capacity);
+		obs_data_set_double(t, "write_p50_ms", (double)c.write_p50_ns / 1e6);
+		obs_data_set_double(t, "write_p99_ms", (double)c.write_p99_ns / 1e6);
+		obs_data_set_double(t, "write_max_ms", (double)c.write_max_ns / 1e6);
+		obs_data_set_int(t, "clipped_samples", (int64_t)c.clipped_samples);
+		obs_data_set_bool(t, "write_failed", c.write_failed);
+		obs_data_set_double(t, "peak_dbfs", to_dbfs(c.peak));
+		obs_data_set_double(t, "rms_dbfs", to_dbfs(c.rms));
+	}
+
+	obs_data_t *steps = obs_data_create();
+	for (size_t i = 0; i < k_post_step_count; i++) {
+		const PostStepStats &st = o.step_stats[i];
+		if (!st.ran)
+			continue;
+		obs_data_t *it = obs_data_create();
+		obs_data_set_double(it, "ms", st.ms);
+		obs_data_set_int(it, "bytes", (int64_t)st.bytes);
+		obs_data_set_obj(steps, post_step_name((PostStep)(1u << i)), it);
+		obs_data_release(it);
+	}
+	obs_data_set_obj(t, "postprocess", steps);
+	obs_data_release(steps);
+	return t;
+}
+
+void write_session_sidecar(const FinalizeJob &job, bool cancelled)
+{
+	const Settings &settings = job.settings;
+	if (job.session_dir.empty())
+		return;
+	trace::Scope span("write_sidecar", "finalize");
+	obs_data_t *root = obs_data_create();
+	obs_data_set_string(root, "session_dir", job.session_dir.c_str());
+	obs_data_set_string(root, "mode", job.kind == SessionKind::Recording   ? "recording"
+					  : job.kind == SessionKind::Streaming ? "streaming"
+									       : "replay");
+	obs_data_set_int(root, "sample_rate", (int64_t)job.sample_rate);
+	obs_data_set_int(root, "channels", (int64_t)job.channels);
+	obs_data_set_int(root, "start_ns", (int64_t)job.start_ns);
+	obs_data_set_bool(root, "postprocess_cancelled", cancelled);
+	if (job.recovered)
+		obs_data_set_bool(root, "recovered", true);
+
+	obs_data_t *cfg = obs_data_create();
+	obs_data_set_string(cfg, "output_format", settings.output_format.c_str());
+	obs_data_set_int(cfg, "wav_bit_depth", static_cast<int64_t>(settings.wav_bit_depth));
+	obs_data_set_string(cfg, "resample_quality", settings.resample_quality.c_str());
+	obs_data_set_string(cfg, "remix_matrix", settings.remix_matrix.c_str());
+	obs_data_set_string(cfg, "dither_mode", settings.dither_mode.c_str());
+	obs_data_set_bool(cfg, "trim_silence", settings.trim_silence);
+	obs_data_set_string(cfg, "trim_mode", settings.trim_mode.c_str());
+	obs_data_set_double(cfg, "trim_threshold_dbfs", settings.trim_threshold_dbfs);
+	obs_data_set_int(cfg, "trim_lead_ms", settings.trim_lead_ms);
+	obs_data_set_int(cfg, "trim_trail_ms", settings.trim_trail_ms);
+	obs_data_set_bool(cfg, "normalize_audio", settings.normalize_audio);
+	obs_data_set_string(cfg, "normalize_mode", settings.normalize_mode.c_str());
+	obs_data_set_double(cfg, "normalize_target_dbfs", settings.normalize_target_dbfs);
+	obs_data_set_bool(cfg, "normalize_limiter", settings.normalize_limiter);
+	obs_data_set_double(cfg, "limiter_ceiling_dbfs", settings.limiter_ceiling_dbfs);
+	obs_data_set_double(cfg, "limiter_attack_ms", settings.limiter_attack_ms);
+	obs_data_set_double(cfg, "limiter_release_ms", settings.limiter_release_ms);
+	obs_data_set_bool(cfg, "record_scene_markers", settings.record_scene_markers);
+	obs_data_set_int(cfg, "preroll_seconds", settings.preroll_enabled ? settings.preroll_seconds : 0);
+	obs_data_set_bool(cfg, "use_source_aliases", settings.use_source_aliases);
+	obs_data_set_obj(root, "settings", cfg);
+	obs_data_release(cfg);
+
+	obs_data_array_t *stems = obs_data_array_create();
+	for (const auto &o : job.stems) {
+		obs_data_t *it = obs_data_create();
+		obs_data_set_string(it, "wav", o.wav_path.c_str());
+		obs_data_set_string(it, "file", o.final_path.c_str());
+		obs_data_set_string(it, "source_uuid", o.source_uuid.c_str());
+		obs_data_set_string(it, "source_name", o.source_name.c_str());
+		obs_data_set_int(it, "source_sample_rate", static_cast<int64_t>(o.audio_properties.sample_rate));
+		obs_data_set_int(it, "source_channels", static_cast<int64_t>(o.audio_properties.channels));
+		obs_data_set_int(it, "source_bitrate_kbps", static_cast<int64_t>(o.audio_properties.bitrate_kbps));
+		obs_data_set_int(it, "preroll_frames", static_cast<int64_t>(o.preroll_frames));
+		obs_data_set_int(it, "trim_start_frames", static_cast<int64_t>(o.trim_start_frames));
+		if (o.loudness_measured) {
+			if (std::isfinite(o.loudness.integrated_lufs))
+				obs_data_set_double(it, "integrated_lufs", o.loudness.integrated_lufs);
+			if (o.loudness.true_peak > 0.0)
+				obs_data_set_double(it, "true_peak_dbtp", 20.0 * std::log10(o.loudness.true_peak));
+		}
+		obs_data_t *telemetry = stem_telemetry(job, o);
+		obs_data_set_obj(it, "telemetry", telemetry);
+		obs_data_release(telemetry);
+		obs_data_array_push_back(stems, it);
+		obs_data_release(it);
+	}
+	obs_data_set_array(root, "stems", stems);
+	obs_data_array_release(stems);
+
+	obs_data_array_t *marks = obs_data_array_create();
+	for (const auto &m : job.markers) {
+		obs_data_t *it = obs_data_create();
+		obs_data_set_int(it, "offset_ns", (int64_t)m.offset_ns);
+		obs_data_set_string(it, "type", m.type.c_str());
+		obs_data_set_string(it, "value", m.value.c_str());
+		obs_data_array_push_back(marks, it);
+		obs_data_release(it);
+	}
+	obs_data_set_array(root, "markers", marks);
+	obs_data_array_release(marks);
+
+	fs::path sidecar = fs::path(job.session_dir) / "session.json";
+	obs_data_save_json_safe(root, sidecar.string().c_str(), "tmp", "bak");
+	obs_data_release(root);
+}
+
+// Scans every stem in parallel and returns one cut covering the audible span of all of
+// them, so trimming keeps the stems sample-aligned with each other.
+static bool compute_session_cut(const FinalizeJob &job, TrimCut &cut)
+{
+	trace::Scope span("session_cut", "postprocess");
+	const Settings &settings = job.settings;
+	const size_t total = job.stems.size();
+	std::vector<AudibleRange> ranges(total);
+	std::vector<char> ok(total, 0);
+	parallel_for(total, parallel_workers(total), [&](size_t, size_t i) {
+		if (!job.stems[i].wav_path.empty())
+			ok[i] = find_audible_range_wav(job.stems[i].wav_path, job.channels, settings.trim_threshold_dbfs,
+						      ranges[i]);
+	});
+
+	bool audible = false;
+	uint64_t first = 0;
+	uint64_t last = 0;
+	uint64_t longest = 0;
+	for (size_t i = 0; i < total; i++) {
+		if (!ok[i])
+			continue;
+		longest = std::max(longest, ranges[i].total_frames);
+		if (!ranges[i].audible)
+			continue;
+		if (!audible) {
+			first = ranges[i].first_frame;
+			last = ranges[i].last_frame;
+			audible = true;
+		} else {
+			first = std::min(first, ranges[i].first_frame);
+			last = std::max(last, ranges[i].last_frame);
+		}
+	}
+	if (!audible)
+		return false;
+
+	const uint32_t rate = job.sample_rate ? job.sample_rate : 48000;
+	const uint64_t lead_frames = (uint64_t)std::max(0, settings.trim_lead_ms) * rate / 1000u;
+	const uint64_t trail_frames = (uint64_t)std::max(0, settings.trim_trail_ms) * rate / 1000u;
+	cut.start_frame = first > lead_frames ? first - lead_frames : 0;
+	cut.end_frame = std::min(longest, last + 1 + trail_frames);
+	blog(LOG_INFO, "Audio Stems: session trim keeps frames %llu-%llu of %llu across %zu stems",
+	     (unsigned long long)cut.start_frame, (unsigned long long)cut.end_frame, (unsigned long long)longest, total);
+	return true;
+}
+
+static void write_session_trace(const FinalizeJob &job)
+{
+	std::vector<trace::Event> events;
+	std::vector<trace::ThreadInfo> threads;
+	trace::collect(job.trace_since_ns, events, threads);
+	const fs::path path = fs::path(job.session_dir) / "session.trace.json";
+	if (trace::write_chrome_trace(path.string(), events, threads, job.trace_since_ns))
+		blog(LOG_INFO, "Audio Stems: wrote %zu trace events from %zu threads to %s", events.size(),
+		     threads.size(), path.string().c_str());
+	else
+		blog(LOG_WARNING, "Audio Stems: failed writing trace %s", path.string().c_str());
+}
+
+void finalize_session(FinalizeJob &job, const FinalizeProgressFn &progress, const FinalizeCancelledFn &cancelled)
+{
+	const uint64_t finalize_begin_ns = os_gettime_ns();
+	const FinalizeCancelledFn is_cancelled = cancelled ? cancelled : FinalizeCancelledFn([] { return false; });
+	const size_t total = job.stems.size();
+	std::mutex progress_mtx;
+	size_t done = 0;
+	std::atomic<bool> was_cancelled{false};
+	if (progress)
+		progress(done, total);
+
+	parallel_for(total, parallel_workers(total), [&](size_t, size_t i) {
+		StemOutput &o = job.stems[i];
+		if (o.snapshot && !write_snapshot_wav(job, o))
+			o.wav_path.clear();
+	});
+
+	if (job.recovered) {
+		for (auto &o : job.stems)
+			resolve_interrupted_files(o, job.channels);
+	}
+	open_sessions_add(job.settings.output_dir, job.session_dir);
+	SessionJournal journal;
+	if (!journal.begin_finalize(job))
+		blog(LOG_WARNING, "Audio Stems: failed writing post-processing journal: %s", job.session_dir.c_str());
+
+	TrimCut session_cut;
+	const TrimCut *cut_ptr = nullptr;
+	if (job.settings.trim_silence && job.settings.trim_mode == "session" && !is_cancelled()) {
+		const bool any_trimmed = std::any_of(job.stems.begin(), job.stems.end(), [](const StemOutput &o) {
+			return o.step_done(PostStep::Trim);
+		});
+		if (job.session_cut_known) {
+			session_cut.start_frame = job.session_cut_start;
+			session_cut.end_frame = job.session_cut_end;
+			cut_ptr = &session_cut;
+		} else if (!any_trimmed && compute_session_cut(job, session_cut)) {
+			job.session_cut_known = true;
+			job.session_cut_start = session_cut.start_frame;
+			job.session_cut_end = session_cut.end_frame;
+			journal.session_cut(session_cut.start_frame, session_cut.end_frame);
+			cut_ptr = &session_cut;
+		}
+	}
+
+	parallel_for(total, parallel_workers(total), [&](size_t, size_t i) {
+		if (!postprocess_stem(job, i, job.stems[i], cut_ptr, journal, is_cancelled)) {
+			was_cancelled = true;
+			return;
+		}
+		std::lock_guard<std::mutex> lock(progress_mtx);
+		done++;
+		if (progress)
+			progress(done, total);
+	});
+
+	if (was_cancelled)
+		blog(LOG_WARNING, "Audio Stems: post-processing cancelled after %zu/%zu stems: %s", done, total,
+		     job.session_dir.c_str());
+	if (job.settings.write_sidecar_json)
+		write_session_sidecar(job, was_cancelled);
+	journal.close();
+	// A cancelled job keeps its journal and is resumed on the next start.
+	if (!was_cancelled) {
+		SessionJournal::remove(job.session_dir);
+		open_sessions_remove(job.settings.output_dir, job.session_dir);
+	}
+
+	if (job.trace) {
+		trace::record("finalize_session", "finalize", finalize_begin_ns, os_gettime_ns(), job.session_dir);
+		if (!job.session_dir.empty())
+			write_session_trace(job);
+		trace::release();
+		job.trace = false;
+	}
+}
+
+}
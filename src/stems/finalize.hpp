@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "session.hpp"
+#include "settings.hpp"
+
+namespace stems {
+
+struct FinalizeJob {
+	SessionKind kind = SessionKind::Recording;
+	Settings settings;
+	std::string session_dir;
+	uint32_t sample_rate = 48000;
+	uint16_t channels = 2;
+	uint64_t start_ns = 0;
+	std::vector<SessionMarker> markers;
+	std::vector<StemOutput> stems;
+	// Rebuilt from the session journal after a crash.
+	bool recovered = false;
+	// Session-mode trim range, once computed.
+	bool session_cut_known = false;
+	uint64_t session_cut_start = 0;
+	uint64_t session_cut_end = 0;
+	// The session holds a trace reference that finalizing hands back after
+	// writing everything since trace_since_ns to session.trace.json.
+	bool trace = false;
+	uint64_t trace_since_ns = 0;
+};
+
+using FinalizeProgressFn = std::function<void(size_t stems_done, size_t stems_total)>;
+using FinalizeCancelledFn = std::function<bool()>;
+
+// Runs post-processing and writes the sidecar. When cancelled, the remaining
+// stems are left as captured but the sidecar is still written. Progress is
+// journaled in the session folder; a job rebuilt from it after a restart
+// skips the steps that already finished.
+void finalize_session(FinalizeJob &job, const FinalizeProgressFn &progress, const FinalizeCancelledFn &cancelled);
+
+void write_session_sidecar(const FinalizeJob &job, bool cancelled);
+
+} 
@@ -0,0 +1,125 @@
+#include "finalize_queue.hpp"
+
+#include "trace.hpp"
+
+#include <obs-module.h>
+
+#include <utility>
+
+namespace stems {
+
+FinalizeQueue::~FinalizeQueue()
+{
+	shutdown(true);
+}
+
+void FinalizeQueue::start()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (running_)
+		return;
+	running_ = true;
+	worker_ = std::thread(&FinalizeQueue::worker_main, this);
+}
+
+void FinalizeQueue::shutdown(bool cancel_pending)
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (!running_)
+			return;
+		running_ = false;
+		if (cancel_pending)
+			cancel_before_ = next_seq_;
+	}
+	cv_.notify_all();
+	if (worker_.joinable())
+		worker_.join();
+}
+
+void FinalizeQueue::submit(std::unique_ptr<FinalizeJob> job)
+{
+	if (!job)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (running_) {
+			Entry e;
+			e.seq = next_seq_++;
+			e.job = std::move(job);
+			jobs_.push_back(std::move(e));
+			status_.queued = jobs_.size();
+		}
+	}
+	if (job) {
+		blog(LOG_WARNING, "Audio Stems: finalize queue not running, finalizing inline: %s", job->session_dir.c_str());
+		finalize_session(*job, nullptr, nullptr);
+		return;
+	}
+	cv_.notify_one();
+}
+
+void FinalizeQueue::cancel_all()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	cancel_before_ = next_seq_;
+}
+
+FinalizeStatus FinalizeQueue::status() const
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	return status_;
+}
+
+bool FinalizeQueue::is_cancelled(uint64_t seq) const
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	return seq < cancel_before_;
+}
+
+void FinalizeQueue::worker_main()
+{
+	trace::name_thread("finalize");
+	for (;;) {
+		Entry e;
+		{
+			std::unique_lock<std::mutex> lock(mtx_);
+			cv_.wait(lock, [this] { return !running_ || !jobs_.empty(); });
+			if (jobs_.empty())
+				break;
+			e = std::move(jobs_.front());
+			jobs_.pop_front();
+			status_.busy = true;
+			status_.session_dir = e.job->session_dir;
+			status_.stems_done = 0;
+			status_.stems_total = e.job->stems.size();
+			status_.queued = jobs_.size();
+		}
+
+		const uint64_t seq = e.seq;
+		const std::string dir = e.job->session_dir;
+		blog(LOG_INFO, "Audio Stems: finalizing session: %s", dir.c_str());
+		finalize_session(
+			*e.job,
+			[this, &dir](size_t done, size_t total) {
+				{
+					std::lock_guard<std::mutex> lock(mtx_);
+					status_.stems_done = done;
+					status_.stems_total = total;
+				}
+				if (done > 0)
+					blog(LOG_INFO, "Audio Stems: finalized %zu/%zu stems: %s", done, total, dir.c_str());
+			},
+			[this, seq] { return is_cancelled(seq); });
+		e.job.reset();
+
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			status_ = FinalizeStatus{};
+			status_.queued = jobs_.size();
+		}
+		blog(LOG_INFO, "Audio Stems: session finalized: %s", dir.c_str());
+	}
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "finalize.hpp"
+
+namespace stems {
+
+struct FinalizeStatus {
+	bool busy = false;
+	std::string session_dir;
+	size_t stems_done = 0;
+	size_t stems_total = 0;
+	size_t queued = 0;
+};
+
+class FinalizeQueue {
+public:
+	FinalizeQueue() = default;
+	~FinalizeQueue();
+	FinalizeQueue(const FinalizeQueue &) = delete;
+	FinalizeQueue &operator=(const FinalizeQueue &) = delete;
+
+	void start();
+	// Waits for queued jobs; with cancel_pending they only write their sidecar.
+	void shutdown(bool cancel_pending);
+
+	void submit(std::unique_ptr<FinalizeJob> job);
+	// Stops every job submitted so far after its current step; they resume
+	// from their journal on the next start.
+	void cancel_all();
+	FinalizeStatus status() const;
+
+private:
+	struct Entry {
+		uint64_t seq = 0;
+		std::unique_ptr<FinalizeJob> job;
+	};
+
+	void worker_main();
+	bool is_cancelled(uint64_t seq) const;
+
+	mutable std::mutex mtx_;
+	std::condition_variable cv_;
+	std::deque<Entry> jobs_;
+	std::thread worker_;
+	bool running_ = false;
+	uint64_t next_seq_ = 1;
+	uint64_t cancel_before_ = 0;
+	FinalizeStatus status_;
+};
+
+} 
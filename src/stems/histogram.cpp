@@ -0,0 +1,164 @@
+#include "histogram.hpp"
+
+namespace stems {
+
+static unsigned highest_bit(uint64_t v)
+{
+	unsigned bit = 0;
+	while (v >>= 1)
+		bit++;
+	return bit;
+}
+
+size_t Histogram::bucket_of(uint64_t value)
+{
+	const uint64_t sub_count = 1ull << k_sub_bits;
+	if (value < sub_count)
+		return (size_t)value;
+	const unsigned shift = highest_bit(value) - k_sub_bits;
+	return ((size_t)(shift + 1) << k_sub_bits) + (size_t)((value >> shift) & (sub_count - 1));
+}
+
+uint64_t Histogram::bucket_upper(size_t bucket)
+{
+	const uint64_t sub_count = 1ull << k_sub_bits;
+	if (bucket < sub_count)
+		return bucket;
+	const unsigned shift = (unsigned)(bucket >> k_sub_bits) - 1;
+	const uint64_t lower = (sub_count + (bucket & (sub_count - 1))) << shift;
+	return lower + ((1ull << shift) - 1);
+}
+
+void Histogram::record(uint64_t value)
+{
+	buckets_[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+	count_.fetch_add(1, std::memory_order_relaxed);
+	sum_.fetch_add(value, std::memory_order_relaxed);
+	uint64_t max = max_.load(std::memory_order_relaxed);
+	while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+	}
+}
+
+void Histogram::reset()
+{
+	for (auto &b : buckets_)
+		b.store(0, std::memory_order_relaxed);
+	count_.store(0, std::memory_order_relaxed);
+	sum_.store(0, std::memory_order_relaxed);
+	max_.store(0, std::memory_order_relaxed);
+}
+
+void Histogram::merge_from(const Histogram &other)
+{
+	uint64_t total = 0;
+	for (size_t i = 0; i < k_buckets; i++) {
+		const uint64_t n = other.buckets_[i].load(std::memory_order_relaxed);
+		if (n == 0)
+			continue;
+		buckets_[i].fetch_add(n, std::memory_order_relaxed);
+		total += n;
+	}
+	count_.fetch_add(total, std::memory_order_relaxed);
+	sum_.fetch_add(other.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	const uint64_t other_max = other.max();
+	uint64_t max = max_.load(std::memory_order_relaxed);
+	while (other_max > max && !max_.compare_exchange_weak(max, other_max, std::memory_order_relaxed)) {
+	}
+}
+
+double Histogram::mean() const
+{
+	const uint64_t n = count();
+	return n ? (double)sum_.load(std::memory_order_relaxed) / (double)n : 0.0;
+}
+
+uint64_t Histogram::percentile(double q) const
+{
+	const uint64_t n = count();
+	if (n == 0)
+		return 0;
+	q = q < 0.0 ? 0.0 : q > 1.0 ? 1.0 : q;
+	uint64_t rank = (uint64_t)(q * (double)n + 0.5);
+	rank = rank < 1 ? 1 : rank > n ? n : rank;
+	uint64_t seen = 0;
+	for (size_t i = 0; i < k_buckets; i++) {
+		seen += buckets_[i].load(std::memory_order_relaxed);
+		if (seen >= rank) {
+			const uint64_t upper = bucket_upper(i);
+			return upper < max() ? upper : max();
+		}
+	}
+	return max();
+}
+
+void Histogram::copy_to(HistogramCounts &out) const
+{
+	uint64_t total = 0;
+	for (size_t i = 0; i < k_buckets; i++) {
+		out.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+		total += out.buckets[i];
+	}
+	// Summed from the buckets so percentiles stay consistent with count
+	// while record() runs concurrently.
+	out.count = total;
+	out.sum = sum_.load(std::memory_order_relaxed);
+	out.max = max();
+}
+
+void HistogramCounts::subtract(const HistogramCounts &earlier)
+{
+	if (count < earlier.count)
+		return;
+	for (size_t i = 0; i < Histogram::k_buckets; i++)
+		buckets[i] = buckets[i] > earlier.buckets[i] ? buckets[i] - earlier.buckets[i] : 0;
+	count -= earlier.count;
+	sum = sum > earlier.sum ? sum - earlier.sum : 0;
+}
+
+void HistogramCounts::add(const HistogramCounts &other)
+{
+	for (size_t i = 0; i < Histogram::k_buckets; i++)
+		buckets[i] += other.buckets[i];
+	count += other.count;
+	sum += other.sum;
+	max = other.max > max ? other.max : max;
+}
+
+HistogramSummary summarize(const HistogramCounts &c)
+{
+	HistogramSummary s;
+	if (c.count == 0)
+		return s;
+	size_t top = 0;
+	for (size_t i = 0; i < Histogram::k_buckets; i++) {
+		if (c.buckets[i])
+			top = i;
+	}
+	const uint64_t top_upper = Histogram::bucket_upper(top);
+	s.count = c.count;
+	s.max = c.max < top_upper ? c.max : top_upper;
+	s.mean = (double)c.sum / (double)c.count;
+
+	const double qs[3] = {0.50, 0.90, 0.99};
+	uint64_t *out[3] = {&s.p50, &s.p90, &s.p99};
+	size_t bucket = 0;
+	uint64_t seen = 0;
+	for (int k = 0; k < 3; k++) {
+		uint64_t rank = (uint64_t)(qs[k] * (double)c.count + 0.5);
+		rank = rank < 1 ? 1 : rank > c.count ? c.count : rank;
+		while (bucket < Histogram::k_buckets && seen + c.buckets[bucket] < rank)
+			seen += c.buckets[bucket++];
+		const uint64_t upper = bucket < Histogram::k_buckets ? Histogram::bucket_upper(bucket) : s.max;
+		*out[k] = upper < s.max ? upper : s.max;
+	}
+	return s;
+}
+
+HistogramSummary summarize(const Histogram &h)
+{
+	HistogramCounts c;
+	h.copy_to(c);
+	return summarize(c);
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace stems {
+
+struct HistogramCounts;
+
+// Lock-free histogram of non-negative values (durations in ns, queue
+// depths). Buckets split each power of two into eight linear steps, so a
+// percentile is within 12.5% of the true value. record() is a handful of
+// relaxed atomic adds and may be called from any thread.
+class Histogram {
+public:
+	Histogram() { reset(); }
+	Histogram(const Histogram &) = delete;
+	Histogram &operator=(const Histogram &) = delete;
+
+	void record(uint64_t value);
+	void reset();
+	// Adds other's samples; other may be recorded into concurrently.
+	void merge_from(const Histogram &other);
+
+	uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+	uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+	double mean() const;
+	// Upper bound of the bucket holding quantile q (0..1); 0 when empty.
+	uint64_t percentile(double q) const;
+	// Plain copy of the counters, for differencing two points in time.
+	void copy_to(HistogramCounts &out) const;
+
+	static constexpr unsigned k_sub_bits = 3;
+	static constexpr size_t k_buckets = (64 - k_sub_bits + 1) << k_sub_bits;
+
+	static uint64_t bucket_upper(size_t bucket);
+
+private:
+	static size_t bucket_of(uint64_t value);
+
+	std::atomic<uint64_t> buckets_[k_buckets];
+	std::atomic<uint64_t> count_;
+	std::atomic<uint64_t> sum_;
+	std::atomic<uint64_t> max_;
+};
+
+struct HistogramCounts {
+	uint64_t buckets[Histogram::k_buckets] = {};
+	uint64_t count = 0;
+	uint64_t sum = 0;
+	uint64_t max = 0;
+
+	// Leaves the samples recorded since earlier. A histogram that was reset
+	// in between keeps its current counts.
+	void subtract(const HistogramCounts &earlier);
+	void add(const HistogramCounts &other);
+};
+
+struct HistogramSummary {
+	uint64_t count = 0;
+	uint64_t p50 = 0;
+	uint64_t p90 = 0;
+	uint64_t p99 = 0;
+	uint64_t max = 0;
+	double mean = 0.0;
+};
+
+HistogramSummary summarize(const Histogram &h);
+// max is the cumulative max clamped to the highest non-empty bucket, so a
+// difference of two copies reports the max of its own window.
+HistogramSummary summarize(const HistogramCounts &c);
+
+}
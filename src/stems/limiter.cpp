@@ -0,0 +1,86 @@
+#include "limiter.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace stems {
+
+LookaheadLimiter::LookaheadLimiter(uint32_t sample_rate, uint16_t channels, const LimiterParams &params,
+				   float full_scale)
+	: channels_(channels ? channels : 2)
+{
+	const double rate = sample_rate ? (double)sample_rate : 48000.0;
+	lookahead_ = std::max<size_t>(1, (size_t)std::lround(std::max(0.1f, params.attack_ms) * rate / 1000.0));
+	ceiling_ = full_scale * std::pow(10.0f, std::min(0.0f, params.ceiling_dbfs) / 20.0f);
+	const double release_frames = std::max(1.0, std::max(1.0f, params.release_ms) * rate / 1000.0);
+	release_coef_ = 1.0 - std::exp(-1.0 / release_frames);
+
+	delay_.assign(lookahead_ * channels_, 0.0f);
+	min_values_.assign(lookahead_, 1.0f);
+	min_index_.assign(lookahead_, 0);
+	avg_window_.assign(lookahead_, 1.0f);
+	avg_sum_ = (double)lookahead_;
+}
+
+void LookaheadLimiter::push(float *frame)
+{
+	float peak = 0.0f;
+	for (uint16_t ch = 0; ch < channels_; ch++)
+		peak = std::max(peak, std::fabs(frame[ch]));
+	const float required = peak > ceiling_ ? ceiling_ / peak : 1.0f;
+
+	// Sliding minimum of the required gain over the look-ahead window,
+	// kept as a monotonic ring of (value, index) pairs.
+	if (min_size_ > 0 && min_index_[min_head_] + lookahead_ <= index_) {
+		min_head_ = (min_head_ + 1) % lookahead_;
+		min_size_--;
+	}
+	while (min_size_ > 0) {
+		const size_t back = (min_head_ + min_size_ - 1) % lookahead_;
+		if (min_values_[back] < required)
+			break;
+		min_size_--;
+	}
+	const size_t slot = (min_head_ + min_size_) % lookahead_;
+	min_values_[slot] = required;
+	min_index_[slot] = index_;
+	min_size_++;
+	const float held = min_values_[min_head_];
+
+	// Averaging the held minimum over the same window ramps the gain down
+	// across the look-ahead and still reaches it before the peak leaves the
+	// delay line.
+	avg_sum_ += (double)held - (double)avg_window_[avg_pos_];
+	avg_window_[avg_pos_] = held;
+	avg_pos_ = (avg_pos_ + 1) % lookahead_;
+	const double target = std::min(1.0, avg_sum_ / (double)lookahead_);
+
+	if (target < gain_)
+		gain_ = target;
+	else
+		gain_ += (target - gain_) * release_coef_;
+	min_gain_ = std::min(min_gain_, (float)gain_);
+
+	float *in_slot = delay_.data() + delay_pos_ * channels_;
+	std::copy(frame, frame + channels_, in_slot);
+	delay_pos_ = (delay_pos_ + 1) % lookahead_;
+	const float *out_slot = delay_.data() + delay_pos_ * channels_;
+	const float g = (float)gain_;
+	for (uint16_t ch = 0; ch < channels_; ch++)
+		frame[ch] = std::max(-ceiling_, std::min(ceiling_, out_slot[ch] * g));
+	index_++;
+}
+
+void LookaheadLimiter::process(float *interleaved, size_t frames)
+{
+	for (size_t i = 0; i < frames; i++)
+		push(interleaved + i * channels_);
+}
+
+void LookaheadLimiter::drain(float *interleaved, size_t frames)
+{
+	std::fill(interleaved, interleaved + frames * channels_, 0.0f);
+	process(interleaved, frames);
+}
+
+}
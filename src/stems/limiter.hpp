@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace stems {
+
+struct LimiterParams {
+	float ceiling_dbfs = -1.0f;
+	float attack_ms = 5.0f;
+	float release_ms = 100.0f;
+};
+
+// Channel-linked look-ahead peak limiter. Output is delayed by latency()
+// frames; drain() pushes the delayed tail out at the end of a stream.
+class LookaheadLimiter {
+public:
+	LookaheadLimiter(uint32_t sample_rate, uint16_t channels, const LimiterParams &params, float full_scale = 1.0f);
+
+	void process(float *interleaved, size_t frames);
+	void drain(float *interleaved, size_t frames);
+
+	size_t latency() const { return lookahead_ - 1; }
+	float min_gain() const { return min_gain_; }
+
+private:
+	void push(float *frame);
+
+	uint16_t channels_;
+	size_t lookahead_;
+	float ceiling_;
+	double release_coef_;
+
+	std::vector<float> delay_;
+	size_t delay_pos_ = 0;
+
+	std::vector<float> min_values_;
+	std::vector<uint64_t> min_index_;
+	size_t min_head_ = 0;
+	size_t min_size_ = 0;
+
+	std::vector<float> avg_window_;
+	size_t avg_pos_ = 0;
+	double avg_sum_ = 0.0;
+
+	double gain_ = 1.0;
+	float min_gain_ = 1.0f;
+	uint64_t index_ = 0;
+};
+
+} 
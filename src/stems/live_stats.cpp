@@ -0,0 +1,192 @@
+#include "live_stats.hpp"
+
+#include <obs-module.h>
+
+#include <chrono>
+#include <cstdio>
+#include <unordered_set>
+
+namespace stems {
+
+static double ms(uint64_t ns)
+{
+	return (double)ns / 1e6;
+}
+
+void LiveStatsWindow::apply(LiveStats &stats)
+{
+	HotPathCounts total;
+	std::unordered_set<std::string> callback_sources;
+	std::unordered_map<std::string, HotPathCounts> next;
+	for (auto &s : stats.stems) {
+		const std::string key = s.session + '\n' + s.source_uuid;
+		HotPathCounts window = s.counts;
+		auto it = prev_.find(key);
+		if (it != prev_.end()) {
+			window.audio_callback_ns.subtract(it->second.audio_callback_ns);
+			window.queue_depth.subtract(it->second.queue_depth);
+			window.write_ns.subtract(it->second.write_ns);
+			window.wake_to_write_ns.subtract(it->second.wake_to_write_ns);
+		}
+		s.audio_callback_ns = summarize(window.audio_callback_ns);
+		s.queue_depth = summarize(window.queue_depth);
+		s.write_ns = summarize(window.write_ns);
+		s.wake_to_write_ns = summarize(window.wake_to_write_ns);
+
+		// Recording and streaming sessions share a source's callback.
+		if (callback_sources.insert(s.source_uuid).second)
+			total.audio_callback_ns.add(window.audio_callback_ns);
+		total.queue_depth.add(window.queue_depth);
+		total.write_ns.add(window.write_ns);
+		total.wake_to_write_ns.add(window.wake_to_write_ns);
+		next[key] = s.counts;
+	}
+	stats.audio_callback_ns = summarize(total.audio_callback_ns);
+	stats.queue_depth = summarize(total.queue_depth);
+	stats.write_ns = summarize(total.write_ns);
+	stats.wake_to_write_ns = summarize(total.wake_to_write_ns);
+	stats.window_ns = prev_taken_ns_ ? stats.taken_ns - prev_taken_ns_ : 0;
+	prev_taken_ns_ = stats.taken_ns;
+	prev_ = std::move(next);
+}
+
+void log_live_stats(const LiveStats &stats)
+{
+	char window[32] = "since start";
+	if (stats.window_ns)
+		snprintf(window, sizeof(window), "over the last %.1f s", (double)stats.window_ns / 1e9);
+	blog(LOG_INFO,
+	     "Audio Stems: stats for %zu stems %s: audio callback p50 %.3f / p99 %.3f / max %.3f ms, "
+	     "write p99 %.2f ms, wake-to-write p99 %.2f ms, queue depth p99 %llu / max %llu, %zu sessions "
+	     "waiting for post-processing",
+	     stats.stems.size(), window, ms(stats.audio_callback_ns.p50), ms(stats.audio_callback_ns.p99),
+	     ms(stats.audio_callback_ns.max), ms(stats.write_ns.p99), ms(stats.wake_to_write_ns.p99),
+	     (unsigned long long)stats.queue_depth.p99, (unsigned long long)stats.queue_depth.max,
+	     stats.finalize_queued);
+	if (stats.finalize_busy)
+		blog(LOG_INFO, "Audio Stems:   post-processing %zu/%zu stems: %s", stats.finalize_stems_done,
+		     stats.finalize_stems_total, stats.finalize_session.c_str());
+	for (const auto &s : stats.stems) {
+		blog(LOG_INFO,
+		     "Audio Stems:   %s/%s: callback p99 %.3f ms, write p99 %.2f ms, wake-to-write p99 %.2f ms, "
+		     "queue p99 %llu/%zu, %llu dropped",
+		     s.session.c_str(), s.source_name.c_str(), ms(s.audio_callback_ns.p99), ms(s.write_ns.p99),
+		     ms(s.wake_to_write_ns.p99), (unsigned long long)s.queue_depth.p99, s.queue_capacity,
+		     (unsigned long long)s.dropped_chunks);
+	}
+}
+
+static obs_data_t *summary_data(const HistogramSummary &s)
+{
+	obs_data_t *d = obs_data_create();
+	obs_data_set_int(d, "count", (int64_t)s.count);
+	obs_data_set_int(d, "p50", (int64_t)s.p50);
+	obs_data_set_int(d, "p90", (int64_t)s.p90);
+	obs_data_set_int(d, "p99", (int64_t)s.p99);
+	obs_data_set_int(d, "max", (int64_t)s.max);
+	obs_data_set_double(d, "mean", s.mean);
+	return d;
+}
+
+static void set_summary(obs_data_t *parent, const char *name, const HistogramSummary &s)
+{
+	obs_data_t *d = summary_data(s);
+	obs_data_set_obj(parent, name, d);
+	obs_data_release(d);
+}
+
+bool write_live_stats_json(const LiveStats &stats, const std::string &path)
+{
+	obs_data_t *root = obs_data_create();
+	obs_data_set_int(root, "taken_ns", (int64_t)stats.taken_ns);
+	obs_data_set_int(root, "window_ns", (int64_t)stats.window_ns);
+	obs_data_set_int(root, "finalize_queued", (int64_t)stats.finalize_queued);
+	if (stats.finalize_busy) {
+		obs_data_t *f = obs_data_create();
+		obs_data_set_string(f, "session", stats.finalize_session.c_str());
+		obs_data_set_int(f, "stems_done", (int64_t)stats.finalize_stems_done);
+		obs_data_set_int(f, "stems_total", (int64_t)stats.finalize_stems_total);
+		obs_data_set_obj(root, "finalizing", f);
+		obs_data_release(f);
+	}
+	set_summary(root, "audio_callback_ns", stats.audio_callback_ns);
+	set_summary(root, "queue_depth", stats.queue_depth);
+	set_summary(root, "write_ns", stats.write_ns);
+	set_summary(root, "wake_to_write_ns", stats.wake_to_write_ns);
+
+	obs_data_array_t *stems = obs_data_array_create();
+	for (const auto &s : stats.stems) {
+		obs_data_t *it = obs_data_create();
+		obs_data_set_string(it, "session", s.session.c_str());
+		obs_data_set_string(it, "source_uuid", s.source_uuid.c_str());
+		obs_data_set_string(it, "source_name", s.source_name.c_str());
+		obs_data_set_int(it, "frames_written", (int64_t)s.frames_written);
+		obs_data_set_int(it, "dropped_chunks", (int64_t)s.dropped_chunks);
+		obs_data_set_int(it, "queue_capacity", (int64_t)s.queue_capacity);
+		set_summary(it, "audio_callback_ns", s.audio_callback_ns);
+		set_summary(it, "queue_depth", s.queue_depth);
+		set_summary(it, "write_ns", s.write_ns);
+		set_summary(it, "wake_to_write_ns", s.wake_to_write_ns);
+		obs_data_array_push_back(stems, it);
+		obs_data_release(it);
+	}
+	obs_data_set_array(root, "stems", stems);
+	obs_data_array_release(stems);
+
+	const bool ok = obs_data_save_json_safe(root, path.c_str(), "tmp", nullptr);
+	obs_data_release(root);
+	return ok;
+}
+
+StatsReporter::~StatsReporter()
+{
+	stop();
+}
+
+void StatsReporter::configure(int interval_s, const std::string &json_path, LiveStatsFn collect)
+{
+	stop();
+	if (interval_s <= 0 || !collect)
+		return;
+	std::lock_guard<std::mutex> lock(mtx_);
+	quit_ = false;
+	window_ = LiveStatsWindow();
+	interval_s_ = interval_s;
+	json_path_ = json_path;
+	collect_ = std::move(collect);
+	worker_ = std::thread(&StatsReporter::worker_main, this);
+}
+
+void StatsReporter::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		quit_ = true;
+	}
+	cv_.notify_all();
+	if (worker_.joinable())
+		worker_.join();
+}
+
+void StatsReporter::worker_main()
+{
+	std::unique_lock<std::mutex> lock(mtx_);
+	for (;;) {
+		if (cv_.wait_for(lock, std::chrono::seconds(interval_s_), [this]() { return quit_; }))
+			return;
+		const std::string path = json_path_;
+		LiveStatsFn collect = collect_;
+		lock.unlock();
+
+		LiveStats stats = collect();
+		window_.apply(stats);
+		if (!stats.stems.empty()) {
+			log_live_stats(stats);
+			if (!path.empty() && !write_live_stats_json(stats, path))
+				blog(LOG_WARNING, "Audio Stems: failed writing stats to %s", path.c_str());
+		}
+		lock.lock();
+	}
+}
+
+}
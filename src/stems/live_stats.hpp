@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "histogram.hpp"
+
+namespace stems {
+
+// Hot-path histograms summed over every running stem.
+struct HotPathHistograms {
+	Histogram audio_callback_ns;
+	Histogram queue_depth;
+	Histogram write_ns;
+	Histogram wake_to_write_ns;
+};
+
+// Raw counters behind a stem's summaries.
+struct HotPathCounts {
+	HistogramCounts audio_callback_ns;
+	HistogramCounts queue_depth;
+	HistogramCounts write_ns;
+	HistogramCounts wake_to_write_ns;
+};
+
+struct StemLiveStats {
+	std::string session;
+	std::string source_uuid;
+	std::string source_name;
+	uint64_t frames_written = 0;
+	uint64_t dropped_chunks = 0;
+	size_t queue_capacity = 0;
+	HistogramSummary audio_callback_ns;
+	HistogramSummary queue_depth;
+	HistogramSummary write_ns;
+	HistogramSummary wake_to_write_ns;
+	HotPathCounts counts;
+};
+
+struct LiveStats {
+	uint64_t taken_ns = 0;
+	// Span the summaries cover after LiveStatsWindow::apply(); 0 means
+	// since each stem started.
+	uint64_t window_ns = 0;
+	HistogramSummary audio_callback_ns;
+	HistogramSummary queue_depth;
+	HistogramSummary write_ns;
+	HistogramSummary wake_to_write_ns;
+	std::vector<StemLiveStats> stems;
+	// Post-processing: the session being finalized, if any, and how many
+	// wait behind it.
+	bool finalize_busy = false;
+	std::string finalize_session;
+	size_t finalize_stems_done = 0;
+	size_t finalize_stems_total = 0;
+	size_t finalize_queued = 0;
+};
+
+void log_live_stats(const LiveStats &stats);
+bool write_live_stats_json(const LiveStats &stats, const std::string &path);
+
+using LiveStatsFn = std::function<LiveStats()>;
+
+// Replaces the cumulative summaries of each snapshot with those of the
+// samples recorded since the previous snapshot passed to apply(), so a
+// stall shows up in the interval it happened in. Totals are summed from
+// the stems. Each consumer keeps its own window.
+class LiveStatsWindow {
+public:
+	void apply(LiveStats &stats);
+
+private:
+	uint64_t prev_taken_ns_ = 0;
+	std::unordered_map<std::string, HotPathCounts> prev_;
+};
+
+// Takes a snapshot every interval and writes it to the log and, with a
+// path, to a JSON file that is replaced each time.
+class StatsReporter {
+public:
+	StatsReporter() = default;
+	~StatsReporter();
+	StatsReporter(const StatsReporter &) = delete;
+	StatsReporter &operator=(const StatsReporter &) = delete;
+
+	// interval_s <= 0 stops reporting. Must not be called while collect
+	// could be blocked on a lock the caller holds.
+	void configure(int interval_s, const std::string &json_path, LiveStatsFn collect);
+	void stop();
+
+private:
+	void worker_main();
+
+	LiveStatsWindow window_;
+	std::mutex mtx_;
+	std::condition_variable cv_;
+	std::thread worker_;
+	bool quit_ = false;
+	int interval_s_ = 0;
+	std::string json_path_;
+	LiveStatsFn collect_;
+};
+
+}
@@ -0,0 +1,261 @@
+#include "loudness.hpp"
+
+#include "dsp.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace stems {
+
+static const double k_pi = 3.14159265358979323846;
+static const size_t k_taps_per_phase = 12;
+static const size_t k_scan_frames = 1024;
+
+static double channel_weight(uint16_t channels, uint16_t ch)
+{
+	switch (channels) {
+	case 3:
+		return ch == 2 ? 0.0 : 1.0;
+	case 4:
+		return ch == 3 ? 1.41 : 1.0;
+	case 5:
+		return ch == 3 ? 0.0 : (ch == 4 ? 1.41 : 1.0);
+	case 6:
+	case 8:
+		return ch == 3 ? 0.0 : (ch >= 4 ? 1.41 : 1.0);
+	default:
+		return 1.0;
+	}
+}
+
+LoudnessMeter::LoudnessMeter(uint32_t sample_rate, uint16_t channels)
+	: sample_rate_(sample_rate ? sample_rate : 48000),
+	  channels_(channels ? channels : 2)
+{
+	const double rate = (double)sample_rate_;
+
+	{
+		const double f0 = 1681.974450955533;
+		const double gain_db = 3.999843853973347;
+		const double q = 0.7071752369554196;
+		const double k = std::tan(k_pi * f0 / rate);
+		const double vh = std::pow(10.0, gain_db / 20.0);
+		const double vb = std::pow(vh, 0.4996667741545416);
+		const double a0 = 1.0 + k / q + k * k;
+		shelf_.b0 = (vh + vb * k / q + k * k) / a0;
+		shelf_.b1 = 2.0 * (k * k - vh) / a0;
+		shelf_.b2 = (vh - vb * k / q + k * k) / a0;
+		shelf_.a1 = 2.0 * (k * k - 1.0) / a0;
+		shelf_.a2 = (1.0 - k / q + k * k) / a0;
+	}
+	{
+		const double f0 = 38.13547087602444;
+		const double q = 0.5003270373238773;
+		const double k = std::tan(k_pi * f0 / rate);
+		const double a0 = 1.0 + k / q + k * k;
+		highpass_.b0 = 1.0;
+		highpass_.b1 = -2.0;
+		highpass_.b2 = 1.0;
+		highpass_.a1 = 2.0 * (k * k - 1.0) / a0;
+		highpass_.a2 = (1.0 - k / q + k * k) / a0;
+	}
+
+	weights_.resize(channels_);
+	for (uint16_t ch = 0; ch < channels_; ch++)
+		weights_[ch] = channel_weight(channels_, ch);
+	shelf_state_.resize(channels_);
+	highpass_state_.resize(channels_);
+	subblock_frames_ = std::max<size_t>(1, sample_rate_ / 10);
+
+	oversample_ = sample_rate_ < 96000 ? 4 : (sample_rate_ < 192000 ? 2 : 1);
+	if (oversample_ > 1) {
+		taps_ = k_taps_per_phase;
+		const size_t n = taps_ * oversample_;
+		std::vector<double> h(n);
+		double sum = 0.0;
+		for (size_t i = 0; i < n; i++) {
+			const double t = ((double)i - (double)(n - 1) / 2.0) / (double)oversample_;
+			const double sinc = t == 0.0 ? 1.0 : std::sin(k_pi * t) / (k_pi * t);
+			const double w = 0.42 - 0.5 * std::cos(2.0 * k_pi * (double)i / (double)(n - 1)) +
+					 0.08 * std::cos(4.0 * k_pi * (double)i / (double)(n - 1));
+			h[i] = sinc * w;
+			sum += h[i];
+		}
+
+		// Laid out as [tap][phase] so all phases of one tap are contiguous.
+		fir_.assign(n, 0.0f);
+		std::vector<double> abs_sum(oversample_, 0.0);
+		for (size_t j = 0; j < taps_; j++) {
+			for (unsigned p = 0; p < oversample_; p++) {
+				const double c = h[j * oversample_ + p] * (double)oversample_ / sum;
+				fir_[j * oversample_ + p] = (float)c;
+				abs_sum[p] += std::fabs(c);
+			}
+		}
+		fir_bound_ = (float)*std::max_element(abs_sum.begin(), abs_sum.end());
+		history_.assign((size_t)channels_ * taps_ * 2, 0.0f);
+	}
+}
+
+inline double LoudnessMeter::filter_step(double in, BiquadState &s, BiquadState &h) const
+{
+	const double y1 = shelf_.b0 * in + s.s1;
+	s.s1 = shelf_.b1 * in - shelf_.a1 * y1 + s.s2;
+	s.s2 = shelf_.b2 * in - shelf_.a2 * y1;
+	const double y2 = highpass_.b0 * y1 + h.s1;
+	h.s1 = highpass_.b1 * y1 - highpass_.a1 * y2 + h.s2;
+	h.s2 = highpass_.b2 * y1 - highpass_.a2 * y2;
+	return y2 * y2;
+}
+
+void LoudnessMeter::process_s16(const int16_t *interleaved, size_t frames)
+{
+	const size_t chunk = 4096;
+	scratch_.resize(chunk * channels_);
+	while (frames > 0) {
+		const size_t n = std::min(chunk, frames);
+		const size_t samples = n * channels_;
+		for (size_t i = 0; i < samples; i++)
+			scratch_[i] = (float)interleaved[i] * (1.0f / 32768.0f);
+		accumulate(scratch_.data(), n);
+		scan_true_peak(scratch_.data(), n);
+		interleaved += samples;
+		frames -= n;
+	}
+}
+
+void LoudnessMeter::process(const float *interleaved, size_t frames)
+{
+	accumulate(interleaved, frames);
+	scan_true_peak(interleaved, frames);
+}
+
+void LoudnessMeter::accumulate(const float *interleaved, size_t frames)
+{
+	while (frames > 0) {
+		const size_t n = std::min(frames, subblock_frames_ - subblock_pos_);
+		// Channels run in pairs so the two recursive filter chains overlap.
+		for (uint16_t ch = 0; ch < channels_; ch += 2) {
+			const bool pair = ch + 1 < channels_;
+			BiquadState s0 = shelf_state_[ch];
+			BiquadState h0 = highpass_state_[ch];
+			BiquadState s1 = pair ? shelf_state_[ch + 1] : BiquadState{};
+			BiquadState h1 = pair ? highpass_state_[ch + 1] : BiquadState{};
+			double e0 = 0.0;
+			double e1 = 0.0;
+			const float *x = interleaved + ch;
+			const size_t stride = channels_;
+			for (size_t i = 0; i < n; i++) {
+				const double in0 = (double)x[i * stride];
+				const double in1 = pair ? (double)x[i * stride + 1] : 0.0;
+				e0 += filter_step(in0, s0, h0);
+				e1 += filter_step(in1, s1, h1);
+			}
+			shelf_state_[ch] = s0;
+			highpass_state_[ch] = h0;
+			subblock_energy_ += weights_[ch] * e0;
+			if (pair) {
+				shelf_state_[ch + 1] = s1;
+				highpass_state_[ch + 1] = h1;
+				subblock_energy_ += weights_[ch + 1] * e1;
+			}
+		}
+		subblock_pos_ += n;
+		interleaved += n * channels_;
+		frames -= n;
+		if (subblock_pos_ == subblock_frames_)
+			close_subblock();
+	}
+}
+
+void LoudnessMeter::close_subblock()
+{
+	recent_[recent_count_ % 4] = subblock_energy_;
+	recent_count_++;
+	subblock_energy_ = 0.0;
+	subblock_pos_ = 0;
+	if (recent_count_ >= 4) {
+		const double sum = (recent_[0] + recent_[1]) + (recent_[2] + recent_[3]);
+		blocks_.push_back(sum / (double)(4 * subblock_frames_));
+	}
+}
+
+void LoudnessMeter::scan_true_peak(const float *interleaved, size_t frames)
+{
+	while (frames > 0) {
+		const size_t n = std::min(frames, k_scan_frames);
+		const float peak = dsp::abs_max_f32(interleaved, n * channels_);
+		sample_peak_ = std::max(sample_peak_, (double)peak);
+		true_peak_ = std::max(true_peak_, (double)peak);
+
+		// The interpolated output can't exceed the input peak times the
+		// largest phase gain, so quiet spans after a loud one are skipped.
+		const bool skip = oversample_ == 1 ||
+				  (double)(std::max(peak, prev_peak_) * fir_bound_) <= true_peak_;
+		if (oversample_ > 1) {
+			for (uint16_t ch = 0; ch < channels_; ch++) {
+				float *hist = history_.data() + (size_t)ch * taps_ * 2;
+				size_t pos = history_pos_;
+				float best = 0.0f;
+				for (size_t i = 0; i < n; i++) {
+					const float x = interleaved[i * channels_ + ch];
+					pos = pos == 0 ? taps_ - 1 : pos - 1;
+					hist[pos] = x;
+					hist[pos + taps_] = x;
+					if (skip)
+						continue;
+					float acc[4] = {};
+					const float *hp = hist + pos;
+					for (size_t j = 0; j < taps_; j++) {
+						const float *c = fir_.data() + j * oversample_;
+						for (unsigned p = 0; p < oversample_; p++)
+							acc[p] += c[p] * hp[j];
+					}
+					for (unsigned p = 0; p < oversample_; p++)
+						best = std::max(best, std::fabs(acc[p]));
+				}
+				true_peak_ = std::max(true_peak_, (double)best);
+				if (ch + 1 == channels_)
+					history_pos_ = pos;
+			}
+		}
+		prev_peak_ = peak;
+		interleaved += n * channels_;
+		frames -= n;
+	}
+}
+
+LoudnessStats LoudnessMeter::stats() const
+{
+	LoudnessStats out;
+	out.true_peak = true_peak_;
+	out.sample_peak = sample_peak_;
+
+	const double abs_gate = std::pow(10.0, (-70.0 + 0.691) / 10.0);
+	double sum = 0.0;
+	size_t count = 0;
+	for (double z : blocks_) {
+		if (z > abs_gate) {
+			sum += z;
+			count++;
+		}
+	}
+	if (count == 0)
+		return out;
+
+	const double rel_gate = std::max(abs_gate, (sum / (double)count) * 0.1);
+	sum = 0.0;
+	count = 0;
+	for (double z : blocks_) {
+		if (z > rel_gate) {
+			sum += z;
+			count++;
+		}
+	}
+	if (count == 0)
+		return out;
+	out.integrated_lufs = -0.691 + 10.0 * std::log10(sum / (double)count);
+	return out;
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace stems {
+
+struct LoudnessStats {
+	double integrated_lufs = -std::numeric_limits<double>::infinity();
+	double true_peak = 0.0;
+	double sample_peak = 0.0;
+};
+
+// ITU-R BS.1770 / EBU R128 integrated loudness with gated 400 ms blocks and
+// an oversampled true-peak estimate. Feed it interleaved audio in any chunk
+// size; stats() can be read at any point.
+class LoudnessMeter {
+public:
+	LoudnessMeter(uint32_t sample_rate, uint16_t channels);
+
+	void process(const float *interleaved, size_t frames);
+	void process_s16(const int16_t *interleaved, size_t frames);
+
+	LoudnessStats stats() const;
+	uint32_t sample_rate() const { return sample_rate_; }
+	uint16_t channels() const { return channels_; }
+
+private:
+	struct Biquad {
+		double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+	};
+	struct BiquadState {
+		double s1 = 0.0, s2 = 0.0;
+	};
+
+	double filter_step(double in, BiquadState &s, BiquadState &h) const;
+	void accumulate(const float *interleaved, size_t frames);
+	void close_subblock();
+	void scan_true_peak(const float *interleaved, size_t frames);
+
+	uint32_t sample_rate_;
+	uint16_t channels_;
+	std::vector<double> weights_;
+
+	Biquad shelf_;
+	Biquad highpass_;
+	std::vector<BiquadState> shelf_state_;
+	std::vector<BiquadState> highpass_state_;
+
+	size_t subblock_frames_ = 0;
+	size_t subblock_pos_ = 0;
+	double subblock_energy_ = 0.0;
+	double recent_[4] = {};
+	size_t recent_count_ = 0;
+	std::vector<double> blocks_;
+
+	unsigned oversample_ = 1;
+	size_t taps_ = 0;
+	std::vector<float> fir_;
+	float fir_bound_ = 1.0f;
+	std::vector<float> history_;
+	size_t history_pos_ = 0;
+	float prev_peak_ = 0.0f;
+	double true_peak_ = 0.0;
+	double sample_peak_ = 0.0;
+
+	std::vector<float> scratch_;
+};
+
+} 
@@ -0,0 +1,56 @@
+#include "parallel.hpp"
+
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace stems {
+
+static thread_local bool t_in_parallel = false;
+
+size_t parallel_workers(size_t tasks)
+{
+	size_t hw = std::thread::hardware_concurrency();
+	if (hw == 0)
+		hw = 2;
+	if (t_in_parallel)
+		hw = 1;
+	return std::max<size_t>(1, std::min(hw, tasks));
+}
+
+void parallel_for(size_t tasks, size_t workers, const std::function<void(size_t worker, size_t task)> &fn)
+{
+	if (tasks == 0)
+		return;
+	workers = std::max<size_t>(1, std::min(workers, tasks));
+
+	std::atomic<size_t> next{0};
+	auto run = [&](size_t worker) {
+		const bool nested = t_in_parallel;
+		t_in_parallel = nested || workers > 1;
+		for (;;) {
+			const size_t task = next.fetch_add(1, std::memory_order_relaxed);
+			if (task >= tasks)
+				break;
+			fn(worker, task);
+		}
+		t_in_parallel = nested;
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(workers - 1);
+	for (size_t w = 1; w < workers; w++) {
+		threads.emplace_back([&run, w]() {
+			trace::name_thread("parallel worker");
+			run(w);
+		});
+	}
+	run(0);
+	for (auto &t : threads)
+		t.join();
+}
+
+}
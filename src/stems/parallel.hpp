@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace stems {
+
+size_t parallel_workers(size_t tasks);
+
+// Runs fn(worker, task) for every task in [0, tasks). Tasks are claimed in
+// order by up to `workers` threads, the calling thread included. Nested calls
+// from inside a worker run serially on that worker.
+void parallel_for(size_t tasks, size_t workers, const std::function<void(size_t worker, size_t task)> &fn);
+
+} 
@@ -0,0 +1,82 @@
+#include "recorder_pool.hpp"
+
+#include <algorithm>
+
+namespace stems {
+
+std::unique_ptr<StemRecorder> RecorderPool::acquire()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		leased_++;
+		if (!idle_.empty()) {
+			std::unique_ptr<StemRecorder> rec = std::move(idle_.back());
+			idle_.pop_back();
+			hits_++;
+			return rec;
+		}
+		misses_++;
+	}
+	auto rec = std::make_unique<StemRecorder>();
+	rec->warm();
+	return rec;
+}
+
+void RecorderPool::release(std::unique_ptr<StemRecorder> recorder)
+{
+	if (!recorder)
+		return;
+	recorder->stop();
+
+	std::unique_ptr<StemRecorder> excess;
+	std::lock_guard<std::mutex> lock(mtx_);
+	leased_ -= std::min<size_t>(leased_, 1);
+	if (idle_.size() < max_idle_)
+		idle_.push_back(std::move(recorder));
+	else
+		excess = std::move(recorder);
+}
+
+void RecorderPool::reserve(size_t count)
+{
+	count = std::min(count, max_idle_);
+	std::vector<std::unique_ptr<StemRecorder>> fresh;
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (idle_.size() + leased_ >= count)
+			return;
+		count -= idle_.size() + leased_;
+	}
+	for (size_t i = 0; i < count; i++) {
+		fresh.push_back(std::make_unique<StemRecorder>());
+		fresh.back()->warm();
+	}
+	std::lock_guard<std::mutex> lock(mtx_);
+	for (auto &rec : fresh) {
+		if (idle_.size() >= max_idle_)
+			break;
+		idle_.push_back(std::move(rec));
+	}
+}
+
+void RecorderPool::clear()
+{
+	std::vector<std::unique_ptr<StemRecorder>> idle;
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		idle.swap(idle_);
+	}
+}
+
+RecorderPoolStats RecorderPool::stats() const
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	RecorderPoolStats s;
+	s.hits = hits_;
+	s.misses = misses_;
+	s.idle = idle_.size();
+	s.leased = leased_;
+	return s;
+}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "stem_recorder.hpp"
+
+namespace stems {
+
+struct RecorderPoolStats {
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	size_t idle = 0;
+	size_t leased = 0;
+};
+
+// Idle recorders kept between sessions. A returned recorder keeps its writer
+// thread, chunk queue and file buffer, so a quick restart reuses them.
+class RecorderPool {
+public:
+	explicit RecorderPool(size_t max_idle = 64) : max_idle_(max_idle) {}
+	RecorderPool(const RecorderPool &) = delete;
+	RecorderPool &operator=(const RecorderPool &) = delete;
+
+	std::unique_ptr<StemRecorder> acquire();
+	// Stops the recorder if it is still running.
+	void release(std::unique_ptr<StemRecorder> recorder);
+	// Warms up recorders until `count` stems, leased or idle, are covered.
+	void reserve(size_t count);
+	void clear();
+
+	RecorderPoolStats stats() const;
+
+private:
+	const size_t max_idle_;
+	mutable std::mutex mtx_;
+	std::vector<std::unique_ptr<StemRecorder>> idle_;
+	uint64_t hits_ = 0;
+	uint64_t misses_ = 0;
+	size_t leased_ = 0;
+};
+
+}
@@ -0,0 +1,157 @@
+#include "remix.hpp"
+
+#include "dsp.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+namespace stems {
+
+enum Speaker { FL, FR, FC, LFE, RL, RR, SL, SR, RC, NONE };
+
+static Speaker speaker_at(uint16_t channels, uint16_t index)
+{
+	static const Speaker k_2_1[] = {FL, FR, LFE};
+	static const Speaker k_4_0[] = {FL, FR, FC, RC};
+	static const Speaker k_4_1[] = {FL, FR, FC, LFE, RC};
+	static const Speaker k_5_1[] = {FL, FR, FC, LFE, RL, RR};
+	static const Speaker k_7_1[] = {FL, FR, FC, LFE, RL, RR, SL, SR};
+	switch (channels) {
+	case 1:
+		return FC;
+	case 2:
+		return index < 2 ? (Speaker)index : NONE;
+	case 3:
+		return index < 3 ? k_2_1[index] : NONE;
+	case 4:
+		return index < 4 ? k_4_0[index] : NONE;
+	case 5:
+		return index < 5 ? k_4_1[index] : NONE;
+	case 6:
+		return index < 6 ? k_5_1[index] : NONE;
+	case 8:
+		return index < 8 ? k_7_1[index] : NONE;
+	default:
+		return NONE;
+	}
+}
+
+ChannelMatrix::ChannelMatrix(uint16_t in_channels, uint16_t out_channels)
+	: in_(in_channels), out_(out_channels), m_((size_t)in_channels * out_channels, 0.0f)
+{
+}
+
+static void stereo_downmix_gains(Speaker s, float &l, float &r)
+{
+	const float c = 0.70710678f;
+	l = r = 0.0f;
+	switch (s) {
+	case FL:
+		l = 1.0f;
+		break;
+	case FR:
+		r = 1.0f;
+		break;
+	case FC:
+	case RC:
+		l = r = c;
+		break;
+	case RL:
+	case SL:
+		l = c;
+		break;
+	case RR:
+	case SR:
+		r = c;
+		break;
+	default:
+		break;
+	}
+}
+
+ChannelMatrix ChannelMatrix::standard(uint16_t in_channels, uint16_t out_channels)
+{
+	ChannelMatrix m(in_channels, out_channels);
+	if (in_channels == 0 || out_channels == 0)
+		return m;
+
+	if (in_channels == 1) {
+		for (uint16_t o = 0; o < std::min<uint16_t>(out_channels, 2); o++)
+			m.set(o, 0, 1.0f);
+		return m;
+	}
+
+	if (out_channels <= 2 && speaker_at(in_channels, 0) != NONE) {
+		for (uint16_t i = 0; i < in_channels; i++) {
+			float l, r;
+			stereo_downmix_gains(speaker_at(in_channels, i), l, r);
+			if (out_channels == 1) {
+				m.set(0, i, 0.5f * (l + r));
+			} else {
+				m.set(0, i, l);
+				m.set(1, i, r);
+			}
+		}
+		for (uint16_t o = 0; o < out_channels; o++) {
+			float sum = 0.0f;
+			for (uint16_t i = 0; i < in_channels; i++)
+				sum += std::fabs(m.at(o, i));
+			if (sum > 1.0f)
+				for (uint16_t i = 0; i < in_channels; i++)
+					m.set(o, i, m.at(o, i) / sum);
+		}
+		return m;
+	}
+
+	for (uint16_t c = 0; c < std::min(in_channels, out_channels); c++)
+		m.set(c, c, 1.0f);
+	return m;
+}
+
+bool ChannelMatrix::parse(const std::string &text, uint16_t in_channels, uint16_t out_channels, ChannelMatrix &out)
+{
+	ChannelMatrix m(in_channels, out_channels);
+	std::stringstream rows(text);
+	std::string row;
+	uint16_t o = 0;
+	while (std::getline(rows, row, ';')) {
+		std::replace(row.begin(), row.end(), ',', ' ');
+		if (row.find_first_not_of(" \t") == std::string::npos)
+			continue;
+		if (o >= out_channels)
+			return false;
+		std::stringstream cols(row);
+		uint16_t i = 0;
+		float v = 0.0f;
+		while (cols >> v) {
+			if (i >= in_channels || !std::isfinite(v))
+				return false;
+			m.set(o, i++, v);
+		}
+		if (i != in_channels || !cols.eof())
+			return false;
+		o++;
+	}
+	if (o != out_channels)
+		return false;
+	out = std::move(m);
+	return true;
+}
+
+void ChannelMatrix::apply(const float *const *in_planes, size_t frames, float *const *out_planes) const
+{
+	for (uint16_t o = 0; o < out_; o++) {
+		float *dst = out_planes[o];
+		std::memset(dst, 0, frames * sizeof(float));
+		for (uint16_t i = 0; i < in_; i++) {
+			const float g = at(o, i);
+			if (g != 0.0f && in_planes[i])
+				dsp::mix_add_f32(dst, in_planes[i], g, frames);
+		}
+	}
+}
+
+}
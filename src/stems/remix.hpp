@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace stems {
+
+// Output = matrix x input, one row per output channel. Channel order follows
+// the OBS speaker layouts (FL FR FC LFE RL RR SL SR for 7.1).
+class ChannelMatrix {
+public:
+	ChannelMatrix() = default;
+	ChannelMatrix(uint16_t in_channels, uint16_t out_channels);
+
+	// ITU-R BS.775 style downmix for 2.1/4.0/4.1/5.1/7.1 to stereo or mono,
+	// with rows scaled so a full-scale input cannot clip. Upmixes copy the
+	// front pair (mono feeds both fronts); other channels stay silent.
+	static ChannelMatrix standard(uint16_t in_channels, uint16_t out_channels);
+
+	// Rows separated by ';', coefficients by spaces or commas.
+	static bool parse(const std::string &text, uint16_t in_channels, uint16_t out_channels, ChannelMatrix &out);
+
+	uint16_t in_channels() const { return in_; }
+	uint16_t out_channels() const { return out_; }
+	float at(uint16_t out_ch, uint16_t in_ch) const { return m_[(size_t)out_ch * in_ + in_ch]; }
+	void set(uint16_t out_ch, uint16_t in_ch, float v) { m_[(size_t)out_ch * in_ + in_ch] = v; }
+
+	// Planar in/out, matching the layout of OBS audio callbacks.
+	void apply(const float *const *in_planes, size_t frames, float *const *out_planes) const;
+
+private:
+	uint16_t in_ = 0;
+	uint16_t out_ = 0;
+	std::vector<float> m_;
+};
+
+}
@@ -0,0 +1,154 @@
+#include "resampler.hpp"
+
+#include "dsp.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace stems {
+
+static const uint32_t k_max_phases = 1024;
+
+ResampleQuality resample_quality_from_string(const std::string &name)
+{
+	if (name == "fast")
+		return ResampleQuality::Fast;
+	if (name == "high")
+		return ResampleQuality::High;
+	return ResampleQuality::Medium;
+}
+
+static double bessel_i0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	const double q = x * x / 4.0;
+	for (int k = 1; k < 64; k++) {
+		term *= q / ((double)k * (double)k);
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+bool Resampler::supported(uint32_t in_rate, uint32_t out_rate)
+{
+	if (in_rate == 0 || out_rate == 0)
+		return false;
+	const uint32_t g = std::gcd(in_rate, out_rate);
+	return out_rate / g <= k_max_phases && in_rate / g <= k_max_phases;
+}
+
+uint64_t Resampler::output_frames(uint64_t in_frames, uint32_t in_rate, uint32_t out_rate)
+{
+	const uint32_t g = std::gcd(in_rate, out_rate);
+	const uint64_t up = out_rate / g;
+	const uint64_t down = in_rate / g;
+	return (in_frames * up + down - 1) / down;
+}
+
+Resampler::Resampler(uint32_t in_rate, uint32_t out_rate, uint16_t channels, ResampleQuality quality)
+	: channels_(channels ? channels : 2)
+{
+	const uint32_t g = std::gcd(in_rate, out_rate);
+	up_ = out_rate / g;
+	down_ = in_rate / g;
+
+	size_t half = 16;
+	double rolloff = 0.94;
+	double beta = 8.0;
+	switch (quality) {
+	case ResampleQuality::Fast:
+		half = 8;
+		rolloff = 0.90;
+		beta = 6.0;
+		break;
+	case ResampleQuality::High:
+		half = 32;
+		rolloff = 0.96;
+		beta = 10.0;
+		break;
+	default:
+		break;
+	}
+	// When decimating the cutoff drops with the ratio; widen the kernel to keep the
+	// transition band the same width in output samples.
+	if (down_ > up_)
+		half = half * ((down_ + up_ - 1) / up_);
+	half_ = half;
+	taps_ = half * 2;
+
+	const double cutoff = rolloff * std::min(1.0, (double)up_ / (double)down_);
+	const double i0_beta = bessel_i0(beta);
+	const double pi = 3.14159265358979323846;
+	coeffs_.resize((size_t)up_ * taps_);
+	std::vector<double> tmp(taps_);
+	for (uint32_t p = 0; p < up_; p++) {
+		const double frac = (double)p / (double)up_;
+		float *h = coeffs_.data() + (size_t)p * taps_;
+		double sum = 0.0;
+		for (size_t j = 0; j < taps_; j++) {
+			const double d = (double)j - (double)(half_ - 1) - frac;
+			const double r = d / (double)half_;
+			const double w = (r * r < 1.0) ? bessel_i0(beta * std::sqrt(1.0 - r * r)) / i0_beta : 0.0;
+			const double x = pi * cutoff * d;
+			const double s = (std::fabs(x) < 1e-12) ? 1.0 : std::sin(x) / x;
+			tmp[j] = cutoff * s * w;
+			sum += tmp[j];
+		}
+		for (size_t j = 0; j < taps_; j++)
+			h[j] = (float)(tmp[j] / sum);
+	}
+
+	history_.assign(channels_, std::vector<float>(half_ - 1, 0.0f));
+	history_base_ = -(int64_t)(half_ - 1);
+}
+
+void Resampler::produce(std::vector<float> &out, uint64_t limit)
+{
+	const int64_t available_end = history_base_ + (int64_t)history_[0].size();
+	while (out_index_ < limit) {
+		const uint64_t pos = out_index_ * down_;
+		const int64_t centre = (int64_t)(pos / up_);
+		if (centre + (int64_t)half_ >= available_end)
+			break;
+		const float *h = coeffs_.data() + (size_t)(pos % up_) * taps_;
+		const size_t first = (size_t)(centre - (int64_t)(half_ - 1) - history_base_);
+		for (uint16_t c = 0; c < channels_; c++)
+			out.push_back(dsp::dot_f32(h, history_[c].data() + first, taps_));
+		out_index_++;
+	}
+
+	const int64_t keep_from = (int64_t)(out_index_ * down_ / up_) - (int64_t)(half_ - 1);
+	if (keep_from > history_base_) {
+		const size_t drop = (size_t)std::min<int64_t>(keep_from - history_base_, (int64_t)history_[0].size());
+		for (auto &h : history_)
+			h.erase(h.begin(), h.begin() + (ptrdiff_t)drop);
+		history_base_ += (int64_t)drop;
+	}
+}
+
+void Resampler::process(const float *interleaved, size_t frames, std::vector<float> &out)
+{
+	for (uint16_t c = 0; c < channels_; c++) {
+		std::vector<float> &h = history_[c];
+		const size_t base = h.size();
+		h.resize(base + frames);
+		for (size_t i = 0; i < frames; i++)
+			h[base + i] = interleaved[i * channels_ + c];
+	}
+	in_frames_ += frames;
+	out.reserve(out.size() + (size_t)(((uint64_t)frames * up_ / down_ + 1) * channels_));
+	produce(out, UINT64_MAX);
+}
+
+void Resampler::flush(std::vector<float> &out)
+{
+	for (auto &h : history_)
+		h.resize(h.size() + half_ + 1, 0.0f);
+	produce(out, output_frames(in_frames_, down_, up_));
+}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace stems {
+
+enum class ResampleQuality {
+	Fast,
+	Medium,
+	High,
+};
+
+ResampleQuality resample_quality_from_string(const std::string &name);
+
+// Rational polyphase windowed-sinc converter. The filter is centred on each
+// output instant, so output is time-aligned with the input with no delay;
+// flush() emits the remaining tail once the input has ended.
+class Resampler {
+public:
+	Resampler(uint32_t in_rate, uint32_t out_rate, uint16_t channels, ResampleQuality quality);
+
+	// False for ratios whose reduced form needs an impractically large
+	// phase table; callers fall back to ffmpeg for those.
+	static bool supported(uint32_t in_rate, uint32_t out_rate);
+	static uint64_t output_frames(uint64_t in_frames, uint32_t in_rate, uint32_t out_rate);
+
+	void process(const float *interleaved, size_t frames, std::vector<float> &out);
+	void flush(std::vector<float> &out);
+
+	size_t taps() const { return taps_; }
+
+private:
+	void produce(std::vector<float> &out, uint64_t limit);
+
+	uint16_t channels_;
+	uint32_t up_;
+	uint32_t down_;
+	size_t half_;
+	size_t taps_;
+	std::vector<float> coeffs_;
+
+	std::vector<std::vector<float>> history_;
+	int64_t history_base_ = 0;
+	uint64_t in_frames_ = 0;
+	uint64_t out_index_ = 0;
+};
+
+}
@@ -1,16 +1,23 @@
 #include "session.hpp"
 
-#include "transcode.hpp"
-#include "wav_postprocess.hpp"
+#include "finalize.hpp"
+#include "finalize_queue.hpp"
+#include "parallel.hpp"
+#include "session_index.hpp"
+#include "session_journal.hpp"
+#include "trace.hpp"
 
 #include <obs-module.h>
 #include <obs-frontend-api.h>
 #include <util/platform.h>
+#include <chrono>
 #include <ctime>
 #include <cstdio>
 #include <filesystem>
 #include <string>
 #include <system_error>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace stems {
@@ -94,6 +101,33 @@ static uint16_t speaker_channels(enum speaker_layout speakers)
 	}
 }
 
+bool get_mix_format(uint32_t &sample_rate, uint16_t &channels)
+{
+	obs_audio_info aoi{};
+	if (!obs_get_audio_info(&aoi))
+		return false;
+	sample_rate = aoi.samples_per_sec ? aoi.samples_per_sec : 48000;
+	channels = speaker_channels(aoi.speakers);
+	return true;
+}
+
+std::vector<obs_source_t *> selected_audio_sources(const Settings &settings)
+{
+	const std::unordered_set<std::string> wanted(settings.selected_source_uuids.begin(),
+						     settings.selected_source_uuids.end());
+	std::vector<obs_source_t *> sources;
+	enumerate_audio_sources(sources);
+	std::vector<obs_source_t *> selected;
+	for (obs_source_t *src : sources) {
+		const char *uuid = obs_source_get_uuid(src);
+		if (uuid && *uuid && wanted.count(uuid))
+			selected.push_back(src);
+		else
+			obs_source_release(src);
+	}
+	return selected;
+}
+
 static uint16_t parse_channels_string(const std::string &value)
 {
 	if (value == "mono" || value == "1")
@@ -188,155 +222,518 @@ static SourceAudioProperties detect_source_audio_properties(obs_source_t *source
 	return props;
 }
 
-Session::Session(SessionKind kind, const Settings &settings) : kind_(kind), settings_(settings) {}
+static bool create_session_dir(const Settings &settings, const std::string &mode, std::string &out)
+{
+	const std::string stamp = now_stamp();
+	fs::path base = settings.output_dir.empty() ? fs::current_path() : fs::path(settings.output_dir);
+	std::error_code ec;
+	fs::create_directories(base, ec);
+	if (ec) {
+		blog(LOG_ERROR, "Audio Stems: failed creating output directory: %s", ec.message().c_str());
+		return false;
+	}
+
+	fs::path session_dir = base / (stamp + "_" + mode);
+	for (int n = 2; !fs::create_directory(session_dir, ec); n++) {
+		if (ec || n > 100) {
+			blog(LOG_ERROR, "Audio Stems: failed creating session directory: %s",
+			     ec ? ec.message().c_str() : session_dir.string().c_str());
+			return false;
+		}
+		session_dir = base / (stamp + "_" + mode + "_" + std::to_string(n));
+	}
+	out = session_dir.string();
+	return true;
+}
+
+static std::string stem_file_name(const Settings &settings, const char *uuid, const char *name)
+{
+	std::string fname = sanitize_filename(name ? name : "source");
+	if (settings.use_source_aliases) {
+		for (const auto &p : settings.source_aliases) {
+			if (p.first == (uuid ? uuid : "") && !p.second.empty()) {
+				fname = sanitize_filename(p.second);
+				break;
+			}
+		}
+	}
+	return fname;
+}
+
+static fs::path unique_wav_path(const fs::path &dir, const std::string &base,
+				std::unordered_set<std::string> *taken = nullptr)
+{
+	std::error_code ec;
+	fs::path p = dir / (base + ".wav");
+	for (int n = 2; (fs::exists(p, ec) || (taken && taken->count(p.string()))) && n <= 100; n++)
+		p = dir / (base + "_" + std::to_string(n) + ".wav");
+	if (taken)
+		taken->insert(p.string());
+	return p;
+}
+
+// Stems whose first audio has not arrived by then start padded.
+static const uint64_t k_start_gate_timeout_ns = 500000000ull;
+
+Session::Session(SessionKind kind, const Settings &settings, FinalizeQueue *finalizer, CaptureHub *hub,
+		 RecorderPool *pool)
+	: kind_(kind),
+	  settings_(settings),
+	  finalizer_(finalizer),
+	  hub_(hub),
+	  pool_(pool),
+	  selected_(settings.selected_source_uuids.begin(), settings.selected_source_uuids.end()),
+	  journal_(std::make_unique<SessionJournal>())
+{
+	if (!hub_) {
+		own_hub_ = std::make_unique<CaptureHub>();
+		hub_ = own_hub_.get();
+	}
+}
 
 Session::~Session()
 {
 	stop();
 }
 
+void Session::end_trace()
+{
+	if (tracing_)
+		trace::release();
+	tracing_ = false;
+}
+
 bool Session::start()
 {
 	stop();
+	if (settings_.trace_sessions) {
+		trace::acquire();
+		tracing_ = true;
+		trace_since_ns_ = os_gettime_ns();
+	}
+	trace::Scope span("session_start", "session");
 	markers_.clear();
-	start_ns_ = os_gettime_ns();
+	index_.clear();
+	journaled_capture_.clear();
+	session_preroll_frames_ = 0;
+	const uint64_t begin_ns = os_gettime_ns();
+	start_ns_ = begin_ns;
 
-	obs_audio_info aoi{};
-	if (!obs_get_audio_info(&aoi)) {
+	if (!get_mix_format(sample_rate_, channels_)) {
 		blog(LOG_ERROR, "Audio Stems: obs_get_audio_info failed");
+		end_trace();
 		return false;
 	}
 
-	sample_rate_ = aoi.samples_per_sec ? aoi.samples_per_sec : 48000;
-	channels_ = speaker_channels(aoi.speakers);
-
-	const std::string stamp = now_stamp();
 	const std::string mode = (kind_ == SessionKind::Recording) ? "RECORDING" : "STREAMING";
-
-	fs::path base = settings_.output_dir.empty() ? fs::current_path() : fs::path(settings_.output_dir);
-	fs::path session_dir = base / (stamp + "_" + mode);
-
-	std::error_code ec;
-	fs::create_directories(session_dir, ec);
-	if (ec) {
-		blog(LOG_ERROR, "Audio Stems: failed creating output directory: %s", ec.message().c_str());
+	if (!create_session_dir(settings_, mode, session_dir_)) {
+		end_trace();
 		return false;
 	}
-	session_dir_ = session_dir.string();
 	mark_inprogress(true);
+	if (!journal_->open(session_dir_, kind_, sample_rate_, channels_, start_ns_, settings_))
+		blog(LOG_WARNING, "Audio Stems: failed creating session journal in %s", session_dir_.c_str());
 
-	markers_.push_back(Marker{0, "session_start", mode});
+	add_marker(0, "session_start", mode);
 	if (settings_.record_scene_markers) {
 		obs_source_t *scene = obs_frontend_get_current_scene();
 		if (scene) {
 			const char *sn = obs_source_get_name(scene);
 			if (sn && *sn)
-				markers_.push_back(Marker{0, "scene", sn});
+				add_marker(0, "scene", sn);
 			obs_source_release(scene);
 		}
 	}
 
-	auto is_selected = [&](const char *uuid) {
-		if (!uuid || !*uuid)
-			return false;
-		for (const auto &u : settings_.selected_source_uuids) {
-			if (u == uuid)
-				return true;
-		}
-		return false;
-	};
-
-	std::vector<obs_source_t *> sources;
-	enumerate_audio_sources(sources);
-
-	bool any = false;
-	for (obs_source_t *src : sources) {
-		const char *uuid = obs_source_get_uuid(src);
-		if (!is_selected(uuid)) {
-			obs_source_release(src);
-			continue;
-		}
+	// Opening files and starting writers is the slow part; do it for all
+	// stems in parallel, then attach every capture in one tight batch.
+	std::vector<obs_source_t *> sources = selected_audio_sources(settings_);
+	std::vector<StemOutput> outs(sources.size());
+	std::unordered_set<std::string> taken;
+	for (size_t i = 0; i < sources.size(); i++) {
+		const char *uuid = obs_source_get_uuid(sources[i]);
+		const char *name = obs_source_get_name(sources[i]);
+		StemOutput &o = outs[i];
+		o.recorder = lease_recorder();
+		o.wav_path = unique_wav_path(fs::path(session_dir_), stem_file_name(settings_, uuid, name), &taken).string();
+		o.final_path = o.wav_path;
+		o.source_uuid = uuid ? uuid : "";
+		o.source_name = name ? name : "";
+		o.audio_properties = detect_source_audio_properties(sources[i], sample_rate_, channels_);
+	}
 
-		const char *name = obs_source_get_name(src);
-		std::string fname = sanitize_filename(name ? name : "source");
-		if (settings_.use_source_aliases) {
-			for (const auto &p : settings_.source_aliases) {
-				if (p.first == (uuid ? uuid : "") && !p.second.empty()) {
-					fname = sanitize_filename(p.second);
-					break;
-				}
-			}
+	std::vector<char> ok(sources.size(), 0);
+	parallel_for(sources.size(), parallel_workers(sources.size()), [&](size_t, size_t i) {
+		trace::Scope prepare_span("prepare_stem", "session", outs[i].source_name);
+		auto source = HubSource::create(*hub_, sources[i]);
+		ok[i] = outs[i].recorder->prepare(std::move(source), outs[i].wav_path, sample_rate_, channels_) ? 1 : 0;
+	});
+	const uint64_t prepared_ns = os_gettime_ns();
+
+	size_t prepared = 0;
+	for (char v : ok)
+		prepared += v ? 1 : 0;
+	auto gate = std::make_shared<StartGate>(prepared, k_start_gate_timeout_ns);
+	const DitherMode dither = dither_mode_from_string(settings_.dither_mode);
+	start_ns_ = os_gettime_ns();
+	for (size_t i = 0; i < sources.size(); i++) {
+		if (ok[i] && !outs[i].recorder->attach(dither, gate)) {
+			ok[i] = 0;
+			gate->leave();
 		}
-		fs::path wavp = session_dir / (fname + ".wav");
+	}
+	const uint64_t attached_ns = os_gettime_ns();
+	trace::record("attach_stems", "session", start_ns_, attached_ns);
 
-		auto rec = std::make_unique<StemRecorder>();
-		if (!rec->start(src, wavp.string(), sample_rate_, channels_)) {
-			blog(LOG_ERROR, "Audio Stems: failed starting stem for %s", name ? name : "(null)");
-			obs_source_release(src);
+	bool any = false;
+	for (size_t i = 0; i < sources.size(); i++) {
+		obs_source_release(sources[i]);
+		if (!ok[i]) {
+			blog(LOG_ERROR, "Audio Stems: failed starting stem for %s", outs[i].source_name.c_str());
+			return_recorder(std::move(outs[i].recorder));
 			continue;
 		}
-
-		StemOutput o;
-		o.recorder = std::move(rec);
-		o.wav_path = wavp.string();
-		o.final_path = wavp.string();
-		o.source_uuid = uuid ? uuid : "";
-		o.source_name = name ? name : "";
-		o.audio_properties = detect_source_audio_properties(src, sample_rate_, channels_);
-		stems_.push_back(std::move(o));
+		outs[i].preroll_frames = outs[i].recorder->preroll_frames();
+		index_[outs[i].source_uuid] = stems_.size();
+		stems_.push_back(std::move(outs[i]));
+		journal_->stem(stems_.back());
 		any = true;
-
-		obs_source_release(src);
 	}
 
 	if (!any) {
 		blog(LOG_WARNING, "Audio Stems: no selected audio sources to record (%s)", mode.c_str());
+		journal_->close();
+		SessionJournal::remove(session_dir_);
+		mark_inprogress(false);
+		open_sessions_remove(settings_.output_dir, session_dir_);
 		stop();
+		end_trace();
 		return false;
 	}
 
+	session_preroll_frames_ = stems_.front().preroll_frames;
 	running_ = true;
-	blog(LOG_INFO, "Audio Stems: session started (%s)", mode.c_str());
+	journal_->flush();
+	journal_quit_ = false;
+	journal_thread_ = std::thread(&Session::journal_main, this);
+	connect_signals(true);
+	blog(LOG_INFO, "Audio Stems: session started (%s, %zu stems in %.1f ms: files %.1f ms, attach %.2f ms)",
+	     mode.c_str(), stems_.size(), (double)(attached_ns - begin_ns) / 1e6,
+	     (double)(prepared_ns - begin_ns) / 1e6, (double)(attached_ns - start_ns_) / 1e6);
+	if (pool_) {
+		const RecorderPoolStats ps = pool_->stats();
+		blog(LOG_INFO, "Audio Stems: recorder pool %llu hits, %llu misses, %zu idle",
+		     (unsigned long long)ps.hits, (unsigned long long)ps.misses, ps.idle);
+	}
+	if (session_preroll_frames_ > 0)
+		blog(LOG_INFO, "Audio Stems: stems include %.2f s of pre-roll (%zu KiB buffered)",
+		     (double)session_preroll_frames_ / sample_rate_, hub_->history_bytes() / 1024);
 	return true;
 }
 
 void Session::stop()
 {
+	// Disconnecting waits for any signal callback still in flight.
+	connect_signals(false);
+	stop_journal_thread();
+
+	std::lock_guard<std::mutex> lock(mtx_);
 	if (!running_ && stems_.empty())
 		return;
 
-	uint64_t off = 0;
-	if (start_ns_ != 0) {
-		uint64_t now = os_gettime_ns();
-		off = (now > start_ns_) ? (now - start_ns_) : 0;
-	}
-	markers_.push_back(Marker{off, "session_stop", ""});
-
-	std::vector<StemOutput> finished;
-	finished.swap(stems_);
-	for (auto &o : finished) {
-		if (o.recorder)
+	trace::Scope span("session_stop", "session");
+	add_marker(elapsed_ns(), "session_stop", "");
+
+	auto job = std::make_unique<FinalizeJob>();
+	job->kind = kind_;
+	job->settings = settings_;
+	job->session_dir = session_dir_;
+	job->sample_rate = sample_rate_;
+	job->channels = channels_;
+	job->start_ns = start_ns_;
+	job->markers = markers_;
+	job->trace = tracing_;
+	job->trace_since_ns = trace_since_ns_;
+	tracing_ = false;
+	job->stems.swap(stems_);
+	index_.clear();
+	for (auto &o : job->stems) {
+		// Start alignment may have trimmed the pre-roll slightly.
+		if (o.recorder && o.recorder->preroll_frames() > 0)
+			o.preroll_frames = o.recorder->preroll_frames();
+		if (o.recorder) {
+			trace::Scope stop_span("stop_stem", "session", o.source_name);
 			o.recorder->stop();
+			o.capture_stats = o.recorder->capture_stats();
+			o.has_capture_stats = true;
+		}
 		if (o.source_uuid.empty())
 			o.source_uuid = o.recorder ? o.recorder->source_uuid() : "";
 		if (o.source_name.empty())
 			o.source_name = o.recorder ? o.recorder->source_name() : "";
-		o.recorder.reset();
+		return_recorder(std::move(o.recorder));
 	}
+	for (size_t i = 0; i < job->stems.size(); i++) {
+		const StemOutput &o = job->stems[i];
+		if (o.has_capture_stats)
+			journal_capture(i, o.capture_stats.dropped_chunks, o.capture_stats.write_failed);
+	}
+	journal_->close();
 	running_ = false;
 	mark_inprogress(false);
-	postprocess_stems(finished);
-	if (settings_.write_sidecar_json)
-		write_sidecar_json(finished);
+
+	if (finalizer_)
+		finalizer_->submit(std::move(job));
+	else
+		finalize_session(*job, nullptr, nullptr);
+}
+
+void Session::collect_stats(std::vector<StemLiveStats> &out, HotPathHistograms *total)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (!running_)
+		return;
+	const std::string name = fs::path(session_dir_).filename().string();
+	for (const auto &o : stems_) {
+		if (!o.recorder || !o.recorder->has_source())
+			continue;
+		StemLiveStats st;
+		st.session = name;
+		o.recorder->collect_stats(st, total);
+		out.push_back(std::move(st));
+	}
 }
 
 void Session::on_scene_changed(const std::string &scene_name)
 {
+	std::lock_guard<std::mutex> lock(mtx_);
 	if (!running_ || !settings_.record_scene_markers)
 		return;
-	uint64_t now = os_gettime_ns();
-	uint64_t off = (now > start_ns_) ? (now - start_ns_) : 0;
-	markers_.push_back(Marker{off, "scene", scene_name});
+	add_marker(elapsed_ns(), "scene", scene_name);
+}
+
+void Session::update_selection(const Settings &settings)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (!running_)
+		return;
+	settings_.selected_source_uuids = settings.selected_source_uuids;
+	selected_ = std::unordered_set<std::string>(settings.selected_source_uuids.begin(),
+						    settings.selected_source_uuids.end());
+
+	std::vector<std::string> deselected;
+	for (const auto &entry : index_) {
+		if (!is_selected(entry.first.c_str()))
+			deselected.push_back(entry.first);
+	}
+	for (const auto &uuid : deselected)
+		release_stem(uuid);
+
+	const uint64_t pad = session_preroll_frames_ + elapsed_ns() * sample_rate_ / 1000000000ULL;
+	for (obs_source_t *src : selected_audio_sources(settings_)) {
+		const char *uuid = obs_source_get_uuid(src);
+		auto it = index_.find(uuid);
+		if (it == index_.end() || !stems_[it->second].recorder->has_source()) {
+			if (add_stem(src, pad))
+				add_marker(elapsed_ns(), "source_added", stems_.back().source_name);
+		}
+		obs_source_release(src);
+	}
+}
+
+void Session::source_create_cb(void *data, calldata_t *cd)
+{
+	auto *self = static_cast<Session *>(data);
+	auto *source = static_cast<obs_source_t *>(calldata_ptr(cd, "source"));
+	if (!self || !source || (obs_source_get_output_flags(source) & OBS_SOURCE_AUDIO) == 0)
+		return;
+	const char *uuid = obs_source_get_uuid(source);
+
+	std::lock_guard<std::mutex> lock(self->mtx_);
+	if (!self->running_ || !self->is_selected(uuid))
+		return;
+	auto it = self->index_.find(uuid);
+	if (it != self->index_.end() && self->stems_[it->second].recorder->has_source())
+		return;
+	const uint64_t offset = self->elapsed_ns();
+	const uint64_t pad = self->session_preroll_frames_ + offset * self->sample_rate_ / 1000000000ULL;
+	if (self->add_stem(source, pad)) {
+		self->add_marker(offset, "source_added", self->stems_.back().source_name);
+		blog(LOG_INFO, "Audio Stems: added stem for %s at %.2f s", self->stems_.back().source_name.c_str(),
+		     (double)offset / 1e9);
+	}
+}
+
+void Session::source_remove_cb(void *data, calldata_t *cd)
+{
+	auto *self = static_cast<Session *>(data);
+	auto *source = static_cast<obs_source_t *>(calldata_ptr(cd, "source"));
+	if (!self || !source)
+		return;
+	const char *uuid = obs_source_get_uuid(source);
+	if (!uuid)
+		return;
+
+	std::lock_guard<std::mutex> lock(self->mtx_);
+	if (self->running_)
+		self->release_stem(uuid);
+}
+
+void Session::source_rename_cb(void *data, calldata_t *cd)
+{
+	auto *self = static_cast<Session *>(data);
+	auto *source = static_cast<obs_source_t *>(calldata_ptr(cd, "source"));
+	const char *new_name = calldata_string(cd, "new_name");
+	if (!self || !source || !new_name)
+		return;
+	const char *uuid = obs_source_get_uuid(source);
+	if (!uuid)
+		return;
+
+	std::lock_guard<std::mutex> lock(self->mtx_);
+	auto it = self->index_.find(uuid);
+	if (!self->running_ || it == self->index_.end())
+		return;
+	StemOutput &o = self->stems_[it->second];
+	if (!o.recorder->has_source())
+		return;
+	o.source_name = new_name;
+	self->add_marker(self->elapsed_ns(), "source_renamed", new_name);
+}
+
+void Session::connect_signals(bool connect)
+{
+	if (connect == signals_connected_)
+		return;
+	signal_handler_t *sh = obs_get_signal_handler();
+	if (!sh)
+		return;
+	if (connect) {
+		signal_handler_connect(sh, "source_create", &Session::source_create_cb, this);
+		signal_handler_connect(sh, "source_remove", &Session::source_remove_cb, this);
+		signal_handler_connect(sh, "source_destroy", &Session::source_remove_cb, this);
+		signal_handler_connect(sh, "source_rename", &Session::source_rename_cb, this);
+	} else {
+		signal_handler_disconnect(sh, "source_create", &Session::source_create_cb, this);
+		signal_handler_disconnect(sh, "source_remove", &Session::source_remove_cb, this);
+		signal_handler_disconnect(sh, "source_destroy", &Session::source_remove_cb, this);
+		signal_handler_disconnect(sh, "source_rename", &Session::source_rename_cb, this);
+	}
+	signals_connected_ = connect;
+}
+
+bool Session::add_stem(obs_source_t *src, uint64_t pad_frames)
+{
+	const char *uuid = obs_source_get_uuid(src);
+	const char *name = obs_source_get_name(src);
+	const fs::path wavp = unique_wav_path(fs::path(session_dir_), stem_file_name(settings_, uuid, name));
+
+	auto rec = lease_recorder();
+	if (!rec->start(HubSource::create(*hub_, src), wavp.string(), sample_rate_, channels_,
+			dither_mode_from_string(settings_.dither_mode), pad_frames)) {
+		blog(LOG_ERROR, "Audio Stems: failed starting stem for %s", name ? name : "(null)");
+		return_recorder(std::move(rec));
+		return false;
+	}
+
+	StemOutput o;
+	o.recorder = std::move(rec);
+	o.wav_path = wavp.string();
+	o.final_path = wavp.string();
+	o.source_uuid = uuid ? uuid : "";
+	o.source_name = name ? name : "";
+	o.audio_properties = detect_source_audio_properties(src, sample_rate_, channels_);
+	// Padded stems line up with the others, pre-roll included.
+	o.preroll_frames = pad_frames ? session_preroll_frames_ : o.recorder->preroll_frames();
+	index_[o.source_uuid] = stems_.size();
+	stems_.push_back(std::move(o));
+	journal_->stem(stems_.back());
+	return true;
+}
+
+void Session::release_stem(const std::string &uuid)
+{
+	auto it = index_.find(uuid);
+	if (it == index_.end())
+		return;
+	StemOutput &o = stems_[it->second];
+	if (!o.recorder->has_source())
+		return;
+	// The stem ends here but is finalized with the rest of the session.
+	o.recorder->release_source();
+	add_marker(elapsed_ns(), "source_removed", o.source_name);
+	blog(LOG_INFO, "Audio Stems: source %s removed from the session", o.source_name.c_str());
+}
+
+std::unique_ptr<StemRecorder> Session::lease_recorder()
+{
+	return pool_ ? pool_->acquire() : std::make_unique<StemRecorder>();
+}
+
+void Session::return_recorder(std::unique_ptr<StemRecorder> recorder)
+{
+	if (pool_)
+		pool_->release(std::move(recorder));
+}
+
+bool Session::is_selected(const char *uuid) const
+{
+	return uuid && *uuid && selected_.count(uuid) != 0;
+}
+
+uint64_t Session::elapsed_ns() const
+{
+	if (start_ns_ == 0)
+		return 0;
+	const uint64_t now = os_gettime_ns();
+	return now > start_ns_ ? now - start_ns_ : 0;
+}
+
+void Session::journal_capture(size_t index, uint64_t dropped_chunks, bool write_failed)
+{
+	if (journaled_capture_.size() <= index)
+		journaled_capture_.resize(index + 1, {0, false});
+	auto &last = journaled_capture_[index];
+	if (last.first == dropped_chunks && last.second == write_failed)
+		return;
+	last = {dropped_chunks, write_failed};
+	journal_->capture(index, elapsed_ns(), dropped_chunks, write_failed);
+}
+
+void Session::journal_main()
+{
+	trace::name_thread("session journal");
+	std::unique_lock<std::mutex> wait_lock(journal_mtx_);
+	while (!journal_cv_.wait_for(wait_lock, std::chrono::seconds(1), [this] { return journal_quit_; })) {
+		wait_lock.unlock();
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			for (size_t i = 0; i < stems_.size(); i++) {
+				const StemOutput &o = stems_[i];
+				if (o.recorder)
+					journal_capture(i, o.recorder->dropped_chunks(), o.recorder->write_failed());
+			}
+		}
+		journal_->flush();
+		wait_lock.lock();
+	}
+}
+
+void Session::stop_journal_thread()
+{
+	{
+		std::lock_guard<std::mutex> lock(journal_mtx_);
+		journal_quit_ = true;
+	}
+	journal_cv_.notify_all();
+	if (journal_thread_.joinable())
+		journal_thread_.join();
+}
+
+void Session::add_marker(uint64_t offset_ns, const std::string &type, const std::string &value)
+{
+	markers_.push_back(SessionMarker{offset_ns, type, value});
+	journal_->marker(markers_.back());
 }
 
 void Session::mark_inprogress(bool inprogress)
@@ -346,125 +743,87 @@ void Session::mark_inprogress(bool inprogress)
 	fs::path marker = fs::path(session_dir_) / ".inprogress";
 	std::error_code ec;
 	if (inprogress) {
+		// Indexed first, so recovery never mistakes a live session for a crashed one.
+		open_sessions_add(settings_.output_dir, session_dir_);
 		std::FILE *f = std::fopen(marker.string().c_str(), "wb");
 		if (f) {
 			std::fwrite("inprogress", 1, 10, f);
 			std::fclose(f);
 		}
 	} else {
+		// The index entry stays until post-processing is done.
 		fs::remove(marker, ec);
 	}
 }
 
-void Session::postprocess_stems(std::vector<StemOutput> &finished)
+bool save_replay_stems(const Settings &settings, CaptureHub &hub, FinalizeQueue *finalizer, double seconds)
 {
-	for (auto &o : finished) {
-		if (o.wav_path.empty())
-			continue;
-		if (settings_.trim_silence)
-			trim_silence_wav(o.wav_path, channels_, sample_rate_, settings_.trim_threshold_dbfs,
-					 settings_.trim_lead_ms, settings_.trim_trail_ms);
-		if (settings_.normalize_audio)
-			normalize_wav_rms(o.wav_path, channels_, sample_rate_, settings_.normalize_target_dbfs,
-					 settings_.normalize_limiter);
-
-		OutputFormat output_format = settings_.output_format == "mp3" ? OutputFormat::Mp3 : OutputFormat::Wav;
-		const bool needs_export = output_format == OutputFormat::Mp3 ||
-			(o.audio_properties.sample_rate != sample_rate_) ||
-			(o.audio_properties.channels != channels_) ||
-			(settings_.wav_bit_depth != 16);
-		if (!needs_export) {
-			o.final_path = o.wav_path;
-			continue;
-		}
+	uint32_t sample_rate = 48000;
+	uint16_t channels = 2;
+	if (seconds <= 0.0 || !get_mix_format(sample_rate, channels))
+		return false;
 
-		fs::path desired_path = fs::path(o.wav_path).replace_extension(output_format == OutputFormat::Mp3 ? ".mp3" : ".wav");
-		fs::path export_path = desired_path;
-		if (output_format == OutputFormat::Wav)
-			export_path = desired_path.parent_path() / (desired_path.stem().string() + ".render.wav");
-
-		if (export_audio("", o.wav_path, export_path.string(), output_format, o.audio_properties.bitrate_kbps,
-				 o.audio_properties.sample_rate, o.audio_properties.channels, settings_.wav_bit_depth)) {
-			if (output_format == OutputFormat::Wav) {
-				std::error_code ec;
-				fs::remove(o.wav_path, ec);
-				ec.clear();
-				fs::rename(export_path, desired_path, ec);
-				if (ec) {
-					blog(LOG_ERROR, "Audio Stems: failed finalizing WAV export: %s", ec.message().c_str());
-					o.final_path = o.wav_path;
-					fs::remove(export_path, ec);
-				} else {
-					o.final_path = desired_path.string();
-				}
-			} else {
-				o.final_path = desired_path.string();
-				std::error_code ec;
-				fs::remove(o.wav_path, ec);
-			}
-		} else {
-			o.final_path = o.wav_path;
-		}
+	struct SourceInfo {
+		std::string name;
+		SourceAudioProperties props;
+	};
+	std::vector<std::string> uuids;
+	std::unordered_map<std::string, SourceInfo> info;
+	for (obs_source_t *src : selected_audio_sources(settings)) {
+		const char *uuid = obs_source_get_uuid(src);
+		const char *name = obs_source_get_name(src);
+		uuids.push_back(uuid ? uuid : "");
+		info[uuids.back()] = SourceInfo{stem_file_name(settings, uuid, name),
+						detect_source_audio_properties(src, sample_rate, channels)};
+		obs_source_release(src);
 	}
-}
 
-void Session::write_sidecar_json(const std::vector<StemOutput> &finished) const
-{
-	if (session_dir_.empty())
-		return;
-	obs_data_t *root = obs_data_create();
-	obs_data_set_string(root, "session_dir", session_dir_.c_str());
-	obs_data_set_string(root, "mode", kind_ == SessionKind::Recording ? "recording" : "streaming");
-	obs_data_set_int(root, "sample_rate", (int64_t)sample_rate_);
-	obs_data_set_int(root, "channels", (int64_t)channels_);
-	obs_data_set_int(root, "start_ns", (int64_t)start_ns_);
-
-	obs_data_t *cfg = obs_data_create();
-	obs_data_set_string(cfg, "output_format", settings_.output_format.c_str());
-	obs_data_set_int(cfg, "wav_bit_depth", static_cast<int64_t>(settings_.wav_bit_depth));
-	obs_data_set_bool(cfg, "trim_silence", settings_.trim_silence);
-	obs_data_set_double(cfg, "trim_threshold_dbfs", settings_.trim_threshold_dbfs);
-	obs_data_set_int(cfg, "trim_lead_ms", settings_.trim_lead_ms);
-	obs_data_set_int(cfg, "trim_trail_ms", settings_.trim_trail_ms);
-	obs_data_set_bool(cfg, "normalize_audio", settings_.normalize_audio);
-	obs_data_set_double(cfg, "normalize_target_dbfs", settings_.normalize_target_dbfs);
-	obs_data_set_bool(cfg, "normalize_limiter", settings_.normalize_limiter);
-	obs_data_set_bool(cfg, "record_scene_markers", settings_.record_scene_markers);
-	obs_data_set_bool(cfg, "use_source_aliases", settings_.use_source_aliases);
-	obs_data_set_obj(root, "settings", cfg);
-	obs_data_release(cfg);
-
-	obs_data_array_t *stems = obs_data_array_create();
-	for (const auto &o : finished) {
-		obs_data_t *it = obs_data_create();
-		obs_data_set_string(it, "wav", o.wav_path.c_str());
-		obs_data_set_string(it, "file", o.final_path.c_str());
-		obs_data_set_string(it, "source_uuid", o.source_uuid.c_str());
-		obs_data_set_string(it, "source_name", o.source_name.c_str());
-		obs_data_set_int(it, "source_sample_rate", static_cast<int64_t>(o.audio_properties.sample_rate));
-		obs_data_set_int(it, "source_channels", static_cast<int64_t>(o.audio_properties.channels));
-		obs_data_set_int(it, "source_bitrate_kbps", static_cast<int64_t>(o.audio_properties.bitrate_kbps));
-		obs_data_array_push_back(stems, it);
-		obs_data_release(it);
-	}
-	obs_data_set_array(root, "stems", stems);
-	obs_data_array_release(stems);
-
-	obs_data_array_t *marks = obs_data_array_create();
-	for (const auto &m : markers_) {
-		obs_data_t *it = obs_data_create();
-		obs_data_set_int(it, "offset_ns", (int64_t)m.offset_ns);
-		obs_data_set_string(it, "type", m.type.c_str());
-		obs_data_set_string(it, "value", m.value.c_str());
-		obs_data_array_push_back(marks, it);
-		obs_data_release(it);
-	}
-	obs_data_set_array(root, "markers", marks);
-	obs_data_array_release(marks);
-
-	fs::path sidecar = fs::path(session_dir_) / "session.json";
-	obs_data_save_json_safe(root, sidecar.string().c_str(), "tmp", "bak");
-	obs_data_release(root);
+	std::vector<HistorySnapshot> snaps;
+	if (!hub.snapshot(uuids, seconds, snaps)) {
+		blog(LOG_WARNING, "Audio Stems: replay saved but no stem history is available");
+		return false;
+	}
+
+	std::string session_dir;
+	if (!create_session_dir(settings, "REPLAY", session_dir))
+		return false;
+
+	auto job = std::make_unique<FinalizeJob>();
+	job->kind = SessionKind::Replay;
+	job->settings = settings;
+	job->session_dir = session_dir;
+	job->sample_rate = sample_rate;
+	job->channels = channels;
+	job->start_ns = os_gettime_ns() - (uint64_t)(seconds * 1000000000.0);
+	job->markers.push_back(SessionMarker{0, "session_start", "REPLAY"});
+	char *replay_path = obs_frontend_get_last_replay();
+	if (replay_path) {
+		job->markers.push_back(SessionMarker{0, "replay_file", replay_path});
+		bfree(replay_path);
+	}
+
+	// Aliases and sanitized names can collide; each snapshot needs its own
+	// file since they are written in parallel.
+	std::unordered_set<std::string> taken;
+	for (auto &snap : snaps) {
+		const SourceInfo &src = info[snap.uuid];
+		StemOutput o;
+		o.wav_path = unique_wav_path(fs::path(session_dir), src.name, &taken).string();
+		o.final_path = o.wav_path;
+		o.source_uuid = snap.uuid;
+		o.source_name = src.name;
+		o.audio_properties = src.props;
+		o.snapshot = std::make_shared<HistorySnapshot>(std::move(snap));
+		job->stems.push_back(std::move(o));
+	}
+	blog(LOG_INFO, "Audio Stems: saving %zu replay stems (%.1f s) to %s", job->stems.size(), seconds,
+	     session_dir.c_str());
+
+	if (finalizer)
+		finalizer->submit(std::move(job));
+	else
+		finalize_session(*job, nullptr, nullptr);
+	return true;
 }
 
 }
@@ -1,18 +1,31 @@
 #pragma once
 
+#include <condition_variable>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "capture_hub.hpp"
+#include "loudness.hpp"
+#include "recorder_pool.hpp"
 #include "settings.hpp"
 #include "stem_recorder.hpp"
 
 namespace stems {
 
+class FinalizeQueue;
+class SessionJournal;
+
 enum class SessionKind {
 	Recording,
 	Streaming,
+	Replay,
 };
 
 struct SourceAudioProperties {
@@ -21,6 +34,26 @@ struct SourceAudioProperties {
 	int bitrate_kbps = 0;
 };
 
+// Post-processing steps, as bits in StemOutput::steps_done.
+enum class PostStep : unsigned {
+	Trim = 1u << 0,
+	Normalize = 1u << 1,
+	Remix = 1u << 2,
+	Resample = 1u << 3,
+	Export = 1u << 4,
+};
+
+constexpr size_t k_post_step_count = 5;
+size_t post_step_index(PostStep step);
+const char *post_step_name(PostStep step);
+
+struct PostStepStats {
+	bool ran = false;
+	double ms = 0.0;
+	// Size of the file the step left behind.
+	uint64_t bytes = 0;
+};
+
 struct StemOutput {
 	std::unique_ptr<StemRecorder> recorder;
 	std::string wav_path;
@@ -28,39 +61,102 @@ struct StemOutput {
 	std::string source_uuid;
 	std::string source_name;
 	SourceAudioProperties audio_properties;
+	uint64_t preroll_frames = 0;
+	// Set for replay saves: audio still in memory, written by the finalizer.
+	std::shared_ptr<HistorySnapshot> snapshot;
+	uint64_t trim_start_frames = 0;
+	bool loudness_measured = false;
+	LoudnessStats loudness;
+	// Steps already applied to the file, for jobs resumed after a restart.
+	unsigned steps_done = 0;
+	bool has_capture_stats = false;
+	StemCaptureStats capture_stats;
+	PostStepStats step_stats[k_post_step_count];
+
+	bool step_done(PostStep step) const { return (steps_done & (unsigned)step) != 0; }
+	void set_step_done(PostStep step) { steps_done |= (unsigned)step; }
 };
 
+struct SessionMarker {
+	uint64_t offset_ns = 0;
+	std::string type;
+	std::string value;
+};
+
+bool get_mix_format(uint32_t &sample_rate, uint16_t &channels);
+
+// Referenced sources; release each with obs_source_release().
+std::vector<obs_source_t *> selected_audio_sources(const Settings &settings);
+
+// Writes the last `seconds` of every selected source's history to a new
+// REPLAY session folder; the files are written on the finalize thread.
+bool save_replay_stems(const Settings &settings, CaptureHub &hub, FinalizeQueue *finalizer, double seconds);
+
 class Session {
 public:
-	Session(SessionKind kind, const Settings &settings);
+	Session(SessionKind kind, const Settings &settings, FinalizeQueue *finalizer = nullptr,
+		CaptureHub *hub = nullptr, RecorderPool *pool = nullptr);
 	~Session();
 
 	bool start();
 	void stop();
 
 	void on_scene_changed(const std::string &scene_name);
+	// Starts stems for newly selected sources and releases deselected ones.
+	void update_selection(const Settings &settings);
 
 	SessionKind kind() const { return kind_; }
 	bool is_running() const { return running_; }
+	void collect_stats(std::vector<StemLiveStats> &out, HotPathHistograms *total);
 
 private:
-	void write_sidecar_json(const std::vector<StemOutput> &finished) const;
-	void postprocess_stems(std::vector<StemOutput> &finished);
+	static void source_create_cb(void *data, calldata_t *cd);
+	static void source_remove_cb(void *data, calldata_t *cd);
+	static void source_rename_cb(void *data, calldata_t *cd);
+
 	void mark_inprogress(bool inprogress);
+	void add_marker(uint64_t offset_ns, const std::string &type, const std::string &value);
+	void connect_signals(bool connect);
+	bool add_stem(obs_source_t *source, uint64_t pad_frames);
+	std::unique_ptr<StemRecorder> lease_recorder();
+	void return_recorder(std::unique_ptr<StemRecorder> recorder);
+	void release_stem(const std::string &uuid);
+	bool is_selected(const char *uuid) const;
+	uint64_t elapsed_ns() const;
+	void end_trace();
+	// Journals changed drop and write-failure counters; mtx_ held.
+	void journal_capture(size_t index, uint64_t dropped_chunks, bool write_failed);
+	void journal_main();
+	void stop_journal_thread();
+
 	SessionKind kind_;
 	Settings settings_;
+	FinalizeQueue *finalizer_ = nullptr;
+	std::unique_ptr<CaptureHub> own_hub_;
+	CaptureHub *hub_ = nullptr;
+	RecorderPool *pool_ = nullptr;
+	std::unordered_set<std::string> selected_;
 	std::string session_dir_;
+	std::mutex mtx_;
 	std::vector<StemOutput> stems_;
+	// Source UUID -> index into stems_ of its most recent stem.
+	std::unordered_map<std::string, size_t> index_;
+	uint64_t session_preroll_frames_ = 0;
+	bool signals_connected_ = false;
 	uint32_t sample_rate_ = 48000;
 	uint16_t channels_ = 2;
 	uint64_t start_ns_ = 0;
-
-	struct Marker {
-		uint64_t offset_ns = 0;
-		std::string type;
-		std::string value;
-	};
-	std::vector<Marker> markers_;
+	std::vector<SessionMarker> markers_;
+	std::unique_ptr<SessionJournal> journal_;
+	// Flushes the journal and samples the stems' capture counters once a second.
+	std::thread journal_thread_;
+	std::mutex journal_mtx_;
+	std::condition_variable journal_cv_;
+	bool journal_quit_ = false;
+	// What was last journaled for each stem: dropped chunks, write failed.
+	std::vector<std::pair<uint64_t, bool>> journaled_capture_;
+	bool tracing_ = false;
+	uint64_t trace_since_ns_ = 0;
 	bool running_ = false;
 };
 
@@ -0,0 +1,122 @@
+#include "session_index.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <system_error>
+
+namespace stems {
+namespace fs = std::filesystem;
+
+static const char *k_index_name = ".stems-open";
+
+// Recording and streaming sessions update the index from different threads.
+static std::mutex g_index_mtx;
+
+static fs::path base_dir(const std::string &output_dir)
+{
+	return output_dir.empty() ? fs::current_path() : fs::path(output_dir);
+}
+
+static bool read_entries(const fs::path &index, std::vector<std::string> &out)
+{
+	out.clear();
+	std::FILE *f = std::fopen(index.string().c_str(), "rb");
+	if (!f)
+		return false;
+	std::string line;
+	for (int c; (c = std::fgetc(f)) != EOF;) {
+		if (c == '\n' || c == '\r') {
+			if (!line.empty())
+				out.push_back(std::move(line));
+			line.clear();
+		} else {
+			line.push_back((char)c);
+		}
+	}
+	if (!line.empty())
+		out.push_back(std::move(line));
+	std::fclose(f);
+	return true;
+}
+
+static bool write_entries(const fs::path &index, const std::vector<std::string> &entries)
+{
+	fs::path tmp = index;
+	tmp += ".tmp";
+	std::FILE *f = std::fopen(tmp.string().c_str(), "wb");
+	if (!f)
+		return false;
+	bool ok = true;
+	for (const auto &e : entries) {
+		ok = ok && std::fwrite(e.data(), 1, e.size(), f) == e.size();
+		ok = ok && std::fputc('\n', f) != EOF;
+	}
+	ok = std::fclose(f) == 0 && ok;
+	std::error_code ec;
+	if (ok)
+		fs::rename(tmp, index, ec);
+	if (!ok || ec) {
+		fs::remove(tmp, ec);
+		return false;
+	}
+	return true;
+}
+
+static void update_index(const std::string &output_dir, const std::string &session_dir, bool add)
+{
+	const fs::path base = base_dir(output_dir);
+	const fs::path index = base / k_index_name;
+	const std::string name = fs::path(session_dir).filename().string();
+
+	std::lock_guard<std::mutex> lock(g_index_mtx);
+	std::vector<std::string> entries;
+	read_entries(index, entries);
+	auto it = std::find(entries.begin(), entries.end(), name);
+	if (add == (it != entries.end()))
+		return;
+	if (add)
+		entries.push_back(name);
+	else
+		entries.erase(it);
+	write_entries(index, entries);
+}
+
+void open_sessions_add(const std::string &output_dir, const std::string &session_dir)
+{
+	update_index(output_dir, session_dir, true);
+}
+
+void open_sessions_remove(const std::string &output_dir, const std::string &session_dir)
+{
+	update_index(output_dir, session_dir, false);
+}
+
+bool open_sessions_list(const std::string &output_dir, std::vector<std::string> &session_dirs)
+{
+	const fs::path base = base_dir(output_dir);
+	std::vector<std::string> entries;
+	{
+		std::lock_guard<std::mutex> lock(g_index_mtx);
+		if (!read_entries(base / k_index_name, entries)) {
+			session_dirs.clear();
+			return false;
+		}
+	}
+	session_dirs.clear();
+	for (const auto &e : entries)
+		session_dirs.push_back((base / e).string());
+	return true;
+}
+
+void open_sessions_init(const std::string &output_dir)
+{
+	const fs::path index = base_dir(output_dir) / k_index_name;
+	std::lock_guard<std::mutex> lock(g_index_mtx);
+	std::error_code ec;
+	if (!fs::exists(index, ec))
+		write_entries(index, {});
+}
+
+}
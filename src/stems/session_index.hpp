@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace stems {
+
+// Session folders that still carry an .inprogress marker, listed in a small
+// file in the output directory so startup recovery can skip the full scan.
+// Entries are folder names relative to the output directory.
+void open_sessions_add(const std::string &output_dir, const std::string &session_dir);
+void open_sessions_remove(const std::string &output_dir, const std::string &session_dir);
+// False if the output directory has no index yet (written by an older
+// version); the caller then has to scan.
+bool open_sessions_list(const std::string &output_dir, std::vector<std::string> &session_dirs);
+// Creates an empty index once a full scan has handled everything.
+void open_sessions_init(const std::string &output_dir);
+
+}
@@ -0,0 +1,461 @@
+#include "session_journal.hpp"
+
+#include "finalize.hpp"
+
+#include <obs-module.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <system_error>
+
+namespace stems {
+namespace fs = std::filesystem;
+
+static const char *k_journal_name = "session.journal";
+static const char *k_journal_magic = "stems-journal 1";
+static const size_t k_flush_records = 64;
+
+static std::string escape_field(const std::string &s)
+{
+	std::string out;
+	out.reserve(s.size());
+	for (char c : s) {
+		switch (c) {
+		case '\\':
+			out += "\\\\";
+			break;
+		case '\t':
+			out += "\\t";
+			break;
+		case '\n':
+			out += "\\n";
+			break;
+		case '\r':
+			out += "\\r";
+			break;
+		default:
+			out.push_back(c);
+		}
+	}
+	return out;
+}
+
+static std::vector<std::string> split_record(const std::string &line)
+{
+	std::vector<std::string> fields(1);
+	for (size_t i = 0; i < line.size(); i++) {
+		const char c = line[i];
+		if (c == '\t') {
+			fields.emplace_back();
+		} else if (c == '\\' && i + 1 < line.size()) {
+			const char e = line[++i];
+			fields.back().push_back(e == 't' ? '\t' : e == 'n' ? '\n' : e == 'r' ? '\r' : e);
+		} else {
+			fields.back().push_back(c);
+		}
+	}
+	return fields;
+}
+
+static uint64_t parse_u64(const std::string &s)
+{
+	return std::strtoull(s.c_str(), nullptr, 10);
+}
+
+static std::string format_double(double v)
+{
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%.9g", v);
+	return buf;
+}
+
+static const char *kind_name(SessionKind kind)
+{
+	switch (kind) {
+	case SessionKind::Streaming:
+		return "streaming";
+	case SessionKind::Replay:
+		return "replay";
+	default:
+		return "recording";
+	}
+}
+
+static std::vector<std::string> step_record(size_t stem, const StemOutput &o, PostStep step)
+{
+	std::vector<std::string> rec{"step", std::to_string(stem), post_step_name(step)};
+	switch (step) {
+	case PostStep::Trim:
+		rec.push_back(std::to_string(o.trim_start_frames));
+		break;
+	case PostStep::Normalize:
+		rec.push_back(o.loudness_measured ? "1" : "0");
+		rec.push_back(format_double(o.loudness.integrated_lufs));
+		rec.push_back(format_double(o.loudness.true_peak));
+		break;
+	case PostStep::Export:
+		rec.push_back(fs::path(o.final_path).filename().string());
+		break;
+	default:
+		break;
+	}
+	return rec;
+}
+
+static std::vector<std::string> stem_record(const StemOutput &o)
+{
+	// A stem that lost its file keeps its place, so step indices still match.
+	return {"stem",
+		o.source_uuid,
+		o.source_name,
+		o.wav_path.empty() ? std::string() : fs::path(o.wav_path).filename().string(),
+		std::to_string(o.preroll_frames),
+		std::to_string(o.audio_properties.sample_rate),
+		std::to_string(o.audio_properties.channels),
+		std::to_string(o.audio_properties.bitrate_kbps)};
+}
+
+SessionJournal::~SessionJournal()
+{
+	close();
+}
+
+std::string SessionJournal::path_for(const std::string &session_dir)
+{
+	return (fs::path(session_dir) / k_journal_name).string();
+}
+
+bool SessionJournal::create(const std::string &path)
+{
+	close();
+	fp_ = std::fopen(path.c_str(), "wb");
+	if (!fp_)
+		return false;
+	std::setvbuf(fp_, buffer_, _IOFBF, sizeof(buffer_));
+	unflushed_ = 0;
+	std::fputs(k_journal_magic, fp_);
+	std::fputc('\n', fp_);
+	return true;
+}
+
+void SessionJournal::write_header(SessionKind kind, uint32_t sample_rate, uint16_t channels, uint64_t start_ns,
+				  const Settings &settings)
+{
+	append({"session", kind_name(kind), std::to_string(sample_rate), std::to_string(channels),
+		std::to_string(start_ns)});
+	append({"settings", settings_to_json(settings)}, true);
+}
+
+bool SessionJournal::open(const std::string &session_dir, SessionKind kind, uint32_t sample_rate, uint16_t channels,
+			  uint64_t start_ns, const Settings &settings)
+{
+	if (!create(path_for(session_dir)))
+		return false;
+	write_header(kind, sample_rate, channels, start_ns, settings);
+	return true;
+}
+
+bool SessionJournal::begin_finalize(const FinalizeJob &job)
+{
+	// Written aside and swapped in, so a crash leaves the old journal or
+	// the new one, never half of it.
+	const std::string path = path_for(job.session_dir);
+	const std::string tmp = path + ".tmp";
+	if (!create(tmp))
+		return false;
+	write_header(job.kind, job.sample_rate, job.channels, job.start_ns, job.settings);
+	for (size_t i = 0; i < job.stems.size(); i++) {
+		append(stem_record(job.stems[i]));
+		const StemOutput &o = job.stems[i];
+		if (o.has_capture_stats && (o.capture_stats.dropped_chunks || o.capture_stats.write_failed))
+			capture(i, 0, o.capture_stats.dropped_chunks, o.capture_stats.write_failed);
+		for (size_t k = 0; k < k_post_step_count; k++) {
+			const PostStep step = (PostStep)(1u << k);
+			if (job.stems[i].step_done(step))
+				append(step_record(i, job.stems[i], step));
+		}
+	}
+	for (const auto &m : job.markers)
+		marker(m);
+	if (job.session_cut_known)
+		session_cut(job.session_cut_start, job.session_cut_end);
+	const bool ok = std::ferror(fp_) == 0;
+	close();
+
+	std::error_code ec;
+	if (ok)
+		fs::rename(tmp, path, ec);
+	if (!ok || ec) {
+		fs::remove(tmp, ec);
+		return false;
+	}
+	fp_ = std::fopen(path.c_str(), "ab");
+	if (fp_)
+		std::setvbuf(fp_, buffer_, _IOFBF, sizeof(buffer_));
+	return fp_ != nullptr;
+}
+
+void SessionJournal::stem(const StemOutput &o)
+{
+	append(stem_record(o));
+}
+
+void SessionJournal::marker(const SessionMarker &m)
+{
+	append({"marker", std::to_string(m.offset_ns), m.type, m.value});
+}
+
+void SessionJournal::capture(size_t stem, uint64_t offset_ns, uint64_t dropped_chunks, bool write_failed)
+{
+	append({"capture", std::to_string(stem), std::to_string(offset_ns), std::to_string(dropped_chunks),
+		write_failed ? "1" : "0"});
+}
+
+void SessionJournal::step_begin(size_t stem, PostStep step, const WavFormat &in, const WavFormat &out,
+			       uint64_t trim_start_frames, uint64_t in_fingerprint)
+{
+	append({"begin", std::to_string(stem), post_step_name(step), std::to_string(in.sample_rate),
+		std::to_string(in.channels), std::to_string(in.frames), std::to_string(out.sample_rate),
+		std::to_string(out.channels), std::to_string(out.frames), std::to_string(trim_start_frames),
+		std::to_string(in_fingerprint)},
+	       true);
+}
+
+void SessionJournal::step(size_t stem, const StemOutput &o, PostStep step)
+{
+	append(step_record(stem, o, step), true);
+}
+
+void SessionJournal::session_cut(uint64_t start_frame, uint64_t end_frame)
+{
+	append({"cut", std::to_string(start_frame), std::to_string(end_frame)}, true);
+}
+
+void SessionJournal::flush()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (!fp_ || unflushed_ == 0)
+		return;
+	std::fflush(fp_);
+	unflushed_ = 0;
+}
+
+void SessionJournal::close()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (!fp_)
+		return;
+	std::fclose(fp_);
+	fp_ = nullptr;
+	unflushed_ = 0;
+}
+
+void SessionJournal::append(const std::vector<std::string> &fields, bool flush_now)
+{
+	std::string line;
+	for (size_t i = 0; i < fields.size(); i++) {
+		if (i)
+			line.push_back('\t');
+		line += escape_field(fields[i]);
+	}
+	line.push_back('\n');
+
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (!fp_)
+		return;
+	std::fwrite(line.data(), 1, line.size(), fp_);
+	// Reaching the OS is enough to survive a crash of OBS; no fsync.
+	if (flush_now || ++unflushed_ >= k_flush_records) {
+		std::fflush(fp_);
+		unflushed_ = 0;
+	}
+}
+
+bool SessionJournal::read(const std::string &session_dir, FinalizeJob &job, bool *has_settings)
+{
+	if (has_settings)
+		*has_settings = false;
+	std::FILE *f = std::fopen(path_for(session_dir).c_str(), "rb");
+	if (!f)
+		return false;
+
+	std::vector<std::string> lines;
+	std::string line;
+	for (int c; (c = std::fgetc(f)) != EOF;) {
+		if (c == '\n') {
+			lines.push_back(std::move(line));
+			line.clear();
+		} else {
+			line.push_back((char)c);
+		}
+	}
+	std::fclose(f);
+	// A record cut short by the crash has no newline and is dropped.
+	if (lines.empty() || lines.front() != k_journal_magic)
+		return false;
+
+	struct PendingStep {
+		size_t stem = 0;
+		PostStep step = PostStep::Trim;
+		WavFormat in;
+		WavFormat out;
+		uint64_t trim_start_frames = 0;
+		uint64_t in_fingerprint = 0;
+	};
+	std::vector<PendingStep> pending;
+
+	job.session_dir = session_dir;
+	bool have_session = false;
+	bool complete = false;
+	for (size_t i = 1; i < lines.size(); i++) {
+		const std::vector<std::string> rec = split_record(lines[i]);
+		if (rec[0] == "session" && rec.size() >= 5) {
+			job.kind = rec[1] == "streaming" ? SessionKind::Streaming
+				   : rec[1] == "replay"  ? SessionKind::Replay
+							 : SessionKind::Recording;
+			job.sample_rate = (uint32_t)parse_u64(rec[2]);
+			job.channels = (uint16_t)parse_u64(rec[3]);
+			job.start_ns = parse_u64(rec[4]);
+			have_session = true;
+		} else if (rec[0] == "settings" && rec.size() >= 2) {
+			if (settings_from_json(rec[1], job.settings) && has_settings)
+				*has_settings = true;
+		} else if (rec[0] == "stem" && rec.size() >= 5) {
+			StemOutput o;
+			o.source_uuid = rec[1];
+			o.source_name = rec[2];
+			if (!rec[3].empty())
+				o.wav_path = (fs::path(session_dir) / rec[3]).string();
+			o.final_path = o.wav_path;
+			o.preroll_frames = parse_u64(rec[4]);
+			if (rec.size() >= 8) {
+				o.audio_properties.sample_rate = (uint32_t)parse_u64(rec[5]);
+				o.audio_properties.channels = (uint16_t)parse_u64(rec[6]);
+				o.audio_properties.bitrate_kbps = (int)parse_u64(rec[7]);
+			}
+			job.stems.push_back(std::move(o));
+		} else if (rec[0] == "marker" && rec.size() >= 4) {
+			job.markers.push_back(SessionMarker{parse_u64(rec[1]), rec[2], rec[3]});
+			complete = complete || rec[2] == "session_stop";
+		} else if (rec[0] == "cut" && rec.size() >= 3) {
+			job.session_cut_known = true;
+			job.session_cut_start = parse_u64(rec[1]);
+			job.session_cut_end = parse_u64(rec[2]);
+		} else if (rec[0] == "capture" && rec.size() >= 5) {
+			const size_t index = (size_t)parse_u64(rec[1]);
+			if (index >= job.stems.size())
+				continue;
+			StemOutput &o = job.stems[index];
+			o.has_capture_stats = true;
+			o.capture_stats.dropped_chunks = parse_u64(rec[3]);
+			o.capture_stats.write_failed = rec[4] == "1";
+		} else if (rec[0] == "begin" && rec.size() >= 10) {
+			PendingStep p;
+			p.stem = (size_t)parse_u64(rec[1]);
+			bool known = false;
+			for (size_t k = 0; k < k_post_step_count; k++) {
+				if (rec[2] == post_step_name((PostStep)(1u << k))) {
+					p.step = (PostStep)(1u << k);
+					known = true;
+				}
+			}
+			if (!known || p.stem >= job.stems.size())
+				continue;
+			p.in.sample_rate = (uint32_t)parse_u64(rec[3]);
+			p.in.channels = (uint16_t)parse_u64(rec[4]);
+			p.in.frames = parse_u64(rec[5]);
+			p.out.sample_rate = (uint32_t)parse_u64(rec[6]);
+			p.out.channels = (uint16_t)parse_u64(rec[7]);
+			p.out.frames = parse_u64(rec[8]);
+			p.trim_start_frames = parse_u64(rec[9]);
+			if (rec.size() >= 11)
+				p.in_fingerprint = parse_u64(rec[10]);
+			pending.push_back(p);
+		} else if (rec[0] == "step" && rec.size() >= 3) {
+			const size_t index = (size_t)parse_u64(rec[1]);
+			if (index >= job.stems.size())
+				continue;
+			StemOutput &o = job.stems[index];
+			for (size_t k = 0; k < k_post_step_count; k++) {
+				const PostStep step = (PostStep)(1u << k);
+				if (rec[2] != post_step_name(step))
+					continue;
+				o.set_step_done(step);
+				pending.erase(std::remove_if(pending.begin(), pending.end(),
+							     [&](const PendingStep &p) {
+								     return p.stem == index && p.step == step;
+							     }),
+					      pending.end());
+			}
+			if (rec[2] == "trim" && rec.size() >= 4) {
+				o.trim_start_frames = parse_u64(rec[3]);
+			} else if (rec[2] == "normalize" && rec.size() >= 6) {
+				o.loudness_measured = rec[3] == "1";
+				o.loudness.integrated_lufs = std::strtod(rec[4].c_str(), nullptr);
+				o.loudness.true_peak = std::strtod(rec[5].c_str(), nullptr);
+			} else if (rec[2] == "export" && rec.size() >= 4) {
+				o.final_path = (fs::path(session_dir) / rec[3]).string();
+			}
+		}
+	}
+	if (!have_session)
+		return false;
+
+	// Steps that began but were never recorded as done: if the file already
+	// has the step's output format, or its samples changed under a step
+	// that keeps the format, the crash came after the swap and running the
+	// step again would apply it twice. A missing file is left to the
+	// finalizer, which finishes an interrupted swap.
+	for (const PendingStep &p : pending) {
+		StemOutput &o = job.stems[p.stem];
+		WavFormat now;
+		if (o.wav_path.empty() || o.step_done(p.step) || !read_wav_format(o.wav_path, now))
+			continue;
+		uint64_t fingerprint = 0;
+		const bool rewritten = p.in_fingerprint && now == p.in && wav_fingerprint(o.wav_path, fingerprint) &&
+				       fingerprint != p.in_fingerprint;
+		if (now == p.out && (now != p.in || rewritten)) {
+			o.set_step_done(p.step);
+			if (p.step == PostStep::Trim)
+				o.trim_start_frames = p.trim_start_frames;
+		} else if (now != p.in) {
+			blog(LOG_WARNING, "Audio Stems: %s matches neither side of its interrupted %s step",
+			     o.wav_path.c_str(), post_step_name(p.step));
+		}
+	}
+
+	// Capture records carry the problem counters only; the length is what
+	// the file holds now.
+	for (auto &o : job.stems) {
+		WavFormat now;
+		if (!o.has_capture_stats || o.wav_path.empty() || !read_wav_format(o.wav_path, now))
+			continue;
+		o.capture_stats.frames_written = now.frames;
+		o.capture_stats.bytes_written = now.frames * now.channels * sizeof(int16_t);
+	}
+
+	if (!complete) {
+		// The stop marker never made it; end the session with its longest stem.
+		uint64_t longest_ns = 0;
+		std::error_code ec;
+		for (const auto &o : job.stems) {
+			const uintmax_t size = fs::file_size(o.wav_path, ec);
+			if (ec || size < 44 || job.sample_rate == 0 || job.channels == 0)
+				continue;
+			const uint64_t frames = (uint64_t)(size - 44) / (job.channels * 2u);
+			const uint64_t live = frames > o.preroll_frames ? frames - o.preroll_frames : 0;
+			longest_ns = std::max<uint64_t>(longest_ns, live * 1000000000ull / job.sample_rate);
+		}
+		job.markers.push_back(SessionMarker{longest_ns, "session_stop", "recovered"});
+	}
+	return true;
+}
+
+void SessionJournal::remove(const std::string &session_dir)
+{
+	std::error_code ec;
+	fs::remove(path_for(session_dir), ec);
+}
+
+}
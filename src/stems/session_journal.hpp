@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "session.hpp"
+#include "settings.hpp"
+#include "wav_postprocess.hpp"
+
+namespace stems {
+
+struct FinalizeJob;
+
+// Append-only record of a session, kept next to its stems so a crash loses
+// neither markers nor post-processing progress. One tab-separated record per
+// line. Capture-time records are buffered and reach the OS every
+// k_flush_records appends or on flush(); post-processing records, which must
+// land before the file changes they describe, are flushed at once. Nothing
+// is synced to disk.
+class SessionJournal {
+public:
+	SessionJournal() = default;
+	~SessionJournal();
+	SessionJournal(const SessionJournal &) = delete;
+	SessionJournal &operator=(const SessionJournal &) = delete;
+
+	bool open(const std::string &session_dir, SessionKind kind, uint32_t sample_rate, uint16_t channels,
+		  uint64_t start_ns, const Settings &settings);
+	// Replaces the journal with everything needed to redo post-processing
+	// of `job`, including the steps it has already done.
+	bool begin_finalize(const FinalizeJob &job);
+	void stem(const StemOutput &o);
+	void marker(const SessionMarker &m);
+	// Running totals of a stem's capture problems, written when they change.
+	void capture(size_t stem, uint64_t offset_ns, uint64_t dropped_chunks, bool write_failed);
+	// `stem` is the index into the job's stems. step_begin() goes before a
+	// step that replaces the file, so a restart can tell whether its output
+	// was swapped in before step() was written. Steps that keep the format
+	// pass the input's wav_fingerprint().
+	void step_begin(size_t stem, PostStep step, const WavFormat &in, const WavFormat &out,
+			uint64_t trim_start_frames = 0, uint64_t in_fingerprint = 0);
+	void step(size_t stem, const StemOutput &o, PostStep step);
+	void session_cut(uint64_t start_frame, uint64_t end_frame);
+	void flush();
+	void close();
+
+	bool is_open() const { return fp_ != nullptr; }
+
+	static std::string path_for(const std::string &session_dir);
+	// Rebuilds the session, stems, markers and post-processing progress of
+	// an interrupted session. has_settings tells whether the journal also
+	// carries the settings to finish post-processing with.
+	static bool read(const std::string &session_dir, FinalizeJob &job, bool *has_settings = nullptr);
+	static void remove(const std::string &session_dir);
+
+private:
+	bool create(const std::string &path);
+	void write_header(SessionKind kind, uint32_t sample_rate, uint16_t channels, uint64_t start_ns,
+			  const Settings &settings);
+	void append(const std::vector<std::string> &fields, bool flush_now = false);
+
+	std::mutex mtx_;
+	std::FILE *fp_ = nullptr;
+	size_t unflushed_ = 0;
+	char buffer_[4096];
+};
+
+}
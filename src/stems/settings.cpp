@@ -46,22 +46,11 @@ static std::string default_output_dir()
 	return p.empty() ? std::string{} : p;
 }
 
-Settings load_settings()
+bool settings_from_json(const std::string &json, Settings &s)
 {
-	Settings s;
-	s.output_dir = default_output_dir();
-
-	const std::string path = module_config_path(k_config_file);
-	if (path.empty())
-		return s;
-
-	QFile f(QString::fromStdString(path));
-	if (!f.exists() || !f.open(QIODevice::ReadOnly))
-		return s;
-
-	const QJsonDocument doc = QJsonDocument::fromJson(f.readAll());
+	const QJsonDocument doc = QJsonDocument::fromJson(QByteArray::fromStdString(json));
 	if (!doc.isObject())
-		return s;
+		return false;
 	const QJsonObject root = doc.object();
 
 	s.trigger_recording = root.value("trigger_recording").toBool(true);
@@ -74,16 +63,35 @@ Settings load_settings()
 	s.output_format = (output_format == "mp3") ? "mp3" : "wav";
 	const int wav_bit_depth = root.value("wav_bit_depth").toInt(16);
 	s.wav_bit_depth = (wav_bit_depth == 24 || wav_bit_depth == 32) ? wav_bit_depth : 16;
+	const QString resample_quality = root.value("resample_quality").toString("medium").trimmed().toLower();
+	s.resample_quality = (resample_quality == "fast" || resample_quality == "high") ? resample_quality.toStdString()
+											: "medium";
+	s.remix_matrix = root.value("remix_matrix").toString().trimmed().toStdString();
+	const QString dither_mode = root.value("dither_mode").toString("off").trimmed().toLower();
+	s.dither_mode = (dither_mode == "tpdf" || dither_mode == "shaped") ? dither_mode.toStdString() : "off";
 
 	s.trim_silence = root.value("trim_silence").toBool(true);
+	const QString trim_mode = root.value("trim_mode").toString("stem").trimmed().toLower();
+	s.trim_mode = (trim_mode == "session") ? "session" : "stem";
 	s.trim_threshold_dbfs = (float)root.value("trim_threshold_dbfs").toDouble(-45.0);
 	s.trim_lead_ms = root.value("trim_lead_ms").toInt(150);
 	s.trim_trail_ms = root.value("trim_trail_ms").toInt(350);
 	s.normalize_audio = root.value("normalize_audio").toBool(true);
+	const QString normalize_mode = root.value("normalize_mode").toString("rms").trimmed().toLower();
+	s.normalize_mode = (normalize_mode == "lufs") ? "lufs" : "rms";
 	s.normalize_target_dbfs = (float)root.value("normalize_target_dbfs").toDouble(-16.0);
 	s.normalize_limiter = root.value("normalize_limiter").toBool(true);
+	s.limiter_ceiling_dbfs = (float)std::clamp(root.value("limiter_ceiling_dbfs").toDouble(-1.0), -20.0, 0.0);
+	s.limiter_attack_ms = (float)std::clamp(root.value("limiter_attack_ms").toDouble(5.0), 0.1, 50.0);
+	s.limiter_release_ms = (float)std::clamp(root.value("limiter_release_ms").toDouble(100.0), 1.0, 2000.0);
 	s.write_sidecar_json = root.value("write_sidecar_json").toBool(true);
 	s.record_scene_markers = root.value("record_scene_markers").toBool(true);
+	s.stats_interval_seconds = std::clamp(root.value("stats_interval_seconds").toInt(0), 0, 3600);
+	s.stats_write_json = root.value("stats_write_json").toBool(false);
+	s.trace_sessions = root.value("trace_sessions").toBool(false);
+	s.preroll_enabled = root.value("preroll_enabled").toBool(false);
+	s.preroll_seconds = std::clamp(root.value("preroll_seconds").toInt(5), 1, 60);
+	s.replay_stems = root.value("replay_stems").toBool(false);
 	s.use_source_aliases = root.value("use_source_aliases").toBool(false);
 
 	const QJsonArray uuids = root.value("selected_source_uuids").toArray();
@@ -116,33 +124,43 @@ Settings load_settings()
 				[](const std::string &x) { return x.empty(); }),
 		s.selected_source_uuids.end());
 
-	return s;
+	return true;
 }
 
-void save_settings(const Settings &s)
+std::string settings_to_json(const Settings &s)
 {
-	const std::string path = module_config_path(k_config_file);
-	if (path.empty())
-		return;
-
 	QJsonObject root;
 	root["trigger_recording"] = s.trigger_recording;
 	root["trigger_streaming"] = s.trigger_streaming;
 	root["output_dir"] = QString::fromStdString(s.output_dir);
 	root["output_format"] = QString::fromStdString(s.output_format == "mp3" ? "mp3" : "wav");
 	root["wav_bit_depth"] = (s.wav_bit_depth == 24 || s.wav_bit_depth == 32) ? s.wav_bit_depth : 16;
+	root["resample_quality"] = QString::fromStdString(s.resample_quality);
+	root["remix_matrix"] = QString::fromStdString(s.remix_matrix);
+	root["dither_mode"] = QString::fromStdString(s.dither_mode);
 
 	root["trim_silence"] = s.trim_silence;
+	root["trim_mode"] = QString::fromStdString(s.trim_mode);
 	root["trim_threshold_dbfs"] = s.trim_threshold_dbfs;
 	root["trim_lead_ms"] = s.trim_lead_ms;
 	root["trim_trail_ms"] = s.trim_trail_ms;
 
 	root["normalize_audio"] = s.normalize_audio;
+	root["normalize_mode"] = QString::fromStdString(s.normalize_mode == "lufs" ? "lufs" : "rms");
 	root["normalize_target_dbfs"] = s.normalize_target_dbfs;
 	root["normalize_limiter"] = s.normalize_limiter;
+	root["limiter_ceiling_dbfs"] = s.limiter_ceiling_dbfs;
+	root["limiter_attack_ms"] = s.limiter_attack_ms;
+	root["limiter_release_ms"] = s.limiter_release_ms;
 
 	root["write_sidecar_json"] = s.write_sidecar_json;
 	root["record_scene_markers"] = s.record_scene_markers;
+	root["stats_interval_seconds"] = s.stats_interval_seconds;
+	root["stats_write_json"] = s.stats_write_json;
+	root["trace_sessions"] = s.trace_sessions;
+	root["preroll_enabled"] = s.preroll_enabled;
+	root["preroll_seconds"] = s.preroll_seconds;
+	root["replay_stems"] = s.replay_stems;
 	root["use_source_aliases"] = s.use_source_aliases;
 
 	QJsonArray uuids;
@@ -164,7 +182,32 @@ void save_settings(const Settings &s)
 	root["source_aliases"] = aliases;
 
 	const QJsonDocument doc(root);
-	write_text_file(path, doc.toJson(QJsonDocument::Compact).toStdString());
+	return doc.toJson(QJsonDocument::Compact).toStdString();
+}
+
+Settings load_settings()
+{
+	Settings s;
+	s.output_dir = default_output_dir();
+
+	const std::string path = module_config_path(k_config_file);
+	if (path.empty())
+		return s;
+
+	QFile f(QString::fromStdString(path));
+	if (!f.exists() || !f.open(QIODevice::ReadOnly))
+		return s;
+
+	settings_from_json(f.readAll().toStdString(), s);
+	return s;
+}
+
+void save_settings(const Settings &s)
+{
+	const std::string path = module_config_path(k_config_file);
+	if (path.empty())
+		return;
+	write_text_file(path, settings_to_json(s));
 }
 
 } 
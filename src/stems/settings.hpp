@@ -9,21 +9,37 @@ namespace stems {
 struct Settings {
 	bool trigger_recording = true;
 	bool trigger_streaming = true;
+	bool preroll_enabled = false;
+	int preroll_seconds = 5;
+	bool replay_stems = false;
 	std::string output_dir;
 	std::string output_format = "wav";
 	int wav_bit_depth = 16;
+	std::string resample_quality = "medium";
+	std::string remix_matrix;
+	std::string dither_mode = "off";
 
 	bool trim_silence = true;
+	std::string trim_mode = "stem";
 	float trim_threshold_dbfs = -45.0f; 
 	int trim_lead_ms = 150;            
 	int trim_trail_ms = 350;           
 
 	bool normalize_audio = true;
+	std::string normalize_mode = "rms";
 	float normalize_target_dbfs = -16.0f; 
 	bool normalize_limiter = true;        
+	float limiter_ceiling_dbfs = -1.0f;
+	float limiter_attack_ms = 5.0f;
+	float limiter_release_ms = 100.0f;
 
 	bool write_sidecar_json = true;
 	bool record_scene_markers = true;
+	// Hot-path stats dumped to the log every N seconds; 0 turns it off.
+	int stats_interval_seconds = 0;
+	bool stats_write_json = false;
+	// Writes session.trace.json (Chrome trace events) next to session.json.
+	bool trace_sessions = false;
 
 	bool use_source_aliases = false;
 	
@@ -35,4 +51,9 @@ struct Settings {
 Settings load_settings();
 void save_settings(const Settings &s);
 
+// Compact single-line JSON, as stored in the config file.
+std::string settings_to_json(const Settings &s);
+// Missing fields get their defaults; an empty output_dir keeps s.output_dir.
+bool settings_from_json(const std::string &json, Settings &s);
+
 } 
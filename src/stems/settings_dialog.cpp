@@ -116,6 +116,18 @@ namespace stems
 				chk_streaming_ = new QCheckBox(tr("Capture when Streaming starts/stops"));
 				g->addWidget(chk_recording_);
 				g->addWidget(chk_streaming_);
+				chk_replay_ = new QCheckBox(tr("Save stems when the Replay Buffer is saved"));
+				g->addWidget(chk_replay_);
+
+				auto *rowPreroll = new QHBoxLayout();
+				rowPreroll->setSpacing(8);
+				chk_preroll_ = new QCheckBox(tr("Keep pre-roll of selected sources (s)"));
+				rowPreroll->addWidget(chk_preroll_);
+				spin_preroll_ = new QSpinBox();
+				spin_preroll_->setRange(1, 60);
+				rowPreroll->addWidget(spin_preroll_);
+				rowPreroll->addStretch(1);
+				g->addLayout(rowPreroll);
 
 				lay->addWidget(group);
 			}
@@ -156,9 +168,33 @@ namespace stems
 				combo_wav_bit_depth_->addItem(QStringLiteral("24-bit"), 24);
 				combo_wav_bit_depth_->addItem(QStringLiteral("32-bit"), 32);
 				rowFormat->addWidget(combo_wav_bit_depth_);
+
+				rowFormat->addWidget(new QLabel(tr("Resampling")));
+				combo_resample_quality_ = new QComboBox();
+				combo_resample_quality_->addItem(tr("Fast"), QStringLiteral("fast"));
+				combo_resample_quality_->addItem(tr("Medium"), QStringLiteral("medium"));
+				combo_resample_quality_->addItem(tr("High"), QStringLiteral("high"));
+				rowFormat->addWidget(combo_resample_quality_);
 				rowFormat->addStretch(1);
 				g->addLayout(rowFormat);
 
+				auto *rowRemix = new QHBoxLayout();
+				rowRemix->setSpacing(8);
+				rowRemix->addWidget(new QLabel(tr("Channel matrix")));
+				edit_remix_matrix_ = new QLineEdit();
+				edit_remix_matrix_->setPlaceholderText(tr("Default downmix (rows separated by ';')"));
+				rowRemix->addWidget(edit_remix_matrix_, 1);
+
+				rowRemix->addWidget(new QLabel(tr("Dither")));
+				combo_dither_ = new QComboBox();
+				combo_dither_->addItem(tr("Off"), QStringLiteral("off"));
+				combo_dither_->addItem(tr("TPDF"), QStringLiteral("tpdf"));
+				combo_dither_->addItem(tr("TPDF + noise shaping"), QStringLiteral("shaped"));
+				combo_dither_->setToolTip(tr("Noise added when converting to 16-bit. TPDF hides quantization "
+							     "distortion on very quiet stems at the cost of a constant noise floor."));
+				rowRemix->addWidget(combo_dither_);
+				g->addLayout(rowRemix);
+
 				connect(combo_output_format_, qOverload<int>(&QComboBox::currentIndexChanged), this,
 					[this](int) {
 						const bool is_wav = combo_output_format_->currentData().toString() == QStringLiteral("wav");
@@ -236,6 +272,12 @@ namespace stems
 				auto *rowTrim = new QHBoxLayout();
 				rowTrim->setSpacing(8);
 
+				rowTrim->addWidget(new QLabel(tr("Mode")));
+				combo_trim_mode_ = new QComboBox();
+				combo_trim_mode_->addItem(tr("Per stem"), QStringLiteral("stem"));
+				combo_trim_mode_->addItem(tr("Whole session (keep sync)"), QStringLiteral("session"));
+				rowTrim->addWidget(combo_trim_mode_);
+
 				rowTrim->addWidget(new QLabel(tr("Threshold (dBFS)")));
 				spin_trim_thr_ = new QDoubleSpinBox();
 				spin_trim_thr_->setRange(-90.0, -1.0);
@@ -271,18 +313,55 @@ namespace stems
 				auto *rowNorm = new QHBoxLayout();
 				rowNorm->setSpacing(8);
 
-				rowNorm->addWidget(new QLabel(tr("Target (dBFS)")));
+				rowNorm->addWidget(new QLabel(tr("Mode")));
+				combo_norm_mode_ = new QComboBox();
+				combo_norm_mode_->addItem(tr("RMS"), QStringLiteral("rms"));
+				combo_norm_mode_->addItem(tr("Loudness (LUFS)"), QStringLiteral("lufs"));
+				rowNorm->addWidget(combo_norm_mode_);
+
+				auto *lblTarget = new QLabel(tr("Target (dBFS)"));
+				rowNorm->addWidget(lblTarget);
 				spin_norm_target_ = new QDoubleSpinBox();
 				spin_norm_target_->setRange(-60.0, -1.0);
 				spin_norm_target_->setDecimals(1);
 				rowNorm->addWidget(spin_norm_target_);
 
-				chk_limiter_ = new QCheckBox(tr("Limiter (prevent clipping)"));
-				rowNorm->addWidget(chk_limiter_);
+				connect(combo_norm_mode_, qOverload<int>(&QComboBox::currentIndexChanged), this,
+					[this, lblTarget](int) {
+						const bool lufs = combo_norm_mode_->currentData().toString() == QStringLiteral("lufs");
+						lblTarget->setText(lufs ? tr("Target (LUFS)") : tr("Target (dBFS)"));
+					});
 
 				rowNorm->addStretch(1);
 				g->addLayout(rowNorm);
 
+				auto *rowLimiter = new QHBoxLayout();
+				rowLimiter->setSpacing(8);
+
+				chk_limiter_ = new QCheckBox(tr("Limiter (prevent clipping)"));
+				rowLimiter->addWidget(chk_limiter_);
+
+				rowLimiter->addWidget(new QLabel(tr("Ceiling (dBFS)")));
+				spin_limiter_ceiling_ = new QDoubleSpinBox();
+				spin_limiter_ceiling_->setRange(-20.0, 0.0);
+				spin_limiter_ceiling_->setDecimals(1);
+				rowLimiter->addWidget(spin_limiter_ceiling_);
+
+				rowLimiter->addWidget(new QLabel(tr("Attack (ms)")));
+				spin_limiter_attack_ = new QDoubleSpinBox();
+				spin_limiter_attack_->setRange(0.1, 50.0);
+				spin_limiter_attack_->setDecimals(1);
+				rowLimiter->addWidget(spin_limiter_attack_);
+
+				rowLimiter->addWidget(new QLabel(tr("Release (ms)")));
+				spin_limiter_release_ = new QDoubleSpinBox();
+				spin_limiter_release_->setRange(1.0, 2000.0);
+				spin_limiter_release_->setDecimals(0);
+				rowLimiter->addWidget(spin_limiter_release_);
+
+				rowLimiter->addStretch(1);
+				g->addLayout(rowLimiter);
+
 				proc->addWidget(group);
 			}
 
@@ -298,6 +377,20 @@ namespace stems
 				g->addWidget(chk_sidecar_);
 				g->addWidget(chk_scene_markers_);
 
+				auto *rowStats = new QHBoxLayout();
+				rowStats->setSpacing(8);
+				rowStats->addWidget(new QLabel(tr("Log capture stats every (s, 0 = off)")));
+				spin_stats_interval_ = new QSpinBox();
+				spin_stats_interval_->setRange(0, 3600);
+				rowStats->addWidget(spin_stats_interval_);
+				chk_stats_json_ = new QCheckBox(tr("Also write stats.json"));
+				rowStats->addWidget(chk_stats_json_);
+				rowStats->addStretch(1);
+				g->addLayout(rowStats);
+
+				chk_trace_ = new QCheckBox(tr("Write a timeline trace of each session (session.trace.json)"));
+				g->addWidget(chk_trace_);
+
 				proc->addWidget(group);
 			}
 
@@ -356,6 +449,9 @@ namespace stems
 		settings_ = s;
 		chk_recording_->setChecked(settings_.trigger_recording);
 		chk_streaming_->setChecked(settings_.trigger_streaming);
+		chk_replay_->setChecked(settings_.replay_stems);
+		chk_preroll_->setChecked(settings_.preroll_enabled);
+		spin_preroll_->setValue(settings_.preroll_seconds);
 		edit_output_->setText(QString::fromUtf8(settings_.output_dir.c_str()));
 		const QString outputFormat = QString::fromStdString(settings_.output_format == "mp3" ? "mp3" : "wav");
 		int formatIndex = combo_output_format_->findData(outputFormat);
@@ -367,15 +463,38 @@ namespace stems
 			bitDepthIndex = combo_wav_bit_depth_->findData(16);
 		combo_wav_bit_depth_->setCurrentIndex(bitDepthIndex);
 		combo_wav_bit_depth_->setEnabled(outputFormat == QStringLiteral("wav"));
+		int resampleIndex = combo_resample_quality_->findData(QString::fromStdString(settings_.resample_quality));
+		if (resampleIndex < 0)
+			resampleIndex = combo_resample_quality_->findData(QStringLiteral("medium"));
+		combo_resample_quality_->setCurrentIndex(resampleIndex);
+		edit_remix_matrix_->setText(QString::fromStdString(settings_.remix_matrix));
+		int ditherIndex = combo_dither_->findData(QString::fromStdString(settings_.dither_mode));
+		if (ditherIndex < 0)
+			ditherIndex = combo_dither_->findData(QStringLiteral("off"));
+		combo_dither_->setCurrentIndex(ditherIndex);
 		chk_trim_->setChecked(settings_.trim_silence);
+		int trimModeIndex = combo_trim_mode_->findData(QString::fromStdString(settings_.trim_mode));
+		if (trimModeIndex < 0)
+			trimModeIndex = 0;
+		combo_trim_mode_->setCurrentIndex(trimModeIndex);
 		spin_trim_thr_->setValue(settings_.trim_threshold_dbfs);
 		spin_lead_ms_->setValue(settings_.trim_lead_ms);
 		spin_trail_ms_->setValue(settings_.trim_trail_ms);
 		chk_norm_->setChecked(settings_.normalize_audio);
+		int normModeIndex = combo_norm_mode_->findData(QString::fromStdString(settings_.normalize_mode));
+		if (normModeIndex < 0)
+			normModeIndex = 0;
+		combo_norm_mode_->setCurrentIndex(normModeIndex);
 		spin_norm_target_->setValue(settings_.normalize_target_dbfs);
 		chk_limiter_->setChecked(settings_.normalize_limiter);
+		spin_limiter_ceiling_->setValue(settings_.limiter_ceiling_dbfs);
+		spin_limiter_attack_->setValue(settings_.limiter_attack_ms);
+		spin_limiter_release_->setValue(settings_.limiter_release_ms);
 		chk_sidecar_->setChecked(settings_.write_sidecar_json);
 		chk_scene_markers_->setChecked(settings_.record_scene_markers);
+		spin_stats_interval_->setValue(settings_.stats_interval_seconds);
+		chk_stats_json_->setChecked(settings_.stats_write_json);
+		chk_trace_->setChecked(settings_.trace_sessions);
 		chk_use_aliases_->setChecked(settings_.use_source_aliases);
 		apply_selection_from_settings();
 	}
@@ -417,18 +536,32 @@ namespace stems
 		Settings s;
 		s.trigger_recording = chk_recording_->isChecked();
 		s.trigger_streaming = chk_streaming_->isChecked();
+		s.replay_stems = chk_replay_->isChecked();
+		s.preroll_enabled = chk_preroll_->isChecked();
+		s.preroll_seconds = spin_preroll_->value();
 		s.output_dir = edit_output_->text().toUtf8().constData();
 		s.output_format = combo_output_format_->currentData().toString().toUtf8().constData();
 		s.wav_bit_depth = combo_wav_bit_depth_->currentData().toInt();
+		s.resample_quality = combo_resample_quality_->currentData().toString().toUtf8().constData();
+		s.remix_matrix = edit_remix_matrix_->text().trimmed().toUtf8().constData();
+		s.dither_mode = combo_dither_->currentData().toString().toUtf8().constData();
 		s.trim_silence = chk_trim_->isChecked();
+		s.trim_mode = combo_trim_mode_->currentData().toString().toUtf8().constData();
 		s.trim_threshold_dbfs = (float)spin_trim_thr_->value();
 		s.trim_lead_ms = spin_lead_ms_->value();
 		s.trim_trail_ms = spin_trail_ms_->value();
 		s.normalize_audio = chk_norm_->isChecked();
+		s.normalize_mode = combo_norm_mode_->currentData().toString().toUtf8().constData();
 		s.normalize_target_dbfs = (float)spin_norm_target_->value();
 		s.normalize_limiter = chk_limiter_->isChecked();
+		s.limiter_ceiling_dbfs = (float)spin_limiter_ceiling_->value();
+		s.limiter_attack_ms = (float)spin_limiter_attack_->value();
+		s.limiter_release_ms = (float)spin_limiter_release_->value();
 		s.write_sidecar_json = chk_sidecar_->isChecked();
 		s.record_scene_markers = chk_scene_markers_->isChecked();
+		s.stats_interval_seconds = spin_stats_interval_->value();
+		s.stats_write_json = chk_stats_json_->isChecked();
+		s.trace_sessions = chk_trace_->isChecked();
 		s.use_source_aliases = chk_use_aliases_->isChecked();
 
 		s.selected_source_uuids.clear();
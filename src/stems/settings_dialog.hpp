@@ -39,19 +39,33 @@ namespace stems
 
 		QCheckBox *chk_recording_ = nullptr;
 		QCheckBox *chk_streaming_ = nullptr;
+		QCheckBox *chk_replay_ = nullptr;
+		QCheckBox *chk_preroll_ = nullptr;
+		QSpinBox *spin_preroll_ = nullptr;
 		QCheckBox *chk_trim_ = nullptr;
+		QComboBox *combo_trim_mode_ = nullptr;
 		QDoubleSpinBox *spin_trim_thr_ = nullptr;
 		QSpinBox *spin_lead_ms_ = nullptr;
 		QSpinBox *spin_trail_ms_ = nullptr;
 		QCheckBox *chk_norm_ = nullptr;
+		QComboBox *combo_norm_mode_ = nullptr;
 		QDoubleSpinBox *spin_norm_target_ = nullptr;
 		QCheckBox *chk_limiter_ = nullptr;
+		QDoubleSpinBox *spin_limiter_ceiling_ = nullptr;
+		QDoubleSpinBox *spin_limiter_attack_ = nullptr;
+		QDoubleSpinBox *spin_limiter_release_ = nullptr;
 		QCheckBox *chk_sidecar_ = nullptr;
 		QCheckBox *chk_scene_markers_ = nullptr;
+		QSpinBox *spin_stats_interval_ = nullptr;
+		QCheckBox *chk_stats_json_ = nullptr;
+		QCheckBox *chk_trace_ = nullptr;
 		QCheckBox *chk_use_aliases_ = nullptr;
 		QLineEdit *edit_output_ = nullptr;
 		QComboBox *combo_output_format_ = nullptr;
 		QComboBox *combo_wav_bit_depth_ = nullptr;
+		QComboBox *combo_resample_quality_ = nullptr;
+		QLineEdit *edit_remix_matrix_ = nullptr;
+		QComboBox *combo_dither_ = nullptr;
 		QTableWidget *table_sources_ = nullptr;
 
 		QListWidget *nav_list_ = nullptr;
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace stems {
+
+// Bounded single-producer/single-consumer ring. One thread may push while
+// another pops without locking; capacity is rounded up to a power of two.
+template<typename T> class SpscQueue {
+public:
+	explicit SpscQueue(size_t capacity)
+	{
+		size_t cap = 2;
+		while (cap < capacity)
+			cap <<= 1;
+		slots_.resize(cap);
+		mask_ = cap - 1;
+	}
+
+	SpscQueue(const SpscQueue &) = delete;
+	SpscQueue &operator=(const SpscQueue &) = delete;
+
+	bool try_push(T &&value)
+	{
+		const size_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail - head_.load(std::memory_order_acquire) > mask_)
+			return false;
+		slots_[tail & mask_] = std::move(value);
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool try_pop(T &out)
+	{
+		const size_t head = head_.load(std::memory_order_relaxed);
+		if (head == tail_.load(std::memory_order_acquire))
+			return false;
+		out = std::move(slots_[head & mask_]);
+		slots_[head & mask_] = T();
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side: oldest item, or nullptr when empty.
+	const T *peek() const
+	{
+		const size_t head = head_.load(std::memory_order_relaxed);
+		if (head == tail_.load(std::memory_order_acquire))
+			return nullptr;
+		return &slots_[head & mask_];
+	}
+
+	// Consumer side: visits queued items oldest first without removing them.
+	template<typename F> void for_each(F &&fn) const
+	{
+		const size_t tail = tail_.load(std::memory_order_acquire);
+		for (size_t i = head_.load(std::memory_order_relaxed); i != tail; i++)
+			fn(slots_[i & mask_]);
+	}
+
+	size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+	size_t capacity() const { return mask_ + 1; }
+	bool full() const { return size() > mask_; }
+
+private:
+	std::vector<T> slots_;
+	size_t mask_ = 0;
+	alignas(64) std::atomic<size_t> head_{0};
+	alignas(64) std::atomic<size_t> tail_{0};
+};
+
+}
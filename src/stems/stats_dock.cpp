@@ -0,0 +1,141 @@
+#include "stats_dock.hpp"
+
+#include <QBoxLayout>
+#include <QHeaderView>
+#include <QLabel>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QTableWidget>
+#include <QTimer>
+
+#include <algorithm>
+
+namespace stems
+{
+
+	static QString format_ms(uint64_t ns)
+	{
+		return QString::number((double)ns / 1e6, 'f', 2);
+	}
+
+	StatsDock::StatsDock(LiveStatsFn collect, std::function<void()> cancel_finalize, QWidget *parent)
+		: QWidget(parent),
+		  collect_(std::move(collect)),
+		  cancel_finalize_(std::move(cancel_finalize))
+	{
+		auto *root = new QVBoxLayout();
+		root->setContentsMargins(6, 6, 6, 6);
+		root->setSpacing(6);
+		setLayout(root);
+
+		label_summary_ = new QLabel(tr("No session running"));
+		label_summary_->setWordWrap(true);
+		root->addWidget(label_summary_);
+
+		table_stems_ = new QTableWidget(0, 7);
+		table_stems_->setHorizontalHeaderLabels({tr("Stem"), tr("Callback p99 ms"), tr("Write p99 ms"),
+							 tr("Wake to write p99 ms"), tr("Queue p99"), tr("Queue max"),
+							 tr("Dropped")});
+		table_stems_->verticalHeader()->setVisible(false);
+		table_stems_->horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
+		table_stems_->setEditTriggers(QAbstractItemView::NoEditTriggers);
+		table_stems_->setSelectionMode(QAbstractItemView::NoSelection);
+		root->addWidget(table_stems_, 1);
+
+		label_finalize_ = new QLabel(tr("No post-processing running"));
+		label_finalize_->setWordWrap(true);
+		root->addWidget(label_finalize_);
+		auto *row_finalize = new QHBoxLayout();
+		progress_finalize_ = new QProgressBar();
+		progress_finalize_->setRange(0, 1);
+		progress_finalize_->setValue(0);
+		row_finalize->addWidget(progress_finalize_, 1);
+		btn_cancel_finalize_ = new QPushButton(tr("Cancel"));
+		btn_cancel_finalize_->setToolTip(tr("Stop post-processing; it resumes the next time OBS starts."));
+		btn_cancel_finalize_->setEnabled(false);
+		row_finalize->addWidget(btn_cancel_finalize_);
+		root->addLayout(row_finalize);
+		connect(btn_cancel_finalize_, &QPushButton::clicked, this, [this]()
+			{
+		if (cancel_finalize_)
+			cancel_finalize_();
+		btn_cancel_finalize_->setEnabled(false); });
+
+		timer_ = new QTimer(this);
+		timer_->setInterval(1000);
+		connect(timer_, &QTimer::timeout, this, [this]()
+			{
+		if (isVisible())
+			refresh(); });
+		timer_->start();
+	}
+
+	void StatsDock::refresh()
+	{
+		if (!collect_)
+			return;
+		LiveStats stats = collect_();
+		window_.apply(stats);
+		if (stats.finalize_busy)
+		{
+			label_finalize_->setText(tr("Post-processing %1 (%2 more waiting)")
+							 .arg(QString::fromStdString(stats.finalize_session))
+							 .arg(stats.finalize_queued));
+			progress_finalize_->setRange(0, (int)std::max<size_t>(1, stats.finalize_stems_total));
+			progress_finalize_->setValue((int)stats.finalize_stems_done);
+			progress_finalize_->setFormat(tr("%v/%m stems"));
+			btn_cancel_finalize_->setEnabled(true);
+		}
+		else
+		{
+			label_finalize_->setText(tr("No post-processing running"));
+			progress_finalize_->setRange(0, 1);
+			progress_finalize_->setValue(0);
+			progress_finalize_->setFormat(QString());
+			btn_cancel_finalize_->setEnabled(false);
+		}
+
+		if (stats.stems.empty())
+		{
+			label_summary_->setText(tr("No session running"));
+			table_stems_->setRowCount(0);
+			return;
+		}
+
+		const QString window = stats.window_ns
+						   ? tr("last %1 s").arg((double)stats.window_ns / 1e9, 0, 'f', 1)
+						   : tr("since start");
+		label_summary_->setText(tr("%1 stems, %2. Audio callback p50 %3 / p99 %4 / max %5 ms.")
+						.arg(stats.stems.size())
+						.arg(window)
+						.arg(format_ms(stats.audio_callback_ns.p50))
+						.arg(format_ms(stats.audio_callback_ns.p99))
+						.arg(format_ms(stats.audio_callback_ns.max)));
+
+		table_stems_->setRowCount((int)stats.stems.size());
+		for (int row = 0; row < (int)stats.stems.size(); row++)
+		{
+			const StemLiveStats &s = stats.stems[(size_t)row];
+			const QString cells[] = {
+				QString::fromStdString(s.session + " / " + s.source_name),
+				format_ms(s.audio_callback_ns.p99),
+				format_ms(s.write_ns.p99),
+				format_ms(s.wake_to_write_ns.p99),
+				QString::number(s.queue_depth.p99) + "/" + QString::number(s.queue_capacity),
+				QString::number(s.queue_depth.max),
+				QString::number(s.dropped_chunks),
+			};
+			for (int col = 0; col < 7; col++)
+			{
+				QTableWidgetItem *it = table_stems_->item(row, col);
+				if (!it)
+				{
+					it = new QTableWidgetItem();
+					table_stems_->setItem(row, col, it);
+				}
+				it->setText(cells[col]);
+			}
+		}
+	}
+
+} 
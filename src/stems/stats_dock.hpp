@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QWidget>
+
+#include "live_stats.hpp"
+
+class QLabel;
+class QProgressBar;
+class QPushButton;
+class QTableWidget;
+class QTimer;
+
+namespace stems
+{
+
+	// Live hot-path stats of the running sessions and post-processing
+	// progress, refreshed once a second while the dock is visible.
+	class StatsDock : public QWidget
+	{
+	public:
+		StatsDock(LiveStatsFn collect, std::function<void()> cancel_finalize, QWidget *parent = nullptr);
+
+	private:
+		void refresh();
+
+		LiveStatsFn collect_;
+		LiveStatsWindow window_;
+		std::function<void()> cancel_finalize_;
+		QLabel *label_summary_ = nullptr;
+		QLabel *label_finalize_ = nullptr;
+		QProgressBar *progress_finalize_ = nullptr;
+		QPushButton *btn_cancel_finalize_ = nullptr;
+		QTableWidget *table_stems_ = nullptr;
+		QTimer *timer_ = nullptr;
+	};
+
+} 
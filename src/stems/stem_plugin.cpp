@@ -1,35 +1,37 @@
 #include "stem_plugin.hpp"
 
 #include <obs-module.h>
+#include <util/config-file.h>
+#include <util/platform.h>
 
 #include <QApplication>
 #include <QWidget>
 
+#include "finalize.hpp"
+#include "session_index.hpp"
+#include "session_journal.hpp"
 #include "settings_dialog.hpp"
+#include "stats_dock.hpp"
 
 #include "wav_writer.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
+#include <unordered_map>
 
 namespace stems {
 
-static void repair_inprogress_sessions(const Settings &settings)
+namespace fs = std::filesystem;
+
+// Returns true when the session was handed to the finalizer to resume its
+// post-processing; the finalizer then removes the journal and index entry.
+static bool repair_inprogress_session(const Settings &settings, const fs::path &dir, FinalizeQueue *finalizer)
 {
-	namespace fs = std::filesystem;
-	fs::path base = settings.output_dir.empty() ? fs::current_path() : fs::path(settings.output_dir);
 	std::error_code ec;
-	if (!fs::exists(base, ec))
-		return;
-	for (auto &entry : fs::directory_iterator(base, ec)) {
-		if (ec)
-			break;
-		if (!entry.is_directory())
-			continue;
-		fs::path marker = entry.path() / ".inprogress";
-		if (!fs::exists(marker, ec))
-			continue;
-		
-		for (auto &f : fs::directory_iterator(entry.path(), ec)) {
+	const bool inprogress = fs::exists(dir / ".inprogress", ec);
+	if (inprogress) {
+		for (auto &f : fs::directory_iterator(dir, ec)) {
 			if (ec)
 				break;
 			if (!f.is_regular_file())
@@ -39,9 +41,88 @@ static void repair_inprogress_sessions(const Settings &settings)
 			}
 		}
 		ec.clear();
-		fs::remove(marker, ec);
-		blog(LOG_WARNING, "Audio Stems: repaired in-progress session: %s", entry.path().string().c_str());
 	}
+
+	auto job = std::make_unique<FinalizeJob>();
+	bool has_settings = false;
+	bool resumed = false;
+	if (SessionJournal::read(dir.string(), *job, &has_settings) && !job->stems.empty()) {
+		job->recovered = true;
+		if (finalizer && has_settings) {
+			blog(LOG_INFO, "Audio Stems: resuming post-processing of %zu stems: %s", job->stems.size(),
+			     dir.string().c_str());
+			finalizer->submit(std::move(job));
+			resumed = true;
+		} else if (settings.write_sidecar_json && !fs::exists(dir / "session.json", ec)) {
+			// Markers survive in the journal; rebuild the sidecar stop() never wrote.
+			job->settings = settings;
+			write_session_sidecar(*job, false);
+			blog(LOG_INFO, "Audio Stems: rebuilt session.json with %zu stems and %zu markers",
+			     job->stems.size(), job->markers.size());
+		}
+	}
+	if (!resumed) {
+		SessionJournal::remove(dir.string());
+		open_sessions_remove(settings.output_dir, dir.string());
+	}
+
+	if (inprogress) {
+		fs::remove(dir / ".inprogress", ec);
+		blog(LOG_WARNING, "Audio Stems: repaired in-progress session: %s", dir.string().c_str());
+	}
+	return resumed;
+}
+
+static bool needs_recovery(const fs::path &dir)
+{
+	std::error_code ec;
+	return fs::exists(dir / ".inprogress", ec) || fs::exists(SessionJournal::path_for(dir.string()), ec);
+}
+
+// Only the sessions listed in the open-sessions index are checked. Without an
+// index (first run of this version) the output directory is scanned once.
+// A session whose post-processing was interrupted still has its journal and
+// index entry; it is resumed on the finalizer instead of left half done.
+static void repair_inprogress_sessions(const Settings &settings, const std::vector<std::string> &candidates,
+				       bool full_scan, FinalizeQueue *finalizer, const std::atomic<bool> &cancel)
+{
+	const uint64_t begin_ns = os_gettime_ns();
+	size_t repaired = 0;
+	size_t resumed = 0;
+	std::error_code ec;
+	if (!full_scan) {
+		for (const auto &dir : candidates) {
+			if (cancel)
+				return;
+			if (needs_recovery(dir)) {
+				resumed += repair_inprogress_session(settings, dir, finalizer) ? 1 : 0;
+				repaired++;
+			} else {
+				open_sessions_remove(settings.output_dir, dir);
+			}
+		}
+	} else {
+		fs::path base = settings.output_dir.empty() ? fs::current_path() : fs::path(settings.output_dir);
+		if (!fs::exists(base, ec))
+			return;
+		for (auto &entry : fs::directory_iterator(base, ec)) {
+			if (ec || cancel)
+				return;
+			if (!entry.is_directory() || !needs_recovery(entry.path()))
+				continue;
+			// Sessions started since OBS came up are indexed; leave them alone.
+			std::vector<std::string> live;
+			open_sessions_list(settings.output_dir, live);
+			if (std::find(live.begin(), live.end(), entry.path().string()) != live.end())
+				continue;
+			resumed += repair_inprogress_session(settings, entry.path(), finalizer) ? 1 : 0;
+			repaired++;
+		}
+		open_sessions_init(settings.output_dir);
+	}
+	blog(LOG_INFO, "Audio Stems: startup recovery checked %s in %.1f ms, repaired %zu sessions, resumed %zu",
+	     full_scan ? "the output directory" : (std::to_string(candidates.size()) + " indexed sessions").c_str(),
+	     (double)(os_gettime_ns() - begin_ns) / 1e6, repaired, resumed);
 }
 
 StemPlugin::~StemPlugin()
@@ -49,21 +130,43 @@ StemPlugin::~StemPlugin()
 	shutdown();
 }
 
+static const char *k_stats_dock_id = "audio_stems_stats";
+
 void StemPlugin::startup()
 {
-	std::lock_guard<std::mutex> lock(mtx_);
-	settings_ = load_settings();
-	repair_inprogress_sessions(settings_);
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		settings_ = load_settings();
+		// Read now, repaired after OBS finished loading: anything indexed
+		// later belongs to a live session.
+		recovery_full_scan_ = !open_sessions_list(settings_.output_dir, recovery_candidates_);
+		finalizer_.start();
+		refresh_history();
+		recorder_pool_.reserve(settings_.selected_source_uuids.size());
 
-	if (!hooked_) {
-		obs_frontend_add_event_callback(&StemPlugin::frontend_event_cb, this);
-		obs_frontend_add_tools_menu_item("Audio Stems Recorder...", &StemPlugin::tools_menu_cb, this);
-		hooked_ = true;
+		if (!hooked_) {
+			obs_frontend_add_event_callback(&StemPlugin::frontend_event_cb, this);
+			obs_frontend_add_tools_menu_item("Audio Stems Recorder...", &StemPlugin::tools_menu_cb, this);
+			hooked_ = true;
+		}
+		if (!stats_dock_added_) {
+			auto *dock = new StatsDock([this]() { return collect_live_stats(); },
+						   [this]() { finalizer_.cancel_all(); });
+			stats_dock_added_ = obs_frontend_add_dock_by_id(k_stats_dock_id, "Audio Stems Stats", dock);
+			if (!stats_dock_added_)
+				delete dock;
+		}
 	}
+	configure_stats();
 }
 
 void StemPlugin::shutdown()
 {
+	stats_reporter_.stop();
+	recovery_cancel_ = true;
+	if (recovery_thread_.joinable())
+		recovery_thread_.join();
+
 	std::lock_guard<std::mutex> lock(mtx_);
 	
 	if (rec_session_) {
@@ -74,7 +177,102 @@ void StemPlugin::shutdown()
 		stream_session_->stop();
 		stream_session_.reset();
 	}
-	
+	capture_hub_.set_history(0.0, 0, 0, DitherMode::Off, {});
+	recorder_pool_.clear();
+	// Unfinished jobs keep their journal and resume on the next start.
+	finalizer_.shutdown(true);
+}
+
+static double replay_buffer_seconds()
+{
+	config_t *cfg = obs_frontend_get_profile_config();
+	if (!cfg)
+		return 0.0;
+	const char *mode = config_get_string(cfg, "Output", "Mode");
+	const bool advanced = mode && std::strcmp(mode, "Advanced") == 0;
+	return (double)config_get_int(cfg, advanced ? "AdvOut" : "SimpleOutput", "RecRBTime");
+}
+
+void StemPlugin::refresh_history()
+{
+	const double preroll = settings_.preroll_enabled ? settings_.preroll_seconds : 0.0;
+	const double replay = settings_.replay_stems ? replay_buffer_seconds() : 0.0;
+	const double seconds = std::max(preroll, replay);
+	capture_hub_.set_preroll_seconds(preroll);
+
+	uint32_t rate = 48000;
+	uint16_t channels = 2;
+	if (seconds <= 0.0 || !get_mix_format(rate, channels)) {
+		capture_hub_.set_history(0.0, 0, 0, DitherMode::Off, {});
+		return;
+	}
+
+	std::vector<obs_source_t *> sources = selected_audio_sources(settings_);
+	capture_hub_.set_history(seconds, rate, channels, dither_mode_from_string(settings_.dither_mode), sources);
+	const double budget_mib = (double)sources.size() * seconds * rate * channels * sizeof(int16_t) / (1024.0 * 1024.0);
+	blog(LOG_INFO, "Audio Stems: keeping %.0f s of history on %zu sources (pre-roll %.0f s, replay %.0f s; "
+		       "at most %.1f MiB, %zu KiB in use)",
+	     seconds, sources.size(), preroll, replay, budget_mib, capture_hub_.history_bytes() / 1024);
+	for (obs_source_t *src : sources)
+		obs_source_release(src);
+}
+
+// The reporter thread takes mtx_ to collect, so this runs without it held.
+void StemPlugin::configure_stats()
+{
+	std::string json_path;
+	if (settings_.stats_write_json) {
+		char *path = obs_module_config_path("stats.json");
+		if (path) {
+			json_path = path;
+			bfree(path);
+		}
+	}
+	stats_reporter_.configure(settings_.stats_interval_seconds, json_path,
+				  [this]() { return collect_live_stats(); });
+}
+
+LiveStats StemPlugin::collect_live_stats()
+{
+	LiveStats stats;
+	HotPathHistograms total;
+	std::unordered_map<std::string, HistogramCounts> callbacks;
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		stats.taken_ns = os_gettime_ns();
+		if (rec_session_)
+			rec_session_->collect_stats(stats.stems, &total);
+		if (stream_session_)
+			stream_session_->collect_stats(stats.stems, &total);
+		capture_hub_.collect_callback_stats(callbacks, &total.audio_callback_ns);
+	}
+	for (auto &s : stats.stems) {
+		auto it = callbacks.find(s.source_uuid);
+		if (it == callbacks.end())
+			continue;
+		s.counts.audio_callback_ns = it->second;
+		s.audio_callback_ns = summarize(it->second);
+	}
+	stats.audio_callback_ns = summarize(total.audio_callback_ns);
+	stats.queue_depth = summarize(total.queue_depth);
+	stats.write_ns = summarize(total.write_ns);
+	stats.wake_to_write_ns = summarize(total.wake_to_write_ns);
+	const FinalizeStatus finalize = finalizer_.status();
+	stats.finalize_busy = finalize.busy;
+	stats.finalize_session = finalize.session_dir;
+	stats.finalize_stems_done = finalize.stems_done;
+	stats.finalize_stems_total = finalize.stems_total;
+	stats.finalize_queued = finalize.queued;
+	return stats;
+}
+
+void StemPlugin::start_recovery()
+{
+	if (recovery_thread_.joinable())
+		return;
+	recovery_cancel_ = false;
+	recovery_thread_ = std::thread(repair_inprogress_sessions, settings_, std::move(recovery_candidates_),
+				       recovery_full_scan_, &finalizer_, std::cref(recovery_cancel_));
 }
 
 void StemPlugin::frontend_event_cb(enum obs_frontend_event event, void *param)
@@ -93,6 +291,16 @@ void StemPlugin::tools_menu_cb(void *param)
 
 void StemPlugin::on_frontend_event(enum obs_frontend_event event)
 {
+	// By module unload the main window and its docks are gone; remove ours
+	// while the frontend still owns it. Outside mtx_, which its refresh takes.
+	if (event == OBS_FRONTEND_EVENT_EXIT) {
+		if (stats_dock_added_) {
+			obs_frontend_remove_dock(k_stats_dock_id);
+			stats_dock_added_ = false;
+		}
+		return;
+	}
+
 	std::lock_guard<std::mutex> lock(mtx_);
 
 	switch (event) {
@@ -103,7 +311,8 @@ void StemPlugin::on_frontend_event(enum obs_frontend_event event)
 				rec_session_->stop();
 				rec_session_.reset();
 			}
-			rec_session_ = std::make_unique<Session>(SessionKind::Recording, settings_);
+			rec_session_ = std::make_unique<Session>(SessionKind::Recording, settings_, &finalizer_,
+								 &capture_hub_, &recorder_pool_);
 			rec_session_->start();
 		}
 		break;
@@ -118,7 +327,8 @@ void StemPlugin::on_frontend_event(enum obs_frontend_event event)
 				stream_session_->stop();
 				stream_session_.reset();
 			}
-			stream_session_ = std::make_unique<Session>(SessionKind::Streaming, settings_);
+			stream_session_ = std::make_unique<Session>(SessionKind::Streaming, settings_, &finalizer_,
+								 &capture_hub_, &recorder_pool_);
 			stream_session_->start();
 		}
 		break;
@@ -126,6 +336,18 @@ void StemPlugin::on_frontend_event(enum obs_frontend_event event)
 		if (stream_session_)
 			stream_session_->stop();
 		break;
+	case OBS_FRONTEND_EVENT_REPLAY_BUFFER_SAVED:
+		if (settings_.replay_stems)
+			save_replay_stems(settings_, capture_hub_, &finalizer_, replay_buffer_seconds());
+		break;
+	case OBS_FRONTEND_EVENT_FINISHED_LOADING:
+		start_recovery();
+		refresh_history();
+		break;
+	case OBS_FRONTEND_EVENT_SCENE_COLLECTION_CHANGED:
+	case OBS_FRONTEND_EVENT_REPLAY_BUFFER_STARTED:
+		refresh_history();
+		break;
 
 #ifdef OBS_FRONTEND_EVENT_SCENE_CHANGED
 	case OBS_FRONTEND_EVENT_SCENE_CHANGED: {
@@ -167,6 +389,14 @@ void StemPlugin::open_settings_dialog()
 		settings_ = dlg.get_settings();
 		save_settings(settings_);
 		blog(LOG_INFO, "Audio Stems: settings saved");
+		configure_stats();
+		std::lock_guard<std::mutex> lock(mtx_);
+		refresh_history();
+		recorder_pool_.reserve(settings_.selected_source_uuids.size());
+		if (rec_session_ && rec_session_->is_running())
+			rec_session_->update_selection(settings_);
+		if (stream_session_ && stream_session_->is_running())
+			stream_session_->update_selection(settings_);
 	}
 }
 
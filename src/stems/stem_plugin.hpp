@@ -1,10 +1,18 @@
 #pragma once
 
+#include <atomic>
 #include <mutex>
 #include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <obs-frontend-api.h>
 
+#include "capture_hub.hpp"
+#include "finalize_queue.hpp"
+#include "live_stats.hpp"
+#include "recorder_pool.hpp"
 #include "settings.hpp"
 #include "session.hpp"
 
@@ -24,12 +32,26 @@ private:
 
 	void on_frontend_event(enum obs_frontend_event event);
 	void open_settings_dialog();
+	void refresh_history();
+	void start_recovery();
+	void configure_stats();
+	LiveStats collect_live_stats();
 
 	std::mutex mtx_;
 	Settings settings_;
+	FinalizeQueue finalizer_;
+	CaptureHub capture_hub_;
+	RecorderPool recorder_pool_;
 	std::unique_ptr<Session> rec_session_;
 	std::unique_ptr<Session> stream_session_;
 	bool hooked_ = false;
+	StatsReporter stats_reporter_;
+	bool stats_dock_added_ = false;
+
+	std::vector<std::string> recovery_candidates_;
+	bool recovery_full_scan_ = false;
+	std::atomic<bool> recovery_cancel_{false};
+	std::thread recovery_thread_;
 };
 
 } 
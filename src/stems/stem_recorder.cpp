@@ -1,6 +1,10 @@
 #include "stem_recorder.hpp"
 
 #include <obs-module.h>
+#include <util/platform.h>
+
+#include "dsp.hpp"
+#include "trace.hpp"
 
 #include <algorithm>
 #include <chrono>
@@ -8,145 +12,357 @@
 
 namespace stems {
 
-static inline int16_t f32_to_s16(float v)
+StemRecorder::~StemRecorder()
+{
+	stop();
+	{
+		std::lock_guard<std::mutex> lock(worker_mtx_);
+		quit_ = true;
+	}
+	worker_cv_.notify_all();
+	if (worker_.joinable())
+		worker_.join();
+}
+
+void StemRecorder::warm()
 {
-	if (v > 1.0f)
-		v = 1.0f;
-	else if (v < -1.0f)
-		v = -1.0f;
-	int x = (int)lrintf(v * 32767.0f);
-	if (x > 32767)
-		x = 32767;
-	if (x < -32768)
-		x = -32768;
-	return (int16_t)x;
+	if (!worker_.joinable())
+		worker_ = std::thread(&StemRecorder::worker_main, this);
 }
 
-StemRecorder::~StemRecorder()
+void StemRecorder::wait_idle()
 {
-	stop();
+	std::unique_lock<std::mutex> lock(worker_mtx_);
+	worker_cv_.wait(lock, [this]() { return !active_; });
+}
+
+// Alignment only corrects for start-up skew; anything larger means the
+// timestamps are not comparable and the chunk is written as-is.
+static const uint64_t k_max_align_ns = 1000000000ull;
+
+StartGate::StartGate(size_t stems, uint64_t timeout_ns)
+	: expected_(stems),
+	  deadline_ns_(os_gettime_ns() + timeout_ns)
+{
+}
+
+void StartGate::arrive(uint64_t timestamp)
+{
+	uint64_t latest = latest_.load();
+	while (timestamp > latest && !latest_.compare_exchange_weak(latest, timestamp)) {
+	}
+	uint64_t first = first_.load();
+	while (timestamp < first && !first_.compare_exchange_weak(first, timestamp)) {
+	}
+	arrived_++;
+}
+
+void StartGate::leave()
+{
+	expected_--;
 }
 
-bool StemRecorder::start(obs_source_t *source, const std::string &wav_path, uint32_t sample_rate, uint16_t channels)
+bool StartGate::ready(uint64_t &start_ns)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (!closed_) {
+		const size_t arrived = arrived_.load();
+		const size_t expected = expected_.load();
+		if (arrived < expected && os_gettime_ns() < deadline_ns_)
+			return false;
+		closed_ = true;
+		start_ns_ = latest_.load();
+		if (arrived > 0)
+			blog(LOG_INFO, "Audio Stems: %zu of %zu stems aligned to a common start (first chunks %.1f ms apart)",
+			     arrived, expected, (double)(start_ns_ - first_.load()) / 1e6);
+	}
+	start_ns = start_ns_;
+	return true;
+}
+
+bool StemRecorder::start(std::unique_ptr<AudioSource> source, const std::string &wav_path, uint32_t sample_rate,
+			 uint16_t channels, DitherMode dither, uint64_t pad_frames)
+{
+	return prepare(std::move(source), wav_path, sample_rate, channels, pad_frames) && attach(dither);
+}
+
+bool StemRecorder::prepare(std::unique_ptr<AudioSource> source, const std::string &wav_path, uint32_t sample_rate,
+			   uint16_t channels, uint64_t pad_frames)
 {
 	stop();
 	if (!source)
 		return false;
 
-	source_ = source;
-	const char *uuid = obs_source_get_uuid(source);
-	const char *name = obs_source_get_name(source);
-	source_uuid_ = uuid ? uuid : "";
-	source_name_ = name ? name : "";
+	source_uuid_ = source->uuid();
+	source_name_ = source->name();
 
 	sample_rate_ = sample_rate ? sample_rate : 48000;
 	channels_ = channels ? channels : 2;
 
 	if (!wav_.open(wav_path, sample_rate_, channels_))
 		return false;
+	// Sources added mid-session start at their offset on the session timeline.
+	if (!wav_.write_silence(pad_frames)) {
+		wav_.close();
+		return false;
+	}
+	source_ = std::move(source);
 
 	running_ = true;
 	stopping_ = false;
+	dropped_chunks_ = 0;
+	peak_ = 0.0f;
+	frames_written_ = pad_frames;
+	bytes_written_ = 0;
+	clipped_samples_ = 0;
+	write_failed_ = false;
+	rms_samples_ = 0;
+	sum_squares_ = 0.0;
+	write_latency_.reset();
+	queue_depth_.reset();
+	wake_to_write_.reset();
+	preroll_frames_ = 0;
+	pad_frames_ = pad_frames;
+	gate_.reset();
+	arrived_ = false;
+	aligned_ = false;
 
-	worker_ = std::thread(&StemRecorder::worker_main, this);
+	warm();
+	{
+		std::lock_guard<std::mutex> lock(worker_mtx_);
+		active_ = true;
+	}
+	worker_cv_.notify_all();
+	return true;
+}
+
+bool StemRecorder::attach(DitherMode dither, const std::shared_ptr<StartGate> &gate)
+{
+	if (!running_ || !source_)
+		return false;
 
-	obs_source_add_audio_capture_callback(source_, &StemRecorder::audio_cb, this);
+	gate_ = gate;
+	if (!source_->attach(this, channels_, dither, pad_frames_ ? nullptr : &preroll_frames_)) {
+		running_ = false;
+		wait_idle();
+		wav_.close();
+		source_.reset();
+		return false;
+	}
+	attached_ = true;
 	return true;
 }
 
+void StemRecorder::release_source()
+{
+	if (source_ && attached_)
+		source_->detach(this);
+	attached_ = false;
+	source_.reset();
+}
+
 void StemRecorder::stop()
 {
 	if (!running_)
 		return;
 
 	stopping_ = true;
-	if (source_)
-		obs_source_remove_audio_capture_callback(source_, &StemRecorder::audio_cb, this);
+	release_source();
 
 	running_ = false;
-	if (worker_.joinable())
-		worker_.join();
+	wait_idle();
 
-	{
-		std::lock_guard<std::mutex> lock(mtx_);
-		queue_.clear();
+	QueuedChunk discard;
+	while (queue_.try_pop(discard)) {
 	}
 	wav_.close();
-	source_ = nullptr;
+
+	const float peak = peak_.load(std::memory_order_relaxed);
+	blog(LOG_INFO,
+	     "Audio Stems: stem %s stopped (peak %.1f dBFS, %llu dropped chunks, queue peak %zu/%zu, "
+	     "write p99 %.2f ms)",
+	     source_name_.c_str(), peak > 0.0f ? 20.0f * std::log10(peak) : -INFINITY,
+	     (unsigned long long)dropped_chunks_.load(), (size_t)queue_depth_.max(), queue_.capacity(),
+	     (double)write_latency_.percentile(0.99) / 1e6);
 }
 
-void StemRecorder::audio_cb(void *param, obs_source_t *, const struct audio_data *audio, bool muted)
+StemCaptureStats StemRecorder::capture_stats() const
 {
-	auto *self = static_cast<StemRecorder *>(param);
-	if (!self || !audio)
-		return;
-	self->on_audio(audio, muted);
+	StemCaptureStats st;
+	st.frames_written = frames_written_.load(std::memory_order_relaxed);
+	st.bytes_written = bytes_written_.load(std::memory_order_relaxed);
+	st.dropped_chunks = dropped_chunks_.load(std::memory_order_relaxed);
+	st.max_queue_depth = (size_t)queue_depth_.max();
+	st.queue_capacity = queue_.capacity();
+	st.write_p50_ns = write_latency_.percentile(0.50);
+	st.write_p99_ns = write_latency_.percentile(0.99);
+	st.write_max_ns = write_latency_.max();
+	st.clipped_samples = clipped_samples_.load(std::memory_order_relaxed);
+	st.write_failed = write_failed_.load(std::memory_order_relaxed);
+	st.peak = peak_.load(std::memory_order_relaxed);
+	const uint64_t n = rms_samples_.load(std::memory_order_relaxed);
+	st.rms = n ? std::sqrt(sum_squares_.load(std::memory_order_relaxed) / (double)n) / 32768.0 : 0.0;
+	return st;
 }
 
-void StemRecorder::on_audio(const struct audio_data *audio, bool muted)
+void StemRecorder::collect_stats(StemLiveStats &out, HotPathHistograms *total) const
 {
-	if (stopping_)
-		return;
+	out.source_uuid = source_uuid_;
+	out.source_name = source_name_;
+	out.frames_written = frames_written_.load(std::memory_order_relaxed);
+	out.dropped_chunks = dropped_chunks_.load(std::memory_order_relaxed);
+	out.queue_capacity = queue_.capacity();
+	out.queue_depth = summarize(queue_depth_);
+	out.write_ns = summarize(write_latency_);
+	out.wake_to_write_ns = summarize(wake_to_write_);
+	queue_depth_.copy_to(out.counts.queue_depth);
+	write_latency_.copy_to(out.counts.write_ns);
+	wake_to_write_.copy_to(out.counts.wake_to_write_ns);
+	if (total) {
+		total->queue_depth.merge_from(queue_depth_);
+		total->write_ns.merge_from(write_latency_);
+		total->wake_to_write_ns.merge_from(wake_to_write_);
+	}
+}
 
-	const uint32_t frames = audio->frames;
-	if (frames == 0)
+void StemRecorder::on_chunk(const ChunkPtr &chunk, uint64_t timestamp)
+{
+	if (stopping_)
 		return;
 
-	
-	PcmChunk chunk;
-	chunk.frames = frames;
-	chunk.samples.resize((size_t)frames * (size_t)channels_);
-
-	for (uint32_t i = 0; i < frames; i++) {
-		for (uint16_t ch = 0; ch < channels_; ch++) {
-			float v = 0.0f;
-			if (!muted && audio->data[ch]) {
-				const float *plane = reinterpret_cast<const float *>(audio->data[ch]);
-				v = plane[i];
-			}
-			chunk.samples[(size_t)i * (size_t)channels_ + ch] = f32_to_s16(v);
-		}
+	trace::Scope span("enqueue", "capture");
+	if (gate_ && !arrived_ && timestamp != 0) {
+		gate_->arrive(timestamp);
+		arrived_ = true;
 	}
+	if (chunk->peak > peak_.load(std::memory_order_relaxed))
+		peak_.store(chunk->peak, std::memory_order_relaxed);
 
-	
-	
-	{
-		std::lock_guard<std::mutex> lock(mtx_);
-		if (queue_.size() >= 128) {
-			queue_.pop_front();
-			dropped_chunks_++;
-		}
-		queue_.push_back(std::move(chunk));
+	if (!queue_.try_push(QueuedChunk{chunk, timestamp, os_gettime_ns()})) {
+		dropped_chunks_++;
+		return;
 	}
+	queue_depth_.record(queue_.size());
 }
 
 void StemRecorder::worker_main()
 {
-	while (running_ || stopping_) {
-		PcmChunk chunk;
-		bool got = false;
+	// The thread outlives a session so a pooled recorder starts warm.
+	trace::name_thread("stem writer");
+	for (;;) {
 		{
-			std::lock_guard<std::mutex> lock(mtx_);
-			if (!queue_.empty()) {
-				chunk = std::move(queue_.front());
-				queue_.pop_front();
-				got = true;
-			}
+			std::unique_lock<std::mutex> lock(worker_mtx_);
+			worker_cv_.wait(lock, [this]() { return active_ || quit_; });
+			if (!active_)
+				return;
 		}
+		write_session();
+		{
+			std::lock_guard<std::mutex> lock(worker_mtx_);
+			active_ = false;
+		}
+		worker_cv_.notify_all();
+	}
+}
 
-		if (!got) {
+void StemRecorder::write_session()
+{
+	QueuedChunk q;
+	bool have = false;
+	bool gate_open = false;
+	uint64_t start_ns = 0;
+	while (running_ || stopping_) {
+		if (!have && !(have = queue_.try_pop(q))) {
 			if (!running_)
 				break;
 			std::this_thread::sleep_for(std::chrono::milliseconds(5));
 			continue;
 		}
+		// Hold audio until the stems of the session start have lined up.
+		if (gate_ && !gate_open) {
+			gate_open = gate_->ready(start_ns);
+			if (!gate_open && running_) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+				continue;
+			}
+			gate_open = true;
+		}
+		have = false;
+
+		wake_to_write_.record(os_gettime_ns() - q.queued_ns);
+		if (!write_aligned(q, start_ns)) {
+			blog(LOG_ERROR, "Audio Stems: failed writing WAV for %s", source_name_.c_str());
+			write_failed_ = true;
+			break;
+		}
+	}
+}
 
-	if (!wav_.write_samples(chunk.samples.data(), chunk.frames)) {
-		
-		blog(LOG_ERROR, "Audio Stems: failed writing WAV for %s", source_name_.c_str());
-		break;
+bool StemRecorder::write_aligned(const QueuedChunk &q, uint64_t start_ns)
+{
+	const PcmChunk &c = *q.chunk;
+	if (aligned_ || start_ns == 0 || q.timestamp == 0) {
+		aligned_ = true;
+		return write_chunk(c, 0);
 	}
+
+	// Drop what came in before the common start, pad up to it if late.
+	const uint64_t delta_ns = q.timestamp < start_ns ? start_ns - q.timestamp : q.timestamp - start_ns;
+	uint64_t skip = 0;
+	if (delta_ns <= k_max_align_ns) {
+		const uint64_t delta = delta_ns * sample_rate_ / 1000000000ull;
+		if (q.timestamp > start_ns) {
+			if (!write_padding(delta))
+				return false;
+			if (preroll_frames_ > 0)
+				preroll_frames_ += delta;
+		} else {
+			skip = std::min<uint64_t>(delta, c.frames);
+			preroll_frames_ -= std::min<uint64_t>(preroll_frames_, skip);
+		}
 	}
+	if (skip == c.frames)
+		return true;
+	aligned_ = true;
+	return write_chunk(c, (size_t)skip);
 }
 
-} 
+bool StemRecorder::write_padding(uint64_t frames)
+{
+	trace::Scope span("write_silence", "writer");
+	if (!wav_.write_silence(frames))
+		return false;
+	frames_written_.fetch_add(frames, std::memory_order_relaxed);
+	return true;
+}
+
+bool StemRecorder::write_chunk(const PcmChunk &c, size_t skip)
+{
+	const int16_t *samples = c.samples.data() + skip * channels_;
+	const size_t frames = c.frames - skip;
+	const size_t count = frames * channels_;
+
+	trace::Scope span("write", "writer");
+	const uint64_t begin_ns = os_gettime_ns();
+	if (!wav_.write_samples(samples, frames))
+		return false;
+	write_latency_.record(os_gettime_ns() - begin_ns);
+
+	frames_written_.fetch_add(frames, std::memory_order_relaxed);
+	bytes_written_.fetch_add(count * sizeof(int16_t), std::memory_order_relaxed);
+	rms_samples_.fetch_add(count, std::memory_order_relaxed);
+	// Silent chunks are shared zeros; skip the pass over them.
+	if (c.peak > 0.0f)
+		sum_squares_.store(sum_squares_.load(std::memory_order_relaxed) +
+					   (double)dsp::sum_squares_s16(samples, count),
+				   std::memory_order_relaxed);
+	if (c.peak >= 1.0f) {
+		uint64_t clipped = 0;
+		for (size_t i = 0; i < count; i++)
+			clipped += (samples[i] == INT16_MAX || samples[i] == INT16_MIN) ? 1 : 0;
+		clipped_samples_.fetch_add(clipped, std::memory_order_relaxed);
+	}
+	return true;
+}
+
+}
@@ -1,44 +1,118 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
 #include <cstdint>
-#include <deque>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 
-#include <obs-module.h>
-
+#include "audio_source.hpp"
+#include "histogram.hpp"
+#include "live_stats.hpp"
+#include "spsc_queue.hpp"
 #include "wav_writer.hpp"
 
 namespace stems {
 
-struct PcmChunk {
-	std::vector<int16_t> samples; 
-	uint32_t frames = 0;
+// Lines up the stems of one session start. Each stem reports the timestamp
+// of its first chunk; all of them begin at the latest one, or at the latest
+// seen when the timeout passes (later stems are padded up to it).
+class StartGate {
+public:
+	StartGate(size_t stems, uint64_t timeout_ns);
+
+	// Audio thread; once per stem.
+	void arrive(uint64_t timestamp);
+	// For stems that failed to start.
+	void leave();
+	bool ready(uint64_t &start_ns);
+
+private:
+	std::atomic<size_t> expected_;
+	std::atomic<size_t> arrived_{0};
+	std::atomic<uint64_t> first_{UINT64_MAX};
+	std::atomic<uint64_t> latest_{0};
+	const uint64_t deadline_ns_;
+	std::mutex mtx_;
+	bool closed_ = false;
+	uint64_t start_ns_ = 0;
 };
 
-class StemRecorder {
+// What one stem's capture did, for the session sidecar.
+struct StemCaptureStats {
+	uint64_t frames_written = 0;
+	uint64_t bytes_written = 0;
+	uint64_t dropped_chunks = 0;
+	size_t max_queue_depth = 0;
+	size_t queue_capacity = 0;
+	uint64_t write_p50_ns = 0;
+	uint64_t write_p99_ns = 0;
+	uint64_t write_max_ns = 0;
+	uint64_t clipped_samples = 0;
+	// A write failed and the stem stopped growing there.
+	bool write_failed = false;
+	float peak = 0.0f;
+	// Over the captured audio, not the silence padding.
+	double rms = 0.0;
+};
+
+class StemRecorder : public CaptureSink {
 public:
 	StemRecorder() = default;
-	~StemRecorder();
+	~StemRecorder() override;
 	StemRecorder(const StemRecorder &) = delete;
 	StemRecorder &operator=(const StemRecorder &) = delete;
 
-	bool start(obs_source_t *source, const std::string &wav_path, uint32_t sample_rate, uint16_t channels);
+	// pad_frames of silence lead the stem in place of any pre-roll.
+	bool start(std::unique_ptr<AudioSource> source, const std::string &wav_path, uint32_t sample_rate,
+		   uint16_t channels, DitherMode dither = DitherMode::Off, uint64_t pad_frames = 0);
+	// start() in two steps: prepare() opens the file and starts the writer,
+	// attach() only hooks up the capture so a session can attach every stem
+	// at once. With a gate, the writer holds audio until the stems line up.
+	bool prepare(std::unique_ptr<AudioSource> source, const std::string &wav_path, uint32_t sample_rate,
+		     uint16_t channels, uint64_t pad_frames = 0);
+	bool attach(DitherMode dither, const std::shared_ptr<StartGate> &gate = nullptr);
+	// Starts the writer thread ahead of use; it then idles between sessions.
+	void warm();
+	// Stops capturing and drops the source; the file stays open
+	// until stop() so the stem keeps its place on the session timeline.
+	void release_source();
+	bool has_source() const { return source_ != nullptr; }
+	// Frames of pre-roll written ahead of the live audio.
+	uint64_t preroll_frames() const { return preroll_frames_.load(std::memory_order_relaxed); }
 	void stop();
 
+	void on_chunk(const ChunkPtr &chunk, uint64_t timestamp) override;
+
 	const std::string &wav_path() const { return wav_.path(); }
 	const std::string &source_uuid() const { return source_uuid_; }
 	const std::string &source_name() const { return source_name_; }
+	float peak() const { return peak_.load(std::memory_order_relaxed); }
+	uint64_t dropped_chunks() const { return dropped_chunks_.load(std::memory_order_relaxed); }
+	bool write_failed() const { return write_failed_.load(std::memory_order_relaxed); }
+	StemCaptureStats capture_stats() const;
+	// Live view while recording; adds this stem's histograms to total.
+	void collect_stats(StemLiveStats &out, HotPathHistograms *total) const;
 
 private:
-	static void audio_cb(void *param, obs_source_t *source, const struct audio_data *audio, bool muted);
-	void on_audio(const struct audio_data *audio, bool muted);
+	struct QueuedChunk {
+		ChunkPtr chunk;
+		uint64_t timestamp = 0;
+		uint64_t queued_ns = 0;
+	};
+
 	void worker_main();
+	void write_session();
+	void wait_idle();
+	bool write_aligned(const QueuedChunk &q, uint64_t start_ns);
+	bool write_chunk(const PcmChunk &c, size_t skip);
+	bool write_padding(uint64_t frames);
 
-	obs_source_t *source_ = nullptr; 
+	std::unique_ptr<AudioSource> source_;
+	bool attached_ = false;
 	std::string source_uuid_;
 	std::string source_name_;
 
@@ -47,13 +121,32 @@ private:
 
 	WavWriter wav_;
 
-	std::mutex mtx_;
-	std::deque<PcmChunk> queue_;
+	SpscQueue<QueuedChunk> queue_{128};
+	std::atomic<uint64_t> preroll_frames_{0};
+	uint64_t pad_frames_ = 0;
+	std::shared_ptr<StartGate> gate_;
+	bool arrived_ = false;
+	bool aligned_ = false;
 	std::atomic<bool> running_{false};
 	std::atomic<bool> stopping_{false};
 	std::thread worker_;
+	std::mutex worker_mtx_;
+	std::condition_variable worker_cv_;
+	bool active_ = false;
+	bool quit_ = false;
 
 	std::atomic<uint64_t> dropped_chunks_{0};
+	std::atomic<float> peak_{0.0f};
+	// Written by the worker only.
+	std::atomic<uint64_t> frames_written_{0};
+	std::atomic<uint64_t> bytes_written_{0};
+	std::atomic<uint64_t> clipped_samples_{0};
+	std::atomic<bool> write_failed_{false};
+	std::atomic<uint64_t> rms_samples_{0};
+	std::atomic<double> sum_squares_{0.0};
+	Histogram write_latency_;
+	Histogram queue_depth_;
+	Histogram wake_to_write_;
 };
 
 } 
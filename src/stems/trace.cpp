@@ -0,0 +1,287 @@
+#include "trace.hpp"
+
+#include <util/platform.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+
+namespace stems {
+namespace trace {
+
+// Per-thread ring of about 3 MiB, a few minutes of a stem writer's events.
+// Rings exist only while tracing and are allocated by acquire() or
+// name_thread(), never by record().
+static const size_t k_max_events_per_thread = 1u << 15;
+// Ready-made buffers for threads that record without being named, such as
+// the OBS audio thread.
+static const size_t k_spare_buffers = 4;
+
+namespace {
+
+struct ThreadBuffer {
+	std::mutex mtx;
+	uint32_t thread = 0;
+	const char *name = nullptr;
+	std::unique_ptr<Event[]> events;
+	size_t count = 0;
+	size_t next = 0;
+};
+
+struct Registry {
+	std::mutex mtx;
+	std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+	std::vector<std::shared_ptr<ThreadBuffer>> spare;
+	uint32_t next_thread = 1;
+	int holders = 0;
+};
+
+}
+
+static std::atomic<bool> g_enabled{false};
+static thread_local std::shared_ptr<ThreadBuffer> t_buffer;
+static thread_local const char *t_name = nullptr;
+
+static Registry &registry()
+{
+	static Registry r;
+	return r;
+}
+
+bool enabled()
+{
+	return g_enabled.load(std::memory_order_relaxed);
+}
+
+static void allocate_ring(ThreadBuffer &b)
+{
+	std::lock_guard<std::mutex> lock(b.mtx);
+	if (!b.events)
+		b.events.reset(new Event[k_max_events_per_thread]);
+}
+
+void acquire()
+{
+	Registry &r = registry();
+	std::lock_guard<std::mutex> lock(r.mtx);
+	if (r.holders++ > 0)
+		return;
+	for (auto &b : r.buffers)
+		allocate_ring(*b);
+	r.spare.reserve(k_spare_buffers);
+	while (r.spare.size() < k_spare_buffers) {
+		auto b = std::make_shared<ThreadBuffer>();
+		allocate_ring(*b);
+		r.spare.push_back(std::move(b));
+	}
+	// Handing out a spare must not grow the list either.
+	r.buffers.reserve(r.buffers.size() + r.spare.size());
+	g_enabled = true;
+}
+
+void release()
+{
+	Registry &r = registry();
+	std::lock_guard<std::mutex> lock(r.mtx);
+	if (r.holders == 0 || --r.holders > 0)
+		return;
+	g_enabled = false;
+	// Buffers of threads that have exited are only referenced here.
+	r.buffers.erase(std::remove_if(r.buffers.begin(), r.buffers.end(),
+				       [](const std::shared_ptr<ThreadBuffer> &b) { return b.use_count() == 1; }),
+			r.buffers.end());
+	for (auto &b : r.buffers) {
+		std::lock_guard<std::mutex> buffer_lock(b->mtx);
+		b->events.reset();
+		b->count = 0;
+		b->next = 0;
+	}
+	r.spare.clear();
+}
+
+void name_thread(const char *name)
+{
+	if (t_buffer && t_name == name)
+		return;
+	t_name = name;
+	if (t_buffer) {
+		std::lock_guard<std::mutex> lock(t_buffer->mtx);
+		t_buffer->name = name;
+		return;
+	}
+	auto b = std::make_shared<ThreadBuffer>();
+	b->name = name;
+	Registry &r = registry();
+	std::lock_guard<std::mutex> lock(r.mtx);
+	b->thread = r.next_thread++;
+	if (r.holders > 0)
+		allocate_ring(*b);
+	r.buffers.push_back(b);
+	t_buffer = std::move(b);
+}
+
+// Named threads already have a buffer. Any other thread takes a spare, and
+// drops its events while the registry is busy or none is left.
+static ThreadBuffer *thread_buffer()
+{
+	if (t_buffer)
+		return t_buffer.get();
+	Registry &r = registry();
+	std::unique_lock<std::mutex> lock(r.mtx, std::try_to_lock);
+	if (!lock.owns_lock() || r.spare.empty())
+		return nullptr;
+	std::shared_ptr<ThreadBuffer> b = std::move(r.spare.back());
+	r.spare.pop_back();
+	b->name = t_name;
+	b->thread = r.next_thread++;
+	r.buffers.push_back(b);
+	t_buffer = std::move(b);
+	return t_buffer.get();
+}
+
+static void copy_detail(char (&dst)[k_detail_bytes], const char *src)
+{
+	const size_t len = src ? std::strlen(src) : 0;
+	if (len < k_detail_bytes) {
+		std::memcpy(dst, src ? src : "", len + 1);
+		return;
+	}
+	std::memcpy(dst, "...", 3);
+	std::memcpy(dst + 3, src + len - (k_detail_bytes - 4), k_detail_bytes - 4);
+	dst[k_detail_bytes - 1] = '\0';
+}
+
+void record(const char *name, const char *category, uint64_t begin_ns, uint64_t end_ns, const char *detail)
+{
+	if (!enabled())
+		return;
+	ThreadBuffer *b = thread_buffer();
+	if (!b)
+		return;
+	std::lock_guard<std::mutex> lock(b->mtx);
+	if (!b->events)
+		return;
+	Event &e = b->events[b->next];
+	e.name = name;
+	e.category = category;
+	e.begin_ns = begin_ns;
+	e.end_ns = end_ns;
+	e.thread = b->thread;
+	copy_detail(e.detail, detail);
+	b->next = (b->next + 1) % k_max_events_per_thread;
+	b->count = std::min(b->count + 1, k_max_events_per_thread);
+}
+
+void collect(uint64_t since_ns, std::vector<Event> &events, std::vector<ThreadInfo> &threads)
+{
+	std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+	{
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mtx);
+		buffers = r.buffers;
+	}
+	for (auto &b : buffers) {
+		std::lock_guard<std::mutex> lock(b->mtx);
+		const size_t before = events.size();
+		const size_t n = b->count;
+		const size_t first = n < k_max_events_per_thread ? 0 : b->next;
+		for (size_t i = 0; i < n; i++) {
+			const Event &e = b->events[(first + i) % k_max_events_per_thread];
+			if (e.begin_ns >= since_ns)
+				events.push_back(e);
+		}
+		if (events.size() > before)
+			threads.push_back(ThreadInfo{b->thread, b->name ? b->name : ""});
+	}
+}
+
+static void write_json_string(std::FILE *f, const char *s)
+{
+	std::fputc('"', f);
+	for (; s && *s; s++) {
+		const unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\')
+			std::fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			std::fprintf(f, "\\u%04x", c);
+		else
+			std::fputc(c, f);
+	}
+	std::fputc('"', f);
+}
+
+bool write_chrome_trace(const std::string &path, const std::vector<Event> &events,
+			const std::vector<ThreadInfo> &threads, uint64_t origin_ns)
+{
+	const std::string tmp = path + ".tmp";
+	std::FILE *f = std::fopen(tmp.c_str(), "wb");
+	if (!f)
+		return false;
+
+	std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+	bool first = true;
+	for (const auto &t : threads) {
+		if (t.name.empty())
+			continue;
+		std::fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+			     first ? "" : ",\n", t.thread);
+		write_json_string(f, t.name.c_str());
+		std::fputs("}}", f);
+		first = false;
+	}
+	for (const auto &e : events) {
+		const uint64_t begin = e.begin_ns > origin_ns ? e.begin_ns - origin_ns : 0;
+		const uint64_t dur = e.end_ns > e.begin_ns ? e.end_ns - e.begin_ns : 0;
+		std::fprintf(f, "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+			     first ? "" : ",\n", e.thread, (double)begin / 1e3, (double)dur / 1e3);
+		write_json_string(f, e.name);
+		std::fputs(",\"cat\":", f);
+		write_json_string(f, e.category);
+		if (e.detail[0]) {
+			std::fputs(",\"args\":{\"detail\":", f);
+			write_json_string(f, e.detail);
+			std::fputc('}', f);
+		}
+		std::fputc('}', f);
+		first = false;
+	}
+	std::fputs("\n]}\n", f);
+
+	bool ok = !std::ferror(f);
+	ok = std::fclose(f) == 0 && ok;
+	std::error_code ec;
+	if (ok)
+		std::filesystem::rename(tmp, path, ec);
+	if (!ok || ec) {
+		std::filesystem::remove(tmp, ec);
+		return false;
+	}
+	return true;
+}
+
+Scope::Scope(const char *name, const char *category) : name_(name), category_(category)
+{
+	if (enabled())
+		begin_ns_ = os_gettime_ns();
+}
+
+Scope::Scope(const char *name, const char *category, const std::string &detail) : name_(name), category_(category)
+{
+	if (enabled()) {
+		begin_ns_ = os_gettime_ns();
+		copy_detail(detail_, detail.c_str());
+	}
+}
+
+Scope::~Scope()
+{
+	if (begin_ns_ != 0)
+		record(name_, category_, begin_ns_, os_gettime_ns(), detail_);
+}
+
+}
+}
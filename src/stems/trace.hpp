@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace stems {
+namespace trace {
+
+// Longer details keep their end, where file names and timestamps are.
+constexpr size_t k_detail_bytes = 48;
+
+// Plain data, so recording an event never allocates.
+struct Event {
+	const char *name = nullptr;
+	const char *category = nullptr;
+	uint64_t begin_ns = 0;
+	uint64_t end_ns = 0;
+	uint32_t thread = 0;
+	char detail[k_detail_bytes] = {};
+};
+
+struct ThreadInfo {
+	uint32_t thread = 0;
+	std::string name;
+};
+
+// Tracing is on while at least one session holds it. When off, a scope
+// costs one relaxed load.
+bool enabled();
+void acquire();
+void release();
+
+// Names the calling thread in traces; name must outlive the thread.
+void name_thread(const char *name);
+
+// Does nothing while tracing is off.
+void record(const char *name, const char *category, uint64_t begin_ns, uint64_t end_ns,
+	    const char *detail = nullptr);
+inline void record(const char *name, const char *category, uint64_t begin_ns, uint64_t end_ns,
+		   const std::string &detail)
+{
+	record(name, category, begin_ns, end_ns, detail.c_str());
+}
+
+// Events that began at or after since_ns, oldest first per thread. Each
+// thread keeps only its most recent events, so a long session loses its
+// beginning rather than growing without bound.
+void collect(uint64_t since_ns, std::vector<Event> &events, std::vector<ThreadInfo> &threads);
+
+// Chrome trace-event JSON, loadable in chrome://tracing and Perfetto.
+bool write_chrome_trace(const std::string &path, const std::vector<Event> &events,
+			const std::vector<ThreadInfo> &threads, uint64_t origin_ns);
+
+class Scope {
+public:
+	Scope(const char *name, const char *category);
+	Scope(const char *name, const char *category, const std::string &detail);
+	~Scope();
+	Scope(const Scope &) = delete;
+	Scope &operator=(const Scope &) = delete;
+
+private:
+	const char *name_;
+	const char *category_;
+	uint64_t begin_ns_ = 0;
+	char detail_[k_detail_bytes] = {};
+};
+
+}
+}
@@ -1,5 +1,7 @@
 #include "transcode.hpp"
 
+#include "trace.hpp"
+
 #include <obs-module.h>
 
 #include <cstdlib>
@@ -75,6 +77,7 @@ bool export_audio(const std::string &ffmpeg_path_or_empty, const std::string &in
 
 	cmd << " " << shell_quote(output_path);
 
+	trace::Scope span("ffmpeg", "encoder", output_path);
 	int rc = std::system(cmd.str().c_str());
 	if (rc != 0) {
 		blog(LOG_ERROR, "Audio Stems: ffmpeg export failed (rc=%d)", rc);
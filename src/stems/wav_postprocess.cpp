@@ -1,10 +1,15 @@
 #include "wav_postprocess.hpp"
 
+#include "dsp.hpp"
+#include "limiter.hpp"
+#include "parallel.hpp"
 #include "wav_writer.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <vector>
 
@@ -20,66 +25,128 @@ static inline int16_t clamp_s16(int32_t v)
 	return (int16_t)v;
 }
 
-static bool read_pcm16_data(const std::string &path, std::vector<int16_t> &out, uint16_t channels)
+static const uint64_t k_header_bytes = 44;
+static const size_t k_block_samples = (size_t)1 << 20;
+static const size_t k_scan_samples = (size_t)1 << 16;
+
+static int seek64(std::FILE *f, uint64_t offset)
 {
-	out.clear();
-	std::FILE *f = std::fopen(path.c_str(), "rb");
-	if (!f)
-		return false;
-	
-	if (std::fseek(f, 0, SEEK_END) != 0) {
-		std::fclose(f);
-		return false;
+#if defined(_WIN32)
+	return _fseeki64(f, (__int64)offset, SEEK_SET);
+#else
+	return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+class PcmFile {
+public:
+	PcmFile() = default;
+	~PcmFile() { close(); }
+	PcmFile(const PcmFile &) = delete;
+	PcmFile &operator=(const PcmFile &) = delete;
+	PcmFile(PcmFile &&o) noexcept : fp_(o.fp_) { o.fp_ = nullptr; }
+
+	void close()
+	{
+		if (fp_)
+			std::fclose(fp_);
+		fp_ = nullptr;
 	}
-	long sz = std::ftell(f);
-	if (sz < 44) {
-		std::fclose(f);
-		return false;
+
+	bool read_at(const std::string &path, uint64_t sample, int16_t *dst, size_t count)
+	{
+		if (!fp_)
+			fp_ = std::fopen(path.c_str(), "rb");
+		if (!fp_ || seek64(fp_, k_header_bytes + sample * 2u) != 0)
+			return false;
+		return std::fread(dst, sizeof(int16_t), count, fp_) == count;
 	}
-	const long data_bytes = sz - 44;
-	if (data_bytes <= 0) {
-		std::fclose(f);
-		return true;
+
+	bool write_at(const std::string &path, uint64_t sample, const int16_t *src, size_t count)
+	{
+		if (!fp_)
+			fp_ = std::fopen(path.c_str(), "rb+");
+		if (!fp_ || seek64(fp_, k_header_bytes + sample * 2u) != 0)
+			return false;
+		return std::fwrite(src, sizeof(int16_t), count, fp_) == count;
 	}
-	if (data_bytes % 2 != 0) {
-		std::fclose(f);
+
+private:
+	std::FILE *fp_ = nullptr;
+};
+
+static bool pcm16_sample_count(const std::string &path, uint64_t &samples)
+{
+	std::error_code ec;
+	const uint64_t sz = fs::file_size(fs::path(path), ec);
+	if (ec || sz < k_header_bytes)
 		return false;
-	}
-	const size_t samples = (size_t)(data_bytes / 2);
-	if (samples < channels) {
-		std::fclose(f);
-		return true;
-	}
-	if (std::fseek(f, 44, SEEK_SET) != 0) {
-		std::fclose(f);
+	if ((sz - k_header_bytes) % 2 != 0)
 		return false;
-	}
-	out.resize(samples);
-	size_t rd = std::fread(out.data(), sizeof(int16_t), samples, f);
+	samples = (sz - k_header_bytes) / 2;
+	return true;
+}
+
+bool read_wav_format(const std::string &wav_path, WavFormat &out)
+{
+	out = WavFormat{};
+	uint64_t samples = 0;
+	if (!pcm16_sample_count(wav_path, samples))
+		return false;
+	std::FILE *f = std::fopen(wav_path.c_str(), "rb");
+	if (!f)
+		return false;
+	unsigned char h[k_header_bytes];
+	const bool ok = std::fread(h, 1, sizeof(h), f) == sizeof(h);
 	std::fclose(f);
-	if (rd != samples)
+	if (!ok || std::memcmp(h, "RIFF", 4) != 0 || std::memcmp(h + 8, "WAVE", 4) != 0)
+		return false;
+	out.channels = (uint16_t)(h[22] | (h[23] << 8));
+	out.sample_rate = (uint32_t)h[24] | ((uint32_t)h[25] << 8) | ((uint32_t)h[26] << 16) | ((uint32_t)h[27] << 24);
+	if (out.channels == 0)
 		return false;
+	out.frames = samples / out.channels;
 	return true;
 }
 
-static bool write_pcm16_data(const std::string &path, const std::vector<int16_t> &samples,
-			     uint32_t sample_rate, uint16_t channels)
+bool wav_fingerprint(const std::string &wav_path, uint64_t &out)
 {
-	WavWriter w;
-	if (!w.open(path, sample_rate, channels))
+	static const size_t k_blocks = 16;
+	static const size_t k_block = 2048;
+	uint64_t samples = 0;
+	if (!pcm16_sample_count(wav_path, samples))
 		return false;
-	const size_t frames = channels ? (samples.size() / channels) : 0;
-	if (frames > 0) {
-		
-		if (!w.write_samples(samples.data(), frames)) {
-			w.close();
+	uint64_t h = 1469598103934665603ull ^ samples;
+	std::vector<int16_t> block(k_block);
+	PcmFile in;
+	const size_t n = (size_t)std::min<uint64_t>(k_block, samples);
+	for (size_t b = 0; n && b < k_blocks; b++) {
+		const uint64_t pos = (samples - n) * b / (k_blocks - 1);
+		if (!in.read_at(wav_path, pos, block.data(), n))
 			return false;
+		for (size_t i = 0; i < n; i++) {
+			h ^= (uint16_t)block[i];
+			h *= 1099511628211ull;
 		}
 	}
-	w.close();
+	out = h;
 	return true;
 }
 
+static bool create_pcm16_file(const std::string &path, uint64_t samples, uint32_t sample_rate, uint16_t channels)
+{
+	{
+		WavWriter w;
+		if (!w.open(path, sample_rate, channels))
+			return false;
+	}
+	std::error_code ec;
+	fs::resize_file(fs::path(path), k_header_bytes + samples * 2u, ec);
+	if (ec)
+		return false;
+	return WavWriter::repair_header(path);
+}
+
 static bool swap_in_tmp(const std::string &original, const std::string &tmp)
 {
 	std::error_code ec;
@@ -89,69 +156,231 @@ static bool swap_in_tmp(const std::string &original, const std::string &tmp)
 	return !ec;
 }
 
-bool trim_silence_wav(const std::string &wav_path, uint16_t channels, uint32_t sample_rate,
-			      float threshold_dbfs, int lead_ms, int trail_ms)
+static bool apply_gain_wav(const std::string &wav_path, uint64_t samples, uint32_t sample_rate, uint16_t channels,
+			   long double gain)
+{
+	if (gain <= 0.0L)
+		return true;
+
+	std::vector<int16_t> lut(65536);
+	for (int32_t v = -32768; v <= 32767; v++)
+		lut[(size_t)(v + 32768)] = clamp_s16((int32_t)std::llround((long double)v * gain));
+
+	const size_t blocks = (size_t)((samples + k_block_samples - 1) / k_block_samples);
+	const size_t workers = parallel_workers(blocks);
+	std::atomic<bool> ok{true};
+
+	fs::path p = fs::path(wav_path);
+	fs::path tmp = p;
+	tmp += ".norm.tmp";
+	if (!create_pcm16_file(tmp.string(), samples, sample_rate, channels)) {
+		std::error_code ec;
+		fs::remove(tmp, ec);
+		return false;
+	}
+	{
+		std::vector<PcmFile> in(workers);
+		std::vector<PcmFile> out(workers);
+		std::vector<std::vector<int16_t>> bufs(workers);
+		parallel_for(blocks, workers, [&](size_t w, size_t b) {
+			if (!ok)
+				return;
+			const uint64_t first = (uint64_t)b * k_block_samples;
+			const size_t count = (size_t)std::min<uint64_t>(k_block_samples, samples - first);
+			bufs[w].resize(count);
+			int16_t *v = bufs[w].data();
+			if (!in[w].read_at(wav_path, first, v, count)) {
+				ok = false;
+				return;
+			}
+			for (size_t i = 0; i < count; i++)
+				v[i] = lut[(size_t)((int32_t)v[i] + 32768)];
+			if (!out[w].write_at(tmp.string(), first, v, count))
+				ok = false;
+		});
+	}
+	if (!ok) {
+		std::error_code ec;
+		fs::remove(tmp, ec);
+		return false;
+	}
+	if (!swap_in_tmp(wav_path, tmp.string())) {
+		std::error_code ec;
+		fs::remove(tmp, ec);
+		return false;
+	}
+	return true;
+}
+
+static bool limiter_engages(const LimiterParams &params, long double scaled_peak)
+{
+	return scaled_peak > 32767.0L * std::pow(10.0L, (long double)std::min(0.0f, params.ceiling_dbfs) / 20.0L);
+}
+
+static bool apply_gain_limited_wav(const std::string &wav_path, uint64_t samples, uint32_t sample_rate,
+				   uint16_t channels, long double gain, const LimiterParams &params)
+{
+	if (gain <= 0.0L)
+		return true;
+
+	const uint64_t frames = samples / channels;
+	const size_t block_frames = k_block_samples / channels;
+	const float g = (float)gain;
+
+	fs::path p = fs::path(wav_path);
+	fs::path tmp = p;
+	tmp += ".norm.tmp";
+	if (!create_pcm16_file(tmp.string(), frames * channels, sample_rate, channels)) {
+		std::error_code ec;
+		fs::remove(tmp, ec);
+		return false;
+	}
+
+	LookaheadLimiter limiter(sample_rate, channels, params, 32767.0f);
+	PcmFile in;
+	PcmFile out;
+	std::vector<int16_t> pcm(block_frames * channels);
+	std::vector<float> work(std::max(block_frames, limiter.latency()) * channels);
+	size_t discard = limiter.latency();
+	uint64_t written = 0;
+	bool ok = true;
+
+	auto emit = [&](size_t n) {
+		const size_t skip = std::min(discard, n);
+		discard -= skip;
+		const size_t keep = std::min<uint64_t>(n - skip, frames - written);
+		if (keep == 0)
+			return true;
+		const float *src = work.data() + skip * channels;
+		for (size_t i = 0; i < keep * channels; i++)
+			pcm[i] = clamp_s16((int32_t)std::lrintf(src[i]));
+		if (!out.write_at(tmp.string(), written * channels, pcm.data(), keep * channels))
+			return false;
+		written += keep;
+		return true;
+	};
+
+	for (uint64_t pos = 0; ok && pos < frames; pos += block_frames) {
+		const size_t n = (size_t)std::min<uint64_t>(block_frames, frames - pos);
+		if (!in.read_at(wav_path, pos * channels, pcm.data(), n * channels)) {
+			ok = false;
+			break;
+		}
+		for (size_t i = 0; i < n * channels; i++)
+			work[i] = (float)pcm[i] * g;
+		limiter.process(work.data(), n);
+		ok = emit(n);
+	}
+	if (ok && limiter.latency() > 0) {
+		limiter.drain(work.data(), limiter.latency());
+		ok = emit(limiter.latency());
+	}
+	in.close();
+	out.close();
+
+	if (!ok || written != frames) {
+		std::error_code ec;
+		fs::remove(tmp, ec);
+		return false;
+	}
+	if (!swap_in_tmp(wav_path, tmp.string())) {
+		std::error_code ec;
+		fs::remove(tmp, ec);
+		return false;
+	}
+	return true;
+}
+
+bool find_audible_range_wav(const std::string &wav_path, uint16_t channels, float threshold_dbfs, AudibleRange &out)
 {
 	if (channels == 0)
 		channels = 2;
-	if (sample_rate == 0)
-		sample_rate = 48000;
+	out = AudibleRange{};
 
-	std::vector<int16_t> s;
-	if (!read_pcm16_data(wav_path, s, channels))
+	uint64_t samples = 0;
+	if (!pcm16_sample_count(wav_path, samples))
 		return false;
-	if (s.empty())
-		return true;
 
 	const int32_t thr = (int32_t)std::round(std::pow(10.0f, threshold_dbfs / 20.0f) * 32767.0f);
 	const int32_t athr = std::max<int32_t>(1, std::min<int32_t>(32767, std::abs(thr)));
 
-	const size_t total_frames = s.size() / channels;
+	const uint64_t total_frames = samples / channels;
+	out.total_frames = total_frames;
 	if (total_frames == 0)
 		return true;
+	const uint64_t used = total_frames * channels;
 
-	auto frame_is_audible = [&](size_t frame) {
-		for (uint16_t ch = 0; ch < channels; ch++) {
-			int32_t v = s[frame * channels + ch];
-			if (v < 0)
-				v = -v;
-			if (v >= athr)
-				return true;
-		}
-		return false;
-	};
+	PcmFile in;
+	std::vector<int16_t> buf(k_scan_samples);
 
-	size_t first = 0;
-	while (first < total_frames && !frame_is_audible(first))
-		first++;
-	if (first >= total_frames) {
-		
+	uint64_t first = total_frames;
+	for (uint64_t pos = 0; pos < used; pos += k_scan_samples) {
+		const size_t count = (size_t)std::min<uint64_t>(k_scan_samples, used - pos);
+		if (!in.read_at(wav_path, pos, buf.data(), count))
+			return false;
+		const size_t hit = dsp::find_first_above_s16(buf.data(), count, athr);
+		if (hit != count) {
+			first = (pos + hit) / channels;
+			break;
+		}
+	}
+	if (first >= total_frames)
 		return true;
+
+	uint64_t last = first;
+	const uint64_t floor = first * channels;
+	for (uint64_t end = used; end > floor;) {
+		const size_t count = (size_t)std::min<uint64_t>(k_scan_samples, end - floor);
+		end -= count;
+		if (!in.read_at(wav_path, end, buf.data(), count))
+			return false;
+		const size_t hit = dsp::find_last_above_s16(buf.data(), count, athr);
+		if (hit != count) {
+			last = (end + hit) / channels;
+			break;
+		}
 	}
 
-	size_t last = total_frames - 1;
-	while (last > first && !frame_is_audible(last))
-		last--;
+	out.audible = true;
+	out.first_frame = first;
+	out.last_frame = last;
+	return true;
+}
 
-	const size_t lead_frames = (size_t)std::max(0, lead_ms) * sample_rate / 1000u;
-	const size_t trail_frames = (size_t)std::max(0, trail_ms) * sample_rate / 1000u;
+bool cut_wav(const std::string &wav_path, uint16_t channels, uint32_t sample_rate, uint64_t start_frame,
+	     uint64_t end_frame)
+{
+	if (channels == 0)
+		channels = 2;
+	if (sample_rate == 0)
+		sample_rate = 48000;
 
-	size_t start = (first > lead_frames) ? (first - lead_frames) : 0;
-	size_t end = std::min(total_frames, last + 1 + trail_frames);
-	if (start == 0 && end == total_frames)
+	uint64_t samples = 0;
+	if (!pcm16_sample_count(wav_path, samples))
+		return false;
+	const uint64_t total_frames = samples / channels;
+	end_frame = std::min(end_frame, total_frames);
+	if (start_frame >= end_frame)
+		return false;
+	if (start_frame == 0 && end_frame == total_frames)
 		return true;
 
-	std::vector<int16_t> out;
-	out.reserve((end - start) * channels);
-	for (size_t f = start; f < end; f++) {
-		for (uint16_t ch = 0; ch < channels; ch++)
-			out.push_back(s[f * channels + ch]);
-	}
-
 	fs::path p = fs::path(wav_path);
 	fs::path tmp = p;
 	tmp += ".trim.tmp";
-	if (!write_pcm16_data(tmp.string(), out, sample_rate, channels)) {
+	const uint64_t out_samples = (end_frame - start_frame) * channels;
+	bool ok = create_pcm16_file(tmp.string(), out_samples, sample_rate, channels);
+	if (ok) {
+		PcmFile in;
+		PcmFile out;
+		std::vector<int16_t> buf(k_block_samples);
+		for (uint64_t pos = 0; ok && pos < out_samples; pos += k_block_samples) {
+			const size_t count = (size_t)std::min<uint64_t>(k_block_samples, out_samples - pos);
+			ok = in.read_at(wav_path, start_frame * channels + pos, buf.data(), count) &&
+			     out.write_at(tmp.string(), pos, buf.data(), count);
+		}
+	}
+	if (!ok) {
 		std::error_code ec;
 		fs::remove(tmp, ec);
 		return false;
@@ -164,59 +393,316 @@ bool trim_silence_wav(const std::string &wav_path, uint16_t channels, uint32_t s
 	return true;
 }
 
+bool trim_silence_wav(const std::string &wav_path, uint16_t channels, uint32_t sample_rate,
+			      float threshold_dbfs, int lead_ms, int trail_ms, uint64_t *start_frame)
+{
+	if (channels == 0)
+		channels = 2;
+	if (sample_rate == 0)
+		sample_rate = 48000;
+	if (start_frame)
+		*start_frame = 0;
+
+	AudibleRange range;
+	if (!find_audible_range_wav(wav_path, channels, threshold_dbfs, range))
+		return false;
+	if (!range.audible)
+		return true;
+
+	const uint64_t lead_frames = (uint64_t)std::max(0, lead_ms) * sample_rate / 1000u;
+	const uint64_t trail_frames = (uint64_t)std::max(0, trail_ms) * sample_rate / 1000u;
+
+	const uint64_t start = (range.first_frame > lead_frames) ? (range.first_frame - lead_frames) : 0;
+	const uint64_t end = std::min(range.total_frames, range.last_frame + 1 + trail_frames);
+	if (!cut_wav(wav_path, channels, sample_rate, start, end))
+		return false;
+	if (start_frame)
+		*start_frame = start;
+	return true;
+}
+
 bool normalize_wav_rms(const std::string &wav_path, uint16_t channels, uint32_t sample_rate,
-			       float target_dbfs, bool limiter_enabled)
+			       float target_dbfs, const LimiterParams *limiter)
 {
 	if (channels == 0)
 		channels = 2;
 	if (sample_rate == 0)
 		sample_rate = 48000;
 
-	std::vector<int16_t> s;
-	if (!read_pcm16_data(wav_path, s, channels))
+	uint64_t samples = 0;
+	if (!pcm16_sample_count(wav_path, samples))
 		return false;
-	if (s.empty())
+	if (samples < channels)
 		return true;
 
-	
+	const size_t blocks = (size_t)((samples + k_block_samples - 1) / k_block_samples);
+	const size_t workers = parallel_workers(blocks);
+
+	struct BlockStats {
+		uint64_t sum_sq = 0;
+		int32_t peak = 0;
+	};
+	std::vector<BlockStats> stats(blocks);
+	std::atomic<bool> ok{true};
+	{
+		std::vector<PcmFile> files(workers);
+		std::vector<std::vector<int16_t>> bufs(workers);
+		parallel_for(blocks, workers, [&](size_t w, size_t b) {
+			if (!ok)
+				return;
+			const uint64_t first = (uint64_t)b * k_block_samples;
+			const size_t count = (size_t)std::min<uint64_t>(k_block_samples, samples - first);
+			bufs[w].resize(count);
+			if (!files[w].read_at(wav_path, first, bufs[w].data(), count)) {
+				ok = false;
+				return;
+			}
+			stats[b].sum_sq = dsp::sum_squares_s16(bufs[w].data(), count);
+			stats[b].peak = dsp::abs_max_s16(bufs[w].data(), count);
+		});
+	}
+	if (!ok)
+		return false;
+
 	long double sum_sq = 0.0L;
 	int32_t peak = 0;
-	for (int16_t v : s) {
-		int32_t a = v;
-		if (a < 0)
-			a = -a;
-		if (a > peak)
-			peak = a;
-		long double f = (long double)v / 32768.0L;
-		sum_sq += f * f;
-	}
-	const long double mean_sq = sum_sq / (long double)s.size();
+	for (const auto &st : stats) {
+		sum_sq += (long double)st.sum_sq;
+		peak = std::max(peak, st.peak);
+	}
+	const long double mean_sq = sum_sq / (32768.0L * 32768.0L) / (long double)samples;
 	const long double rms = std::sqrt(mean_sq);
 	if (rms <= 0.0000001L)
 		return true;
 
 	const long double target_lin = std::pow(10.0L, (long double)target_dbfs / 20.0L);
-	long double gain = target_lin / rms;
-	if (limiter_enabled && peak > 0) {
-		const long double max_gain = (32767.0L / (long double)peak);
-		if (gain > max_gain)
-			gain = max_gain;
+	const long double gain = target_lin / rms;
+	if (limiter && limiter_engages(*limiter, (long double)peak * gain))
+		return apply_gain_limited_wav(wav_path, samples, sample_rate, channels, gain, *limiter);
+	return apply_gain_wav(wav_path, samples, sample_rate, channels, gain);
+}
+
+bool measure_wav_loudness(const std::string &wav_path, uint16_t channels, uint32_t sample_rate, LoudnessStats &out)
+{
+	if (channels == 0)
+		channels = 2;
+	if (sample_rate == 0)
+		sample_rate = 48000;
+
+	uint64_t samples = 0;
+	if (!pcm16_sample_count(wav_path, samples))
+		return false;
+	const uint64_t used = samples / channels * channels;
+
+	LoudnessMeter meter(sample_rate, channels);
+	PcmFile in;
+	std::vector<int16_t> buf(k_block_samples / channels * channels);
+	for (uint64_t pos = 0; pos < used; pos += buf.size()) {
+		const size_t count = (size_t)std::min<uint64_t>(buf.size(), used - pos);
+		if (!in.read_at(wav_path, pos, buf.data(), count))
+			return false;
+		meter.process_s16(buf.data(), count / channels);
 	}
-	if (gain <= 0.0L)
+	out = meter.stats();
+	return true;
+}
+
+bool normalize_wav_lufs(const std::string &wav_path, uint16_t channels, uint32_t sample_rate, float target_lufs,
+			const LimiterParams *limiter, const LoudnessStats &measured)
+{
+	if (channels == 0)
+		channels = 2;
+	if (sample_rate == 0)
+		sample_rate = 48000;
+	if (!std::isfinite(measured.integrated_lufs))
 		return true;
 
-	
-	std::vector<int16_t> out;
-	out.resize(s.size());
-	for (size_t i = 0; i < s.size(); i++) {
-		int32_t v = (int32_t)std::llround((long double)s[i] * gain);
-		out[i] = clamp_s16(v);
+	uint64_t samples = 0;
+	if (!pcm16_sample_count(wav_path, samples))
+		return false;
+	if (samples < channels)
+		return true;
+
+	const long double gain =
+		std::pow(10.0L, ((long double)target_lufs - (long double)measured.integrated_lufs) / 20.0L);
+	// Decided on the oversampled true peak so inter-sample overs engage the
+	// limiter too. It limits samples, so its ceiling comes down by how far
+	// the true peak sat above the sample peak (at most 3 dB).
+	const double peak = std::max(measured.true_peak, measured.sample_peak);
+	if (limiter && limiter_engages(*limiter, (long double)peak * 32768.0L * gain)) {
+		LimiterParams params = *limiter;
+		if (measured.sample_peak > 0.0 && measured.true_peak > measured.sample_peak)
+			params.ceiling_dbfs -=
+				(float)std::min(3.0, 20.0 * std::log10(measured.true_peak / measured.sample_peak));
+		return apply_gain_limited_wav(wav_path, samples, sample_rate, channels, gain, params);
 	}
+	return apply_gain_wav(wav_path, samples, sample_rate, channels, gain);
+}
+
+bool resample_wav(const std::string &wav_path, uint16_t channels, uint32_t in_rate, uint32_t out_rate,
+		  ResampleQuality quality, const ChannelMatrix *remix)
+{
+	if (channels == 0)
+		channels = 2;
+	if (remix && (remix->in_channels() != channels || remix->out_channels() == 0))
+		return false;
+	if (in_rate == out_rate)
+		return !remix || remix_wav(wav_path, in_rate, *remix);
+	if (!Resampler::supported(in_rate, out_rate))
+		return false;
+
+	const uint16_t out_ch = remix ? remix->out_channels() : channels;
+	uint64_t samples = 0;
+	if (!pcm16_sample_count(wav_path, samples))
+		return false;
+	const uint64_t frames = samples / channels;
+	const uint64_t out_frames = Resampler::output_frames(frames, in_rate, out_rate);
 
 	fs::path p = fs::path(wav_path);
 	fs::path tmp = p;
-	tmp += ".norm.tmp";
-	if (!write_pcm16_data(tmp.string(), out, sample_rate, channels)) {
+	tmp += ".resample.tmp";
+	if (!create_pcm16_file(tmp.string(), out_frames * out_ch, out_rate, out_ch)) {
+		std::error_code ec;
+		fs::remove(tmp, ec);
+		return false;
+	}
+
+	Resampler resampler(in_rate, out_rate, out_ch, quality);
+	const size_t block_frames = k_block_samples / std::max(channels, out_ch);
+	PcmFile in;
+	PcmFile out;
+	std::vector<int16_t> pcm(block_frames * channels);
+	std::vector<float> work(block_frames * out_ch);
+	std::vector<float> resampled;
+	std::vector<int16_t> out_pcm;
+	std::vector<float> planes;
+	std::vector<const float *> in_planes;
+	std::vector<float *> out_planes;
+	if (remix) {
+		planes.resize(block_frames * (channels + out_ch));
+		for (uint16_t c = 0; c < channels; c++)
+			in_planes.push_back(planes.data() + (size_t)c * block_frames);
+		for (uint16_t c = 0; c < out_ch; c++)
+			out_planes.push_back(planes.data() + (size_t)(channels + c) * block_frames);
+	}
+	uint64_t written = 0;
+	bool ok = true;
+
+	auto emit = [&]() {
+		const size_t keep = (size_t)std::min<uint64_t>(resampled.size() / out_ch, out_frames - written);
+		out_pcm.resize(keep * out_ch);
+		for (size_t i = 0; i < keep * out_ch; i++)
+			out_pcm[i] = clamp_s16((int32_t)std::lrintf(resampled[i] * 32768.0f));
+		resampled.clear();
+		if (keep && !out.write_at(tmp.string(), written * out_ch, out_pcm.data(), keep * out_ch))
+			return false;
+		written += keep;
+		return true;
+	};
+
+	for (uint64_t pos = 0; ok && pos < frames; pos += block_frames) {
+		const size_t n = (size_t)std::min<uint64_t>(block_frames, frames - pos);
+		if (!in.read_at(wav_path, pos * channels, pcm.data(), n * channels)) {
+			ok = false;
+			break;
+		}
+		if (remix) {
+			for (uint16_t c = 0; c < channels; c++) {
+				float *plane = planes.data() + (size_t)c * block_frames;
+				for (size_t i = 0; i < n; i++)
+					plane[i] = (float)pcm[i * channels + c] * (1.0f / 32768.0f);
+			}
+			remix->apply(in_planes.data(), n, out_planes.data());
+			for (uint16_t c = 0; c < out_ch; c++) {
+				const float *plane = out_planes[c];
+				for (size_t i = 0; i < n; i++)
+					work[i * out_ch + c] = plane[i];
+			}
+		} else {
+			for (size_t i = 0; i < n * channels; i++)
+				work[i] = (float)pcm[i] * (1.0f / 32768.0f);
+		}
+		resampler.process(work.data(), n, resampled);
+		ok = emit();
+	}
+	if (ok) {
+		resampler.flush(resampled);
+		ok = emit();
+	}
+	in.close();
+	out.close();
+
+	if (!ok || written != out_frames) {
+		std::error_code ec;
+		fs::remove(tmp, ec);
+		return false;
+	}
+	if (!swap_in_tmp(wav_path, tmp.string())) {
+		std::error_code ec;
+		fs::remove(tmp, ec);
+		return false;
+	}
+	return true;
+}
+
+bool remix_wav(const std::string &wav_path, uint32_t sample_rate, const ChannelMatrix &matrix)
+{
+	const uint16_t in_ch = matrix.in_channels();
+	const uint16_t out_ch = matrix.out_channels();
+	if (in_ch == 0 || out_ch == 0)
+		return false;
+
+	uint64_t samples = 0;
+	if (!pcm16_sample_count(wav_path, samples))
+		return false;
+	const uint64_t frames = samples / in_ch;
+
+	fs::path p = fs::path(wav_path);
+	fs::path tmp = p;
+	tmp += ".remix.tmp";
+	if (!create_pcm16_file(tmp.string(), frames * out_ch, sample_rate, out_ch)) {
+		std::error_code ec;
+		fs::remove(tmp, ec);
+		return false;
+	}
+
+	const size_t block_frames = k_block_samples / std::max(in_ch, out_ch);
+	std::vector<int16_t> pcm(block_frames * std::max(in_ch, out_ch));
+	std::vector<float> in_buf(block_frames * in_ch);
+	std::vector<float> out_buf(block_frames * out_ch);
+	std::vector<const float *> in_planes(in_ch);
+	std::vector<float *> out_planes(out_ch);
+	for (uint16_t c = 0; c < in_ch; c++)
+		in_planes[c] = in_buf.data() + (size_t)c * block_frames;
+	for (uint16_t c = 0; c < out_ch; c++)
+		out_planes[c] = out_buf.data() + (size_t)c * block_frames;
+
+	PcmFile in;
+	PcmFile out;
+	bool ok = true;
+	for (uint64_t pos = 0; ok && pos < frames; pos += block_frames) {
+		const size_t n = (size_t)std::min<uint64_t>(block_frames, frames - pos);
+		if (!in.read_at(wav_path, pos * in_ch, pcm.data(), n * in_ch)) {
+			ok = false;
+			break;
+		}
+		for (uint16_t c = 0; c < in_ch; c++) {
+			float *plane = in_buf.data() + (size_t)c * block_frames;
+			for (size_t i = 0; i < n; i++)
+				plane[i] = (float)pcm[i * in_ch + c];
+		}
+		matrix.apply(in_planes.data(), n, out_planes.data());
+		for (uint16_t c = 0; c < out_ch; c++) {
+			const float *plane = out_planes[c];
+			for (size_t i = 0; i < n; i++)
+				pcm[i * out_ch + c] = clamp_s16((int32_t)std::lrintf(plane[i]));
+		}
+		ok = out.write_at(tmp.string(), pos * out_ch, pcm.data(), n * out_ch);
+	}
+	in.close();
+	out.close();
+
+	if (!ok) {
 		std::error_code ec;
 		fs::remove(tmp, ec);
 		return false;
@@ -229,4 +715,4 @@ bool normalize_wav_rms(const std::string &wav_path, uint16_t channels, uint32_t
 	return true;
 }
 
-} 
+}
@@ -3,16 +3,69 @@
 #include <cstdint>
 #include <string>
 
+#include "limiter.hpp"
+#include "loudness.hpp"
+#include "remix.hpp"
+#include "resampler.hpp"
+
 namespace stems {
 
 
 
+// What a 16-bit stem's header and size say about it.
+struct WavFormat {
+	uint32_t sample_rate = 0;
+	uint16_t channels = 0;
+	uint64_t frames = 0;
+
+	bool operator==(const WavFormat &o) const
+	{
+		return sample_rate == o.sample_rate && channels == o.channels && frames == o.frames;
+	}
+	bool operator!=(const WavFormat &o) const { return !(*this == o); }
+};
+
+bool read_wav_format(const std::string &wav_path, WavFormat &out);
+// Hash of a few blocks spread over the samples; tells an in-place rewrite
+// such as a gain change apart without reading the whole stem.
+bool wav_fingerprint(const std::string &wav_path, uint64_t &out);
+
+struct AudibleRange {
+	uint64_t total_frames = 0;
+	bool audible = false;
+	uint64_t first_frame = 0;
+	uint64_t last_frame = 0;
+};
+
+bool find_audible_range_wav(const std::string &wav_path, uint16_t channels, float threshold_dbfs, AudibleRange &out);
+
+// Keeps frames [start_frame, end_frame); end_frame is clamped to the file.
+bool cut_wav(const std::string &wav_path, uint16_t channels, uint32_t sample_rate, uint64_t start_frame,
+	     uint64_t end_frame);
+
 bool trim_silence_wav(const std::string &wav_path, uint16_t channels, uint32_t sample_rate,
-			      float threshold_dbfs, int lead_ms, int trail_ms);
+			      float threshold_dbfs, int lead_ms, int trail_ms, uint64_t *start_frame = nullptr);
 
 
 
 bool normalize_wav_rms(const std::string &wav_path, uint16_t channels, uint32_t sample_rate,
-			       float target_dbfs, bool limiter_enabled);
+			       float target_dbfs, const LimiterParams *limiter);
+
+bool measure_wav_loudness(const std::string &wav_path, uint16_t channels, uint32_t sample_rate, LoudnessStats &out);
+
+// Applies one gain so the measured integrated loudness lands on target_lufs.
+// With a limiter, peaks pushed over its ceiling are caught by the
+// look-ahead stage instead of lowering the gain for the whole stem.
+bool normalize_wav_lufs(const std::string &wav_path, uint16_t channels, uint32_t sample_rate, float target_lufs,
+			const LimiterParams *limiter, const LoudnessStats &measured);
+
+// Converts a 16-bit stem to out_rate in place with the built-in resampler.
+// With remix, each block is mixed down (or up) to remix->out_channels()
+// before resampling, so both changes take one pass over the file.
+bool resample_wav(const std::string &wav_path, uint16_t channels, uint32_t in_rate, uint32_t out_rate,
+		  ResampleQuality quality, const ChannelMatrix *remix = nullptr);
+
+// Rewrites a 16-bit stem with matrix.out_channels() channels.
+bool remix_wav(const std::string &wav_path, uint32_t sample_rate, const ChannelMatrix &matrix);
 
 } 
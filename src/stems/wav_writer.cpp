@@ -1,21 +1,69 @@
 #include "wav_writer.hpp"
 
+#include "trace.hpp"
+
+#include <atomic>
 #include <cstring>
 #include <filesystem>
 
 namespace stems {
 
-static void write_u32_le(std::FILE *f, uint32_t v)
+static const size_t k_io_buffer_bytes = 64 * 1024;
+
+static int seek64(std::FILE *f, uint64_t offset)
+{
+#if defined(_WIN32)
+	return _fseeki64(f, (__int64)offset, SEEK_SET);
+#else
+	return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+std::FILE *FileBackend::open(const std::string &path, const char *mode)
+{
+	return std::fopen(path.c_str(), mode);
+}
+
+size_t FileBackend::write(std::FILE *f, const void *data, size_t size, size_t count)
+{
+	return std::fwrite(data, size, count, f);
+}
+
+bool FileBackend::seek(std::FILE *f, uint64_t offset)
+{
+	return seek64(f, offset) == 0;
+}
+
+int FileBackend::close(std::FILE *f)
+{
+	return std::fclose(f);
+}
+
+static FileBackend stdio_backend;
+static std::atomic<FileBackend *> current_backend{nullptr};
+
+void set_file_backend(FileBackend *backend)
+{
+	current_backend.store(backend, std::memory_order_release);
+}
+
+FileBackend &file_backend()
+{
+	FileBackend *b = current_backend.load(std::memory_order_acquire);
+	return b ? *b : stdio_backend;
+}
+
+static void write_u32_le(FileBackend &io, std::FILE *f, uint32_t v)
 {
 	uint8_t b[4] = { (uint8_t)(v & 0xFFu), (uint8_t)((v >> 8) & 0xFFu),
 			 (uint8_t)((v >> 16) & 0xFFu), (uint8_t)((v >> 24) & 0xFFu) };
-	std::fwrite(b, 1, 4, f);
+	io.write(f, b, 1, 4);
 }
 
-static void write_u16_le(std::FILE *f, uint16_t v)
+static void write_u16_le(FileBackend &io, std::FILE *f, uint16_t v)
 {
 	uint8_t b[2] = { (uint8_t)(v & 0xFFu), (uint8_t)((v >> 8) & 0xFFu) };
-	std::fwrite(b, 1, 2, f);
+	io.write(f, b, 1, 2);
 }
 
 WavWriter::~WavWriter()
@@ -31,9 +79,13 @@ bool WavWriter::open(const std::string &path, uint32_t sample_rate, uint16_t cha
 	channels_ = channels ? channels : 2;
 	frames_written_ = 0;
 
-	fp_ = std::fopen(path.c_str(), "wb");
+	io_ = &file_backend();
+	fp_ = io_->open(path, "wb");
 	if (!fp_)
 		return false;
+	if (io_buffer_.empty())
+		io_buffer_.resize(k_io_buffer_bytes);
+	std::setvbuf(fp_, io_buffer_.data(), _IOFBF, io_buffer_.size());
 	return write_header_placeholder();
 }
 
@@ -43,25 +95,25 @@ bool WavWriter::write_header_placeholder()
 		return false;
 
 	
-	std::fwrite("RIFF", 1, 4, fp_);
-	write_u32_le(fp_, 0); 
-	std::fwrite("WAVE", 1, 4, fp_);
+	io_->write(fp_, "RIFF", 1, 4);
+	write_u32_le(*io_, fp_, 0); 
+	io_->write(fp_, "WAVE", 1, 4);
 
 	
-	std::fwrite("fmt ", 1, 4, fp_);
-	write_u32_le(fp_, 16);             
-	write_u16_le(fp_, 1);              
-	write_u16_le(fp_, channels_);
-	write_u32_le(fp_, sample_rate_);
+	io_->write(fp_, "fmt ", 1, 4);
+	write_u32_le(*io_, fp_, 16);             
+	write_u16_le(*io_, fp_, 1);              
+	write_u16_le(*io_, fp_, channels_);
+	write_u32_le(*io_, fp_, sample_rate_);
 	uint32_t byte_rate = sample_rate_ * (uint32_t)channels_ * 2u;
-	write_u32_le(fp_, byte_rate);
+	write_u32_le(*io_, fp_, byte_rate);
 	uint16_t block_align = (uint16_t)(channels_ * 2u);
-	write_u16_le(fp_, block_align);
-	write_u16_le(fp_, 16); 
+	write_u16_le(*io_, fp_, block_align);
+	write_u16_le(*io_, fp_, 16); 
 
 	
-	std::fwrite("data", 1, 4, fp_);
-	write_u32_le(fp_, 0); 
+	io_->write(fp_, "data", 1, 4);
+	write_u32_le(*io_, fp_, 0); 
 
 	return true;
 }
@@ -71,13 +123,31 @@ bool WavWriter::write_samples(const int16_t *interleaved, size_t frames)
 	if (!fp_ || !interleaved || frames == 0)
 		return true;
 	size_t samples = frames * (size_t)channels_;
-	size_t written = std::fwrite(interleaved, sizeof(int16_t), samples, fp_);
+	size_t written = io_->write(fp_, interleaved, sizeof(int16_t), samples);
 	if (written != samples)
 		return false;
 	frames_written_ += (uint64_t)frames;
 	return true;
 }
 
+bool WavWriter::write_silence(uint64_t frames)
+{
+	if (!fp_ || frames == 0)
+		return true;
+	// Seek to the last frame and write it; the gap reads back as zeros.
+	const uint64_t frame_bytes = (uint64_t)channels_ * sizeof(int16_t);
+	const uint64_t end = 44 + (frames_written_ + frames) * frame_bytes;
+	if (!io_->seek(fp_, end - frame_bytes))
+		return false;
+	const int16_t zero = 0;
+	for (uint16_t c = 0; c < channels_; ++c) {
+		if (io_->write(fp_, &zero, sizeof(zero), 1) != 1)
+			return false;
+	}
+	frames_written_ += frames;
+	return true;
+}
+
 bool WavWriter::finalize_header()
 {
 	if (!fp_)
@@ -88,14 +158,14 @@ bool WavWriter::finalize_header()
 	uint32_t riff_size = 36u + data_size;
 
 	
-	if (std::fseek(fp_, 4, SEEK_SET) != 0)
+	if (!io_->seek(fp_, 4))
 		return false;
-	write_u32_le(fp_, riff_size);
+	write_u32_le(*io_, fp_, riff_size);
 
 	
-	if (std::fseek(fp_, 40, SEEK_SET) != 0)
+	if (!io_->seek(fp_, 40))
 		return false;
-	write_u32_le(fp_, data_size);
+	write_u32_le(*io_, fp_, data_size);
 
 	return true;
 }
@@ -104,8 +174,9 @@ void WavWriter::close()
 {
 	if (!fp_)
 		return;
+	trace::Scope span("finalize_header", "writer");
 	finalize_header();
-	std::fclose(fp_);
+	io_->close(fp_);
 	fp_ = nullptr;
 }
 
@@ -120,22 +191,23 @@ bool WavWriter::repair_header(const std::string &path)
 	uint32_t data_size = (data_bytes > 0xFFFFFFFFull) ? 0xFFFFFFFFu : (uint32_t)data_bytes;
 	uint32_t riff_size = 36u + data_size;
 
-	std::FILE *f = std::fopen(path.c_str(), "rb+");
+	FileBackend &io = file_backend();
+	std::FILE *f = io.open(path, "rb+");
 	if (!f)
 		return false;
 	
-	if (std::fseek(f, 4, SEEK_SET) != 0) {
-		std::fclose(f);
+	if (!io.seek(f, 4)) {
+		io.close(f);
 		return false;
 	}
-	write_u32_le(f, riff_size);
+	write_u32_le(io, f, riff_size);
 	
-	if (std::fseek(f, 40, SEEK_SET) != 0) {
-		std::fclose(f);
+	if (!io.seek(f, 40)) {
+		io.close(f);
 		return false;
 	}
-	write_u32_le(f, data_size);
-	std::fclose(f);
+	write_u32_le(io, f, data_size);
+	io.close(f);
 	return true;
 }
 
@@ -3,9 +3,27 @@
 #include <cstdint>
 #include <cstdio>
 #include <string>
+#include <vector>
 
 namespace stems {
 
+// Where WavWriter's bytes go. The default is plain stdio; stress tools
+// install one that stalls, throttles or fails writes.
+class FileBackend {
+public:
+	virtual ~FileBackend() = default;
+
+	virtual std::FILE *open(const std::string &path, const char *mode);
+	virtual size_t write(std::FILE *f, const void *data, size_t size, size_t count);
+	virtual bool seek(std::FILE *f, uint64_t offset);
+	virtual int close(std::FILE *f);
+};
+
+// Process-wide; null restores stdio. A writer keeps the backend it was
+// opened with, so swap only while the backend passed in outlives them.
+void set_file_backend(FileBackend *backend);
+FileBackend &file_backend();
+
 class WavWriter {
 public:
 	WavWriter() = default;
@@ -15,6 +33,8 @@ public:
 
 	bool open(const std::string &path, uint32_t sample_rate, uint16_t channels);
 	bool write_samples(const int16_t *interleaved, size_t frames);
+	// Appends silence by extending the file instead of writing buffers.
+	bool write_silence(uint64_t frames);
 	void close();
 
 	const std::string &path() const { return path_; }
@@ -30,10 +50,13 @@ private:
 	bool finalize_header();
 
 	std::FILE *fp_ = nullptr;
+	FileBackend *io_ = nullptr;
 	std::string path_;
 	uint32_t sample_rate_ = 48000;
 	uint16_t channels_ = 2;
 	uint64_t frames_written_ = 0;
+	// Kept across open() calls so a reused writer does not reallocate it.
+	std::vector<char> io_buffer_;
 };
 
 } 